@@ -24,6 +24,8 @@ class AppDelegate: UIResponder, UIApplicationDelegate {
   }
   
   func application(_ application: UIApplication, didFinishLaunchingWithOptions launchOptions: [UIApplication.LaunchOptionsKey: Any]?) -> Bool {
+    StartupTimeline.sharedInstance.markLaunch()
+    
     Fabric.with([Crashlytics()])
     
     #if DEBUG
@@ -38,6 +40,15 @@ class AppDelegate: UIResponder, UIApplicationDelegate {
     // Initialize the core data stack
     _ = CoreDataStack.sharedInstance
     
+    // Start observing changes for patching cached day summaries
+    _ = DaySummaryCache.sharedInstance
+    
+    // Keep the last known state of today for rendering on the next cold start
+    DayStateSnapshot.startUpdating()
+    
+    // Keep the state displayed by the widget, so the widget never loads the persistent store
+    WidgetState.startPublishing()
+    
     #if DEBUG && AQUAZPRO
       let isSnapshotMode = ProcessInfo.processInfo.arguments.contains("-SNAPSHOT")
       
@@ -54,6 +65,9 @@ class AppDelegate: UIResponder, UIApplicationDelegate {
     
     wormholeDataProvider = WormholeDataProvider()
     
+    // Intakes added by the widget while the application was not running
+    WidgetIntakeJournal.ingest()
+    
     setupSynchronizationWithCoreData()
 
     if #available(iOS 9.0, *) {
@@ -93,7 +107,7 @@ class AppDelegate: UIResponder, UIApplicationDelegate {
   }
   
   fileprivate func setupSynchronizationWithCoreData() {
-    CoreDataStack.performOnPrivateContext { privateContext in
+    CoreDataStack.performWrite { privateContext in
       NotificationCenter.default.addObserver(
         self,
         selector: #selector(self.updateNotifications(_:)),
@@ -125,7 +139,7 @@ class AppDelegate: UIResponder, UIApplicationDelegate {
       
       if let lastIntakeDate = lastIntakeDate , DateHelper.areEqualDays(lastIntakeDate, Date()) {
         if Settings.sharedInstance.notificationsLimit.value {
-          CoreDataStack.performOnPrivateContext { privateContext in
+          CoreDataStack.performRead { privateContext in
             let beginDate = Date()
             let endDate = DateHelper.nextDayFrom(beginDate)
             
@@ -178,7 +192,7 @@ class AppDelegate: UIResponder, UIApplicationDelegate {
   }
   
   fileprivate func prePopulateCoreData() {
-    CoreDataStack.performOnPrivateContext { privateContext in
+    CoreDataStack.performWrite { privateContext in
       if !CoreDataPrePopulation.isCoreDataPrePopulated(managedObjectContext: privateContext) {
         CoreDataPrePopulation.prePopulateCoreData(managedObjectContext: privateContext, saveContext: true)
       }
@@ -226,6 +240,42 @@ class AppDelegate: UIResponder, UIApplicationDelegate {
     }
   }
   
+  func applicationDidEnterBackground(_ application: UIApplication) {
+    // Changes deferred by group commit should reach the store before suspension.
+    // The commit may wait for a long write, so the main queue is not blocked by it.
+    var commitTask = UIBackgroundTaskIdentifier.invalid
+    
+    commitTask = application.beginBackgroundTask {
+      application.endBackgroundTask(commitTask)
+    }
+    
+    CoreDataStack.commitPendingSaves {
+      // Store the index of daily amounts, so statistics don't need to build it from the store on the next launch
+      CoreDataStack.performRead { privateContext in
+        DailyAmountsIndex.index(for: privateContext)?.saveSnapshot()
+        
+        DispatchQueue.main.async {
+          application.endBackgroundTask(commitTask)
+        }
+      }
+    }
+    
+    if #available(iOS 9.0, *) {
+      // Changes left in the outbox are flushed on the next launch if there is no time for that now
+      var backgroundTask = UIBackgroundTaskIdentifier.invalid
+      
+      backgroundTask = application.beginBackgroundTask {
+        application.endBackgroundTask(backgroundTask)
+      }
+      
+      HealthKitProvider.sharedInstance.flushPendingChanges {
+        DispatchQueue.main.async {
+          application.endBackgroundTask(backgroundTask)
+        }
+      }
+    }
+  }
+
   func applicationWillEnterForeground(_ application: UIApplication) {
     // Called as part of the transition from the background to the inactive state; here you can undo many of the changes made on entering the background.
     NotificationsHelper.setApplicationIconBadgeNumber(0)
@@ -240,6 +290,10 @@ class AppDelegate: UIResponder, UIApplicationDelegate {
 
     NotificationsHelper.setApplicationIconBadgeNumber(0)
 
+    // Changes made by the widget while the application was inactive
+    CoreDataStack.catchUpWithPersistentHistory()
+    WidgetIntakeJournal.ingest()
+
     refreshCurrentDayForDayViewController(showAlert: false)
   }
   
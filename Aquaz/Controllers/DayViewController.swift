@@ -140,6 +140,9 @@ class DayViewController: UIViewController {
   
   fileprivate var volumeObserver: SettingsObserver?
   
+  /// Displayed while the persistent store is being migrated
+  fileprivate var migrationProgressView: UIProgressView?
+  
   // MARK: Page setup -
   
   override func viewDidLoad() {
@@ -195,6 +198,13 @@ class DayViewController: UIViewController {
     
     updateUIRelatedToCurrentDate(animated: false)
     
+    // Render the last known state while the persistent store is loading, it's reconciled by updateSummaryBar
+    if !CoreDataStack.sharedInstance.isStoreLoaded, let snapshot = DayStateSnapshot.load(forDate: date) {
+      applySummary(snapshot.summary)
+      renderSummaryBar(hydrationAmounts: snapshot.summary.hydrationAmounts, animated: false)
+      StartupTimeline.sharedInstance.markFirstMeaningfulRender(source: .snapshot)
+    }
+    
     updateSummaryBar(animated: false, completion: nil)
     
     volumeObserver = Settings.sharedInstance.generalVolumeUnits.addObserver { [weak self] _ in
@@ -203,7 +213,14 @@ class DayViewController: UIViewController {
   }
   
   fileprivate func setupNotificationsObservation() {
-    CoreDataStack.performOnPrivateContext { privateContext in
+    // Writes are postponed until the persistent store is loaded, so the migration is observed directly
+    NotificationCenter.default.addObserver(
+      self,
+      selector: #selector(self.coreDataMigrationProgressDidChange(_:)),
+      name: NSNotification.Name(rawValue: GlobalConstants.notificationCoreDataMigrationProgress),
+      object: nil)
+    
+    CoreDataStack.performWrite { privateContext in
       NotificationCenter.default.addObserver(
         self,
         selector: #selector(self.managedObjectContextDidChange(_:)),
@@ -218,6 +235,40 @@ class DayViewController: UIViewController {
     }
   }
   
+  @objc func coreDataMigrationProgressDidChange(_ notification: Notification) {
+    guard let progress = notification.userInfo?[GlobalConstants.notificationCoreDataMigrationProgressKey] as? Float else {
+      return
+    }
+    
+    DispatchQueue.main.async {
+      self.updateMigrationProgress(progress)
+    }
+  }
+  
+  fileprivate func updateMigrationProgress(_ progress: Float) {
+    if progress >= 1 {
+      migrationProgressView?.removeFromSuperview()
+      migrationProgressView = nil
+      return
+    }
+    
+    if migrationProgressView == nil {
+      let progressView = UIProgressView(progressViewStyle: .bar)
+      progressView.translatesAutoresizingMaskIntoConstraints = false
+      progressView.progressTintColor = StyleKit.waterColor
+      view.addSubview(progressView)
+      
+      NSLayoutConstraint.activate([
+        progressView.leadingAnchor.constraint(equalTo: view.leadingAnchor),
+        progressView.trailingAnchor.constraint(equalTo: view.trailingAnchor),
+        progressView.topAnchor.constraint(equalTo: topLayoutGuide.bottomAnchor)])
+      
+      migrationProgressView = progressView
+    }
+    
+    migrationProgressView?.setProgress(progress, animated: true)
+  }
+  
   @objc func managedObjectContextDidChange(_ notification: Notification) {
     updateSummaryBar(animated: true) {
       if !self.checkForCongratulationsAboutWaterGoalReaching(notification) {
@@ -413,33 +464,39 @@ class DayViewController: UIViewController {
   }
   
   fileprivate func updateSummaryBar(animated: Bool, completion: (() -> ())?) {
-    CoreDataStack.performOnPrivateContext { privateContext in
-      self.totalDehydrationAmount = Intake.fetchTotalDehydrationAmountForDay(self.date,
-        dayOffsetInHours: 0, managedObjectContext: privateContext)
-
-      self.waterGoal = WaterGoal.fetchWaterGoalForDate(self.date, managedObjectContext: privateContext)
+    CoreDataStack.performRead { privateContext in
+      let summary = DaySummaryCache.sharedInstance.summary(forDate: self.date, managedObjectContext: privateContext)
       
-      let intakeHydrationAmounts = Intake.fetchHydrationAmountsGroupedByDrinksForDay(self.date,
-        dayOffsetInHours: 0, managedObjectContext: privateContext)
+      self.applySummary(summary)
       
       DispatchQueue.main.async {
-        if animated {
-          self.intakesMultiProgressView.updateWithAnimation {
-            self.updateIntakeHydrationAmounts(intakeHydrationAmounts)
-            self.waterGoalWasChanged(animated: animated)
-          }
-        } else {
-          self.intakesMultiProgressView.update {
-            self.updateIntakeHydrationAmounts(intakeHydrationAmounts)
-            self.waterGoalWasChanged(animated: animated)
-          }
-        }
+        self.renderSummaryBar(hydrationAmounts: summary.hydrationAmounts, animated: animated)
+        StartupTimeline.sharedInstance.markFirstMeaningfulRender(source: .store)
       }
       
       completion?()
     }
   }
   
+  fileprivate func applySummary(_ summary: DaySummary) {
+    totalDehydrationAmount = summary.totalDehydrationAmount
+    waterGoal = summary.waterGoal
+  }
+  
+  fileprivate func renderSummaryBar(hydrationAmounts: [DrinkType: Double], animated: Bool) {
+    if animated {
+      intakesMultiProgressView.updateWithAnimation {
+        self.updateIntakeHydrationAmounts(hydrationAmounts)
+        self.waterGoalWasChanged(animated: animated)
+      }
+    } else {
+      intakesMultiProgressView.update {
+        self.updateIntakeHydrationAmounts(hydrationAmounts)
+        self.waterGoalWasChanged(animated: animated)
+      }
+    }
+  }
+  
   // MARK: Summary bar actions -
   
   @IBAction func toggleHighActivityMode(_ sender: Any) {
@@ -725,13 +782,15 @@ class DayViewController: UIViewController {
   }
   
   fileprivate func saveWaterGoalForCurrentDate(baseAmount: Double, isHotDay: Bool, isHighActivity: Bool) {
-    CoreDataStack.performOnPrivateContext { privateContext in
-      self.waterGoal = WaterGoal.addEntity(
+    CoreDataStack.performWrite { privateContext in
+      let waterGoal = WaterGoal.addEntity(
         date: self.date,
         baseAmount: baseAmount,
         isHotDay: isHotDay,
         isHighActivity: isHighActivity,
         managedObjectContext: privateContext)
+      
+      self.waterGoal = DaySummary.Goal(waterGoal: waterGoal)
     }
   }
   
@@ -948,7 +1007,7 @@ class DayViewController: UIViewController {
   
   // MARK: Private properties -
   
-  fileprivate var waterGoal: WaterGoal? {
+  fileprivate var waterGoal: DaySummary.Goal? {
     didSet {
       updateWaterGoalRelatedValues()
     }
@@ -123,7 +123,7 @@ class DiaryViewController: UIViewController {
   }
   
   fileprivate func createFetchedResultsController(completion: (() -> ())?) {
-    CoreDataStack.performOnPrivateContext { privateContext in
+    CoreDataStack.performWrite { privateContext in
       let fetchRequest = self.getFetchRequestForDate(self.date)
       
       let fetchedResultsController = NSFetchedResultsController(
@@ -232,7 +232,7 @@ extension DiaryViewController: UITableViewDataSource {
     
     innerRowDeletion = true
     
-    CoreDataStack.performOnPrivateContextAndWait { _ in
+    CoreDataStack.performWriteAndWait { _ in
       if let intake = self.getIntakeAtIndexPath(indexPath) {
         intake.deleteEntity(saveImmediately: true)
       }
@@ -269,7 +269,7 @@ extension DiaryViewController: UITableViewDelegate {
 
     diaryCell.prepareCell()
     
-    CoreDataStack.performOnPrivateContext { _ in
+    CoreDataStack.performWrite { _ in
       if let intake = self.getIntakeAtIndexPath(indexPath) {
         diaryCell.intake = intake
       }
@@ -277,7 +277,7 @@ extension DiaryViewController: UITableViewDelegate {
   }
 
   func tableView(_ tableView: UITableView, didSelectRowAt indexPath: IndexPath) {
-    CoreDataStack.performOnPrivateContext { _ in
+    CoreDataStack.performWrite { _ in
       if let intake = self.getIntakeAtIndexPath(indexPath) {
         DispatchQueue.main.async {
           self.performSegue(withIdentifier: Constants.editIntakeSegue, sender: intake)
@@ -37,6 +37,8 @@ final class HealthKitViewController: UIViewController {
   @IBOutlet weak var exportButton: UIButton!
   
   fileprivate var localizedStrings = LocalizedStrings()
+  
+  fileprivate var exportProgressObservation: NSKeyValueObservation?
 
   
   // MARK: Methods
@@ -45,6 +47,7 @@ final class HealthKitViewController: UIViewController {
     
     setupUI()
     updateUI()
+    resumeInterruptedExport()
   }
 
   fileprivate func setupUI() {
@@ -67,7 +70,7 @@ final class HealthKitViewController: UIViewController {
   }
   
   fileprivate func updateNumberOfIntakesInAquaz() {
-    CoreDataStack.performOnPrivateContext { privateContext in
+    CoreDataStack.performWrite { privateContext in
       let fetchRequest = Intake.createFetchRequest()
       fetchRequest.includesSubentities = false
 
@@ -99,22 +102,45 @@ final class HealthKitViewController: UIViewController {
       return
     }
     
-    progressView.progress = 0
+    let progress = HealthKitProvider.sharedInstance.exportAllIntakesToHealthKit {
+      DispatchQueue.main.async {
+        self.exportDidFinish()
+      }
+    }
+    
+    displayExportProgress(progress)
+  }
+  
+  /// Continues an export interrupted e.g. by termination of the application
+  fileprivate func resumeInterruptedExport() {
+    let progress = HealthKitProvider.sharedInstance.resumeInterruptedExportToHealthKit {
+      DispatchQueue.main.async {
+        self.exportDidFinish()
+      }
+    }
+    
+    if let progress = progress {
+      displayExportProgress(progress)
+    }
+  }
+  
+  fileprivate func displayExportProgress(_ progress: Progress) {
+    progressView.progress = Float(progress.fractionCompleted)
     progressView.alpha = 1
     
     exportButton.isEnabled = false
-  
-    HealthKitProvider.sharedInstance.exportAllIntakesToHealthKit(
-      progress: { current, maximum in
-        DispatchQueue.main.async {
-          self.progressView.progress = maximum > 0 ? Float(current) / Float(maximum) : 0
-        }
-      },
-      completion: {
-        self.progressView.alpha = 0
-        self.exportButton.isEnabled = true
-        self.updateUI()
+    
+    exportProgressObservation = progress.observe(\.fractionCompleted) { progress, _ in
+      DispatchQueue.main.async {
+        self.progressView.progress = Float(progress.fractionCompleted)
       }
-    )
+    }
+  }
+  
+  fileprivate func exportDidFinish() {
+    exportProgressObservation = nil
+    progressView.alpha = 0
+    exportButton.isEnabled = true
+    updateUI()
   }
 }
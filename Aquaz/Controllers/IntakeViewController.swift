@@ -54,7 +54,7 @@ class IntakeViewController: UIViewController {
   // Should be nil for add intake mode, and not nil for edit intake mode
   var intake: Intake? {
     didSet {
-      CoreDataStack.performOnPrivateContextAndWait { _ in
+      CoreDataStack.performWriteAndWait { _ in
         if let intake = self.intake {
           self.drinkType = intake.drink.drinkType
           self.drink = intake.drink
@@ -104,7 +104,7 @@ class IntakeViewController: UIViewController {
       return
     }
     
-    CoreDataStack.performOnPrivateContextAndWait { privateContext in
+    CoreDataStack.performWriteAndWait { privateContext in
       self.drink = Drink.fetchDrinkByType(self.drinkType, managedObjectContext: privateContext)
     }
   }
@@ -159,7 +159,7 @@ class IntakeViewController: UIViewController {
   fileprivate func getInitialAmount() -> Double {
     var amount: Double!
     
-    CoreDataStack.performOnPrivateContextAndWait { _ in
+    CoreDataStack.performWriteAndWait { _ in
       amount = self.intake?.amount ?? self.drink.recentAmount.amount
     }
     
@@ -314,7 +314,7 @@ class IntakeViewController: UIViewController {
   }
   
   fileprivate func addIntake(amount: Double) {
-    CoreDataStack.performOnPrivateContext { privateContext in
+    CoreDataStack.performWrite { privateContext in
       let drink = try! privateContext.existingObject(with: self.drink.objectID) as! Drink
       drink.recentAmount.amount = amount
 
@@ -326,7 +326,7 @@ class IntakeViewController: UIViewController {
   
   fileprivate func updateIntake(amount: Double) {
     if let intake = intake {
-      CoreDataStack.performOnPrivateContext { privateContext in
+      CoreDataStack.performWrite { privateContext in
         let drink = try! privateContext.existingObject(with: self.drink.objectID) as! Drink
         drink.recentAmount.amount = amount
 
@@ -14,7 +14,21 @@ class MonthStatisticsViewController: UIViewController {
   @IBOutlet weak var monthStatisticsView: MonthStatisticsView!
   @IBOutlet weak var monthLabel: UILabel!
   
-  fileprivate var date: Date = DateHelper.startOfMonth(Date())
+  fileprivate var date: Date = DateHelper.startOfMonth(Date()) {
+    didSet {
+      dataChangeSubscription?.scope = displayedMonthsScope
+    }
+  }
+  
+  fileprivate var dataChangeSubscription: DataChangeBus.Subscription?
+  
+  /// The calendar keeps adjacent months ready for scrolling, so they are refreshed too
+  fileprivate var displayedMonthsScope: DataChangeBus.Scope {
+    let startOfMonth = DateHelper.startOfMonth(date)
+    return .dateRange(
+      beginDate: DateHelper.addToDate(startOfMonth, years: 0, months: -1, days: 0),
+      endDate: DateHelper.addToDate(startOfMonth, years: 0, months: 2, days: 0))
+  }
   fileprivate var helpTipManager = HelpTipManager()
 
   fileprivate struct Constants {
@@ -78,22 +92,12 @@ class MonthStatisticsViewController: UIViewController {
                                            name: NSNotification.Name(rawValue: GlobalConstants.notificationFullVersionIsPurchased), object: nil)
     #endif
     
-    CoreDataStack.performOnPrivateContext { privateContext in
-      NotificationCenter.default.addObserver(
-        self,
-        selector: #selector(self.managedObjectContextDidChange(_:)),
-        name: NSNotification.Name.NSManagedObjectContextDidSave,
-        object: privateContext)
-      
-      NotificationCenter.default.addObserver(
-        self,
-        selector: #selector(self.managedObjectContextDidChange(_:)),
-        name: NSNotification.Name(rawValue: GlobalConstants.notificationManagedObjectContextWasMerged),
-        object: privateContext)
+    dataChangeSubscription = DataChangeBus.sharedInstance.subscribe(entities: [.intake, .waterGoal], scope: displayedMonthsScope) { [weak self] _ in
+      self?.dataDidChange()
     }
   }
 
-  @objc func managedObjectContextDidChange(_ notification: Notification) {
+  fileprivate func dataDidChange() {
     #if AQUAZLITE
     if !Settings.sharedInstance.generalFullVersion.value {
       return
@@ -237,7 +241,7 @@ extension MonthStatisticsViewController: MonthStatisticsViewDataSource {
     }
     #endif
     
-    CoreDataStack.performOnPrivateContext { privateContext in
+    CoreDataStack.performRead { privateContext in
       weak var requestingMonthStatisticsContentView = (calendarContentView as! MonthStatisticsContentView)
       let hydrationFractions = self.fetchHydrationFractions(beginDate: beginDate, endDate: endDate, privateContext: privateContext)
       DispatchQueue.main.async {
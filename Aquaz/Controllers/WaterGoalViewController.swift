@@ -303,7 +303,7 @@ class WaterGoalViewController: OmegaSettingsViewController {
   }
 
   fileprivate func saveWaterGoalToCoreData() {
-    CoreDataStack.performOnPrivateContext { privateContext in
+    CoreDataStack.performWrite { privateContext in
       _ = WaterGoal.addEntity(
         date: Date(),
         baseAmount: self.dailyWaterIntakeCell.value,
@@ -23,6 +23,7 @@ class WeekStatisticsViewController: UIViewController {
   
   fileprivate var statisticsBeginDate: Date!
   fileprivate var statisticsEndDate: Date!
+  fileprivate var dataChangeSubscription: DataChangeBus.Subscription?
   fileprivate var isShowingDay = false
   fileprivate var leftSwipeGestureRecognizer: UISwipeGestureRecognizer!
   fileprivate var rightSwipeGestureRecognizer: UISwipeGestureRecognizer!
@@ -120,22 +121,12 @@ class WeekStatisticsViewController: UIViewController {
       name: NSNotification.Name(rawValue: GlobalConstants.notificationFullVersionIsPurchased), object: nil)
     #endif
     
-    CoreDataStack.performOnPrivateContext { privateContext in
-      NotificationCenter.default.addObserver(
-        self,
-        selector: #selector(self.managedObjectContextDidChange(_:)),
-        name: NSNotification.Name.NSManagedObjectContextDidSave,
-        object: privateContext)
-      
-      NotificationCenter.default.addObserver(
-        self,
-        selector: #selector(self.managedObjectContextDidChange(_:)),
-        name: NSNotification.Name(rawValue: GlobalConstants.notificationManagedObjectContextWasMerged),
-        object: privateContext)
+    dataChangeSubscription = DataChangeBus.sharedInstance.subscribe(entities: [.intake, .waterGoal], scope: .dateRange(beginDate: statisticsBeginDate, endDate: statisticsEndDate)) { [weak self] _ in
+      self?.dataDidChange()
     }
   }
   
-  @objc func managedObjectContextDidChange(_ notification: Notification) {
+  fileprivate func dataDidChange() {
     #if AQUAZLITE
       if !Settings.sharedInstance.generalFullVersion.value {
         return
@@ -259,7 +250,7 @@ class WeekStatisticsViewController: UIViewController {
       }
     #endif
     
-    CoreDataStack.performOnPrivateContext { privateContext in
+    CoreDataStack.performRead { privateContext in
       let date = self.date
       let statisticsItems = self.fetchStatisticsItems(beginDate: self.statisticsBeginDate, endDate: self.statisticsEndDate, privateContext: privateContext)
       
@@ -276,6 +267,7 @@ class WeekStatisticsViewController: UIViewController {
     let daysPerWeek = DateHelper.daysPerWeek()
     statisticsBeginDate = DateHelper.addToDate(date, years: 0, months: 0, days: -weekdayOfDate + 1)
     statisticsEndDate = DateHelper.addToDate(statisticsBeginDate, years: 0, months: 0, days: daysPerWeek)
+    dataChangeSubscription?.scope = .dateRange(beginDate: statisticsBeginDate, endDate: statisticsEndDate)
   }
   
   fileprivate func isFutureDate(_ dayIndex: Int) -> Bool {
@@ -336,7 +336,7 @@ final class WelcomeWizardMetricsViewController: OmegaSettingsViewController {
   }
   
   fileprivate func saveWaterGoalToCoreData() {
-    CoreDataStack.performOnPrivateContext { privateContext in
+    CoreDataStack.performWrite { privateContext in
       _ = WaterGoal.addEntity(
         date: Date(),
         baseAmount: self.dailyWaterIntakeCell.value,
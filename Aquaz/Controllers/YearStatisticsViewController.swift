@@ -22,6 +22,7 @@ class YearStatisticsViewController: UIViewController {
   
   fileprivate var statisticsBeginDate: Date!
   fileprivate var statisticsEndDate: Date!
+  fileprivate var dataChangeSubscription: DataChangeBus.Subscription?
   fileprivate var leftSwipeGestureRecognizer: UISwipeGestureRecognizer!
   fileprivate var rightSwipeGestureRecognizer: UISwipeGestureRecognizer!
   fileprivate var volumeObserver: SettingsObserver?
@@ -76,22 +77,12 @@ class YearStatisticsViewController: UIViewController {
         name: NSNotification.Name(rawValue: GlobalConstants.notificationFullVersionIsPurchased), object: nil)
     #endif
     
-    CoreDataStack.performOnPrivateContext { privateContext in
-      NotificationCenter.default.addObserver(
-        self,
-        selector: #selector(self.managedObjectContextDidChange(_:)),
-        name: NSNotification.Name.NSManagedObjectContextDidSave,
-        object: privateContext)
-      
-      NotificationCenter.default.addObserver(
-        self,
-        selector: #selector(self.managedObjectContextDidChange(_:)),
-        name: NSNotification.Name(rawValue: GlobalConstants.notificationManagedObjectContextWasMerged),
-        object: privateContext)
+    dataChangeSubscription = DataChangeBus.sharedInstance.subscribe(entities: [.intake, .waterGoal], scope: .dateRange(beginDate: statisticsBeginDate, endDate: statisticsEndDate)) { [weak self] _ in
+      self?.dataDidChange()
     }
   }
   
-  @objc func managedObjectContextDidChange(_ notification: Notification) {
+  fileprivate func dataDidChange() {
     #if AQUAZLITE
       if !Settings.sharedInstance.generalFullVersion.value {
         return
@@ -236,7 +227,7 @@ class YearStatisticsViewController: UIViewController {
     }
     #endif
     
-    CoreDataStack.performOnPrivateContext { privateContext in
+    CoreDataStack.performRead { privateContext in
       let date = self.date
       let statisticsItems = self.fetchStatisticsItems(beginDate: self.statisticsBeginDate, endDate: self.statisticsEndDate, privateContext: privateContext)
       
@@ -251,6 +242,7 @@ class YearStatisticsViewController: UIViewController {
   fileprivate func computeStatisticsDateRange() {
     statisticsBeginDate = DateHelper.startOfYear(date)
     statisticsEndDate = DateHelper.nextYearFrom(statisticsBeginDate)
+    dataChangeSubscription?.scope = .dateRange(beginDate: statisticsBeginDate, endDate: statisticsEndDate)
   }
 
   fileprivate func checkHelpTip() {
@@ -42,15 +42,7 @@ class DateHelper {
   }
   
   class func startOfDay(_ date: Date) -> Date {
-    let calendar = Calendar.current
-    let components = calendar.dateComponents([.year, .month ,.day], from: date)
-    
-    if let newDate = calendar.date(from: components) {
-      return newDate
-    } else {
-      assert(false)
-      return date
-    }
+    return DayIndex.current(covering: date).startOfDay(of: date)
   }
   
   class func startOfMonth(_ date: Date) -> Date {
@@ -155,7 +147,8 @@ class DateHelper {
   }
 
   class func daysInMonth(date: Date) -> Int {
-    return Calendar.current.range(of: .day, in: .month, for: date)!.count
+    let dayIndex = DayIndex.current(covering: date)
+    return dayIndex.daysInMonth(dayIndex.month(ofDay: dayIndex.day(of: date)))
   }
   
   /// Generates string for the specified date. If year of a current date is year of today, the function hides it.
@@ -0,0 +1,305 @@
+//
+//  DayIndex.swift
+//  Aquaz
+//
+
+import Foundation
+
+/// Immutable table of day and month boundaries for the current calendar and time zone.
+/// Dates are mapped to integer epoch days (number of calendar days since 01.01.1970) by binary search
+/// over precomputed starts of days, so grouping loops can work in integer day space without calendar math.
+/// Boundaries are DST-correct, because they are computed by the calendar once per table.
+final class DayIndex {
+
+  // MARK: Types
+
+  fileprivate struct Constants {
+    static let epochYear = 1970
+    static let yearsBeforeNow = 10
+    static let yearsAfterNow = 2
+    /// The table is never extended beyond these bounds, e.g. for distant or corrupt dates, which are resolved by the calendar
+    static let maximumYearsBeforeNow = 50
+    static let maximumYearsAfterNow = 10
+  }
+
+  // MARK: Properties
+
+  /// Guards the shared index and its generation
+  fileprivate static let lock = NSLock()
+
+  fileprivate static var sharedIndex: DayIndex?
+
+  /// Advanced on every replacement of the shared index, so threads validate their own snapshots of the index by a single comparison
+  fileprivate static var generation = 0
+
+  fileprivate static let threadSnapshotKey = "DayIndex.Snapshot"
+
+  /// The shared index taken by a thread together with its generation
+  fileprivate final class ThreadSnapshot {
+    let index: DayIndex
+    let generation: Int
+
+    init(index: DayIndex, generation: Int) {
+      self.index = index
+      self.generation = generation
+    }
+  }
+
+  fileprivate static let invalidationObservers: [NSObjectProtocol] = [NSNotification.Name.NSSystemTimeZoneDidChange, NSLocale.currentLocaleDidChangeNotification].map {
+    NotificationCenter.default.addObserver(forName: $0, object: nil, queue: nil) { _ in
+      DayIndex.invalidate()
+    }
+  }
+
+  let calendar: Calendar
+
+  /// Epoch day of the first day of the table
+  fileprivate let firstDay: Int
+
+  /// Epoch month of the first month of the table, months are counted from January 1970
+  fileprivate let firstMonth: Int
+
+  /// Time intervals since the reference date of the start and the end of years the table may be extended to
+  fileprivate let extendableTimeIntervals: ClosedRange<TimeInterval>
+
+  /// Starts of days as time intervals since the reference date, the last item is the end of the last day
+  fileprivate let dayStarts: ContiguousArray<TimeInterval>
+
+  /// Indexes in dayStarts of first days of months, the last item is the index of the end of the last month
+  fileprivate let monthStarts: ContiguousArray<Int>
+
+  /// Epoch day of the first day covered by the table
+  var lowerDay: Int {
+    return firstDay
+  }
+
+  /// Epoch day following the last day covered by the table
+  var upperDay: Int {
+    return firstDay + dayStarts.count - 1
+  }
+
+  // MARK: Shared index
+
+  /// Returns the index for the current calendar covering the passed dates.
+  /// The index is rebuilt with extended bounds if the dates are not covered yet. Dates too far from now are not covered,
+  /// they are resolved by the calendar instead.
+  /// Every thread keeps its own snapshot of the shared index, so the index is rebuilt only after it's replaced.
+  class func current(covering dates: Date...) -> DayIndex {
+    _ = invalidationObservers
+
+    let threadDictionary = Thread.current.threadDictionary
+
+    lock.lock()
+    let currentGeneration = generation
+    lock.unlock()
+
+    if let snapshot = threadDictionary[threadSnapshotKey] as? ThreadSnapshot,
+       snapshot.generation == currentGeneration,
+       !dates.contains(where: { snapshot.index.needsExtension(for: $0) })
+    {
+      return snapshot.index
+    }
+
+    let snapshot = sharedSnapshot(covering: dates)
+    threadDictionary[threadSnapshotKey] = snapshot
+    return snapshot.index
+  }
+
+  fileprivate class func sharedSnapshot(covering dates: [Date]) -> ThreadSnapshot {
+    lock.lock()
+    defer { lock.unlock() }
+
+    if let index = sharedIndex, !dates.contains(where: { index.needsExtension(for: $0) }) {
+      return ThreadSnapshot(index: index, generation: generation)
+    }
+
+    let calendar = Calendar.current
+    let now = Date()
+    let currentYear = calendar.component(.year, from: now)
+    let minimumYear = currentYear - Constants.maximumYearsBeforeNow
+    let maximumYear = currentYear + Constants.maximumYearsAfterNow
+
+    var lowerYear = sharedIndex?.year(ofMonth: sharedIndex!.firstMonth) ?? currentYear - Constants.yearsBeforeNow
+    var upperYear = sharedIndex.map { $0.year(ofMonth: $0.firstMonth + $0.monthStarts.count - 2) } ?? currentYear + Constants.yearsAfterNow
+
+    for date in dates {
+      let year = calendar.component(.year, from: date)
+      lowerYear = max(min(lowerYear, year - 1), minimumYear)
+      upperYear = min(max(upperYear, year + 1), maximumYear)
+    }
+
+    let index = DayIndex(calendar: calendar, lowerYear: lowerYear, upperYear: upperYear, minimumYear: minimumYear, maximumYear: maximumYear)
+    sharedIndex = index
+    generation += 1
+    return ThreadSnapshot(index: index, generation: generation)
+  }
+
+  /// Drops the shared index, it will be rebuilt for the current calendar and time zone on the next request
+  class func invalidate() {
+    NSTimeZone.resetSystemTimeZone()
+
+    lock.lock()
+    sharedIndex = nil
+    generation += 1
+    lock.unlock()
+  }
+
+  // MARK: Building
+
+  /// Builds the table for years lowerYear...upperYear, which may be extended later up to minimumYear...maximumYear
+  fileprivate init(calendar: Calendar, lowerYear: Int, upperYear: Int, minimumYear: Int, maximumYear: Int) {
+    self.calendar = calendar
+
+    let minimumDate = calendar.date(from: DateComponents(year: minimumYear, month: 1, day: 1))!
+    let maximumDate = calendar.date(from: DateComponents(year: maximumYear + 1, month: 1, day: 1))!
+    extendableTimeIntervals = minimumDate.timeIntervalSinceReferenceDate...maximumDate.timeIntervalSinceReferenceDate
+
+    let firstDate = calendar.date(from: DateComponents(year: lowerYear, month: 1, day: 1))!
+    let endDate = calendar.date(from: DateComponents(year: upperYear + 1, month: 1, day: 1))!
+    let epochDate = calendar.date(from: DateComponents(year: Constants.epochYear, month: 1, day: 1))!
+
+    firstDay = calendar.dateComponents([.day], from: epochDate, to: firstDate).day!
+    firstMonth = (lowerYear - Constants.epochYear) * 12
+
+    var dayStarts = ContiguousArray<TimeInterval>()
+    var monthStarts = ContiguousArray<Int>()
+    var dayStart = firstDate
+
+    while dayStart.isEarlierThan(endDate) {
+      if calendar.component(.day, from: dayStart) == 1 {
+        monthStarts.append(dayStarts.count)
+      }
+
+      dayStarts.append(dayStart.timeIntervalSinceReferenceDate)
+
+      // A day lasts from 23 to 25 hours, so 36 hours later is always inside the next day
+      dayStart = calendar.startOfDay(for: dayStart.addingTimeInterval(36 * 60 * 60))
+    }
+
+    dayStarts.append(endDate.timeIntervalSinceReferenceDate)
+    monthStarts.append(dayStarts.count - 1)
+
+    self.dayStarts = dayStarts
+    self.monthStarts = monthStarts
+  }
+
+  // MARK: Days
+
+  func covers(_ date: Date) -> Bool {
+    let timeInterval = date.timeIntervalSinceReferenceDate
+    return timeInterval >= dayStarts.first! && timeInterval < dayStarts.last!
+  }
+
+  /// Whether the table should be rebuilt to cover the date
+  fileprivate func needsExtension(for date: Date) -> Bool {
+    return !covers(date) && extendableTimeIntervals.contains(date.timeIntervalSinceReferenceDate)
+  }
+
+  /// Epoch day of the date. Dates out of the table are resolved by the calendar.
+  func day(of date: Date) -> Int {
+    let timeInterval = date.timeIntervalSinceReferenceDate
+
+    if timeInterval < dayStarts.first! || timeInterval >= dayStarts.last! {
+      let dayStart = calendar.startOfDay(for: date)
+      return firstDay + calendar.dateComponents([.day], from: startOfDay(firstDay), to: dayStart).day!
+    }
+
+    // Index of the last day start not later than the date
+    var low = 0
+    var high = dayStarts.count - 1
+
+    while high - low > 1 {
+      let middle = (low + high) / 2
+
+      if dayStarts[middle] <= timeInterval {
+        low = middle
+      } else {
+        high = middle
+      }
+    }
+
+    return firstDay + low
+  }
+
+  /// Start of the epoch day. Days out of the table are resolved by the calendar.
+  func startOfDay(_ day: Int) -> Date {
+    let index = day - firstDay
+
+    if index >= 0 && index < dayStarts.count {
+      return Date(timeIntervalSinceReferenceDate: dayStarts[index])
+    }
+
+    let firstDate = Date(timeIntervalSinceReferenceDate: dayStarts[0])
+    return calendar.date(byAdding: .day, value: index, to: firstDate)!
+  }
+
+  /// Start of the day of the date
+  func startOfDay(of date: Date) -> Date {
+    return startOfDay(day(of: date))
+  }
+
+  // MARK: Months
+
+  /// Epoch month of the epoch day, months are counted from January 1970
+  func month(ofDay day: Int) -> Int {
+    let index = day - firstDay
+
+    if index < 0 || index >= dayStarts.count - 1 {
+      let components = calendar.dateComponents([.year, .month], from: startOfDay(day))
+      return (components.year! - Constants.epochYear) * 12 + components.month! - 1
+    }
+
+    // Index of the last month start not later than the day
+    var low = 0
+    var high = monthStarts.count - 1
+
+    while high - low > 1 {
+      let middle = (low + high) / 2
+
+      if monthStarts[middle] <= index {
+        low = middle
+      } else {
+        high = middle
+      }
+    }
+
+    return firstMonth + low
+  }
+
+  /// Epoch day of the first day of the epoch month
+  func firstDay(ofMonth month: Int) -> Int {
+    let index = month - firstMonth
+
+    if index >= 0 && index < monthStarts.count {
+      return firstDay + monthStarts[index]
+    }
+
+    let date = calendar.date(from: DateComponents(year: year(ofMonth: month), month: month.modulo(12) + 1, day: 1))!
+    return day(of: date)
+  }
+
+  func daysInMonth(_ month: Int) -> Int {
+    return firstDay(ofMonth: month + 1) - firstDay(ofMonth: month)
+  }
+
+  /// Adds months to the epoch day keeping its day of month. A day of month exceeding the length of the target month
+  /// overflows into the next month, as it does for date components, e.g. 31 January plus one month is 3 March.
+  func day(_ day: Int, addingMonths months: Int) -> Int {
+    let month = self.month(ofDay: day)
+    let dayOfMonth = day - firstDay(ofMonth: month)
+    return firstDay(ofMonth: month + months) + dayOfMonth
+  }
+
+  fileprivate func year(ofMonth month: Int) -> Int {
+    return Constants.epochYear + Int((Double(month) / 12).rounded(.down))
+  }
+
+}
+
+private extension Int {
+  /// Non-negative remainder of division
+  func modulo(_ divisor: Int) -> Int {
+    let remainder = self % divisor
+    return remainder >= 0 ? remainder : remainder + divisor
+  }
+}
@@ -13,6 +13,23 @@ class CodingManagedObject: NSManagedObject, NSCoding {
   
   fileprivate static let encodeKey = "URIRepresentation"
   
+  fileprivate static let decodingScopeKey = "CodingManagedObject.DecodingScope"
+  
+  /// Context of objects being decoded by unarchiveObject(with:managedObjectContext:) on the current thread
+  fileprivate final class DecodingScope {
+    let managedObjectContext: NSManagedObjectContext
+    /// Objects resolved before decoding by URI representations, nil if every object is resolved on decoding
+    let resolvedObjects: [URL: NSManagedObject]?
+
+    init(managedObjectContext: NSManagedObjectContext, resolvedObjects: [URL: NSManagedObject]?) {
+      self.managedObjectContext = managedObjectContext
+      self.resolvedObjects = resolvedObjects
+    }
+  }
+  
+  /// Existing object resolved by the fake initializer, it replaces the placeholder in awakeAfterUsingCoder
+  fileprivate var decodedManagedObject: NSManagedObject?
+  
   override init(entity: NSEntityDescription, insertInto context: NSManagedObjectContext?) {
     super.init(entity: entity, insertInto: context)
   }
@@ -21,30 +38,137 @@ class CodingManagedObject: NSManagedObject, NSCoding {
   convenience required init?(coder aDecoder: NSCoder) {
     if let managedObject = CodingManagedObject.getExistingManagedObject(aDecoder) {
       self.init(entity: managedObject.entity, insertInto: nil)
+      decodedManagedObject = managedObject
     } else {
       return nil
     }
   }
   
   override func awakeAfter(using aDecoder: NSCoder) -> Any? {
-    return CodingManagedObject.getExistingManagedObject(aDecoder)
+    return decodedManagedObject
+  }
+  
+  /// Unarchives data containing managed objects, objects are taken from the writer context
+  class func unarchiveObject(with data: Data) -> Any? {
+    var object: Any?
+
+    CoreDataStack.performWriteAndWait { privateContext in
+      object = unarchiveObject(with: data, managedObjectContext: privateContext)
+    }
+
+    return object
+  }
+  
+  /// Unarchives data containing managed objects taking them from the managed object context.
+  /// All URI representations of the archive are resolved before decoding: registered objects are taken without I/O,
+  /// others are fetched by a single request per entity. Otherwise every object is resolved separately on decoding.
+  /// Should be called on the queue of the managed object context.
+  class func unarchiveObject(with data: Data, managedObjectContext: NSManagedObjectContext, resolvesObjectsInBatch: Bool = true) -> Any? {
+    let resolvedObjects = resolvesObjectsInBatch ? resolveManagedObjects(objectURIs(inArchive: data), managedObjectContext: managedObjectContext) : nil
+
+    let threadDictionary = Thread.current.threadDictionary
+    let enclosingScope = threadDictionary[decodingScopeKey]
+    threadDictionary[decodingScopeKey] = DecodingScope(managedObjectContext: managedObjectContext, resolvedObjects: resolvedObjects)
+
+    defer {
+      threadDictionary[decodingScopeKey] = enclosingScope
+    }
+
+    return NSKeyedUnarchiver.unarchiveObject(with: data)
+  }
+  
+  /// Object URIs are archived as strings in the list of archived objects, so they can be collected without decoding
+  class func objectURIs(inArchive data: Data) -> Set<URL> {
+    guard let archive = (try? PropertyListSerialization.propertyList(from: data, options: [], format: nil)) as? [String: Any],
+          let archivedObjects = archive["$objects"] as? [Any] else
+    {
+      return []
+    }
+
+    var objectURIs = Set<URL>()
+
+    for case let string as String in archivedObjects where string.hasPrefix("x-coredata:") {
+      if let url = URL(string: string) {
+        objectURIs.insert(url)
+      }
+    }
+
+    return objectURIs
+  }
+  
+  /// Returns existing objects for the URI representations. Should be called on the queue of the managed object context.
+  class func resolveManagedObjects(_ objectURIs: Set<URL>, managedObjectContext: NSManagedObjectContext) -> [URL: NSManagedObject] {
+    guard let coordinator = managedObjectContext.persistentStoreCoordinator else {
+      return [:]
+    }
+
+    var managedObjects = [URL: NSManagedObject]()
+    var objectURIsByIDs = [NSManagedObjectID: URL]()
+    var objectIDsByEntities = [String: [NSManagedObjectID]]()
+
+    for url in objectURIs {
+      guard let managedObjectID = coordinator.managedObjectID(forURIRepresentation: url) else {
+        continue
+      }
+
+      if let managedObject = managedObjectContext.registeredObject(for: managedObjectID), !managedObject.isFault {
+        managedObjects[url] = managedObject
+      } else if let entityName = managedObjectID.entity.name {
+        objectURIsByIDs[managedObjectID] = url
+        objectIDsByEntities[entityName, default: []].append(managedObjectID)
+      }
+    }
+
+    for (entityName, managedObjectIDs) in objectIDsByEntities {
+      let fetchRequest = NSFetchRequest<NSManagedObject>(entityName: entityName)
+      fetchRequest.predicate = NSPredicate(format: "SELF IN %@", managedObjectIDs)
+      fetchRequest.returnsObjectsAsFaults = false
+
+      do {
+        for managedObject in try managedObjectContext.fetch(fetchRequest) {
+          if let url = objectURIsByIDs[managedObject.objectID] {
+            managedObjects[url] = managedObject
+          }
+        }
+      } catch let error as NSError {
+        Logger.logError(Logger.Messages.failedToExecuteFetchRequest, error: error)
+      }
+    }
+
+    return managedObjects
   }
   
   fileprivate class func getExistingManagedObject(_ aDecoder: NSCoder) -> NSManagedObject? {
-    var managedObject: NSManagedObject?
-    
-    CoreDataStack.performOnPrivateContextAndWait { privateContext in
-      if let coordinator = privateContext.persistentStoreCoordinator,
-         let url = aDecoder.decodeObject(forKey: encodeKey) as? URL,
-         let managedObjectID = coordinator.managedObjectID(forURIRepresentation: url)
-      {
-        managedObject = try? privateContext.existingObject(with: managedObjectID)
+    guard let url = aDecoder.decodeObject(forKey: encodeKey) as? URL else {
+      return nil
+    }
+
+    if let scope = Thread.current.threadDictionary[decodingScopeKey] as? DecodingScope {
+      // Objects missing among resolved ones don't exist anymore
+      if let resolvedObjects = scope.resolvedObjects {
+        return resolvedObjects[url]
       }
+
+      return getExistingManagedObject(url, managedObjectContext: scope.managedObjectContext)
+    }
+
+    var managedObject: NSManagedObject?
+
+    CoreDataStack.performWriteAndWait { privateContext in
+      managedObject = getExistingManagedObject(url, managedObjectContext: privateContext)
     }
-    
+
     return managedObject
   }
   
+  fileprivate class func getExistingManagedObject(_ url: URL, managedObjectContext: NSManagedObjectContext) -> NSManagedObject? {
+    guard let managedObjectID = managedObjectContext.persistentStoreCoordinator?.managedObjectID(forURIRepresentation: url) else {
+      return nil
+    }
+
+    return try? managedObjectContext.existingObject(with: managedObjectID)
+  }
+  
   func encode(with aCoder: NSCoder) {
     aCoder.encode(objectID.uriRepresentation(), forKey: CodingManagedObject.encodeKey)
   }
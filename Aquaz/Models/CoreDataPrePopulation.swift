@@ -12,128 +12,73 @@ import UIKit
 
 class CoreDataPrePopulation {
   
+  /// Drinks of the catalog with names of their entities
+  fileprivate static let catalog: [(drinkType: DrinkType, name: String)] = [
+    (.water, "Water"),
+    (.coffee, "Coffee"),
+    (.tea, "Tea"),
+    (.soda, "Soda"),
+    (.juice, "Juice"),
+    (.milk, "Milk"),
+    (.sport, "Sport"),
+    (.energy, "Energy"),
+    (.beer, "Beer"),
+    (.wine, "Wine"),
+    (.hardLiquor, "HardLiquor")]
+  
+  static let catalogRecentAmount: Double = 250
+  
   class func isCoreDataPrePopulated(managedObjectContext: NSManagedObjectContext) -> Bool {
+    // The catalog may come with the seed store, so the initial water goal is checked too
+    return isCatalogPrePopulated(managedObjectContext: managedObjectContext) &&
+           WaterGoal.fetchManagedObject(managedObjectContext: managedObjectContext) != nil
+  }
+  
+  class func isCatalogPrePopulated(managedObjectContext: NSManagedObjectContext) -> Bool {
     return Drink.fetchDrinkByIndex(0, managedObjectContext: managedObjectContext) != nil
   }
   
   class func prePopulateCoreData(managedObjectContext: NSManagedObjectContext, saveContext: Bool) {
-    _ = Drink.addEntity(
-      index: DrinkType.water.rawValue,
-      name: "Water",
-      hydrationFactor: DrinkType.water.hydrationFactor,
-      dehydrationFactor: DrinkType.water.dehydrationFactor,
-      recentAmount: 250,
-      managedObjectContext: managedObjectContext,
-      saveImmediately: false)
-    
-    _ = Drink.addEntity(
-      index: DrinkType.coffee.rawValue,
-      name: "Coffee",
-      hydrationFactor: DrinkType.coffee.hydrationFactor,
-      dehydrationFactor: DrinkType.coffee.dehydrationFactor,
-      recentAmount: 250,
-      managedObjectContext: managedObjectContext,
-      saveImmediately: false)
-    
-    _ = Drink.addEntity(
-      index: DrinkType.tea.rawValue,
-      name: "Tea",
-      hydrationFactor: DrinkType.tea.hydrationFactor,
-      dehydrationFactor: DrinkType.tea.dehydrationFactor,
-      recentAmount: 250,
-      managedObjectContext: managedObjectContext,
-      saveImmediately: false)
-
-    _ = Drink.addEntity(
-      index: DrinkType.soda.rawValue,
-      name: "Soda",
-      hydrationFactor: DrinkType.soda.hydrationFactor,
-      dehydrationFactor: DrinkType.soda.dehydrationFactor,
-      recentAmount: 250,
-      managedObjectContext: managedObjectContext,
-      saveImmediately: false)
-    
-    _ = Drink.addEntity(
-      index: DrinkType.juice.rawValue,
-      name: "Juice",
-      hydrationFactor: DrinkType.juice.hydrationFactor,
-      dehydrationFactor: DrinkType.juice.dehydrationFactor,
-      recentAmount: 250,
-      managedObjectContext: managedObjectContext,
-      saveImmediately: false)
-    
-    _ = Drink.addEntity(
-      index: DrinkType.milk.rawValue,
-      name: "Milk",
-      hydrationFactor: DrinkType.milk.hydrationFactor,
-      dehydrationFactor: DrinkType.milk.dehydrationFactor,
-      recentAmount: 250,
-      managedObjectContext: managedObjectContext,
-      saveImmediately: false)
-
-    _ = Drink.addEntity(
-      index: DrinkType.sport.rawValue,
-      name: "Sport",
-      hydrationFactor: DrinkType.sport.hydrationFactor,
-      dehydrationFactor: DrinkType.sport.dehydrationFactor,
-      recentAmount: 250,
-      managedObjectContext: managedObjectContext,
-      saveImmediately: false)
-    
-    _ = Drink.addEntity(
-      index: DrinkType.energy.rawValue,
-      name: "Energy",
-      hydrationFactor: DrinkType.energy.hydrationFactor,
-      dehydrationFactor: DrinkType.energy.dehydrationFactor,
-      recentAmount: 250,
-      managedObjectContext: managedObjectContext,
-      saveImmediately: false)
-
-    _ = Drink.addEntity(
-      index: DrinkType.beer.rawValue,
-      name: "Beer",
-      hydrationFactor: DrinkType.beer.hydrationFactor,
-      dehydrationFactor: DrinkType.beer.dehydrationFactor,
-      recentAmount: 250,
-      managedObjectContext: managedObjectContext,
-      saveImmediately: false)
-    
-    _ = Drink.addEntity(
-      index: DrinkType.wine.rawValue,
-      name: "Wine",
-      hydrationFactor: DrinkType.wine.hydrationFactor,
-      dehydrationFactor: DrinkType.wine.dehydrationFactor,
-      recentAmount: 250,
-      managedObjectContext: managedObjectContext,
-      saveImmediately: false)
-    
-    _ = Drink.addEntity(
-      index: DrinkType.hardLiquor.rawValue,
-      name: "HardLiquor",
-      hydrationFactor: DrinkType.hardLiquor.hydrationFactor,
-      dehydrationFactor: DrinkType.hardLiquor.dehydrationFactor,
-      recentAmount: 250,
-      managedObjectContext: managedObjectContext,
-      saveImmediately: false)
-
-    _ = WaterGoal.addEntity(
-      date: Date(),
-      baseAmount: Settings.sharedInstance.userDailyWaterIntake.value,
-      isHotDay: false,
-      isHighActivity: false,
-      managedObjectContext: managedObjectContext,
-      saveImmediately: false)
+    if !isCatalogPrePopulated(managedObjectContext: managedObjectContext) {
+      prePopulateCatalog(managedObjectContext: managedObjectContext)
+    }
     
-    #if DEBUG
-    CoreDataPrePopulation.generateIntakes(managedObjectContext: managedObjectContext)
-    CoreDataPrePopulation.generateWaterGoals(managedObjectContext: managedObjectContext)
-    #endif
+    if WaterGoal.fetchManagedObject(managedObjectContext: managedObjectContext) == nil {
+      _ = WaterGoal.addEntity(
+        date: Date(),
+        baseAmount: Settings.sharedInstance.userDailyWaterIntake.value,
+        isHotDay: false,
+        isHighActivity: false,
+        managedObjectContext: managedObjectContext,
+        saveImmediately: false)
+      
+      #if DEBUG
+      CoreDataPrePopulation.generateIntakes(managedObjectContext: managedObjectContext)
+      CoreDataPrePopulation.generateWaterGoals(managedObjectContext: managedObjectContext)
+      #endif
+    }
     
     if saveContext {
       CoreDataStack.saveContext(managedObjectContext)
     }
   }
   
+  /// Adds drinks missing in the catalog without saving the context. It's used for generating the seed store as well.
+  class func prePopulateCatalog(managedObjectContext: NSManagedObjectContext) {
+    let existingDrinks = Drink.fetchAllDrinksIndexed(managedObjectContext: managedObjectContext)
+    
+    for (drinkType, name) in catalog where existingDrinks[drinkType.rawValue] == nil {
+      _ = Drink.addEntity(
+        index: drinkType.rawValue,
+        name: name,
+        hydrationFactor: drinkType.hydrationFactor,
+        dehydrationFactor: drinkType.dehydrationFactor,
+        recentAmount: catalogRecentAmount,
+        managedObjectContext: managedObjectContext,
+        saveImmediately: false)
+    }
+  }
+  
   class func generateIntakes(managedObjectContext: NSManagedObjectContext) {
     let secondsPerDay = 60 * 60 * 24
     let endDate = DateHelper.startOfDay(Date())
@@ -142,8 +87,7 @@ class CoreDataPrePopulation {
     let maxAmount = 500
     let maxIntakesPerDay = 10
     
-    let drinks = Drink.fetchAllDrinksIndexed(managedObjectContext: managedObjectContext)
-    
+    var drafts = [Intake.Draft]()
     var currentDay = beginDate
     
     while currentDay.isEarlierThan(endDate) {
@@ -151,16 +95,18 @@ class CoreDataPrePopulation {
       for _ in 0..<intakesCount {
         let drinkIndex = Int(arc4random_uniform(UInt32(Drink.getDrinksCount())))
         
-        if let drink = drinks[drinkIndex] {
+        if let drinkType = DrinkType(rawValue: drinkIndex) {
           let amount = Double(minAmount + Int(arc4random_uniform(UInt32(maxAmount - minAmount))))
           let timeInterval = TimeInterval(Int(arc4random_uniform(UInt32(secondsPerDay))))
           let intakeDate = Date(timeInterval: timeInterval, since: currentDay)
-          _ = Intake.addEntity(drink: drink, amount: amount, date: intakeDate, managedObjectContext: managedObjectContext, saveImmediately: false)
+          drafts.append(Intake.Draft(drinkType: drinkType, amount: amount, date: intakeDate))
         }
       }
       
       currentDay = DateHelper.nextDayFrom(currentDay)
     }
+    
+    _ = Intake.addEntities(drafts, managedObjectContext: managedObjectContext, saveImmediately: false)
   }
   
   class func generateWaterGoals(managedObjectContext: NSManagedObjectContext) {
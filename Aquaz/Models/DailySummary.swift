@@ -0,0 +1,360 @@
+//
+//  DailySummary.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+
+/// Pre-aggregated amounts of intakes for a pair (day, drink).
+/// Entities are maintained incrementally on every save of a managed object context,
+/// so statistics can be built without loading every intake of a period.
+@objc(DailySummary)
+class DailySummary: CodingManagedObject, NamedEntity {
+
+  typealias EntityType = DailySummary
+
+  static var entityName = "DailySummary"
+
+  /// Start of the day
+  @NSManaged var date: Date
+
+  /// Index of the drink (see DrinkType)
+  @NSManaged var drinkIndex: Int16
+
+  /// Overall amount of intakes in millilitres
+  @NSManaged var amount: Double
+
+  /// Overall hydration amount of intakes
+  @NSManaged var hydration: Double
+
+  /// Overall dehydration amount of intakes
+  @NSManaged var dehydration: Double
+
+  /// Overall caffeine amount of intakes in milligrams
+  @NSManaged var caffeine: Double
+
+  /// Number of intakes
+  @NSManaged var intakesCount: Int32
+
+  var drinkType: DrinkType? {
+    return DrinkType(rawValue: Int(drinkIndex))
+  }
+
+  // MARK: Types
+
+  fileprivate struct Key: Hashable {
+    let date: Date
+    let drinkIndex: Int
+  }
+
+  fileprivate struct Delta {
+    var amount: Double = 0
+    var intakesCount: Int = 0
+
+    var isEmpty: Bool {
+      return amount == 0 && intakesCount == 0
+    }
+  }
+
+  fileprivate struct Constants {
+    static let timeZoneMetadataKey = "DailySummaryTimeZone"
+  }
+
+  fileprivate struct Templates {
+    static let datePeriodFormat = "(date >= $beginDate) AND (date < $endDate)"
+    static let sortedByDate = [NSSortDescriptor(key: "date", ascending: true)]
+
+    static let dailySummaries = FetchRequestTemplate(
+      entityName: DailySummary.entityName, name: "dailySummaries",
+      predicateFormat: datePeriodFormat, sortDescriptors: sortedByDate)
+
+    static let amountPartColumns = FetchRequestTemplate(
+      entityName: DailySummary.entityName, name: "amountPartColumns",
+      predicateFormat: datePeriodFormat, sortDescriptors: sortedByDate,
+      propertiesToFetch: ["date", "hydration", "dehydration"], resultType: .dictionaryResultType)
+  }
+
+  // MARK: Maintenance
+
+  fileprivate static let maintenanceObserver: NSObjectProtocol = NotificationCenter.default.addObserver(
+    forName: NSNotification.Name.NSManagedObjectContextWillSave,
+    object: nil,
+    queue: nil) { notification in
+      if let managedObjectContext = notification.object as? NSManagedObjectContext {
+        DailySummary.applyPendingChanges(managedObjectContext: managedObjectContext)
+      }
+  }
+
+  /// Starts incremental maintenance of daily summaries for all managed object contexts.
+  /// Can be called several times, observation is set up only once.
+  class func startMaintenance() {
+    _ = maintenanceObserver
+  }
+
+  /// Applies pending changes of intakes (inserted, updated and deleted ones) of the managed object context to daily summaries.
+  /// It's called right before saving, so the summaries are committed in the same transaction as the intakes
+  /// and previously committed values of updated and deleted intakes are still available.
+  class func applyPendingChanges(managedObjectContext: NSManagedObjectContext) {
+    // Contexts of stores created by previous versions of the model (e.g. during migration) have no daily summaries
+    if managedObjectContext.persistentStoreCoordinator?.managedObjectModel.entitiesByName[entityName] == nil {
+      return
+    }
+
+    var deltas = [Key: Delta]()
+
+    func accumulate(date: Date?, drink: Drink?, amount: Double?, sign: Double) {
+      guard let date = date, let drink = drink, let amount = amount else {
+        return
+      }
+
+      let key = Key(date: DateHelper.startOfDay(date), drinkIndex: drink.index.intValue)
+      var delta = deltas[key] ?? Delta()
+      delta.amount += sign * amount
+      delta.intakesCount += Int(sign)
+      deltas[key] = delta
+    }
+
+    for case let intake as Intake in managedObjectContext.insertedObjects {
+      accumulate(date: intake.date, drink: intake.drink, amount: intake.amount, sign: 1)
+    }
+
+    for case let intake as Intake in managedObjectContext.deletedObjects where !intake.objectID.isTemporaryID {
+      let committedValues = intake.committedValues(forKeys: Intake.summarizedKeys)
+      accumulate(date: committedValues["date"] as? Date, drink: committedDrink(committedValues["drink"], managedObjectContext: managedObjectContext), amount: committedValues["amount"] as? Double, sign: -1)
+    }
+
+    for case let intake as Intake in managedObjectContext.updatedObjects {
+      let changedKeys = Set(intake.changedValues().keys)
+      if changedKeys.isDisjoint(with: Intake.summarizedKeys) {
+        continue
+      }
+
+      let committedValues = intake.committedValues(forKeys: Intake.summarizedKeys)
+      accumulate(date: committedValues["date"] as? Date, drink: committedDrink(committedValues["drink"], managedObjectContext: managedObjectContext), amount: committedValues["amount"] as? Double, sign: -1)
+      accumulate(date: intake.date, drink: intake.drink, amount: intake.amount, sign: 1)
+    }
+
+    let changedDeltas = deltas.filter { !$0.value.isEmpty }
+    applyDeltas(changedDeltas, managedObjectContext: managedObjectContext)
+    DailyAmountsIndex.index(for: managedObjectContext)?.stage(dayDeltas(changedDeltas), for: managedObjectContext)
+  }
+
+  /// Converts deltas to changes of amounts of epoch days for DailyAmountsIndex
+  fileprivate class func dayDeltas(_ deltas: [Key: Delta]) -> [DailyAmountsIndex.DayDelta] {
+    let dayIndex = DayIndex.current(covering: Date())
+
+    return deltas.compactMap { key, delta in
+      guard let drinkType = DrinkType(rawValue: key.drinkIndex) else {
+        return nil
+      }
+
+      return DailyAmountsIndex.DayDelta(
+        day: dayIndex.day(of: key.date),
+        hydration: delta.amount * drinkType.hydrationFactor,
+        dehydration: delta.amount * drinkType.dehydrationFactor,
+        intakesCount: delta.intakesCount)
+    }
+  }
+
+  /// Committed value of a relationship can be represented either by a managed object or by its identifier
+  fileprivate class func committedDrink(_ value: Any?, managedObjectContext: NSManagedObjectContext) -> Drink? {
+    if let drink = value as? Drink {
+      return drink
+    }
+    
+    if let objectID = value as? NSManagedObjectID {
+      return (try? managedObjectContext.existingObject(with: objectID)) as? Drink
+    }
+    
+    return nil
+  }
+
+  fileprivate class func applyDeltas(_ deltas: [Key: Delta], managedObjectContext: NSManagedObjectContext) {
+    if deltas.isEmpty {
+      return
+    }
+
+    let dates = Array(Set(deltas.keys.map { $0.date }))
+    let predicate = NSPredicate(format: "date IN %@", argumentArray: [dates])
+    let summaries = fetchManagedObjects(managedObjectContext: managedObjectContext, predicate: predicate)
+
+    var summariesMap = [Key: DailySummary]()
+    for summary in summaries {
+      summariesMap[Key(date: summary.date, drinkIndex: Int(summary.drinkIndex))] = summary
+    }
+
+    for (key, delta) in deltas {
+      guard let drinkType = DrinkType(rawValue: key.drinkIndex) else {
+        Logger.logDrinkIsNotFound(drinkIndex: key.drinkIndex)
+        continue
+      }
+
+      let summary: DailySummary
+
+      if let existingSummary = summariesMap[key] {
+        summary = existingSummary
+      } else if let newSummary = insertNewObject(inManagedObjectContext: managedObjectContext) {
+        newSummary.date = key.date
+        newSummary.drinkIndex = Int16(key.drinkIndex)
+        summary = newSummary
+      } else {
+        continue
+      }
+
+      summary.intakesCount += Int32(delta.intakesCount)
+
+      if summary.intakesCount <= 0 {
+        Logger.logError(summary.intakesCount == 0, Logger.Messages.logicalError, logDetails: [Logger.Attributes.date: key.date.description, Logger.Attributes.count: "\(summary.intakesCount)"])
+        managedObjectContext.delete(summary)
+        continue
+      }
+
+      summary.amount += delta.amount
+      summary.updateFactoredAmounts(drinkType: drinkType)
+    }
+  }
+
+  fileprivate func updateFactoredAmounts(drinkType: DrinkType) {
+    hydration = amount * drinkType.hydrationFactor
+    dehydration = amount * drinkType.dehydrationFactor
+    caffeine = amount * drinkType.caffeineGramPerLiter
+  }
+
+  // MARK: Rebuilding and verification
+
+  /// Rebuilds daily summaries if they have never been built for the store (e.g. right after migration from the previous model version)
+  /// or if the time zone has been changed since the last building, because day boundaries depend on it.
+  class func rebuildIfNeeded(managedObjectContext: NSManagedObjectContext) {
+    guard let coordinator = managedObjectContext.persistentStoreCoordinator,
+          let store = coordinator.persistentStores.first else
+    {
+      return
+    }
+
+    let timeZoneIdentifier = TimeZone.current.identifier
+
+    if let builtForTimeZone = coordinator.metadata(for: store)[Constants.timeZoneMetadataKey] as? String, builtForTimeZone == timeZoneIdentifier {
+      return
+    }
+
+    rebuild(managedObjectContext: managedObjectContext)
+
+    var metadata = coordinator.metadata(for: store)
+    metadata[Constants.timeZoneMetadataKey] = timeZoneIdentifier
+    coordinator.setMetadata(metadata, for: store)
+
+    CoreDataStack.commitContext(managedObjectContext)
+  }
+
+  /// Removes all daily summaries and builds them again from intakes. The context is not saved.
+  class func rebuild(managedObjectContext: NSManagedObjectContext) {
+    DailyAmountsIndex.index(for: managedObjectContext)?.stageRebuild(for: managedObjectContext)
+
+    for summary in fetchManagedObjects(managedObjectContext: managedObjectContext) {
+      managedObjectContext.delete(summary)
+    }
+
+    for (key, delta) in computeDeltasFromIntakes(managedObjectContext: managedObjectContext) {
+      guard let drinkType = DrinkType(rawValue: key.drinkIndex),
+            let summary = insertNewObject(inManagedObjectContext: managedObjectContext) else
+      {
+        continue
+      }
+
+      summary.date = key.date
+      summary.drinkIndex = Int16(key.drinkIndex)
+      summary.amount = delta.amount
+      summary.intakesCount = Int32(delta.intakesCount)
+      summary.updateFactoredAmounts(drinkType: drinkType)
+    }
+  }
+
+  /// Checks that daily summaries match to intakes. Returns false if any drift is detected.
+  class func verify(managedObjectContext: NSManagedObjectContext) -> Bool {
+    var expected = computeDeltasFromIntakes(managedObjectContext: managedObjectContext)
+
+    for summary in fetchManagedObjects(managedObjectContext: managedObjectContext) {
+      let key = Key(date: summary.date, drinkIndex: Int(summary.drinkIndex))
+
+      guard let delta = expected.removeValue(forKey: key),
+            delta.intakesCount == Int(summary.intakesCount),
+            abs(delta.amount - summary.amount) <= 0.001 * max(1, abs(delta.amount)) else
+      {
+        return false
+      }
+    }
+
+    return expected.isEmpty
+  }
+
+  /// Verifies daily summaries and rebuilds them if any drift is detected. Returns true if summaries were repaired.
+  class func verifyAndRepair(managedObjectContext: NSManagedObjectContext) -> Bool {
+    if verify(managedObjectContext: managedObjectContext) {
+      return false
+    }
+
+    Logger.logWarning("Drift of daily summaries has been detected. The summaries are rebuilt.")
+    rebuild(managedObjectContext: managedObjectContext)
+    CoreDataStack.commitContext(managedObjectContext)
+    return true
+  }
+
+  /// Groups all stored intakes by days and drinks. Intakes are fetched as packed columns to avoid materializing them.
+  fileprivate class func computeDeltasFromIntakes(managedObjectContext: NSManagedObjectContext) -> [Key: Delta] {
+    let columns = Intake.fetchColumns(beginDate: nil, endDate: nil, sorted: false, managedObjectContext: managedObjectContext)
+
+    var deltas = [Key: Delta]()
+
+    for index in 0..<columns.count {
+      let date = Date(timeIntervalSinceReferenceDate: columns.timeIntervals[index])
+      let key = Key(date: DateHelper.startOfDay(date), drinkIndex: columns.drinkIndexes[index])
+      var delta = deltas[key] ?? Delta()
+      delta.amount += columns.amounts[index]
+      delta.intakesCount += 1
+      deltas[key] = delta
+    }
+
+    return deltas
+  }
+
+  // MARK: Fetching
+
+  /// Fetches daily summaries for the specified date interval (beginDate..<endDate) sorted by date
+  class func fetchDailySummaries(beginDate: Date, endDate: Date, managedObjectContext: NSManagedObjectContext) -> [DailySummary] {
+    return fetchManagedObjects(
+      template: Templates.dailySummaries,
+      substitutionVariables: FetchRequestTemplate.dateRangeVariables(beginDate: beginDate, endDate: endDate),
+      managedObjectContext: managedObjectContext)
+  }
+
+  /// Fetches hydration and dehydration amounts of daily summaries for the specified date interval (beginDate..<endDate)
+  /// as packed columns sorted by date. Dictionary result type is used, so no managed objects are materialized.
+  class func fetchAmountPartColumns(beginDate: Date, endDate: Date, managedObjectContext: NSManagedObjectContext) -> Intake.AmountPartColumns {
+    let fetchRequest: NSFetchRequest<NSDictionary> = Templates.amountPartColumns.fetchRequest(
+      substitutionVariables: FetchRequestTemplate.dateRangeVariables(beginDate: beginDate, endDate: endDate),
+      managedObjectContext: managedObjectContext)
+
+    var columns = Intake.AmountPartColumns()
+
+    do {
+      for record in try managedObjectContext.fetch(fetchRequest) {
+        guard let date = record["date"] as? Date,
+              let hydration = record["hydration"] as? Double,
+              let dehydration = record["dehydration"] as? Double else
+        {
+          continue
+        }
+
+        columns.timeIntervals.append(date.timeIntervalSinceReferenceDate)
+        columns.hydrations.append(hydration)
+        columns.dehydrations.append(dehydration)
+      }
+    } catch let error as NSError {
+      Logger.logError(Logger.Messages.failedToExecuteFetchRequest, error: error)
+    }
+
+    return columns
+  }
+
+}
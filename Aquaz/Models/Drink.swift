@@ -26,6 +26,9 @@ class Drink: CodingManagedObject, NamedEntity {
   @NSManaged var intakes: NSSet
   @NSManaged var recentAmount: RecentAmount
   
+  fileprivate struct Templates {
+    static let drinkForIndex = FetchRequestTemplate(entityName: Drink.entityName, name: "drinkForIndex", predicateFormat: "#index = $index")
+  }
 
   var drinkType: DrinkType {
     if _drinkType == nil {
@@ -84,8 +87,7 @@ class Drink: CodingManagedObject, NamedEntity {
   }
   
   class func fetchDrinkByIndex(_ index: Int, managedObjectContext: NSManagedObjectContext) -> Drink? {
-    let predicate = NSPredicate(format: "%K = %@", argumentArray: ["index", index])
-    return fetchManagedObject(managedObjectContext: managedObjectContext, predicate: predicate)
+    return fetchManagedObject(template: Templates.drinkForIndex, substitutionVariables: ["index": index], managedObjectContext: managedObjectContext)
   }
 
   class func fetchAllDrinksIndexed(managedObjectContext: NSManagedObjectContext) -> [Int: Drink] {
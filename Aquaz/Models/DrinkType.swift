@@ -140,4 +140,10 @@ enum DrinkType: Int {
     }
   }
   
+  /// Hydration factors indexed by raw values of drink types, used for aggregating packed columns of intakes
+  static let hydrationFactors: [Double] = (0..<count).map { DrinkType(rawValue: $0)!.hydrationFactor }
+  
+  /// Dehydration factors indexed by raw values of drink types, used for aggregating packed columns of intakes
+  static let dehydrationFactors: [Double] = (0..<count).map { DrinkType(rawValue: $0)!.dehydrationFactor }
+  
 }
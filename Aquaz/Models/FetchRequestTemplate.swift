@@ -0,0 +1,187 @@
+//
+//  FetchRequestTemplate.swift
+//  Aquaz
+//
+
+import CoreData
+
+/// Parameterized fetch request. The predicate uses substitution variables (e.g. $beginDate),
+/// so its format is parsed only once, and callers bind only values of the variables.
+/// Templates are expected to be static constants of entities.
+final class FetchRequestTemplate {
+
+  let name: String
+  let entityName: String
+  let predicate: NSPredicate?
+  let sortDescriptors: [NSSortDescriptor]?
+  let propertiesToFetch: [Any]?
+  let propertiesToGroupBy: [Any]?
+  let resultType: NSFetchRequestResultType
+
+  init(entityName: String, name: String, predicateFormat: String? = nil, sortDescriptors: [NSSortDescriptor]? = nil,
+       propertiesToFetch: [Any]? = nil, propertiesToGroupBy: [Any]? = nil, resultType: NSFetchRequestResultType = .managedObjectResultType)
+  {
+    self.name = "\(entityName).\(name)"
+    self.entityName = entityName
+    self.predicate = predicateFormat.map { NSPredicate(format: $0) }
+    self.sortDescriptors = sortDescriptors
+    self.propertiesToFetch = propertiesToFetch
+    self.propertiesToGroupBy = propertiesToGroupBy
+    self.resultType = resultType
+  }
+
+  /// Returns a new fetch request built from the template with bound substitution variables
+  func fetchRequest<ResultType: NSFetchRequestResult>(substitutionVariables: [String: Any] = [:], managedObjectContext: NSManagedObjectContext) -> NSFetchRequest<ResultType> {
+    let fetchRequest = FetchRequestTemplates.sharedInstance.prototype(for: self, managedObjectContext: managedObjectContext).copy() as! NSFetchRequest<ResultType>
+
+    if let predicate = predicate, !substitutionVariables.isEmpty {
+      fetchRequest.predicate = predicate.withSubstitutionVariables(substitutionVariables)
+    }
+
+    return fetchRequest
+  }
+
+  /// Substitution variables $beginDate and $endDate of a date period, open bounds are replaced by distant dates
+  class func dateRangeVariables(beginDate: Date?, endDate: Date?) -> [String: Any] {
+    return ["beginDate": beginDate ?? Date.distantPast, "endDate": endDate ?? Date.distantFuture]
+  }
+
+}
+
+/// Registry of fetch requests built from templates and of entity descriptions.
+/// Fetch requests are created once per managed object model, so once per persistent store coordinator shared by managed object contexts.
+/// Entity descriptions are attached to the persistent store coordinator, so reading them takes no queue.
+final class FetchRequestTemplates {
+
+  // MARK: Types
+
+  fileprivate final class ModelCache {
+    weak var model: NSManagedObjectModel?
+    var prototypes = [String: NSFetchRequest<NSFetchRequestResult>]()
+
+    init(model: NSManagedObjectModel) {
+      self.model = model
+    }
+  }
+
+  /// Immutable, so it's shared by threads without synchronization
+  fileprivate final class Entities {
+    let entitiesByName: [String: NSEntityDescription]
+
+    init(entitiesByName: [String: NSEntityDescription]) {
+      self.entitiesByName = entitiesByName
+    }
+  }
+
+  // MARK: Properties
+
+  static let sharedInstance = FetchRequestTemplates()
+
+  fileprivate let queue = DispatchQueue(label: "\(GlobalConstants.bundleId).FetchRequestTemplates", attributes: [])
+
+  fileprivate var caches = [ObjectIdentifier: ModelCache]()
+
+  fileprivate static var entitiesKey = 0
+
+  fileprivate var _builtCount = 0
+
+  fileprivate var _reusedCount = 0
+
+  /// Number of fetch requests built from templates
+  var builtCount: Int {
+    return queue.sync { _builtCount }
+  }
+
+  /// Number of requests served by already built fetch requests
+  var reusedCount: Int {
+    return queue.sync { _reusedCount }
+  }
+
+  // MARK: Methods
+
+  fileprivate init() {
+    // Hide initializer, sharedInstance should be used instead.
+  }
+
+  func resetStatistics() {
+    queue.sync {
+      _builtCount = 0
+      _reusedCount = 0
+    }
+  }
+
+  /// Returns the entity description with the name from the model of the managed object context
+  func entity(named entityName: String, managedObjectContext: NSManagedObjectContext) -> NSEntityDescription? {
+    guard let persistentStoreCoordinator = managedObjectContext.persistentStoreCoordinator else {
+      return NSEntityDescription.entity(forEntityName: entityName, in: managedObjectContext)
+    }
+
+    return FetchRequestTemplates.entities(of: persistentStoreCoordinator).entitiesByName[entityName]
+  }
+
+  /// Entity descriptions of the model of the coordinator. The model can't be changed once the coordinator uses it,
+  /// so threads racing on the first read just attach equal descriptions.
+  fileprivate class func entities(of persistentStoreCoordinator: NSPersistentStoreCoordinator) -> Entities {
+    if let entities = objc_getAssociatedObject(persistentStoreCoordinator, &entitiesKey) as? Entities {
+      return entities
+    }
+
+    let entities = Entities(entitiesByName: persistentStoreCoordinator.managedObjectModel.entitiesByName)
+    objc_setAssociatedObject(persistentStoreCoordinator, &entitiesKey, entities, .OBJC_ASSOCIATION_RETAIN)
+    return entities
+  }
+
+  /// Returns the fetch request built from the template for the model of the managed object context.
+  /// The fetch request is shared, so it should be copied before executing.
+  fileprivate func prototype(for template: FetchRequestTemplate, managedObjectContext: NSManagedObjectContext) -> NSFetchRequest<NSFetchRequestResult> {
+    guard let persistentStoreCoordinator = managedObjectContext.persistentStoreCoordinator else {
+      return FetchRequestTemplates.buildFetchRequest(template, entity: NSEntityDescription.entity(forEntityName: template.entityName, in: managedObjectContext))
+    }
+
+    let model = persistentStoreCoordinator.managedObjectModel
+
+    return queue.sync {
+      let cache = modelCache(for: model)
+
+      if let prototype = cache.prototypes[template.name] {
+        _reusedCount += 1
+        return prototype
+      }
+
+      let entity = FetchRequestTemplates.entities(of: persistentStoreCoordinator).entitiesByName[template.entityName]
+      let prototype = FetchRequestTemplates.buildFetchRequest(template, entity: entity)
+      cache.prototypes[template.name] = prototype
+      _builtCount += 1
+      return prototype
+    }
+  }
+
+  /// Should be called on the queue
+  fileprivate func modelCache(for model: NSManagedObjectModel) -> ModelCache {
+    let key = ObjectIdentifier(model)
+
+    if let cache = caches[key], cache.model === model {
+      return cache
+    }
+
+    caches = caches.filter { $0.value.model != nil }
+
+    let cache = ModelCache(model: model)
+    caches[key] = cache
+    return cache
+  }
+
+  fileprivate class func buildFetchRequest(_ template: FetchRequestTemplate, entity: NSEntityDescription?) -> NSFetchRequest<NSFetchRequestResult> {
+    Logger.logSevere(entity != nil, Logger.Messages.failedToCreateEntityDescription, logDetails: [Logger.Attributes.entity: template.entityName])
+
+    let fetchRequest = NSFetchRequest<NSFetchRequestResult>()
+    fetchRequest.entity = entity
+    fetchRequest.predicate = template.predicate
+    fetchRequest.sortDescriptors = template.sortDescriptors
+    fetchRequest.resultType = template.resultType
+    fetchRequest.propertiesToFetch = template.propertiesToFetch
+    fetchRequest.propertiesToGroupBy = template.propertiesToGroupBy
+    return fetchRequest
+  }
+
+}
@@ -33,12 +33,21 @@ class GlobalConstants {
   static let wormholeOptionalDirectory = "AquazPro-Wormhole"
   static let wormholeMessageFromAquaz = "AquazPro-From App"
   static let wormholeMessageFromWidget = "AquazPro-From Widget"
+  static let wormholeMessageWidgetState = "AquazPro-Widget State"
+  static let wormholeMessageWidgetIntakes = "AquazPro-Widget Intakes"
   
   static let notificationManagedObjectContextWasMerged = "Aquaz-ManagedObjectContextWasMerged"
+  static let notificationInsertedObjectIDsKey = "insertedObjectIDs"
+  static let notificationUpdatedObjectIDsKey = "updatedObjectIDs"
+  static let notificationDeletedObjectIDsKey = "deletedObjectIDs"
+  static let notificationContainsRemoteChangesKey = "containsRemoteChanges"
+  static let notificationCoreDataMigrationProgress = "Aquaz-CoreDataMigrationProgress"
+  static let notificationCoreDataMigrationProgressKey = "progress"
   static let notificationWatchAddIntake = "AquazWatch-AddIntake"
   static let notificationWatchCurrentState = "AquazWatch-CurrentState"
   static let notificationFullVersionIsPurchased = "AquazFullVersionIsPurchased"
   static let notificationFullVersionPurchaseStateDidChange = "AquazFullVersionPurchaseStateDidChange"
+  static let notificationWidgetStateWasPublished = "Aquaz-WidgetStateWasPublished"
 
   static let numberOfIntakesToShowReviewAlert = 15
   
@@ -25,6 +25,118 @@ class Intake: CodingManagedObject, NamedEntity {
   /// What drink was consumed
   @NSManaged var drink: Drink
   
+  /// Unique identifier assigned by the originating device (e.g. Apple Watch), used to drop redelivered intakes
+  @NSManaged var originID: String?
+  
+  /// Identifier stored in metadata of HealthKit samples of the intake. It's nil for intakes created by previous versions.
+  @NSManaged var healthKitID: String?
+  
+  /// Keys of attributes affecting daily summaries (see DailySummary)
+  static let summarizedKeys = ["date", "amount", "drink"]
+  
+  fileprivate struct Constants {
+    static let columnsFetchBatchSize = 1000
+    static let recentOriginIDsCapacity = 512
+  }
+  
+  fileprivate struct Templates {
+    static let datePeriodFormat = "(date >= $beginDate) AND (date < $endDate)"
+    static let sortedByDate = [NSSortDescriptor(key: "date", ascending: true)]
+    
+    static let overallWaterAmount: NSExpressionDescription = {
+      let description = NSExpressionDescription()
+      description.expression = NSExpression(forFunction: "sum:", arguments: [NSExpression(forKeyPath: "amount")])
+      description.expressionResultType = .doubleAttributeType
+      description.name = "overallWaterAmount"
+      return description
+    }()
+    
+    static let intakes = FetchRequestTemplate(
+      entityName: Intake.entityName, name: "intakes",
+      predicateFormat: datePeriodFormat, sortDescriptors: sortedByDate)
+    
+    static let columns = FetchRequestTemplate(
+      entityName: Intake.entityName, name: "columns",
+      predicateFormat: datePeriodFormat, sortDescriptors: sortedByDate,
+      propertiesToFetch: ["date", "amount", "drink.index"], resultType: .dictionaryResultType)
+    
+    static let amountsGroupedByDrinks = FetchRequestTemplate(
+      entityName: Intake.entityName, name: "amountsGroupedByDrinks",
+      predicateFormat: datePeriodFormat,
+      propertiesToFetch: ["drink.index", overallWaterAmount], propertiesToGroupBy: ["drink.index"], resultType: .dictionaryResultType)
+    
+    static let hydrationAmountsGroupedByDrinks = FetchRequestTemplate(
+      entityName: Intake.entityName, name: "hydrationAmountsGroupedByDrinks",
+      predicateFormat: "\(datePeriodFormat) AND (drink.hydrationFactor != 0)",
+      propertiesToFetch: ["drink.index", overallWaterAmount], propertiesToGroupBy: ["drink.index"], resultType: .dictionaryResultType)
+    
+    static let dehydrationAmountsGroupedByDrinks = FetchRequestTemplate(
+      entityName: Intake.entityName, name: "dehydrationAmountsGroupedByDrinks",
+      predicateFormat: "\(datePeriodFormat) AND (drink.dehydrationFactor != 0)",
+      propertiesToFetch: ["drink.index", overallWaterAmount], propertiesToGroupBy: ["drink.index"], resultType: .dictionaryResultType)
+  }
+  
+  /// Origin identifiers of recently added intakes, checked before querying the store
+  fileprivate static let recentOriginIDs = RecentOriginIDs(capacity: Constants.recentOriginIDsCapacity)
+  
+  /// Origin identifiers become recent once their intakes are saved,
+  /// so intakes of a rolled back or failed save are accepted on redelivery
+  fileprivate static let recentOriginIDsObserver: NSObjectProtocol = NotificationCenter.default.addObserver(
+    forName: NSNotification.Name.NSManagedObjectContextDidSave,
+    object: nil,
+    queue: nil) { notification in
+      let insertedObjects = notification.userInfo?[NSInsertedObjectsKey] as? Set<NSManagedObject> ?? []
+      let originIDs = insertedObjects.compactMap { ($0 as? Intake)?.originID }
+      
+      if !originIDs.isEmpty {
+        recentOriginIDs.insert(originIDs)
+      }
+  }
+  
+  /// Packed parallel columns of intakes' attributes.
+  /// Drinks are represented by their indexes, so the relationship is never faulted.
+  struct Columns {
+    /// Dates of intakes as time intervals since the reference date
+    fileprivate(set) var timeIntervals = [TimeInterval]()
+    fileprivate(set) var amounts = [Double]()
+    fileprivate(set) var drinkIndexes = [Int]()
+    
+    var count: Int {
+      return timeIntervals.count
+    }
+    
+    /// Hydration and dehydration amounts of intakes computed via factor tables of drink types
+    var amountPartColumns: AmountPartColumns {
+      let hydrationFactors = DrinkType.hydrationFactors
+      let dehydrationFactors = DrinkType.dehydrationFactors
+      
+      var amountPartColumns = AmountPartColumns()
+      amountPartColumns.timeIntervals = timeIntervals
+      amountPartColumns.hydrations.reserveCapacity(count)
+      amountPartColumns.dehydrations.reserveCapacity(count)
+      
+      for index in 0..<count {
+        let drinkIndex = drinkIndexes[index]
+        amountPartColumns.hydrations.append(amounts[index] * hydrationFactors[drinkIndex])
+        amountPartColumns.dehydrations.append(amounts[index] * dehydrationFactors[drinkIndex])
+      }
+      
+      return amountPartColumns
+    }
+  }
+  
+  /// Packed parallel columns of hydration and dehydration amounts ordered by date
+  struct AmountPartColumns {
+    /// Dates as time intervals since the reference date
+    var timeIntervals = [TimeInterval]()
+    var hydrations = [Double]()
+    var dehydrations = [Double]()
+    
+    var count: Int {
+      return timeIntervals.count
+    }
+  }
+  
   /// Water balance of the intake based on hydration and dehydration factors of the corresponding drink
   var waterBalance: Double {
     return amount * (drink.drinkType.hydrationFactor - drink.drinkType.dehydrationFactor)
@@ -51,6 +163,7 @@ class Intake: CodingManagedObject, NamedEntity {
       intake.amount = amount
       intake.drink = drink
       intake.date = date
+      intake.healthKitID = UUID().uuidString
 
       if saveImmediately {
         CoreDataStack.saveContext(managedObjectContext)
@@ -62,6 +175,180 @@ class Intake: CodingManagedObject, NamedEntity {
     return nil
   }
 
+  /// Values of an intake to be added by addEntities
+  struct Draft {
+    let drinkType: DrinkType
+    let amount: Double
+    let date: Date
+    /// Unique identifier of the intake assigned by the originating device, nil for intakes from older clients
+    let originID: String?
+    
+    init(drinkType: DrinkType, amount: Double, date: Date, originID: String? = nil) {
+      self.drinkType = drinkType
+      self.amount = amount
+      self.date = date
+      self.originID = originID
+    }
+  }
+  
+  /// Result of adding of a particular draft by addEntities
+  enum IngestionResult {
+    /// The intake is added
+    case added(Intake)
+    /// The intake with the same origin identifier (or, if there is no identifier, with the same date, drink and amount)
+    /// is already stored or occurs earlier in the batch
+    case duplicate
+    /// The draft has a non-positive amount or its drink is not found
+    case invalid
+  }
+  
+  fileprivate struct IngestionKey: Hashable {
+    let timeInterval: TimeInterval
+    let drinkIndex: Int
+    let amount: Double
+  }
+  
+  /// Adds a batch of intakes into Core Data.
+  /// Drafts having origin identifiers are deduplicated by the identifiers: recently seen identifiers are checked in memory,
+  /// other ones are looked up in the store by a single indexed fetch. Drafts without identifiers are deduplicated
+  /// by date, drink and amount using a single fetch. The whole batch is committed by a single save,
+  /// so observers receive one aggregated did-save notification. Results are returned in order of the drafts.
+  class func addEntities(_ drafts: [Draft], managedObjectContext: NSManagedObjectContext, saveImmediately: Bool = true) -> [IngestionResult] {
+    if drafts.isEmpty {
+      return []
+    }
+    
+    _ = recentOriginIDsObserver
+    
+    let drinks = Drink.fetchAllDrinksTyped(managedObjectContext: managedObjectContext)
+    var knownOriginIDs = knownOriginIDsOfDrafts(drafts, managedObjectContext: managedObjectContext)
+    var knownKeys = fetchIngestionKeys(dates: drafts.filter { $0.originID == nil }.map { $0.date }, managedObjectContext: managedObjectContext)
+    var results = [IngestionResult]()
+    results.reserveCapacity(drafts.count)
+    
+    for draft in drafts {
+      guard draft.amount > 0 && draft.amount.isFinite, let drink = drinks[draft.drinkType] else {
+        Logger.logError("Invalid intake is ignored", logDetails: [Logger.Attributes.drinkIndex: "\(draft.drinkType.rawValue)", Logger.Attributes.date: draft.date.description])
+        results.append(.invalid)
+        continue
+      }
+      
+      if let originID = draft.originID {
+        if knownOriginIDs.contains(originID) {
+          Logger.logWarning("Duplicate intake has been observed. The intake is ignored.", logDetails: [Logger.Attributes.date: draft.date.description])
+          results.append(.duplicate)
+          continue
+        }
+        
+        knownOriginIDs.insert(originID)
+      } else {
+        let key = IngestionKey(timeInterval: draft.date.timeIntervalSinceReferenceDate, drinkIndex: draft.drinkType.rawValue, amount: draft.amount)
+        
+        if knownKeys.contains(key) {
+          Logger.logWarning("Duplicate intake has been observed. The intake is ignored.", logDetails: [Logger.Attributes.date: draft.date.description])
+          results.append(.duplicate)
+          continue
+        }
+        
+        knownKeys.insert(key)
+      }
+      
+      if let intake = addEntity(drink: drink, amount: draft.amount, date: draft.date, managedObjectContext: managedObjectContext, saveImmediately: false) {
+        if let originID = draft.originID {
+          intake.originID = originID
+        }
+        
+        results.append(.added(intake))
+      } else {
+        results.append(.invalid)
+      }
+    }
+    
+    if saveImmediately {
+      CoreDataStack.saveContext(managedObjectContext)
+    }
+    
+    return results
+  }
+  
+  /// Returns origin identifiers of the drafts which are already known: recently saved ones, ones found in the store
+  /// and ones of intakes inserted into the context but not saved yet
+  fileprivate class func knownOriginIDsOfDrafts(_ drafts: [Draft], managedObjectContext: NSManagedObjectContext) -> Set<String> {
+    let originIDs = drafts.compactMap { $0.originID }
+    
+    if originIDs.isEmpty {
+      return []
+    }
+    
+    let insertedOriginIDs = Set(managedObjectContext.insertedObjects.compactMap { ($0 as? Intake)?.originID })
+    let (seenOriginIDs, unseenOriginIDs) = recentOriginIDs.partition(originIDs.filter { !insertedOriginIDs.contains($0) })
+    
+    if unseenOriginIDs.isEmpty {
+      return seenOriginIDs.union(insertedOriginIDs)
+    }
+    
+    let storedOriginIDs = fetchOriginIDs(unseenOriginIDs, managedObjectContext: managedObjectContext)
+    recentOriginIDs.insert(Array(storedOriginIDs))
+    
+    return seenOriginIDs.union(storedOriginIDs).union(insertedOriginIDs)
+  }
+  
+  /// Fetches the passed origin identifiers which are stored. The lookup uses the index of the originID attribute.
+  class func fetchOriginIDs(_ originIDs: [String], managedObjectContext: NSManagedObjectContext) -> Set<String> {
+    let fetchRequest = NSFetchRequest<NSDictionary>()
+    fetchRequest.entity = Intake.entityDescription(inManagedObjectContext: managedObjectContext)
+    fetchRequest.predicate = NSPredicate(format: "originID IN %@", argumentArray: [originIDs])
+    fetchRequest.propertiesToFetch = ["originID"]
+    fetchRequest.resultType = .dictionaryResultType
+    
+    var storedOriginIDs = Set<String>()
+    
+    do {
+      for record in try managedObjectContext.fetch(fetchRequest) {
+        if let originID = record["originID"] as? String {
+          storedOriginIDs.insert(originID)
+        }
+      }
+    } catch let error as NSError {
+      Logger.logError(Logger.Messages.failedToExecuteFetchRequest, error: error)
+    }
+    
+    return storedOriginIDs
+  }
+  
+  /// Fetches keys of stored intakes having the passed dates. Dictionary result type is used to avoid materializing intakes.
+  /// Intakes are fetched by the range of the dates, because a list of thousands of dates (e.g. on pre-population)
+  /// would exceed the limit of bound variables of SQLite.
+  fileprivate class func fetchIngestionKeys(dates: [Date], managedObjectContext: NSManagedObjectContext) -> Set<IngestionKey> {
+    guard let minDate = dates.min(), let maxDate = dates.max() else {
+      return []
+    }
+    
+    let timeIntervals = Set(dates.map { $0.timeIntervalSinceReferenceDate })
+    
+    let fetchRequest = NSFetchRequest<NSDictionary>()
+    fetchRequest.entity = Intake.entityDescription(inManagedObjectContext: managedObjectContext)
+    fetchRequest.predicate = NSPredicate(format: "(date >= %@) AND (date <= %@)", argumentArray: [minDate, maxDate])
+    fetchRequest.propertiesToFetch = ["date", "amount", "drink.index"]
+    fetchRequest.resultType = .dictionaryResultType
+    
+    var keys = Set<IngestionKey>()
+    
+    do {
+      for record in try managedObjectContext.fetch(fetchRequest) {
+        if let date = record["date"] as? Date, let amount = record["amount"] as? Double, let drinkIndex = record["drink.index"] as? NSNumber,
+           timeIntervals.contains(date.timeIntervalSinceReferenceDate)
+        {
+          keys.insert(IngestionKey(timeInterval: date.timeIntervalSinceReferenceDate, drinkIndex: drinkIndex.intValue, amount: amount))
+        }
+      }
+    } catch let error as NSError {
+      Logger.logError(Logger.Messages.failedToExecuteFetchRequest, error: error)
+    }
+    
+    return keys
+  }
+
   /// Deletes the intake from Core Data
   func deleteEntity(saveImmediately: Bool = true) {
     if let managedObjectContext = managedObjectContext {
@@ -77,26 +364,79 @@ class Intake: CodingManagedObject, NamedEntity {
   
   /// Fetches all intakes for the specified date interval (beginDate..<endDate)
   class func fetchIntakes(beginDate: Date?, endDate: Date?, managedObjectContext: NSManagedObjectContext) -> [Intake] {
-    var predicate: NSPredicate?
+    return fetchManagedObjects(
+      template: Templates.intakes,
+      substitutionVariables: FetchRequestTemplate.dateRangeVariables(beginDate: beginDate, endDate: endDate),
+      managedObjectContext: managedObjectContext)
+  }
+
+  /// Fetches a page of intakes sorted by date starting from the specified date, intakes with passed identifiers are skipped.
+  /// Drinks are prefetched, so intakes of a page are ready for reading without further round trips to the store.
+  class func fetchIntakesPage(fromDate: Date?, excludingObjectIDs: Set<NSManagedObjectID>, limit: Int, managedObjectContext: NSManagedObjectContext) -> [Intake] {
+    let fetchRequest = createFetchRequest()
+    fetchRequest.entity = entityDescription(inManagedObjectContext: managedObjectContext)
+    fetchRequest.sortDescriptors = Templates.sortedByDate
+    fetchRequest.fetchLimit = limit
+    fetchRequest.fetchBatchSize = limit
+    fetchRequest.returnsObjectsAsFaults = false
+    fetchRequest.relationshipKeyPathsForPrefetching = ["drink"]
     
-    if let beginDate = beginDate, let endDate = endDate {
-      predicate = NSPredicate(format: "(date >= %@) AND (date < %@)", argumentArray: [beginDate, endDate])
-    } else if let beginDate = beginDate {
-      predicate = NSPredicate(format: "date >= %@", argumentArray: [beginDate])
-    } else if let endDate = endDate {
-      predicate = NSPredicate(format: "date < %@", argumentArray: [endDate])
+    if let fromDate = fromDate {
+      fetchRequest.predicate = excludingObjectIDs.isEmpty ?
+        NSPredicate(format: "date >= %@", fromDate as NSDate) :
+        NSPredicate(format: "date >= %@ AND NOT (self IN %@)", fromDate as NSDate, excludingObjectIDs)
     }
     
-    let descriptor = NSSortDescriptor(key: "date", ascending: true)
-    return fetchManagedObjects(managedObjectContext: managedObjectContext, predicate: predicate, sortDescriptors: [descriptor])
+    do {
+      return try managedObjectContext.fetch(fetchRequest)
+    } catch let error as NSError {
+      Logger.logError(Logger.Messages.failedToExecuteFetchRequest, error: error)
+      return []
+    }
   }
 
-  /// Fetches an intake for specified date, drinkType and amount.
-  /// Used in ConnectivityProvider to prevent double intakes coming from Apple Watch by unknown reason.
-  class func fetchParticularIntake(date: Date, drinkType: DrinkType, amount: Double, managedObjectContext: NSManagedObjectContext) -> Intake? {
-    let predicate = NSPredicate(format: "(date == %@) AND (drink.index == %@) AND (amount == %@)", argumentArray: [date, drinkType.rawValue, amount])
+  /// Fetches attributes of intakes for the specified date interval (beginDate..<endDate) sorted by date.
+  /// Dictionary result type is used, so neither intakes nor their drinks are materialized.
+  class func fetchColumns(beginDate: Date?, endDate: Date?, sorted: Bool = true, managedObjectContext: NSManagedObjectContext) -> Columns {
+    let fetchRequest: NSFetchRequest<NSDictionary> = Templates.columns.fetchRequest(
+      substitutionVariables: FetchRequestTemplate.dateRangeVariables(beginDate: beginDate, endDate: endDate),
+      managedObjectContext: managedObjectContext)
+    fetchRequest.fetchBatchSize = Constants.columnsFetchBatchSize
+    
+    if !sorted {
+      fetchRequest.sortDescriptors = nil
+    }
+    
+    var columns = Columns()
+    
+    do {
+      let records = try managedObjectContext.fetch(fetchRequest)
+      columns.timeIntervals.reserveCapacity(records.count)
+      columns.amounts.reserveCapacity(records.count)
+      columns.drinkIndexes.reserveCapacity(records.count)
+      
+      for record in records {
+        guard let date = record["date"] as? Date,
+              let amount = record["amount"] as? Double,
+              let drinkIndex = (record["drink.index"] as? NSNumber)?.intValue else
+        {
+          continue
+        }
+        
+        if drinkIndex < 0 || drinkIndex >= DrinkType.count {
+          Logger.logDrinkIsNotFound(drinkIndex: drinkIndex)
+          continue
+        }
+        
+        columns.timeIntervals.append(date.timeIntervalSinceReferenceDate)
+        columns.amounts.append(amount)
+        columns.drinkIndexes.append(drinkIndex)
+      }
+    } catch let error as NSError {
+      Logger.logError(Logger.Messages.failedToExecuteFetchRequest, error: error)
+    }
     
-    return fetchManagedObject(managedObjectContext: managedObjectContext, predicate: predicate)
+    return columns
   }
 
   /// Fetches all intakes for a day taken from the specified date.
@@ -110,127 +450,114 @@ class Intake: CodingManagedObject, NamedEntity {
 
   /// Fetches overall hydration amounts of intakes grouped by drinks for passed date
   class func fetchHydrationAmountsGroupedByDrinksForDay(_ date: Date, dayOffsetInHours: Int, managedObjectContext: NSManagedObjectContext) -> [DrinkType: Double] {
-    let beginDate = DateHelper.dateBySettingHour(dayOffsetInHours, minute: 0, second: 0, ofDate: date)
-    let endDate = DateHelper.nextDayFrom(beginDate)
-    let predicate = NSPredicate(format: "(date >= %@) AND (date < %@)", argumentArray: [beginDate, endDate])
-    
-    let expression = NSExpression(forFunction: "sum:", arguments: [NSExpression(forKeyPath: "amount")])
-    
-    let overallWaterAmount = NSExpressionDescription()
-    overallWaterAmount.expression = expression
-    overallWaterAmount.expressionResultType = .doubleAttributeType
-    overallWaterAmount.name = "overallWaterAmount"
-    
-    let fetchRequest = NSFetchRequest<NSDictionary>()
-    fetchRequest.entity = Intake.entityDescription(inManagedObjectContext: managedObjectContext)
-    fetchRequest.predicate = predicate
-    fetchRequest.propertiesToFetch = ["drink.index", overallWaterAmount]
-    fetchRequest.propertiesToGroupBy = ["drink.index"]
-    fetchRequest.resultType = .dictionaryResultType
-    
-    do {
-      let fetchResults = try managedObjectContext.fetch(fetchRequest)
+    if let summaries = fetchDailySummariesForDay(date, dayOffsetInHours: dayOffsetInHours, managedObjectContext: managedObjectContext) {
       var result = [DrinkType: Double]()
       
-      for record in fetchResults {
-        let drinkIndex = record["drink.index"] as! NSNumber
-        let drinkType = DrinkType(rawValue: drinkIndex.intValue)!
-        let amount = (record[overallWaterAmount.name] as! Double) * drinkType.hydrationFactor
-        result[drinkType] = amount
+      for summary in summaries {
+        if let drinkType = summary.drinkType {
+          result[drinkType] = summary.hydration
+        }
       }
+      
       return result
-    } catch let error as NSError {
-      Logger.logError(Logger.Messages.failedToExecuteFetchRequest, error: error)
+    }
+    
+    let beginDate = DateHelper.dateBySettingHour(dayOffsetInHours, minute: 0, second: 0, ofDate: date)
+    let endDate = DateHelper.nextDayFrom(beginDate)
+    guard let fetchResults = fetchAmountsGroupedByDrinks(template: Templates.amountsGroupedByDrinks, beginDate: beginDate, endDate: endDate, managedObjectContext: managedObjectContext) else {
       return [:]
     }
+    
+    var result = [DrinkType: Double]()
+    
+    for (drinkType, amount) in fetchResults {
+      result[drinkType] = amount * drinkType.hydrationFactor
+    }
+    
+    return result
   }
 
   /// Fetches total dehydration amount based on intakes of a passed day
   class func fetchTotalDehydrationAmountForDay(_ date: Date, dayOffsetInHours: Int, managedObjectContext: NSManagedObjectContext) -> Double {
+    if let summaries = fetchDailySummariesForDay(date, dayOffsetInHours: dayOffsetInHours, managedObjectContext: managedObjectContext) {
+      return summaries.reduce(0) { $0 + $1.dehydration }
+    }
+    
     let beginDate = DateHelper.dateBySettingHour(dayOffsetInHours, minute: 0, second: 0, ofDate: date)
     let endDate = DateHelper.nextDayFrom(beginDate)
-    let predicate = NSPredicate(format: "(date >= %@) AND (date < %@) AND (drink.dehydrationFactor != 0)", argumentArray: [beginDate, endDate])
-    
-    let expression = NSExpression(forFunction: "sum:", arguments: [NSExpression(forKeyPath: "amount")])
+    guard let fetchResults = fetchAmountsGroupedByDrinks(template: Templates.dehydrationAmountsGroupedByDrinks, beginDate: beginDate, endDate: endDate, managedObjectContext: managedObjectContext) else {
+      return 0
+    }
     
-    let overallWaterAmount = NSExpressionDescription()
-    overallWaterAmount.expression = expression
-    overallWaterAmount.expressionResultType = .doubleAttributeType
-    overallWaterAmount.name = "overallWaterAmount"
+    var totalDehydration: Double = 0
     
-    let fetchRequest = NSFetchRequest<NSDictionary>()
-    fetchRequest.entity = Intake.entityDescription(inManagedObjectContext: managedObjectContext)
-    fetchRequest.predicate = predicate
-    fetchRequest.propertiesToFetch = ["drink.index", overallWaterAmount]
-    fetchRequest.propertiesToGroupBy = ["drink.index"]
-    fetchRequest.resultType = .dictionaryResultType
-    
-    do {
-      let fetchResults = try managedObjectContext.fetch(fetchRequest)
-      var totalDehydration: Double = 0
-      
-      for record in fetchResults {
-        let drinkIndex = record["drink.index"] as! NSNumber
-        let drinkType = DrinkType(rawValue: drinkIndex.intValue)!
-        let dehydration = (record[overallWaterAmount.name] as! Double) * drinkType.dehydrationFactor
-        totalDehydration += dehydration
-      }
-      
-      return totalDehydration
-    } catch let error as NSError {
-      Logger.logError(Logger.Messages.failedToExecuteFetchRequest, error: error)
-      return 0
+    for (drinkType, amount) in fetchResults {
+      totalDehydration += amount * drinkType.dehydrationFactor
     }
+    
+    return totalDehydration
   }
   
   /// Fetches total hydration amount based on intakes of a passed day
   class func fetchTotalHydrationAmountForDay(_ date: Date, dayOffsetInHours: Int, managedObjectContext: NSManagedObjectContext) -> Double {
+    if let summaries = fetchDailySummariesForDay(date, dayOffsetInHours: dayOffsetInHours, managedObjectContext: managedObjectContext) {
+      return summaries.reduce(0) { $0 + $1.hydration }
+    }
+    
     let beginDate = DateHelper.dateBySettingHour(dayOffsetInHours, minute: 0, second: 0, ofDate: date)
     let endDate = DateHelper.nextDayFrom(beginDate)
-    let predicate = NSPredicate(format: "(date >= %@) AND (date < %@) AND (drink.hydrationFactor != 0)", argumentArray: [beginDate, endDate])
+    guard let fetchResults = fetchAmountsGroupedByDrinks(template: Templates.hydrationAmountsGroupedByDrinks, beginDate: beginDate, endDate: endDate, managedObjectContext: managedObjectContext) else {
+      return 0
+    }
     
-    let expression = NSExpression(forFunction: "sum:", arguments: [NSExpression(forKeyPath: "amount")])
+    var totalHydration: Double = 0
     
-    let overallWaterAmount = NSExpressionDescription()
-    overallWaterAmount.expression = expression
-    overallWaterAmount.expressionResultType = .doubleAttributeType
-    overallWaterAmount.name = "overallWaterAmount"
+    for (drinkType, amount) in fetchResults {
+      totalHydration += amount * drinkType.hydrationFactor
+    }
     
-    let fetchRequest = NSFetchRequest<NSDictionary>()
-    fetchRequest.entity = Intake.entityDescription(inManagedObjectContext: managedObjectContext)
-    fetchRequest.predicate = predicate
-    fetchRequest.propertiesToFetch = ["drink.index", overallWaterAmount]
-    fetchRequest.propertiesToGroupBy = ["drink.index"]
-    fetchRequest.resultType = .dictionaryResultType
+    return totalHydration
+  }
+  
+  /// Fetches daily summaries for a passed day.
+  /// Daily summaries are aggregated by calendar days, so nil is returned for a non-zero day offset.
+  fileprivate class func fetchDailySummariesForDay(_ date: Date, dayOffsetInHours: Int, managedObjectContext: NSManagedObjectContext) -> [DailySummary]? {
+    if dayOffsetInHours != 0 {
+      return nil
+    }
+    
+    let beginDate = DateHelper.startOfDay(date)
+    let endDate = DateHelper.nextDayFrom(beginDate)
+    return DailySummary.fetchDailySummaries(beginDate: beginDate, endDate: endDate, managedObjectContext: managedObjectContext)
+  }
+  
+  /// Fetches overall amounts of intakes of the date period (beginDate..<endDate) matching to the template grouped by drinks.
+  /// Used for days with a non-zero offset which are not covered by daily summaries.
+  fileprivate class func fetchAmountsGroupedByDrinks(template: FetchRequestTemplate, beginDate: Date, endDate: Date, managedObjectContext: NSManagedObjectContext) -> [DrinkType: Double]? {
+    let fetchRequest: NSFetchRequest<NSDictionary> = template.fetchRequest(
+      substitutionVariables: FetchRequestTemplate.dateRangeVariables(beginDate: beginDate, endDate: endDate),
+      managedObjectContext: managedObjectContext)
     
     do {
       let fetchResults = try managedObjectContext.fetch(fetchRequest)
-      var totalHydration: Double = 0
+      var result = [DrinkType: Double]()
       
       for record in fetchResults {
         let drinkIndex = record["drink.index"] as! NSNumber
         let drinkType = DrinkType(rawValue: drinkIndex.intValue)!
-        let hydration = (record[overallWaterAmount.name] as! Double) * drinkType.hydrationFactor
-        totalHydration += hydration
+        result[drinkType] = record[Templates.overallWaterAmount.name] as? Double
       }
       
-      return totalHydration
+      return result
     } catch let error as NSError {
       Logger.logError(Logger.Messages.failedToExecuteFetchRequest, error: error)
-      return 0
+      return nil
     }
   }
   
   enum GroupingCalendarUnit {
     case day
     case month
-    
-    func getCalendarComponent() -> Calendar.Component {
-      switch self {
-      case .day  : return .day
-      case .month: return .month
-      }
-    }
   }
   
   enum AggregateFunction {
@@ -258,64 +585,146 @@ class Intake: CodingManagedObject, NamedEntity {
       return []
     }
     
-    let intakes = fetchIntakes(beginDate: beginDate, endDate: endDate, managedObjectContext: managedObjectContext)
-
     // It's just an optimization. An algorithm below already groups intakes by days, so calculating the average is useless
     let aggregateFunction: AggregateFunction = (groupingUnit == .day) ? .summary : aggregateFunctionRaw
     
-    let deltaMonths = groupingUnit == .month ? 1 : 0
-    let deltaDays   = groupingUnit == .day   ? 1 : 0
-    
-    let calendarComponent = groupingUnit.getCalendarComponent()
-    let calendar = Calendar.current
-    
-    var groupedAmountParts: [(hydration: Double, dehydration: Double)] = []
-    var nextDate: Date!
-    var intakeIndex = 0
-    var daysInCalendarUnit = 0
+    // Grouping works in integer day space, boundaries of units are taken from precomputed tables of DayIndex
+    let dayIndex = DayIndex.current(covering: beginDate, endDate)
+    let beginDay = dayIndex.day(of: beginDate)
     
-    var nextDateComponents = calendar.dateComponents([.year, .month, .day], from: beginDate)
+    var unitDayRanges = [Range<Int>]()
+    var unitBeginDay = beginDay
     
     while true {
-      if aggregateFunction == .average {
-        let currentDate = nextDate ?? beginDate
-        daysInCalendarUnit = Calendar.current.range(of: .day, in: calendarComponent, for: currentDate)!.count
+      let nextDay: Int
+      
+      switch groupingUnit {
+      case .day  : nextDay = beginDay + unitDayRanges.count + 1
+      case .month: nextDay = dayIndex.day(beginDay, addingMonths: unitDayRanges.count + 1)
       }
-
-      nextDateComponents.month = nextDateComponents.month! + deltaMonths
-      nextDateComponents.day = nextDateComponents.day! + deltaDays
-      nextDate = calendar.date(from: nextDateComponents)
       
-      if nextDate.isLaterThan(endDate) {
+      if dayIndex.startOfDay(nextDay).isLaterThan(endDate) {
         break
       }
-
-      var hydrationAmountForUnit: Double = 0
-      var dehydrationAmountForUnit: Double = 0
-
-      while intakeIndex < intakes.count {
-        let intake = intakes[intakeIndex]
+      
+      unitDayRanges.append(unitBeginDay..<nextDay)
+      unitBeginDay = nextDay
+    }
+    
+    var groupedAmountParts: [(hydration: Double, dehydration: Double)]
+    
+    if dayOffsetInHours == 0, let amountsIndex = DailyAmountsIndex.index(for: managedObjectContext) {
+      // Calendar days are covered by the prefix-sum index, so each unit is a single range query
+      groupedAmountParts = amountsIndex.totals(dayRanges: unitDayRanges, managedObjectContext: managedObjectContext).map {
+        (hydration: $0.hydration, dehydration: $0.dehydration)
+      }
+    } else {
+      // Intakes are fetched as packed columns for days with a non-zero offset, so no managed objects are materialized
+      let amountParts: AmountPartColumns
+      
+      if dayOffsetInHours == 0 {
+        amountParts = DailySummary.fetchAmountPartColumns(beginDate: beginDate, endDate: endDate, managedObjectContext: managedObjectContext)
+      } else {
+        amountParts = fetchColumns(beginDate: beginDate, endDate: endDate, managedObjectContext: managedObjectContext).amountPartColumns
+      }
+      
+      groupedAmountParts = []
+      var amountPartIndex = 0
+      
+      for unitDayRange in unitDayRanges {
+        var hydrationAmountForUnit: Double = 0
+        var dehydrationAmountForUnit: Double = 0
+        
+        let nextTimeInterval = dayIndex.startOfDay(unitDayRange.upperBound).timeIntervalSinceReferenceDate
         
-        if !intake.date.isEarlierThan(nextDate) {
-          break
+        while amountPartIndex < amountParts.count {
+          if amountParts.timeIntervals[amountPartIndex] >= nextTimeInterval {
+            break
+          }
+          
+          hydrationAmountForUnit += amountParts.hydrations[amountPartIndex]
+          dehydrationAmountForUnit += amountParts.dehydrations[amountPartIndex]
+          
+          amountPartIndex += 1
         }
-
-        hydrationAmountForUnit += intake.hydrationAmount
-        dehydrationAmountForUnit += intake.dehydrationAmount
         
-        intakeIndex += 1
+        groupedAmountParts.append((hydration: hydrationAmountForUnit, dehydration: dehydrationAmountForUnit))
+      }
+    }
+    
+    if aggregateFunction == .average {
+      for (index, unitDayRange) in unitDayRanges.enumerated() {
+        let daysInCalendarUnit = Double(dayIndex.daysInMonth(dayIndex.month(ofDay: unitDayRange.lowerBound)))
+        groupedAmountParts[index].hydration /= daysInCalendarUnit
+        groupedAmountParts[index].dehydration /= daysInCalendarUnit
       }
+    }
+    
+    return groupedAmountParts
+  }
+  
+}
+
+
+// MARK: RecentOriginIDs
+
+/// Bounded set of recently seen origin identifiers. The oldest identifiers are evicted when the capacity is exceeded.
+/// It's thread-safe, because intakes are added on queues of different managed object contexts.
+fileprivate final class RecentOriginIDs {
+  
+  fileprivate let capacity: Int
+  
+  fileprivate let queue = DispatchQueue(label: "\(GlobalConstants.bundleId).Intake.RecentOriginIDs", attributes: [])
+  
+  fileprivate var members = Set<String>()
+  
+  /// Ring buffer of members in order of insertion
+  fileprivate var order = [String]()
+  
+  fileprivate var oldestIndex = 0
+  
+  init(capacity: Int) {
+    self.capacity = capacity
+    members.reserveCapacity(capacity)
+    order.reserveCapacity(capacity)
+  }
+  
+  /// Splits the identifiers into seen and unseen ones
+  func partition(_ originIDs: [String]) -> (seen: Set<String>, unseen: [String]) {
+    return queue.sync {
+      var seen = Set<String>()
+      var unseen = [String]()
       
-      if aggregateFunction == .average {
-        hydrationAmountForUnit /= Double(daysInCalendarUnit)
-        dehydrationAmountForUnit /= Double(daysInCalendarUnit)
+      for originID in originIDs {
+        if members.contains(originID) {
+          seen.insert(originID)
+        } else {
+          unseen.append(originID)
+        }
       }
       
-      let amountPartsItem = (hydration: hydrationAmountForUnit, dehydration: dehydrationAmountForUnit)
-      groupedAmountParts.append(amountPartsItem)
+      return (seen, unseen)
+    }
+  }
+  
+  func insert(_ originIDs: [String]) {
+    if originIDs.isEmpty {
+      return
     }
     
-    return groupedAmountParts
+    queue.sync {
+      for originID in originIDs where !members.contains(originID) {
+        members.insert(originID)
+        
+        if order.count < capacity {
+          order.append(originID)
+        } else {
+          members.remove(order[oldestIndex])
+          order[oldestIndex] = originID
+          oldestIndex = (oldestIndex + 1) % capacity
+        }
+      }
+    }
   }
   
 }
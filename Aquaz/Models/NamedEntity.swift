@@ -29,7 +29,7 @@ extension NamedEntity {
   }
   
   static func entityDescription(inManagedObjectContext managedObjectContext: NSManagedObjectContext) -> NSEntityDescription? {
-    let entityDescription = NSEntityDescription.entity(forEntityName: entityName, in: managedObjectContext)
+    let entityDescription = FetchRequestTemplates.sharedInstance.entity(named: entityName, managedObjectContext: managedObjectContext)
     Logger.logSevere(entityDescription != nil, Logger.Messages.failedToCreateEntityDescription, logDetails: [Logger.Attributes.entity: entityName])
     return entityDescription
   }
@@ -50,6 +50,24 @@ extension NamedEntity {
     }
   }
   
+  /// Fetches managed objects from Core Data using a prepared template with bound substitution variables
+  static func fetchManagedObjects(template: FetchRequestTemplate, substitutionVariables: [String: Any] = [:], managedObjectContext: NSManagedObjectContext, fetchLimit: Int? = nil) -> [EntityType] {
+    let fetchRequest: NSFetchRequest<EntityType> = template.fetchRequest(substitutionVariables: substitutionVariables, managedObjectContext: managedObjectContext)
+    fetchRequest.fetchLimit = fetchLimit ?? 0
+    
+    do {
+      return try managedObjectContext.fetch(fetchRequest)
+    } catch let error as NSError {
+      Logger.logError(Logger.Messages.failedToExecuteFetchRequest, error: error)
+      return []
+    }
+  }
+  
+  /// Fetches a managed object from Core Data using a prepared template with bound substitution variables
+  static func fetchManagedObject(template: FetchRequestTemplate, substitutionVariables: [String: Any] = [:], managedObjectContext: NSManagedObjectContext) -> EntityType? {
+    return fetchManagedObjects(template: template, substitutionVariables: substitutionVariables, managedObjectContext: managedObjectContext, fetchLimit: 1).first
+  }
+  
   /// Fetches a managed object from Core Data taking into account specified predicate and sort descriptors
   static func fetchManagedObject(managedObjectContext: NSManagedObjectContext, predicate: NSPredicate? = nil, sortDescriptors: [NSSortDescriptor]? = nil) -> EntityType? {
     let entities = fetchManagedObjects(managedObjectContext: managedObjectContext, predicate: predicate, sortDescriptors: sortDescriptors, fetchLimit: 1)
@@ -40,6 +40,10 @@ class WaterGoal: CodingManagedObject, NamedEntity {
     return isHighActivity ? Settings.sharedInstance.generalHighActivityExtraFactor.value : 0
   }
 
+  fileprivate struct Templates {
+    static let waterGoalForDate = FetchRequestTemplate(entityName: WaterGoal.entityName, name: "waterGoalForDate", predicateFormat: "date = $date")
+  }
+
   /// Adds a new water goal entity into Core Data. If a water goal with passed date is already exist, it will be returned as a result.
   class func addEntity(date: Date, baseAmount: Double, isHotDay: Bool, isHighActivity: Bool, managedObjectContext: NSManagedObjectContext, saveImmediately: Bool = true) -> WaterGoal {
     if let waterGoal = self.fetchWaterGoalStrictlyForDate(date, managedObjectContext: managedObjectContext) {
@@ -82,17 +86,10 @@ class WaterGoal: CodingManagedObject, NamedEntity {
   /// Stage 1: The function looks for a water goal's entity with a date equals to the specified date.
   /// Stage 2: The function looks for a water goal's entity with a date earlier than the specified date.
   /// Stage 3: The function looks for a water goal's entity with a date later than the specified date.
+  /// Stages are resolved by binary search in WaterGoalTimeline, only the found entity is faulted.
   class func fetchWaterGoalForDate(_ date: Date, managedObjectContext: NSManagedObjectContext) -> WaterGoal? {
-    if let waterGoal = fetchWaterGoalStrictlyForDate(date, managedObjectContext: managedObjectContext) {
-      return waterGoal
-    }
-    
-    if let waterGoal = fetchNearestWaterGoalForDateEarlierThanDate(date, managedObjectContext: managedObjectContext) {
-      return waterGoal
-    }
-    
-    if let waterGoal = fetchNearestWaterGoalForDateLaterThanDate(date, managedObjectContext: managedObjectContext) {
-      return waterGoal
+    if let entry = WaterGoalTimeline.timeline(for: managedObjectContext)?.entry(forDate: date, managedObjectContext: managedObjectContext) {
+      return managedObjectContext.object(with: entry.objectID) as? WaterGoal
     }
     
     Logger.logError("Failed to fetch water goal", logDetails: [Logger.Attributes.date: date.description])
@@ -104,30 +101,15 @@ class WaterGoal: CodingManagedObject, NamedEntity {
   /// Note: If there is no water goal's entity exist for an intermediate date,
   /// only base amount of fitting water goal's entity will be used.
   /// High activity and hot day factors will be skipped in such a case.
-  class func fetchWaterGoalAmounts(beginDate beginDateRaw: Date, endDate endDateRaw: Date, managedObjectContext: NSManagedObjectContext) -> [Double] {
-    let beginDate = DateHelper.startOfDay(beginDateRaw)
-    let endDate = DateHelper.startOfDay(endDateRaw)
-
-    let waterGoals = fetchWaterGoalsForDateInterval(beginDate: beginDate, endDate: endDate, managedObjectContext: managedObjectContext)
-    var earlierWaterGoal = fetchNearestWaterGoalForDateEarlierThanDate(beginDate, managedObjectContext: managedObjectContext)
-    var laterWaterGoal = fetchNearestWaterGoalForDateLaterThanDate(endDate, managedObjectContext: managedObjectContext)
+  class func fetchWaterGoalAmounts(beginDate: Date, endDate: Date, managedObjectContext: NSManagedObjectContext) -> [Double] {
+    guard let timeline = WaterGoalTimeline.timeline(for: managedObjectContext) else {
+      return []
+    }
     
     var waterGoalAmounts: [Double] = []
-    var waterGoalIndex = 0
-    
-    var currentDay = beginDate
     
-    while currentDay.isEarlierThan(endDate) {
-      let waterGoalAmount = findWaterGoalForDate(currentDay,
-        waterGoals: waterGoals,
-        managedObjectContext: managedObjectContext,
-        waterGoalIndex: &waterGoalIndex,
-        earlierWaterGoal: &earlierWaterGoal,
-        laterWaterGoal: &laterWaterGoal)
-      
-      waterGoalAmounts.append(waterGoalAmount)
-      
-      currentDay = DateHelper.nextDayFrom(currentDay)
+    for span in timeline.spans(beginDate: beginDate, endDate: endDate, managedObjectContext: managedObjectContext) {
+      waterGoalAmounts += repeatElement(span.amount, count: span.daysCount)
     }
     
     return waterGoalAmounts
@@ -138,59 +120,34 @@ class WaterGoal: CodingManagedObject, NamedEntity {
   /// Note: If there is no water goal's entity exist for an intermediate date,
   /// only base amount of fitting water goal's entity will be used.
   /// High activity and hot day factors will be skipped in such a case.
-  class func fetchWaterGoalAmountsGroupedByMonths(beginDate beginDateRaw: Date, endDate endDateRaw: Date, managedObjectContext: NSManagedObjectContext) -> [Double] {
-    let beginDate = DateHelper.startOfDay(beginDateRaw)
-    let endDate = DateHelper.startOfDay(endDateRaw)
+  class func fetchWaterGoalAmountsGroupedByMonths(beginDate: Date, endDate: Date, managedObjectContext: NSManagedObjectContext) -> [Double] {
+    guard let timeline = WaterGoalTimeline.timeline(for: managedObjectContext) else {
+      return []
+    }
+    
+    // Months are iterated in integer day space, boundaries of months are taken from precomputed tables of DayIndex
+    let dayIndex = DayIndex.current(covering: beginDate, endDate)
+    let endDay = dayIndex.day(of: endDate)
     
-    let waterGoals = fetchWaterGoalsForDateInterval(beginDate: beginDate, endDate: endDate, managedObjectContext: managedObjectContext)
-    var earlierWaterGoal = fetchNearestWaterGoalForDateEarlierThanDate(beginDate, managedObjectContext: managedObjectContext)
-    var laterWaterGoal = fetchNearestWaterGoalForDateLaterThanDate(endDate, managedObjectContext: managedObjectContext)
-
-    let calendar = Calendar.current
-
     var waterGoalAmounts: [Double] = []
-    var waterGoalIndex = 0
-    var daysInMonth: Int!
-    var processedDaysCount = 0
-    var overallWaterGoal: Double = 0
-
-    let beginDayComponents = calendar.dateComponents([.day], from: beginDate)
-    var currentDayIndex = beginDayComponents.day!
-
-    var currentDay = beginDate
+    var monthBeginDay = dayIndex.day(of: beginDate)
     
-    while currentDay.isEarlierThan(endDate) {
-      if daysInMonth == nil {
-        daysInMonth = DateHelper.daysInMonth(date: currentDay)
+    while monthBeginDay < endDay {
+      let monthEndDay = min(dayIndex.firstDay(ofMonth: dayIndex.month(ofDay: monthBeginDay) + 1), endDay)
+      
+      var overallWaterGoal: Double = 0
+      var processedDaysCount = 0
+      
+      for span in timeline.spans(beginDate: dayIndex.startOfDay(monthBeginDay), endDate: dayIndex.startOfDay(monthEndDay), managedObjectContext: managedObjectContext) {
+        overallWaterGoal += span.amount * Double(span.daysCount)
+        processedDaysCount += span.daysCount
       }
-
-      let waterGoalAmount = findWaterGoalForDate(currentDay,
-        waterGoals: waterGoals,
-        managedObjectContext: managedObjectContext,
-        waterGoalIndex: &waterGoalIndex,
-        earlierWaterGoal: &earlierWaterGoal,
-        laterWaterGoal: &laterWaterGoal)
-
-      overallWaterGoal += waterGoalAmount
-      processedDaysCount += 1
-      currentDayIndex += 1
       
-      if currentDayIndex > daysInMonth {
-        let averageWaterGoal = overallWaterGoal / Double(processedDaysCount)
-        waterGoalAmounts.append(averageWaterGoal)
-
-        overallWaterGoal = 0
-        currentDayIndex = 1
-        processedDaysCount = 0
-        daysInMonth = nil
+      if processedDaysCount > 0 {
+        waterGoalAmounts.append(overallWaterGoal / Double(processedDaysCount))
       }
       
-      currentDay = DateHelper.nextDayFrom(currentDay)
-    }
-    
-    if processedDaysCount > 0 {
-      let averageWaterGoal = overallWaterGoal / Double(processedDaysCount)
-      waterGoalAmounts.append(averageWaterGoal)
+      monthBeginDay = monthEndDay
     }
   
     return waterGoalAmounts
@@ -199,67 +156,7 @@ class WaterGoal: CodingManagedObject, NamedEntity {
   /// Fetches water goal strictly for a specified date (time part is skipped).
   class func fetchWaterGoalStrictlyForDate(_ date: Date, managedObjectContext: NSManagedObjectContext) -> WaterGoal? {
     let pureDate = DateHelper.startOfDay(date)
-    let predicate = NSPredicate(format: "date = %@", argumentArray: [pureDate])
-    return fetchManagedObject(managedObjectContext: managedObjectContext, predicate: predicate)
-  }
-  
-  fileprivate class func findWaterGoalForDate(_ currentDay: Date, waterGoals: [WaterGoal], managedObjectContext: NSManagedObjectContext, waterGoalIndex: inout Int, earlierWaterGoal: inout WaterGoal?, laterWaterGoal: inout WaterGoal?) -> Double {
-    var amount: Double!
-    
-    // Looking for a water goal's entity for the current day
-    if waterGoalIndex < waterGoals.count {
-      let waterGoal = waterGoals[waterGoalIndex]
-      let waterGoalDate = waterGoal.date
-      
-      switch currentDay.compare(waterGoalDate) {
-      case .orderedSame:
-        // Use computed amount (taking into account high activity etc.)
-        // only for a water goal's entity strictly related to the current day
-        amount = waterGoal.amount
-        earlierWaterGoal = waterGoal
-        waterGoalIndex += 1
-        
-      case .orderedAscending: // date of current water goal is later than current day
-        laterWaterGoal = waterGoal
-        
-      case .orderedDescending: // unreal case
-        Logger.logError(Logger.Messages.logicalError, logDetails: ["currentDay": currentDay.description, "waterGoalDate": waterGoalDate.description])
-        earlierWaterGoal = waterGoal
-      }
-    }
-    
-    if amount == nil {
-      if let earlierWaterGoal = earlierWaterGoal {
-        amount = earlierWaterGoal.baseAmount
-      } else if let laterWaterGoal = laterWaterGoal {
-        amount = laterWaterGoal.baseAmount
-      } else { // unreal case
-        Logger.logError(Logger.Messages.logicalError)
-        amount = Settings.sharedInstance.userDailyWaterIntake.value
-      }
-    }
-
-    return amount
-  }
-  
-  fileprivate class func fetchNearestWaterGoalForDateEarlierThanDate(_ date: Date, managedObjectContext: NSManagedObjectContext) -> WaterGoal? {
-    let pureDate = DateHelper.startOfDay(date)
-    let predicate = NSPredicate(format: "date < %@", argumentArray: [pureDate])
-    let sortDescriptor = NSSortDescriptor(key: "date", ascending: false)
-    return fetchManagedObject(managedObjectContext: managedObjectContext, predicate: predicate, sortDescriptors: [sortDescriptor])
-  }
-  
-  fileprivate class func fetchNearestWaterGoalForDateLaterThanDate(_ date: Date, managedObjectContext: NSManagedObjectContext) -> WaterGoal? {
-    let pureDate = DateHelper.startOfDay(date)
-    let predicate = NSPredicate(format: "date >= %@", argumentArray: [pureDate])
-    let sortDescriptor = NSSortDescriptor(key: "date", ascending: true)
-    return fetchManagedObject(managedObjectContext: managedObjectContext, predicate: predicate, sortDescriptors: [sortDescriptor])
-  }
-  
-  fileprivate class func fetchWaterGoalsForDateInterval(beginDate: Date, endDate: Date, managedObjectContext: NSManagedObjectContext) -> [WaterGoal] {
-    let predicate = NSPredicate(format: "(date >= %@) AND (date < %@)", argumentArray: [beginDate, endDate])
-    let sortDescriptor = NSSortDescriptor(key: "date", ascending: true)
-    return fetchManagedObjects(managedObjectContext: managedObjectContext, predicate: predicate, sortDescriptors: [sortDescriptor])
+    return fetchManagedObject(template: Templates.waterGoalForDate, substitutionVariables: ["date": pureDate], managedObjectContext: managedObjectContext)
   }
   
 }
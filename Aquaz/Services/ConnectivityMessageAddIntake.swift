@@ -16,6 +16,7 @@ final class ConnectivityMessageAddIntake {
     static let drinkType = "drinkType"
     static let amount    = "amount"
     static let date      = "date"
+    static let originID  = "originID"
   }
   
   fileprivate struct Constants {
@@ -28,13 +29,16 @@ final class ConnectivityMessageAddIntake {
   var drinkType: DrinkType
   var amount: Double
   var date: Date
+  /// Unique identifier of the intake, it's absent in messages of older versions of the watch app
+  var originID: String?
   
   // MARK: Methods
   
-  init(drinkType: DrinkType, amount: Double, date: Date) {
+  init(drinkType: DrinkType, amount: Double, date: Date, originID: String? = nil) {
     self.drinkType = drinkType
     self.amount    = amount
     self.date      = date
+    self.originID  = originID
   }
   
   init?(metadata: [String : Any]) {
@@ -55,6 +59,7 @@ final class ConnectivityMessageAddIntake {
     self.drinkType = drinkType
     self.amount    = amount
     self.date      = date
+    self.originID  = metadata[Keys.originID] as? String
   }
   
   func composeMetadata() -> [String : Any] {
@@ -64,6 +69,7 @@ final class ConnectivityMessageAddIntake {
     metadata[Keys.drinkType]       = drinkType.rawValue
     metadata[Keys.amount]          = amount
     metadata[Keys.date]            = date
+    metadata[Keys.originID]        = originID
     
     return metadata
   }
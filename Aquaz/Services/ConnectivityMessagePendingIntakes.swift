@@ -16,6 +16,7 @@ final class ConnectivityMessagePendingIntakes {
     static let drinkType = "drinkType"
     static let amount    = "amount"
     static let date      = "date"
+    static let originID  = "originID"
   }
   
   fileprivate struct Constants {
@@ -26,7 +27,8 @@ final class ConnectivityMessagePendingIntakes {
   
   // MARK: Properties
   
-  var pendingIntakes = [(drinkType: DrinkType, amount: Double, date: Date)]()
+  /// Origin identifiers are absent in messages of older versions of the watch app
+  var pendingIntakes = [(drinkType: DrinkType, amount: Double, date: Date, originID: String?)]()
   
   // MARK: Methods
   
@@ -46,7 +48,7 @@ final class ConnectivityMessagePendingIntakes {
          let amount = intakeInfo[Keys.amount] as? Double,
          let date = intakeInfo[Keys.date] as? Date
       {
-        pendingIntakes.append((drinkType: drinkType, amount: amount, date: date))
+        pendingIntakes.append((drinkType: drinkType, amount: amount, date: date, originID: intakeInfo[Keys.originID] as? String))
       }
     }
     
@@ -55,8 +57,8 @@ final class ConnectivityMessagePendingIntakes {
     }
   }
   
-  func addIntake(drinkType: DrinkType, amount: Double, date: Date) {
-    pendingIntakes.append((drinkType: drinkType, amount: amount, date: date))
+  func addIntake(drinkType: DrinkType, amount: Double, date: Date, originID: String?) {
+    pendingIntakes.append((drinkType: drinkType, amount: amount, date: date, originID: originID))
   }
   
   func clear() {
@@ -71,10 +73,11 @@ final class ConnectivityMessagePendingIntakes {
     var intakesData = [[String: Any]]()
     
     for intake in pendingIntakes {
-      let intakeInfo: [String: Any] = [
+      var intakeInfo: [String: Any] = [
         Keys.drinkType: intake.drinkType.rawValue,
         Keys.amount: intake.amount,
         Keys.date: intake.date]
+      intakeInfo[Keys.originID] = intake.originID
       intakesData.append(intakeInfo)
     }
 
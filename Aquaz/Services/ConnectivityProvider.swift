@@ -33,23 +33,23 @@ final class ConnectivityProvider: NSObject {
     return nil
   }
   
-  fileprivate let queue = DispatchQueue(label: "\(GlobalConstants.bundleId).ConnectivityProvider", attributes: [])
-
-  fileprivate var needToUpdateWatchState: Bool = false
+  fileprivate struct Constants {
+    static let statePublishingInterval: TimeInterval = 0.5
+  }
   
   fileprivate var settingObserverGeneralVolumeUnits: SettingsObserver?
   
-  fileprivate var drinks = [DrinkType: Drink]()
+  fileprivate var dataChangeSubscription: DataChangeBus.Subscription?
   
-  // If it's greater than 0 all savings of managed object context will be ignored.
-  // It's used when ConnectivityProvider received add intage info from WatchApp.
-  fileprivate var ignoreManagedObjectContextSavingsCounter = 0
+  fileprivate var statePublisher: ConnectivityStatePublisher!
   
   // MARK: Methods
   
   fileprivate override init() {
     super.init()
     
+    setupStatePublisher()
+    
     setupCoreDataSynchronization()
     
     setupSettingsSynchronization()
@@ -64,85 +64,68 @@ final class ConnectivityProvider: NSObject {
     session?.activate()
   }
   
-  fileprivate func composeCurrentStateMessage() -> ConnectivityMessageCurrentState {
-    var message: ConnectivityMessageCurrentState!
+  fileprivate func setupStatePublisher() {
+    statePublisher = ConnectivityStatePublisher(
+      interval: Constants.statePublishingInterval,
+      composeState: { [weak self] completion in
+        self?.composeCurrentStateMessage(completion)
+      },
+      publish: { [weak self] message in
+        return self?.updateApplicationContext(message) ?? false
+      })
     
-    CoreDataStack.performOnPrivateContextAndWait { privateContext in
-      let date = Date()
-
-      let waterGoalAmount: Double
-      let highPhysicalActivityModeEnabled: Bool
-      let hotWeatherModeEnabled: Bool
-
-      if let waterGoal = WaterGoal.fetchWaterGoalForDate(date, managedObjectContext: privateContext) {
-        waterGoalAmount = waterGoal.amount
-        highPhysicalActivityModeEnabled = waterGoal.isHighActivity
-        hotWeatherModeEnabled = waterGoal.isHotDay
-      } else {
-        waterGoalAmount = Settings.sharedInstance.userDailyWaterIntake.value
-        highPhysicalActivityModeEnabled = false
-        hotWeatherModeEnabled = false
-      }
-
-      let totalHydrationAmount = Intake.fetchTotalHydrationAmountForDay(date, dayOffsetInHours: 0, managedObjectContext: privateContext)
-      let totalDehydrationAmount = Intake.fetchTotalDehydrationAmountForDay(date, dayOffsetInHours: 0, managedObjectContext: privateContext)
-
-      message = ConnectivityMessageCurrentState(
-        messageDate: date,
-        hydrationAmount: totalHydrationAmount,
-        dehydrationAmount: totalDehydrationAmount,
-        dailyWaterGoal: waterGoalAmount,
-        highPhysicalActivityModeEnabled: highPhysicalActivityModeEnabled,
-        hotWeatherModeEnabled: hotWeatherModeEnabled,
-        volumeUnits: Settings.sharedInstance.generalVolumeUnits.value)
+    // On cold start the watch is answered from the last known state until the persistent store is loaded
+    let date = Date()
+    
+    if let snapshot = DayStateSnapshot.load(forDate: date) {
+      statePublisher.restore(composeCurrentStateMessage(date: date, summary: snapshot.summary))
     }
-
-    return message
   }
-
-  fileprivate func setupCoreDataSynchronization() {
-    CoreDataStack.performOnPrivateContext { privateContext in
-      NotificationCenter.default.addObserver(
-        self,
-        selector: #selector(self.managedObjectContextDidSave),
-        name: NSNotification.Name.NSManagedObjectContextDidSave,
-        object: privateContext)
-      
-      NotificationCenter.default.addObserver(
-        self,
-        selector: #selector(self.managedObjectContextDidSave),
-        name: NSNotification.Name(rawValue: GlobalConstants.notificationManagedObjectContextWasMerged),
-        object: privateContext)
+  
+  fileprivate func composeCurrentStateMessage(_ completion: @escaping (ConnectivityMessageCurrentState) -> Void) {
+    CoreDataStack.performRead { privateContext in
+      let date = Date()
+      let summary = DaySummaryCache.sharedInstance.summary(forDate: date, managedObjectContext: privateContext)
+      completion(self.composeCurrentStateMessage(date: date, summary: summary))
     }
   }
   
-  @objc func managedObjectContextDidSave() {
-    if isManagedObjectContextSavingIgnored() {
-      return
+  fileprivate func composeCurrentStateMessage(date: Date, summary: DaySummary) -> ConnectivityMessageCurrentState {
+    return ConnectivityMessageCurrentState(
+      messageDate: date,
+      hydrationAmount: summary.totalHydrationAmount,
+      dehydrationAmount: summary.totalDehydrationAmount,
+      dailyWaterGoal: summary.waterGoalAmount,
+      highPhysicalActivityModeEnabled: summary.waterGoal?.isHighActivity ?? false,
+      hotWeatherModeEnabled: summary.waterGoal?.isHotDay ?? false,
+      volumeUnits: Settings.sharedInstance.generalVolumeUnits.value)
+  }
+
+  fileprivate func setupCoreDataSynchronization() {
+    // The watch displays today's state only
+    dataChangeSubscription = DataChangeBus.sharedInstance.subscribe(entities: [.intake, .waterGoal], scope: .today) { [weak self] _ in
+      self?.statePublisher.setNeedsPublish()
     }
-    
-    sendCurrentState()
   }
   
-  fileprivate func sendCurrentState() {
-    guard session != nil && session!.isWatchAppInstalled && session!.activationState == .activated else {
-      return
+  /// Should be called on the queue of the state publisher
+  fileprivate func updateApplicationContext(_ message: ConnectivityMessageCurrentState) -> Bool {
+    guard let session = session, session.isWatchAppInstalled && session.activationState == .activated else {
+      return false
     }
     
-    DispatchQueue.main.async {
-      let message = self.composeCurrentStateMessage()
-
-      do {
-        try self.session?.updateApplicationContext(message.composeMetadata())
-      } catch {
-        print("Error occured on updating application context. Error: \(error)")
-      }
+    do {
+      try session.updateApplicationContext(message.composeMetadata())
+      return true
+    } catch {
+      print("Error occured on updating application context. Error: \(error)")
+      return false
     }
   }
   
   fileprivate func setupSettingsSynchronization() {
     settingObserverGeneralVolumeUnits = Settings.sharedInstance.generalVolumeUnits.addObserver { [weak self] _ in
-      self?.sendCurrentState()
+      self?.statePublisher.setNeedsPublish()
     }
   }
 
@@ -186,103 +169,57 @@ extension ConnectivityProvider: WCSessionDelegate {
   // Called when the session has completed activation. If session state is WCSessionActivationStateNotActivated there will be an error with more details.
   func session(_ session: WCSession, activationDidCompleteWith activationState: WCSessionActivationState, error: Error?) {
     if activationState == .activated {
-      sendCurrentState()
+      statePublisher.setNeedsPublish()
     }
   }
 
   func session(_ session: WCSession, didReceiveMessage message: [String : Any]) {
     if let message = ConnectivityMessageAddIntake(metadata: message) {
-      processAddIntakeMessage(message)
+      addIntakes([makeDraft(message)], replyHandler: nil)
     } else if let message = ConnectivityMessagePendingIntakes(metadata: message) {
-      processPendingIntakesMessage(message)
+      // All pending intakes are committed at once, so the watch receives a single state update
+      addIntakes(makeDrafts(message), replyHandler: nil)
     }
   }
   
   func session(_ session: WCSession, didReceiveMessage message: [String : Any], replyHandler: @escaping ([String : Any]) -> Void) {
     if let message = ConnectivityMessageAddIntake(metadata: message) {
-      processAddIntakeMessage(message)
-      let currentStateMessage = composeCurrentStateMessage()
-      replyHandler(currentStateMessage.composeMetadata())
+      addIntakes([makeDraft(message)], replyHandler: replyHandler)
     } else if let message = ConnectivityMessagePendingIntakes(metadata: message) {
-      processPendingIntakesMessage(message)
-      let currentStateMessage = composeCurrentStateMessage()
-      replyHandler(currentStateMessage.composeMetadata())
+      addIntakes(makeDrafts(message), replyHandler: replyHandler)
+    } else {
+      replyHandler([:])
     }
-    
-    replyHandler([:])
   }
   
-  fileprivate func processAddIntakeMessage(_ message: ConnectivityMessageAddIntake) {
-    CoreDataStack.performOnPrivateContext { privateContext in
-      self.addIntake(drinkType: message.drinkType,
-                     amount: message.amount,
-                     date: message.date,
-                     saveImmediately: true,
-                     managedObjectContext: privateContext)
-    }
+  fileprivate func makeDraft(_ message: ConnectivityMessageAddIntake) -> Intake.Draft {
+    return Intake.Draft(drinkType: message.drinkType, amount: message.amount, date: message.date, originID: message.originID)
   }
   
-  fileprivate func processPendingIntakesMessage(_ message: ConnectivityMessagePendingIntakes) {
-    CoreDataStack.performOnPrivateContext { privateContext in
-      for intake in message.pendingIntakes {
-        self.addIntake(drinkType: intake.drinkType,
-                       amount: intake.amount,
-                       date: intake.date,
-                       saveImmediately: false,
-                       managedObjectContext: privateContext)
-        
-        CoreDataStack.saveContext(privateContext)
-      }
-    }
+  fileprivate func makeDrafts(_ message: ConnectivityMessagePendingIntakes) -> [Intake.Draft] {
+    return message.pendingIntakes.map { Intake.Draft(drinkType: $0.drinkType, amount: $0.amount, date: $0.date, originID: $0.originID) }
   }
   
-  fileprivate func addIntake(drinkType: DrinkType,
-                             amount: Double,
-                             date: Date,
-                             saveImmediately: Bool,
-                             managedObjectContext: NSManagedObjectContext)
-  {
-    // Check for duplicates
-    if let _ = Intake.fetchParticularIntake(date: date, drinkType: drinkType, amount: amount, managedObjectContext: managedObjectContext) {
-      Logger.logWarning("Duplicate intake from Apple Watch has been observed. The intake is ignored.")
-      return
-    }
+  /// Neither the delegate queue nor the main thread waits for the store. The current state is replied once the intakes are committed,
+  /// or right away from the last known state if the persistent store is not loaded yet.
+  fileprivate func addIntakes(_ drafts: [Intake.Draft], replyHandler: (([String : Any]) -> Void)?) {
+    var pendingReplyHandler = replyHandler
     
-    if drinks.isEmpty {
-      drinks = Drink.fetchAllDrinksTyped(managedObjectContext: managedObjectContext)
+    if let replyHandler = replyHandler, !CoreDataStack.sharedInstance.isStoreLoaded, let lastState = statePublisher.lastState {
+      replyHandler(lastState.composeMetadata())
+      pendingReplyHandler = nil
     }
     
-    guard let drink = drinks[drinkType] else {
-      Logger.logError(false, "The drink of intake from paired App Watch is not found in Aquaz")
-      return
-    }
-    
-    increaseIgnoreManagedObjectContextSavingsCounter()
-    
-    _ = Intake.addEntity(drink: drink, amount: amount, date: date, managedObjectContext: managedObjectContext, saveImmediately: saveImmediately)
-    
-    decreaseIgnoreManagedObjectContextSavingsCounter()
-  }
-  
-  fileprivate func isManagedObjectContextSavingIgnored() -> Bool {
-    var ignore = false
-    
-    queue.sync {
-      ignore = self.ignoreManagedObjectContextSavingsCounter > 0
-    }
-    
-    return ignore
-  }
-  
-  fileprivate func increaseIgnoreManagedObjectContextSavingsCounter() {
-    queue.sync {
-      self.ignoreManagedObjectContextSavingsCounter += 1
-    }
-  }
-  
-  fileprivate func decreaseIgnoreManagedObjectContextSavingsCounter() {
-    queue.sync {
-      self.ignoreManagedObjectContextSavingsCounter -= 1
+    CoreDataStack.performWrite { privateContext in
+      _ = Intake.addEntities(drafts, managedObjectContext: privateContext)
+      CoreDataStack.commitContext(privateContext)
+      
+      // The replied state is published as well, so the following notification of the data change bus doesn't resend it
+      if let replyHandler = pendingReplyHandler {
+        self.statePublisher.publishNow { message in
+          replyHandler(message.composeMetadata())
+        }
+      }
     }
   }
   
@@ -0,0 +1,132 @@
+//
+//  ConnectivityStatePublisher.swift
+//  Aquaz
+//
+
+import Foundation
+
+/// Publishes the current state to the watch. Requests made within the interval are composed once,
+/// and the state is published only if something displayed by the watch has changed since the last publication.
+/// Composing is asynchronous, so callers are never blocked by the persistent store.
+final class ConnectivityStatePublisher {
+
+  typealias State = ConnectivityMessageCurrentState
+
+  // MARK: Properties
+
+  fileprivate let queue = DispatchQueue(label: "\(GlobalConstants.bundleId).ConnectivityStatePublisher", attributes: [])
+
+  fileprivate let interval: TimeInterval
+
+  fileprivate let composeState: (@escaping (State) -> Void) -> Void
+
+  fileprivate let publish: (State) -> Bool
+
+  fileprivate var isCompositionScheduled = false
+
+  fileprivate var _lastState: State?
+
+  fileprivate var lastPublishedState: State?
+
+  fileprivate var _compositionsCount = 0
+
+  /// Compositions may complete out of order, so results of compositions started before the applied one are ignored
+  fileprivate var lastAppliedComposition = 0
+
+  fileprivate var _skippedPublicationsCount = 0
+
+  /// The last composed or restored state, nil until there is any
+  var lastState: State? {
+    return queue.sync { _lastState }
+  }
+
+  var compositionsCount: Int {
+    return queue.sync { _compositionsCount }
+  }
+
+  /// Number of composed states which were not published, because the watch already displays them
+  var skippedPublicationsCount: Int {
+    return queue.sync { _skippedPublicationsCount }
+  }
+
+  // MARK: Methods
+
+  /// composeState is called on the internal queue and may call its completion on any queue.
+  /// publish is called on the internal queue and returns false if the state could not be sent.
+  init(interval: TimeInterval, composeState: @escaping (@escaping (State) -> Void) -> Void, publish: @escaping (State) -> Bool) {
+    self.interval = interval
+    self.composeState = composeState
+    self.publish = publish
+  }
+
+  /// Sets the last known state, e.g. taken from a snapshot before the persistent store is loaded. It's not published.
+  func restore(_ state: State) {
+    queue.async {
+      if self._lastState == nil {
+        self._lastState = state
+      }
+    }
+  }
+
+  /// Schedules publishing of the current state after the interval
+  func setNeedsPublish() {
+    queue.async {
+      if self.isCompositionScheduled {
+        return
+      }
+
+      self.isCompositionScheduled = true
+
+      self.queue.asyncAfter(deadline: .now() + self.interval) {
+        self.isCompositionScheduled = false
+        self.composeAndPublish(completion: nil)
+      }
+    }
+  }
+
+  /// Composes and publishes the current state without waiting for the interval, e.g. to reply with changes just committed.
+  /// The completion is called on the internal queue.
+  func publishNow(completion: @escaping (State) -> Void) {
+    queue.async {
+      self.composeAndPublish(completion: completion)
+    }
+  }
+
+  /// Should be called on the queue. If a later composition is already applied, the completion gets its state.
+  fileprivate func composeAndPublish(completion: ((State) -> Void)?) {
+    _compositionsCount += 1
+    let composition = _compositionsCount
+
+    composeState { state in
+      self.queue.async {
+        if composition < self.lastAppliedComposition {
+          completion?(self._lastState ?? state)
+          return
+        }
+
+        self.lastAppliedComposition = composition
+        self._lastState = state
+
+        if let lastPublishedState = self.lastPublishedState, ConnectivityStatePublisher.isDisplayedEqually(lastPublishedState, state) {
+          self._skippedPublicationsCount += 1
+        } else if self.publish(state) {
+          self.lastPublishedState = state
+        }
+
+        completion?(state)
+      }
+    }
+  }
+
+  /// The watch displays amounts, the goal, modes and units of the day of the state
+  class func isDisplayedEqually(_ state1: State, _ state2: State) -> Bool {
+    return DateHelper.areEqualDays(state1.messageDate, state2.messageDate)
+      && state1.hydrationAmount == state2.hydrationAmount
+      && state1.dehydrationAmount == state2.dehydrationAmount
+      && state1.dailyWaterGoal == state2.dailyWaterGoal
+      && state1.isHighActivityEnabled == state2.isHighActivityEnabled
+      && state1.isHotWeatherEnabled == state2.isHotWeatherEnabled
+      && state1.volumeUnits == state2.volumeUnits
+  }
+
+}
@@ -0,0 +1,136 @@
+//
+//  CoreDataMigrator.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+
+/// Migrates a SQLite store created by a previous version of the managed object model to the destination model.
+/// A lightweight (inferred) mapping model is used, but the migration is run by NSMigrationManager,
+/// so its progress can be reported. Should be called on a background queue before the store is added to a coordinator.
+final class CoreDataMigrator {
+
+  typealias ProgressHandler = (Float) -> Void
+
+  // MARK: Properties
+
+  let storeURL: URL
+
+  let destinationModel: NSManagedObjectModel
+
+  /// URL of the compiled versioned model (*.momd) containing all versions of the model
+  fileprivate let modelURL: URL
+
+  fileprivate var progressObservation: NSKeyValueObservation?
+
+  /// True if the store exists and it's incompatible with the destination model
+  var isMigrationNeeded: Bool {
+    guard let metadata = storeMetadata else {
+      return false
+    }
+
+    return !destinationModel.isConfiguration(withName: nil, compatibleWithStoreMetadata: metadata)
+  }
+
+  fileprivate var storeMetadata: [String: Any]? {
+    if !FileManager.default.fileExists(atPath: storeURL.path) {
+      return nil
+    }
+
+    do {
+      return try NSPersistentStoreCoordinator.metadataForPersistentStore(ofType: NSSQLiteStoreType, at: storeURL, options: nil)
+    } catch let error as NSError {
+      Logger.logError("Failed to read metadata of the persistent store", error: error)
+      return nil
+    }
+  }
+
+  fileprivate var temporaryStoreURL: URL {
+    let fileName = storeURL.deletingPathExtension().lastPathComponent + "-Migration.sqlite"
+    return storeURL.deletingLastPathComponent().appendingPathComponent(fileName)
+  }
+
+  // MARK: Methods
+
+  init(storeURL: URL, modelURL: URL, destinationModel: NSManagedObjectModel) {
+    self.storeURL = storeURL
+    self.modelURL = modelURL
+    self.destinationModel = destinationModel
+  }
+
+  /// Migrates the store if it's needed. Progress is reported in range 0...1 on the calling queue.
+  /// Returns false if the migration has failed, the store is left untouched in such a case.
+  func migrateIfNeeded(progressHandler: ProgressHandler? = nil) -> Bool {
+    guard let metadata = storeMetadata,
+          !destinationModel.isConfiguration(withName: nil, compatibleWithStoreMetadata: metadata) else
+    {
+      return true
+    }
+
+    guard let sourceModel = findSourceModel(metadata: metadata) else {
+      Logger.logError("Failed to find a model version of the persistent store")
+      return false
+    }
+
+    let startDate = Date()
+    progressHandler?(0)
+
+    do {
+      let mappingModel = try NSMappingModel.inferredMappingModel(forSourceModel: sourceModel, destinationModel: destinationModel)
+      let migrationManager = NSMigrationManager(sourceModel: sourceModel, destinationModel: destinationModel)
+
+      progressObservation = migrationManager.observe(\.migrationProgress) { migrationManager, _ in
+        progressHandler?(migrationManager.migrationProgress)
+      }
+
+      defer {
+        progressObservation = nil
+      }
+
+      let coordinator = NSPersistentStoreCoordinator(managedObjectModel: destinationModel)
+      try coordinator.destroyPersistentStore(at: temporaryStoreURL, ofType: NSSQLiteStoreType, options: nil)
+
+      try migrationManager.migrateStore(
+        from: storeURL,
+        sourceType: NSSQLiteStoreType,
+        options: nil,
+        with: mappingModel,
+        toDestinationURL: temporaryStoreURL,
+        destinationType: NSSQLiteStoreType,
+        destinationOptions: nil)
+
+      try coordinator.replacePersistentStore(
+        at: storeURL,
+        destinationOptions: nil,
+        withPersistentStoreFrom: temporaryStoreURL,
+        sourceOptions: nil,
+        ofType: NSSQLiteStoreType)
+
+      try coordinator.destroyPersistentStore(at: temporaryStoreURL, ofType: NSSQLiteStoreType, options: nil)
+    } catch let error as NSError {
+      Logger.logError("Failed to migrate the persistent store", error: error)
+      return false
+    }
+
+    progressHandler?(1)
+    Logger.logInfo("The persistent store is migrated", logDetails: "\(Date().timeIntervalSince(startDate)) seconds")
+    return true
+  }
+
+  /// Finds a version of the model compatible with the store among all versions of the compiled versioned model
+  fileprivate func findSourceModel(metadata: [String: Any]) -> NSManagedObjectModel? {
+    let versionURLs = (try? FileManager.default.contentsOfDirectory(at: modelURL, includingPropertiesForKeys: nil, options: [])) ?? []
+
+    for versionURL in versionURLs where versionURL.pathExtension == "mom" {
+      if let model = NSManagedObjectModel(contentsOf: versionURL),
+         model.isConfiguration(withName: nil, compatibleWithStoreMetadata: metadata)
+      {
+        return model
+      }
+    }
+
+    return nil
+  }
+
+}
@@ -12,18 +12,98 @@ import Crashlytics
 
 final class CoreDataStack: NSObject {
   
+  // MARK: Types
+  
+  /// Timings of calls of performRead/performWrite made from a particular call site
+  struct CallSiteMetrics {
+    fileprivate(set) var callsCount = 0
+    /// Time between scheduling of a callback and its start
+    fileprivate(set) var totalQueueWait: TimeInterval = 0
+    fileprivate(set) var maximumQueueWait: TimeInterval = 0
+    fileprivate(set) var totalExecutionTime: TimeInterval = 0
+    fileprivate(set) var maximumExecutionTime: TimeInterval = 0
+    
+    var averageQueueWait: TimeInterval {
+      return callsCount > 0 ? totalQueueWait / Double(callsCount) : 0
+    }
+    
+    var averageExecutionTime: TimeInterval {
+      return callsCount > 0 ? totalExecutionTime / Double(callsCount) : 0
+    }
+    
+    fileprivate mutating func add(queueWait: TimeInterval, executionTime: TimeInterval) {
+      callsCount += 1
+      totalQueueWait += queueWait
+      maximumQueueWait = max(maximumQueueWait, queueWait)
+      totalExecutionTime += executionTime
+      maximumExecutionTime = max(maximumExecutionTime, executionTime)
+    }
+  }
+  
+  fileprivate struct Constants {
+    static let maximumReadContextsCount = 3
+    static let mergeCoalescingInterval: TimeInterval = 0.1
+    static let defaultGroupCommitInterval: TimeInterval = 0.05
+  }
+  
+  // MARK: Properties
+  
   static let sharedInstance = CoreDataStack()
   
   fileprivate var containerURL: URL!
   fileprivate var managedObjectModel: NSManagedObjectModel!
   fileprivate var persistentStoreCoordinator: NSPersistentStoreCoordinator!
 //  private var mainContext: NSManagedObjectContext!
+  /// The only context used for writing
   fileprivate var privateContext: NSManagedObjectContext!
   fileprivate let queue = DispatchQueue(label: "\(GlobalConstants.bundleId).CoreDataStack", attributes: [])
   
+  /// Read-only contexts which are not used by running reads
+  fileprivate var readContexts = [NSManagedObjectContext]()
+  fileprivate var _isStoreLoaded = false
+  fileprivate let readContextsQueue = DispatchQueue(label: "\(GlobalConstants.bundleId).CoreDataStack.ReadContexts", attributes: [])
+  
+  /// Runs reads concurrently, one read per context. It's suspended until the stack is set up.
+  fileprivate let readQueue: OperationQueue = {
+    let operationQueue = OperationQueue()
+    operationQueue.name = "\(GlobalConstants.bundleId).CoreDataStack.Reads"
+    operationQueue.maxConcurrentOperationCount = CoreDataStack.readContextsCount
+    operationQueue.isSuspended = true
+    return operationQueue
+  }()
+  
+  fileprivate static let readContextsCount = min(Constants.maximumReadContextsCount, ProcessInfo.processInfo.activeProcessorCount)
+  
+  fileprivate var metrics = [String: CallSiteMetrics]()
+  fileprivate let metricsQueue = DispatchQueue(label: "\(GlobalConstants.bundleId).CoreDataStack.Metrics", attributes: [])
+  
+  /// Saves of the writer context requested within the interval are committed by a single transaction.
+  /// Zero interval turns off grouping, so every save is committed immediately.
+  let groupCommitInterval = Constants.defaultGroupCommitInterval
+  
+  /// Groups saves of the writer context, it's created together with the writer context
+  fileprivate var groupCommitter: GroupCommitter!
+  
+  /// Save notifications of other contexts are merged into the writer context in batches
+  fileprivate var saveNotificationCoalescer: SaveNotificationCoalescer!
+  
+  /// PersistentHistoryTracker on iOS 11 and later
+  fileprivate var _persistentHistoryTracker: AnyObject?
+  
+  @available(iOS 11.0, *)
+  fileprivate var persistentHistoryTracker: PersistentHistoryTracker? {
+    return _persistentHistoryTracker as? PersistentHistoryTracker
+  }
+  
   override init() {
     super.init()
     
+    saveNotificationCoalescer = SaveNotificationCoalescer(interval: Constants.mergeCoalescingInterval) { [unowned self] batch in
+      self.mergeIntoPrivateContext(batch)
+    }
+    
+    DailySummary.startMaintenance()
+    
     // Use a serial queue in order to not freeze the main UI queue
     queue.async {
       if let containerURL = FileManager.default.containerURL(forSecurityApplicationGroupIdentifier: GlobalConstants.appGroupName) {
@@ -52,16 +132,61 @@ final class CoreDataStack: NSObject {
       
       self.privateContext = NSManagedObjectContext(concurrencyType: .privateQueueConcurrencyType)
       self.privateContext.persistentStoreCoordinator = self.persistentStoreCoordinator
+      self.groupCommitter = GroupCommitter(managedObjectContext: self.privateContext, interval: self.groupCommitInterval)
+      
+      if #available(iOS 11.0, *) {
+        self.privateContext.transactionAuthor = PersistentHistoryTracker.defaultAuthor
+      }
       
       do {
         let url = self.containerURL.appendingPathComponent("Aquaz.sqlite")
         
-        try self.persistentStoreCoordinator.addPersistentStore(ofType: NSSQLiteStoreType, configurationName: nil, at: url, options: nil)
+        // On the first launch the prebuilt store with the catalog is cloned instead of inserting it object by object
+        _ = SeedStore.installIfNeeded(at: url, persistentStoreCoordinator: self.persistentStoreCoordinator)
+        
+        // Stores created by previous versions of the model are migrated explicitly to report progress.
+        // If it fails, automatic migration on adding the store is the last resort.
+        let migrator = CoreDataMigrator(storeURL: url, modelURL: modelURL, destinationModel: self.managedObjectModel)
+        
+        if migrator.isMigrationNeeded {
+          _ = migrator.migrateIfNeeded { progress in
+            NotificationCenter.default.post(
+              name: Notification.Name(rawValue: GlobalConstants.notificationCoreDataMigrationProgress),
+              object: self,
+              userInfo: [GlobalConstants.notificationCoreDataMigrationProgressKey: progress])
+          }
+        }
+        
+        var options: [String: Any] = [NSMigratePersistentStoresAutomaticallyOption: true,
+                                      NSInferMappingModelAutomaticallyOption: true]
+        
+        if #available(iOS 10.0, *) {
+          // Read contexts and the writer context use separate connections, so reads do not wait for each other
+          options[NSPersistentStoreConnectionPoolMaxSizeKey] = CoreDataStack.readContextsCount + 1
+        }
+        
+        if #available(iOS 11.0, *) {
+          // History tokens stamp snapshots of DailyAmountsIndex, and processes sharing the store would catch up with each other's transactions
+          options[NSPersistentHistoryTrackingKey] = true
+        }
+        
+        try self.persistentStoreCoordinator.addPersistentStore(ofType: NSSQLiteStoreType, configurationName: nil, at: url, options: options)
+        
+        if #available(iOS 11.0, *) {
+          self._persistentHistoryTracker = PersistentHistoryTracker(persistentStoreCoordinator: self.persistentStoreCoordinator, userDefaults: Settings.userDefaults)
+        }
       } catch {
         let nserror = error as NSError
         CLSLogv("Core Data Stack initialization error: Failed to add the persistent store. Error: \(nserror.description)", getVaList([]))
         fatalError()
       }
+      
+      self.privateContext.performAndWait {
+        SeedStore.applyCatalogDeltas(managedObjectContext: self.privateContext)
+        DailySummary.rebuildIfNeeded(managedObjectContext: self.privateContext)
+      }
+      
+      self.setupReadContexts()
     }
     
     NotificationCenter.default.addObserver(
@@ -81,14 +206,47 @@ final class CoreDataStack: NSObject {
     if let context = notification.object as? NSManagedObjectContext,
        context !== privateContext
     {
-      queue.async {
-        self.privateContext.perform {
-          self.privateContext.mergeChanges(fromContextDidSave: notification)
-          NotificationCenter.default.post(
-            name: Notification.Name(rawValue: GlobalConstants.notificationManagedObjectContextWasMerged),
-            object: self.privateContext,
-            userInfo: (notification as NSNotification).userInfo)
+      saveNotificationCoalescer.add(notification)
+    }
+  }
+  
+  /// Merges all changes of the batch at once and posts a single notification with the union of changed objects.
+  /// Objects in the notification belong to the writer context, their identifiers are passed under separate keys too.
+  fileprivate func mergeIntoPrivateContext(_ batch: SaveNotificationCoalescer.Batch) {
+    queue.async {
+      self.privateContext.perform {
+        if #available(iOS 10.0, *) {
+          NSManagedObjectContext.mergeChanges(fromRemoteContextSave: batch.objectIDsByChangeKeys, into: [self.privateContext])
+        } else {
+          for notification in batch.notifications where notification.object != nil {
+            self.privateContext.mergeChanges(fromContextDidSave: notification)
+          }
+          
+          // Changes of other processes contain object identifiers only, so registered objects are just refreshed
+          for objectID in batch.updatedObjectIDs.union(batch.deletedObjectIDs) {
+            if let managedObject = self.privateContext.registeredObject(for: objectID) {
+              self.privateContext.refresh(managedObject, mergeChanges: true)
+            }
+          }
         }
+        
+        let objects = { (objectIDs: Set<NSManagedObjectID>) in Set(objectIDs.map { self.privateContext.object(with: $0) }) }
+        
+        let userInfo: [AnyHashable: Any] = [
+          NSInsertedObjectsKey: objects(batch.insertedObjectIDs),
+          NSUpdatedObjectsKey: objects(batch.updatedObjectIDs),
+          NSDeletedObjectsKey: objects(batch.deletedObjectIDs),
+          GlobalConstants.notificationInsertedObjectIDsKey: batch.insertedObjectIDs,
+          GlobalConstants.notificationUpdatedObjectIDsKey: batch.updatedObjectIDs,
+          GlobalConstants.notificationDeletedObjectIDsKey: batch.deletedObjectIDs,
+          GlobalConstants.notificationContainsRemoteChangesKey: batch.containsRemoteChanges]
+        
+        NotificationCenter.default.post(
+          name: Notification.Name(rawValue: GlobalConstants.notificationManagedObjectContextWasMerged),
+          object: self.privateContext,
+          userInfo: userInfo)
+        
+        self.saveNotificationCoalescer.didMerge(batch)
       }
     }
   }
@@ -119,68 +277,244 @@ final class CoreDataStack: NSObject {
 //    }
 //  }
 //  
-  func performOnPrivateContext(_ callback: @escaping (NSManagedObjectContext) -> Void) {
+  // MARK: Reading and writing
+  
+  /// Performs the callback on the writer context asynchronously. Writes are serialized.
+  func performWrite(callSite: String, _ callback: @escaping (NSManagedObjectContext) -> Void) {
+    let scheduleTime = ProcessInfo.processInfo.systemUptime
+    
     // Dispatch the request to our serial queue first and then back to the context queue.
     // Since we set up the stack on this queue it will have succeeded or failed before
     // this block is executed.
     queue.async {
       self.privateContext.perform {
-        callback(self.privateContext)
+        self.measure(callSite: callSite, scheduleTime: scheduleTime) {
+          callback(self.privateContext)
+        }
       }
     }
   }
-
-  func performOnPrivateContextAndWait(_ callback: @escaping (NSManagedObjectContext) -> Void) {
+  
+  /// Performs the callback on the writer context and waits for its completion
+  func performWriteAndWait(callSite: String, _ callback: @escaping (NSManagedObjectContext) -> Void) {
     let dispatchGroup = DispatchGroup()
     dispatchGroup.enter()
-
-    // Dispatch the request to our serial queue first and then back to the context queue.
-    // Since we set up the stack on this queue it will have succeeded or failed before
-    // this block is executed.
-    queue.async {
-      self.privateContext.perform {
-        callback(self.privateContext)
-        dispatchGroup.leave()
-      }
+    
+    performWrite(callSite: callSite) { privateContext in
+      callback(privateContext)
+      dispatchGroup.leave()
     }
     
     _ = dispatchGroup.wait(timeout: DispatchTime.distantFuture)
   }
+  
+  /// Performs the callback on one of read-only contexts asynchronously. Reads run concurrently with each other and with writes.
+  /// The context sees the store as of the start of the callback. Managed objects of the context should not leave the callback.
+  func performRead(callSite: String, _ callback: @escaping (NSManagedObjectContext) -> Void) {
+    readQueue.addOperation(makeReadOperation(callSite: callSite, callback))
+  }
+  
+  /// Performs the callback on one of read-only contexts and waits for its completion.
+  /// It should not be called from a read callback, because all read contexts may be busy.
+  func performReadAndWait(callSite: String, _ callback: @escaping (NSManagedObjectContext) -> Void) {
+    readQueue.addOperations([makeReadOperation(callSite: callSite, callback)], waitUntilFinished: true)
+  }
+  
+  /// Until the persistent store is loaded reads and writes are postponed, so callers may render cached state instead
+  var isStoreLoaded: Bool {
+    return readContextsQueue.sync { _isStoreLoaded }
+  }
+  
+  /// Returns timings of reads and writes grouped by call sites
+  func callSiteMetrics() -> [String: CallSiteMetrics] {
+    return metricsQueue.sync { metrics }
+  }
+  
+  fileprivate func makeReadOperation(callSite: String, _ callback: @escaping (NSManagedObjectContext) -> Void) -> Operation {
+    let scheduleTime = ProcessInfo.processInfo.systemUptime
+    
+    return BlockOperation {
+      // The number of concurrent operations does not exceed the number of contexts, so there is always a free one
+      let readContext = self.readContextsQueue.sync { self.readContexts.removeLast() }
+      
+      readContext.performAndWait {
+        if #available(iOS 10.0, *) {
+          // Pin the context to the current state of the store for the whole callback
+          do {
+            try readContext.setQueryGenerationFrom(NSQueryGenerationToken.current)
+          } catch let error as NSError {
+            Logger.logError("Failed to set query generation of a read context", error: error)
+          }
+        }
+        
+        self.measure(callSite: callSite, scheduleTime: scheduleTime) {
+          callback(readContext)
+        }
+        
+        Logger.logError(!readContext.hasChanges, "Changes made in a read context are discarded", logDetails: [Logger.Attributes.callSite: callSite])
+        readContext.reset()
+      }
+      
+      self.readContextsQueue.sync {
+        self.readContexts.append(readContext)
+      }
+    }
+  }
+  
+  /// Should be called on the queue right after adding the persistent store
+  fileprivate func setupReadContexts() {
+    var readContexts = [NSManagedObjectContext]()
+    
+    for _ in 0..<CoreDataStack.readContextsCount {
+      let readContext = NSManagedObjectContext(concurrencyType: .privateQueueConcurrencyType)
+      readContext.persistentStoreCoordinator = persistentStoreCoordinator
+      readContext.undoManager = nil
+      // Always take values from the store, because changes of other processes are not merged into read contexts
+      readContext.stalenessInterval = 0
+      readContexts.append(readContext)
+    }
+    
+    readContextsQueue.sync {
+      self.readContexts = readContexts
+      self._isStoreLoaded = true
+    }
+    
+    readQueue.isSuspended = false
+    
+    StartupTimeline.sharedInstance.markStoreLoaded()
+  }
+  
+  fileprivate func measure(callSite: String, scheduleTime: TimeInterval, _ block: () -> Void) {
+    let startTime = ProcessInfo.processInfo.systemUptime
+    block()
+    let finishTime = ProcessInfo.processInfo.systemUptime
+    
+    metricsQueue.async {
+      self.metrics[callSite, default: CallSiteMetrics()].add(queueWait: startTime - scheduleTime, executionTime: finishTime - startTime)
+    }
+  }
+  
+  fileprivate class func callSite(file: String, function: String) -> String {
+    return "\((file as NSString).lastPathComponent).\(function)"
+  }
 
   func saveAllContexts() {
-    queue.async {
-//      CoreDataStack.saveContext(self.mainContext)
-      CoreDataStack.saveContext(self.privateContext)
+    commitPendingSavesAndWait()
+  }
+  
+  /// Durability barrier: commits changes of saves deferred by group commit and waits for the commit
+  func commitPendingSavesAndWait() {
+    performWriteAndWait(callSite: "CoreDataStack.commitPendingSavesAndWait") { _ in
+      self.groupCommitter.commit()
     }
   }
   
+  /// Durability barrier: commits changes of saves deferred by group commit asynchronously.
+  /// The completion is called on the queue of the writer context once the changes are in the store.
+  func commitPendingSaves(completion: @escaping () -> Void) {
+    performWrite(callSite: "CoreDataStack.commitPendingSaves") { _ in
+      self.groupCommitter.commit()
+      completion()
+    }
+  }
+  
+  func currentGroupCommitStatistics() -> GroupCommitter.Statistics {
+    return groupCommitter?.currentStatistics() ?? GroupCommitter.Statistics()
+  }
+  
   func mergeAllContextsWithNotification(_ notification: Notification) {
+    saveNotificationCoalescer.add(notification)
+  }
+  
+  /// Merges changes saved by another process. Objects are passed by their URI representations, which are resolved by the coordinator.
+  /// Persistent history contains all changes of other processes, so if it's available the call just catches up with it.
+  func mergeAllContextsWithRemoteChanges(_ objectURIsByChangeKeys: [String: [URL]], isIncomplete: Bool) {
+    if #available(iOS 11.0, *) {
+      catchUpWithPersistentHistory()
+      return
+    }
+    
     queue.async {
-//      self.mainContext.performBlock {
-//        self.mainContext.mergeChangesFromContextDidSaveNotification(notification)
-//        NSNotificationCenter.defaultCenter().postNotificationName(
-//          GlobalConstants.notificationManagedObjectContextWasMerged,
-//          object: self.mainContext,
-//          userInfo: notification.userInfo)
-//      }
+      var objectIDsByChangeKeys = [String: Set<NSManagedObjectID>]()
+      
+      for (key, objectURIs) in objectURIsByChangeKeys {
+        objectIDsByChangeKeys[key] = Set(objectURIs.compactMap { self.persistentStoreCoordinator.managedObjectID(forURIRepresentation: $0) })
+      }
+      
+      self.mergeRemoteChanges([objectIDsByChangeKeys], isIncomplete: isIncomplete)
+    }
+  }
+  
+  /// Merges transactions committed by other processes since the previous catch-up, e.g. on activation
+  func catchUpWithPersistentHistory() {
+    guard #available(iOS 11.0, *) else {
+      return
+    }
     
-      self.privateContext.perform {
-        self.privateContext.mergeChanges(fromContextDidSave: notification)
-        NotificationCenter.default.post(
-          name: Notification.Name(rawValue: GlobalConstants.notificationManagedObjectContextWasMerged),
-          object: self.privateContext,
-          userInfo: (notification as NSNotification).userInfo)
+    queue.async {
+      self.persistentHistoryTracker?.catchUp { catchUp in
+        self.mergeRemoteChanges(catchUp.transactions, isIncomplete: catchUp.isIncomplete)
       }
     }
   }
   
+  /// Each transaction is passed to the coalescer separately, so objects inserted and deleted meanwhile are skipped.
+  /// If some changes are lost, all objects registered in the writer context are treated as updated.
+  fileprivate func mergeRemoteChanges(_ transactions: [[String: Set<NSManagedObjectID>]], isIncomplete: Bool) {
+    // Nil object marks changes of another process
+    let addTransactions = { (transactions: [[String: Set<NSManagedObjectID>]]) in
+      for objectIDsByChangeKeys in transactions where !objectIDsByChangeKeys.isEmpty {
+        self.saveNotificationCoalescer.add(Notification(name: .NSManagedObjectContextDidSave, object: nil, userInfo: objectIDsByChangeKeys))
+      }
+    }
+    
+    if !isIncomplete {
+      addTransactions(transactions)
+      return
+    }
+    
+    privateContext.perform {
+      // Refreshing goes first, so deletions of the transactions take precedence
+      let registeredObjectIDs = Set(self.privateContext.registeredObjects.map { $0.objectID }.filter { !$0.isTemporaryID })
+      addTransactions([[NSUpdatedObjectsKey: registeredObjectIDs]] + transactions)
+    }
+  }
+  
+  /// Counters of merging save notifications of other contexts
+  func mergeStatistics() -> SaveNotificationCoalescer.Statistics {
+    return saveNotificationCoalescer.currentStatistics()
+  }
+  
   // MARK: - Core Data Saving support
   
+  /// Saves changes of the context. Saves of the writer context are deferred and grouped with other saves
+  /// requested within groupCommitInterval, use commitContext(_:) if changes should be in the store right after the call.
+  /// Should be called on the queue of the context.
   class func saveContext(_ managedObjectContext: NSManagedObjectContext) {
     if !managedObjectContext.hasChanges {
       return
     }
     
+    if let groupCommitter = sharedInstance.groupCommitter, managedObjectContext === groupCommitter.managedObjectContext {
+      groupCommitter.save()
+      return
+    }
+    
+    commitContext(managedObjectContext)
+  }
+  
+  /// Durability barrier: saves changes of the context immediately including changes of deferred saves.
+  /// Should be called on the queue of the context.
+  class func commitContext(_ managedObjectContext: NSManagedObjectContext) {
+    if let groupCommitter = sharedInstance.groupCommitter, managedObjectContext === groupCommitter.managedObjectContext {
+      groupCommitter.commit()
+      return
+    }
+    
+    if !managedObjectContext.hasChanges {
+      return
+    }
+    
     do {
       try managedObjectContext.save()
     } catch {
@@ -194,22 +528,46 @@ final class CoreDataStack: NSObject {
     sharedInstance.saveAllContexts()
   }
   
+  class func commitPendingSavesAndWait() {
+    sharedInstance.commitPendingSavesAndWait()
+  }
+  
+  class func commitPendingSaves(completion: @escaping () -> Void) {
+    sharedInstance.commitPendingSaves(completion: completion)
+  }
+  
   class func mergeAllContextsWithNotification(_ notification: Notification) {
     sharedInstance.mergeAllContextsWithNotification(notification)
   }
   
+  class func mergeAllContextsWithRemoteChanges(_ objectURIsByChangeKeys: [String: [URL]], isIncomplete: Bool) {
+    sharedInstance.mergeAllContextsWithRemoteChanges(objectURIsByChangeKeys, isIncomplete: isIncomplete)
+  }
+  
+  class func catchUpWithPersistentHistory() {
+    sharedInstance.catchUpWithPersistentHistory()
+  }
+  
   // MARK: - Convenient methods
   
 //  class func inMainContext(callback: NSManagedObjectContext -> Void) {
 //    sharedInstance.inMainContext(callback)
 //  }
 //  
-  class func performOnPrivateContext(_ callback: @escaping (NSManagedObjectContext) -> Void) {
-    sharedInstance.performOnPrivateContext(callback)
+  class func performWrite(file: String = #file, function: String = #function, _ callback: @escaping (NSManagedObjectContext) -> Void) {
+    sharedInstance.performWrite(callSite: callSite(file: file, function: function), callback)
+  }
+
+  class func performWriteAndWait(file: String = #file, function: String = #function, _ callback: @escaping (NSManagedObjectContext) -> Void) {
+    sharedInstance.performWriteAndWait(callSite: callSite(file: file, function: function), callback)
+  }
+
+  class func performRead(file: String = #file, function: String = #function, _ callback: @escaping (NSManagedObjectContext) -> Void) {
+    sharedInstance.performRead(callSite: callSite(file: file, function: function), callback)
   }
 
-  class func performOnPrivateContextAndWait(_ callback: @escaping (NSManagedObjectContext) -> Void) {
-    sharedInstance.performOnPrivateContextAndWait(callback)
+  class func performReadAndWait(file: String = #file, function: String = #function, _ callback: @escaping (NSManagedObjectContext) -> Void) {
+    sharedInstance.performReadAndWait(callSite: callSite(file: file, function: function), callback)
   }
 
 }
@@ -0,0 +1,616 @@
+//
+//  DailyAmountsIndex.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+
+/// In-memory prefix-sum index of hydration and dehydration amounts over epoch days (see DayIndex).
+/// The index is built once from daily summaries (or loaded from a snapshot stored beside the persistent store),
+/// it's updated by point updates on every save, and sums over any range of days are answered in O(log n) by Fenwick trees.
+/// Changes merged from other processes carry no amounts, so they drop the index.
+/// Water goals are deliberately left out. A goal applies to all following days up to the next goal, and its amount depends on
+/// hot day and high activity factors of settings, so a single change would rewrite a long run of days. Goal totals over a range
+/// are summed over runs of WaterGoalTimeline spans instead, which costs O(goals in the range) rather than O(days).
+final class DailyAmountsIndex: NSObject {
+
+  // MARK: Types
+
+  /// Sums of amounts over a range of days
+  struct Totals {
+    let hydration: Double
+    let dehydration: Double
+    /// Number of days having at least one intake
+    let activeDaysCount: Int
+
+    static let zero = Totals(hydration: 0, dehydration: 0, activeDaysCount: 0)
+  }
+
+  /// Change of amounts of a day
+  struct DayDelta {
+    let day: Int
+    let hydration: Double
+    let dehydration: Double
+    let intakesCount: Int
+  }
+
+  fileprivate struct Constants {
+    /// Extra days reserved around stored days, so new intakes rarely require resizing of the table
+    static let marginDaysCount = 366
+    static let snapshotPathExtension = "amounts"
+    static let snapshotVersion = 2
+    static let totalsTolerance = 1e-6
+  }
+
+  fileprivate struct SnapshotKeys {
+    static let version = "version"
+    static let timeZone = "timeZone"
+    static let firstDay = "firstDay"
+    static let hydrations = "hydrations"
+    static let dehydrations = "dehydrations"
+    static let intakesCounts = "intakesCounts"
+    static let historyToken = "historyToken"
+  }
+
+  /// Changes of a managed object context collected before saving, they are applied after the saving
+  fileprivate struct StagedChanges {
+    var deltas = [DayDelta]()
+    var isRebuilt = false
+  }
+
+  // MARK: Properties
+
+  fileprivate static let registryQueue = DispatchQueue(label: "\(GlobalConstants.bundleId).DailyAmountsIndex.Registry", attributes: [])
+
+  fileprivate static var indexes = [DailyAmountsIndex]()
+
+  fileprivate weak var persistentStoreCoordinator: NSPersistentStoreCoordinator?
+
+  fileprivate let queue = DispatchQueue(label: "\(GlobalConstants.bundleId).DailyAmountsIndex", attributes: [])
+
+  /// Nil until the first request
+  fileprivate var table: Table?
+
+  /// Incremented on every save to the store, used to detect changes made during loading
+  fileprivate var generation = 0
+
+  /// Persistent history token of the store at the state of the table (NSPersistentHistoryToken), nil if it's unknown
+  fileprivate var tableHistoryToken: NSObject?
+
+  fileprivate var stagedChanges = [ObjectIdentifier: StagedChanges]()
+
+  // MARK: Methods
+
+  /// Returns the index of the persistent store coordinator of the managed object context.
+  /// Nil is returned for models without daily summaries.
+  class func index(for managedObjectContext: NSManagedObjectContext) -> DailyAmountsIndex? {
+    guard let coordinator = managedObjectContext.persistentStoreCoordinator,
+          coordinator.managedObjectModel.entitiesByName[DailySummary.entityName] != nil else
+    {
+      return nil
+    }
+
+    return registryQueue.sync {
+      indexes = indexes.filter { $0.persistentStoreCoordinator != nil }
+
+      if let index = indexes.first(where: { $0.persistentStoreCoordinator === coordinator }) {
+        return index
+      }
+
+      let index = DailyAmountsIndex(persistentStoreCoordinator: coordinator)
+      indexes.append(index)
+      return index
+    }
+  }
+
+  fileprivate init(persistentStoreCoordinator: NSPersistentStoreCoordinator) {
+    self.persistentStoreCoordinator = persistentStoreCoordinator
+
+    super.init()
+
+    NotificationCenter.default.addObserver(
+      self,
+      selector: #selector(self.managedObjectContextDidSave(_:)),
+      name: NSNotification.Name.NSManagedObjectContextDidSave,
+      object: nil)
+
+    NotificationCenter.default.addObserver(
+      self,
+      selector: #selector(self.managedObjectContextWasMerged(_:)),
+      name: NSNotification.Name(rawValue: GlobalConstants.notificationManagedObjectContextWasMerged),
+      object: nil)
+
+    NotificationCenter.default.addObserver(
+      self,
+      selector: #selector(self.invalidate),
+      name: NSNotification.Name.NSSystemTimeZoneDidChange,
+      object: nil)
+  }
+
+  deinit {
+    NotificationCenter.default.removeObserver(self)
+  }
+
+  /// Returns sums of amounts for epoch days beginDay..<endDay. Should be called on the queue of the managed object context.
+  func totals(beginDay: Int, endDay: Int, managedObjectContext: NSManagedObjectContext) -> Totals {
+    return loadedTable(managedObjectContext: managedObjectContext).totals(beginDay: beginDay, endDay: endDay)
+  }
+
+  /// Returns sums of amounts for several ranges of epoch days at once. Should be called on the queue of the managed object context.
+  func totals(dayRanges: [Range<Int>], managedObjectContext: NSManagedObjectContext) -> [Totals] {
+    let table = loadedTable(managedObjectContext: managedObjectContext)
+    return dayRanges.map { table.totals(beginDay: $0.lowerBound, endDay: $0.upperBound) }
+  }
+
+  /// Returns sums of amounts for the date period (beginDate..<endDate). Should be called on the queue of the managed object context.
+  func totals(beginDate: Date, endDate: Date, managedObjectContext: NSManagedObjectContext) -> Totals {
+    let dayIndex = DayIndex.current(covering: beginDate, endDate)
+    return totals(beginDay: dayIndex.day(of: beginDate), endDay: dayIndex.day(of: endDate), managedObjectContext: managedObjectContext)
+  }
+
+  /// Drops the loaded table, it will be loaded from the store on the next request
+  @objc func invalidate() {
+    queue.sync {
+      generation += 1
+      table = nil
+      tableHistoryToken = nil
+    }
+
+    removeSnapshot()
+  }
+
+  // MARK: Updating
+
+  /// Stages changes of daily summaries of the managed object context, they are applied when the context is saved.
+  /// It's called by DailySummary right before saving.
+  func stage(_ deltas: [DayDelta], for managedObjectContext: NSManagedObjectContext) {
+    if deltas.isEmpty {
+      return
+    }
+
+    queue.sync {
+      stagedChanges[ObjectIdentifier(managedObjectContext), default: StagedChanges()].deltas += deltas
+    }
+  }
+
+  /// Stages rebuilding of all daily summaries of the managed object context, the index is dropped when the context is saved
+  func stageRebuild(for managedObjectContext: NSManagedObjectContext) {
+    queue.sync {
+      stagedChanges[ObjectIdentifier(managedObjectContext), default: StagedChanges()].isRebuilt = true
+    }
+  }
+
+  @objc func managedObjectContextDidSave(_ notification: Notification) {
+    guard let managedObjectContext = notification.object as? NSManagedObjectContext,
+          managedObjectContext.persistentStoreCoordinator === persistentStoreCoordinator else
+    {
+      return
+    }
+
+    // Only saves of contexts without a parent reach the store and advance its history
+    let isSavedToStore = managedObjectContext.parent == nil
+    let historyToken = isSavedToStore ? currentHistoryToken() : nil
+
+    let isRebuilt: Bool = queue.sync {
+      let changes = stagedChanges.removeValue(forKey: ObjectIdentifier(managedObjectContext))
+
+      if changes == nil && !isSavedToStore {
+        return false
+      }
+
+      generation += 1
+
+      if let changes = changes {
+        if changes.isRebuilt {
+          table = nil
+        } else if table != nil {
+          for delta in changes.deltas {
+            table!.apply(delta)
+          }
+        }
+      }
+
+      if isSavedToStore {
+        tableHistoryToken = historyToken
+      }
+
+      return changes?.isRebuilt ?? false
+    }
+
+    if isRebuilt {
+      removeSnapshot()
+    }
+  }
+
+  /// Intakes of the widget and other processes are merged by object identifiers only, so their amounts are unknown.
+  /// The table is dropped and loaded from the store again, the snapshot is removed as well.
+  @objc func managedObjectContextWasMerged(_ notification: Notification) {
+    guard let managedObjectContext = notification.object as? NSManagedObjectContext,
+          managedObjectContext.persistentStoreCoordinator === persistentStoreCoordinator,
+          notification.userInfo?[GlobalConstants.notificationContainsRemoteChangesKey] as? Bool == true else
+    {
+      return
+    }
+
+    invalidate()
+  }
+
+  // MARK: Loading
+
+  fileprivate func loadedTable(managedObjectContext: NSManagedObjectContext) -> Table {
+    let (table, loadingGeneration): (Table?, Int) = queue.sync { (self.table, generation) }
+
+    if let table = table {
+      return table
+    }
+
+    // The token is taken before fetching, so the table is at least as new as the token
+    let historyToken = currentHistoryToken()
+    var loadedTable = loadSnapshot(managedObjectContext: managedObjectContext, historyToken: historyToken)
+    let isLoadedFromSnapshot = loadedTable != nil
+
+    if loadedTable == nil {
+      loadedTable = DailyAmountsIndex.fetchTable(managedObjectContext: managedObjectContext)
+    }
+
+    let isCached: Bool = queue.sync {
+      // The store has been changed during loading, so the loaded table may be outdated and it's used only once
+      if generation == loadingGeneration {
+        self.table = loadedTable
+        self.tableHistoryToken = historyToken
+        return true
+      }
+      return false
+    }
+
+    if isCached && !isLoadedFromSnapshot {
+      writeSnapshot(loadedTable!, historyToken: historyToken)
+    }
+
+    return loadedTable!
+  }
+
+  /// Builds the table from daily summaries. Dictionary result type is used to avoid materializing them.
+  fileprivate class func fetchTable(managedObjectContext: NSManagedObjectContext) -> Table {
+    let fetchRequest = NSFetchRequest<NSDictionary>()
+    fetchRequest.entity = DailySummary.entityDescription(inManagedObjectContext: managedObjectContext)
+    fetchRequest.propertiesToFetch = ["date", "hydration", "dehydration", "intakesCount"]
+    fetchRequest.resultType = .dictionaryResultType
+
+    var records = [NSDictionary]()
+
+    do {
+      records = try managedObjectContext.fetch(fetchRequest)
+    } catch let error as NSError {
+      Logger.logError(Logger.Messages.failedToExecuteFetchRequest, error: error)
+    }
+
+    let dayIndex = DayIndex.current(covering: Date())
+    let today = dayIndex.day(of: Date())
+    var deltas = [DayDelta]()
+    deltas.reserveCapacity(records.count)
+
+    for record in records {
+      guard let date = record["date"] as? Date,
+            let hydration = record["hydration"] as? Double,
+            let dehydration = record["dehydration"] as? Double,
+            let intakesCount = record["intakesCount"] as? Int else
+      {
+        continue
+      }
+
+      deltas.append(DayDelta(day: dayIndex.day(of: date), hydration: hydration, dehydration: dehydration, intakesCount: intakesCount))
+    }
+
+    let firstDay = min(deltas.map { $0.day }.min() ?? today, today) - Constants.marginDaysCount
+    let endDay = max(deltas.map { $0.day }.max() ?? today, today) + Constants.marginDaysCount
+
+    var hydrations = [Double](repeating: 0, count: endDay - firstDay)
+    var dehydrations = [Double](repeating: 0, count: endDay - firstDay)
+    var intakesCounts = [Int64](repeating: 0, count: endDay - firstDay)
+
+    for delta in deltas {
+      hydrations[delta.day - firstDay] += delta.hydration
+      dehydrations[delta.day - firstDay] += delta.dehydration
+      intakesCounts[delta.day - firstDay] += Int64(delta.intakesCount)
+    }
+
+    return Table(firstDay: firstDay, hydrations: hydrations, dehydrations: dehydrations, intakesCounts: intakesCounts)
+  }
+
+  // MARK: Snapshot
+
+  /// The snapshot is stored beside the persistent store (in the app group container), in-memory stores have no snapshot
+  fileprivate var snapshotURL: URL? {
+    guard let storeURL = persistentStoreCoordinator?.persistentStores.first?.url, storeURL.isFileURL else {
+      return nil
+    }
+
+    return storeURL.deletingPathExtension().appendingPathExtension(Constants.snapshotPathExtension)
+  }
+
+  /// Writes the loaded table to the snapshot, so it can be loaded quickly on the next launch
+  func saveSnapshot() {
+    let (table, historyToken) = queue.sync { (self.table, tableHistoryToken) }
+
+    if let table = table {
+      writeSnapshot(table, historyToken: historyToken)
+    }
+  }
+
+  fileprivate func writeSnapshot(_ table: Table, historyToken: NSObject?) {
+    guard let snapshotURL = snapshotURL else {
+      return
+    }
+
+    var snapshot: [String: Any] = [
+      SnapshotKeys.version: Constants.snapshotVersion,
+      SnapshotKeys.timeZone: TimeZone.current.identifier,
+      SnapshotKeys.firstDay: table.firstDay,
+      SnapshotKeys.hydrations: table.hydrations.withUnsafeBufferPointer { Data(buffer: $0) },
+      SnapshotKeys.dehydrations: table.dehydrations.withUnsafeBufferPointer { Data(buffer: $0) },
+      SnapshotKeys.intakesCounts: table.intakesCounts.withUnsafeBufferPointer { Data(buffer: $0) }]
+
+    if let historyToken = historyToken {
+      snapshot[SnapshotKeys.historyToken] = NSKeyedArchiver.archivedData(withRootObject: historyToken)
+    }
+
+    do {
+      let data = try PropertyListSerialization.data(fromPropertyList: snapshot, format: .binary, options: 0)
+      try data.write(to: snapshotURL, options: .atomic)
+    } catch let error as NSError {
+      Logger.logError("Failed to write snapshot of daily amounts index", error: error)
+    }
+  }
+
+  /// Loads the table from the snapshot. If the store keeps persistent history, the snapshot is used only if it's stamped
+  /// with the current history token, so any change of any day made after writing the snapshot is detected.
+  /// Otherwise its totals should match to totals of stored daily summaries, which are computed by a single aggregate fetch.
+  fileprivate func loadSnapshot(managedObjectContext: NSManagedObjectContext, historyToken: NSObject?) -> Table? {
+    guard let snapshotURL = snapshotURL,
+          let data = try? Data(contentsOf: snapshotURL),
+          let snapshot = (try? PropertyListSerialization.propertyList(from: data, options: [], format: nil)) as? [String: Any],
+          snapshot[SnapshotKeys.version] as? Int == Constants.snapshotVersion,
+          snapshot[SnapshotKeys.timeZone] as? String == TimeZone.current.identifier,
+          let firstDay = snapshot[SnapshotKeys.firstDay] as? Int,
+          let hydrationsData = snapshot[SnapshotKeys.hydrations] as? Data,
+          let dehydrationsData = snapshot[SnapshotKeys.dehydrations] as? Data,
+          let intakesCountsData = snapshot[SnapshotKeys.intakesCounts] as? Data else
+    {
+      return nil
+    }
+
+    let hydrations: [Double] = DailyAmountsIndex.unpack(hydrationsData)
+    let dehydrations: [Double] = DailyAmountsIndex.unpack(dehydrationsData)
+    let intakesCounts: [Int64] = DailyAmountsIndex.unpack(intakesCountsData)
+
+    if hydrations.count != dehydrations.count || hydrations.count != intakesCounts.count || hydrations.isEmpty {
+      return nil
+    }
+
+    let table = Table(firstDay: firstDay, hydrations: hydrations, dehydrations: dehydrations, intakesCounts: intakesCounts)
+
+    if let historyToken = historyToken {
+      guard let tokenData = snapshot[SnapshotKeys.historyToken] as? Data,
+            let snapshotHistoryToken = NSKeyedUnarchiver.unarchiveObject(with: tokenData) as? NSObject,
+            snapshotHistoryToken.isEqual(historyToken) else
+      {
+        Logger.logWarning("Snapshot of daily amounts index is outdated, the index is built from the store")
+        return nil
+      }
+
+      return table
+    }
+
+    guard let storedTotals = DailyAmountsIndex.fetchStoredTotals(managedObjectContext: managedObjectContext),
+          table.matches(hydration: storedTotals.hydration, dehydration: storedTotals.dehydration, intakesCount: storedTotals.intakesCount) else
+    {
+      Logger.logWarning("Snapshot of daily amounts index is outdated, the index is built from the store")
+      return nil
+    }
+
+    return table
+  }
+
+  /// Nil for stores without persistent history
+  fileprivate func currentHistoryToken() -> NSObject? {
+    guard #available(iOS 11.0, *) else {
+      return nil
+    }
+
+    return persistentStoreCoordinator?.currentPersistentHistoryToken(fromStores: nil)
+  }
+
+  fileprivate func removeSnapshot() {
+    if let snapshotURL = snapshotURL {
+      try? FileManager.default.removeItem(at: snapshotURL)
+    }
+  }
+
+  fileprivate class func unpack<Value: Numeric>(_ data: Data) -> [Value] {
+    var values = [Value](repeating: 0, count: data.count / MemoryLayout<Value>.stride)
+    _ = values.withUnsafeMutableBufferPointer { data.copyBytes(to: $0) }
+    return values
+  }
+
+  /// Fetches overall amounts of all daily summaries
+  fileprivate class func fetchStoredTotals(managedObjectContext: NSManagedObjectContext) -> (hydration: Double, dehydration: Double, intakesCount: Int64)? {
+    func sumDescription(_ keyPath: String, _ resultType: NSAttributeType) -> NSExpressionDescription {
+      let description = NSExpressionDescription()
+      description.expression = NSExpression(forFunction: "sum:", arguments: [NSExpression(forKeyPath: keyPath)])
+      description.expressionResultType = resultType
+      description.name = keyPath
+      return description
+    }
+
+    let fetchRequest = NSFetchRequest<NSDictionary>()
+    fetchRequest.entity = DailySummary.entityDescription(inManagedObjectContext: managedObjectContext)
+    fetchRequest.propertiesToFetch = [
+      sumDescription("hydration", .doubleAttributeType),
+      sumDescription("dehydration", .doubleAttributeType),
+      sumDescription("intakesCount", .integer64AttributeType)]
+    fetchRequest.resultType = .dictionaryResultType
+
+    do {
+      guard let record = try managedObjectContext.fetch(fetchRequest).first else {
+        return nil
+      }
+
+      return (hydration: (record["hydration"] as? Double) ?? 0,
+              dehydration: (record["dehydration"] as? Double) ?? 0,
+              intakesCount: (record["intakesCount"] as? NSNumber)?.int64Value ?? 0)
+    } catch let error as NSError {
+      Logger.logError(Logger.Messages.failedToExecuteFetchRequest, error: error)
+      return nil
+    }
+  }
+
+  // MARK: Table
+
+  /// Amounts of days firstDay..<endDay with Fenwick trees over them
+  fileprivate struct Table {
+
+    fileprivate(set) var firstDay: Int
+    fileprivate(set) var hydrations: [Double]
+    fileprivate(set) var dehydrations: [Double]
+    fileprivate(set) var intakesCounts: [Int64]
+
+    fileprivate var hydrationTree: FenwickTree<Double>
+    fileprivate var dehydrationTree: FenwickTree<Double>
+    fileprivate var activeDaysTree: FenwickTree<Int>
+
+    var endDay: Int {
+      return firstDay + hydrations.count
+    }
+
+    init(firstDay: Int, hydrations: [Double], dehydrations: [Double], intakesCounts: [Int64]) {
+      self.firstDay = firstDay
+      self.hydrations = hydrations
+      self.dehydrations = dehydrations
+      self.intakesCounts = intakesCounts
+      hydrationTree = FenwickTree(values: hydrations)
+      dehydrationTree = FenwickTree(values: dehydrations)
+      activeDaysTree = FenwickTree(values: intakesCounts.map { $0 > 0 ? 1 : 0 })
+    }
+
+    func totals(beginDay: Int, endDay: Int) -> Totals {
+      let lowerIndex = max(beginDay, firstDay) - firstDay
+      let upperIndex = min(endDay, self.endDay) - firstDay
+
+      if lowerIndex >= upperIndex {
+        return .zero
+      }
+
+      // Differences of prefix sums may be slightly non-zero for days without intakes because of rounding
+      let activeDaysCount = activeDaysTree.sum(lowerIndex..<upperIndex)
+
+      if activeDaysCount == 0 {
+        return .zero
+      }
+
+      return Totals(
+        hydration: max(0, hydrationTree.sum(lowerIndex..<upperIndex)),
+        dehydration: max(0, dehydrationTree.sum(lowerIndex..<upperIndex)),
+        activeDaysCount: activeDaysCount)
+    }
+
+    func matches(hydration: Double, dehydration: Double, intakesCount: Int64) -> Bool {
+      func isClose(_ value1: Double, _ value2: Double) -> Bool {
+        return abs(value1 - value2) <= Constants.totalsTolerance * max(1, abs(value2))
+      }
+
+      return intakesCounts.reduce(0, +) == intakesCount &&
+        isClose(hydrationTree.sum(0..<hydrations.count), hydration) &&
+        isClose(dehydrationTree.sum(0..<dehydrations.count), dehydration)
+    }
+
+    mutating func apply(_ delta: DayDelta) {
+      if delta.day < firstDay || delta.day >= endDay {
+        resize(covering: delta.day)
+      }
+
+      let index = delta.day - firstDay
+
+      hydrations[index] += delta.hydration
+      hydrationTree.add(delta.hydration, at: index)
+
+      dehydrations[index] += delta.dehydration
+      dehydrationTree.add(delta.dehydration, at: index)
+
+      let wasActive = intakesCounts[index] > 0
+      intakesCounts[index] += Int64(delta.intakesCount)
+      let isActive = intakesCounts[index] > 0
+
+      if wasActive != isActive {
+        activeDaysTree.add(isActive ? 1 : -1, at: index)
+      }
+    }
+
+    fileprivate mutating func resize(covering day: Int) {
+      let newFirstDay = min(firstDay, day - Constants.marginDaysCount)
+      let newEndDay = max(endDay, day + Constants.marginDaysCount)
+      let headCount = firstDay - newFirstDay
+      let tailCount = newEndDay - endDay
+
+      self = Table(
+        firstDay: newFirstDay,
+        hydrations: [Double](repeating: 0, count: headCount) + hydrations + [Double](repeating: 0, count: tailCount),
+        dehydrations: [Double](repeating: 0, count: headCount) + dehydrations + [Double](repeating: 0, count: tailCount),
+        intakesCounts: [Int64](repeating: 0, count: headCount) + intakesCounts + [Int64](repeating: 0, count: tailCount))
+    }
+
+  }
+
+}
+
+// MARK: FenwickTree
+
+/// Binary indexed tree answering prefix sums and point updates in O(log n)
+fileprivate struct FenwickTree<Value: Numeric> {
+
+  /// One-based nodes, each node keeps the sum of a range of values ending at its index
+  fileprivate var nodes: ContiguousArray<Value>
+
+  /// Builds the tree in O(n)
+  init(values: [Value]) {
+    nodes = ContiguousArray(repeating: 0, count: values.count + 1)
+
+    for (index, value) in values.enumerated() {
+      let node = index + 1
+      nodes[node] += value
+
+      let parent = node + (node & -node)
+      if parent < nodes.count {
+        nodes[parent] += nodes[node]
+      }
+    }
+  }
+
+  mutating func add(_ delta: Value, at index: Int) {
+    var node = index + 1
+
+    while node < nodes.count {
+      nodes[node] += delta
+      node += node & -node
+    }
+  }
+
+  /// Sum of first count values
+  func prefixSum(_ count: Int) -> Value {
+    var sum: Value = 0
+    var node = count
+
+    while node > 0 {
+      sum += nodes[node]
+      node -= node & -node
+    }
+
+    return sum
+  }
+
+  func sum(_ range: Range<Int>) -> Value {
+    return prefixSum(range.upperBound) - prefixSum(range.lowerBound)
+  }
+
+}
@@ -0,0 +1,367 @@
+//
+//  DataChangeBus.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+
+/// Central dispatcher of saved changes.
+/// Affected epoch days are computed once per save or merge, and subscribers are notified only if
+/// the change touches entities they are interested in within days they are displaying.
+final class DataChangeBus: NSObject {
+
+  // MARK: Types
+
+  enum Entity {
+    /// Intakes and daily summaries
+    case intake
+    case waterGoal
+    /// Drinks and their recent amounts
+    case drink
+  }
+
+  enum Scope {
+    case allDays
+    /// Days of the date period beginDate..<endDate
+    case dateRange(beginDate: Date, endDate: Date)
+    /// The current day, it's resolved at the moment of notifying
+    case today
+  }
+
+  /// Changes of a single save or merge grouped by entities
+  struct Change {
+    /// Epoch days touched by changed objects. A water goal affects all days from its date.
+    /// If days of an object are unknown (e.g. a deleted object is a fault already), all days are affected.
+    fileprivate(set) var days = [Entity: IndexSet]()
+    fileprivate(set) var insertedObjectIDs = [Entity: Set<NSManagedObjectID>]()
+    fileprivate(set) var updatedObjectIDs = [Entity: Set<NSManagedObjectID>]()
+    fileprivate(set) var deletedObjectIDs = [Entity: Set<NSManagedObjectID>]()
+
+    var entities: Set<Entity> {
+      return Set(days.keys)
+    }
+
+    var isEmpty: Bool {
+      return days.isEmpty
+    }
+
+    /// Returns true if changes of the entities touch any of epoch days beginDay..<endDay
+    func affects(_ entities: Set<Entity>, beginDay: Int, endDay: Int) -> Bool {
+      return entities.contains { entity in
+        days[entity]?.intersects(integersIn: beginDay..<endDay) ?? false
+      }
+    }
+
+    fileprivate mutating func add(_ managedObject: NSManagedObject, isDeleted: Bool, dayIndex: DayIndex) {
+      guard let entity = DataChangeBus.entity(of: managedObject) else {
+        return
+      }
+
+      let objectDays: IndexSet
+
+      if isDeleted && managedObject.isFault {
+        // Attributes of deleted objects which are faults already cannot be read
+        objectDays = IndexSet(integersIn: Constants.allDays)
+      } else {
+        objectDays = DataChangeBus.days(of: managedObject, dayIndex: dayIndex)
+      }
+
+      days[entity, default: IndexSet()].formUnion(objectDays)
+    }
+
+    fileprivate mutating func add(_ objectDays: IndexSet, for entity: Entity) {
+      if !objectDays.isEmpty {
+        days[entity, default: IndexSet()].formUnion(objectDays)
+      }
+    }
+  }
+
+  /// Registration of a handler. Keep a strong reference to it, the handler is removed on deinitialization or cancel().
+  final class Subscription {
+
+    let entities: Set<Entity>
+
+    fileprivate let handler: (Change) -> Void
+
+    fileprivate weak var bus: DataChangeBus?
+
+    fileprivate var _scope: Scope
+
+    /// Displayed days can be changed at any moment
+    var scope: Scope {
+      get {
+        return bus?.queue.sync { _scope } ?? _scope
+      }
+      set {
+        if let bus = bus {
+          bus.queue.sync { _scope = newValue }
+        } else {
+          _scope = newValue
+        }
+      }
+    }
+
+    fileprivate init(entities: Set<Entity>, scope: Scope, handler: @escaping (Change) -> Void) {
+      self.entities = entities
+      self._scope = scope
+      self.handler = handler
+    }
+
+    deinit {
+      bus?.removeReleasedSubscriptions()
+    }
+
+    func cancel() {
+      bus?.remove(self)
+    }
+
+  }
+
+  fileprivate final class WeakSubscription {
+    weak var subscription: Subscription?
+
+    init(_ subscription: Subscription) {
+      self.subscription = subscription
+    }
+  }
+
+  fileprivate struct Constants {
+    /// Bounds used for objects with unknown days and for unbounded periods of water goals
+    static let allDays = Int(Int32.min)..<Int(Int32.max)
+  }
+
+  // MARK: Properties
+
+  /// The bus observing the writer context of CoreDataStack
+  static let sharedInstance: DataChangeBus = {
+    let bus = DataChangeBus()
+
+    CoreDataStack.performWrite { privateContext in
+      bus.observe(privateContext)
+    }
+
+    return bus
+  }()
+
+  fileprivate let queue = DispatchQueue(label: "\(GlobalConstants.bundleId).DataChangeBus", attributes: [])
+
+  fileprivate var subscriptions = [WeakSubscription]()
+
+  fileprivate var _deliveriesCount = 0
+
+  fileprivate var _suppressedDeliveriesCount = 0
+
+  /// Days intakes are moved from by saves in progress, keyed by managed object contexts.
+  /// Saved objects keep their new dates only, so previous ones are taken before saving.
+  fileprivate var previousDays = [ObjectIdentifier: IndexSet]()
+
+  /// Number of handler calls
+  var deliveriesCount: Int {
+    return queue.sync { _deliveriesCount }
+  }
+
+  /// Number of handler calls avoided because changes did not touch the scope of a subscription
+  var suppressedDeliveriesCount: Int {
+    return queue.sync { _suppressedDeliveriesCount }
+  }
+
+  // MARK: Methods
+
+  /// Creates a bus for saves of the managed object context
+  convenience init(managedObjectContext: NSManagedObjectContext) {
+    self.init()
+    observe(managedObjectContext)
+  }
+
+  fileprivate override init() {
+    super.init()
+  }
+
+  deinit {
+    NotificationCenter.default.removeObserver(self)
+  }
+
+  /// Handlers are called on the queue of the observed managed object context
+  func subscribe(entities: Set<Entity>, scope: Scope, handler: @escaping (Change) -> Void) -> Subscription {
+    let subscription = Subscription(entities: entities, scope: scope, handler: handler)
+    subscription.bus = self
+
+    queue.sync {
+      subscriptions = subscriptions.filter { $0.subscription != nil }
+      subscriptions.append(WeakSubscription(subscription))
+    }
+
+    return subscription
+  }
+
+  fileprivate func remove(_ subscription: Subscription) {
+    let identifier = ObjectIdentifier(subscription)
+
+    queue.async {
+      self.subscriptions = self.subscriptions.filter { $0.subscription.map { ObjectIdentifier($0) != identifier } ?? false }
+    }
+  }
+
+  /// It's asynchronous, because the last reference to a subscription may be released on the queue
+  fileprivate func removeReleasedSubscriptions() {
+    queue.async {
+      self.subscriptions = self.subscriptions.filter { $0.subscription != nil }
+    }
+  }
+
+  fileprivate func observe(_ managedObjectContext: NSManagedObjectContext) {
+    NotificationCenter.default.addObserver(
+      self,
+      selector: #selector(self.managedObjectContextWillSave(_:)),
+      name: NSNotification.Name.NSManagedObjectContextWillSave,
+      object: managedObjectContext)
+
+    NotificationCenter.default.addObserver(
+      self,
+      selector: #selector(self.managedObjectContextDidChange(_:)),
+      name: NSNotification.Name.NSManagedObjectContextDidSave,
+      object: managedObjectContext)
+
+    NotificationCenter.default.addObserver(
+      self,
+      selector: #selector(self.managedObjectContextDidChange(_:)),
+      name: NSNotification.Name(rawValue: GlobalConstants.notificationManagedObjectContextWasMerged),
+      object: managedObjectContext)
+  }
+
+  @objc func managedObjectContextWillSave(_ notification: Notification) {
+    guard let managedObjectContext = notification.object as? NSManagedObjectContext else {
+      return
+    }
+
+    let dayIndex = DayIndex.current(covering: Date())
+    var days = IndexSet()
+
+    for case let intake as Intake in managedObjectContext.updatedObjects where intake.changedValues()["date"] != nil {
+      if let date = intake.committedValues(forKeys: ["date"])["date"] as? Date {
+        days.insert(dayIndex.day(of: date))
+      }
+    }
+
+    queue.sync {
+      previousDays[ObjectIdentifier(managedObjectContext)] = days
+    }
+  }
+
+  @objc func managedObjectContextDidChange(_ notification: Notification) {
+    // Values are read on the posting thread, which is the queue of the managed object context owning the objects
+    var change = DataChangeBus.change(from: notification)
+
+    if notification.name == NSNotification.Name.NSManagedObjectContextDidSave, let managedObjectContext = notification.object as? NSManagedObjectContext {
+      if let days = queue.sync(execute: { previousDays.removeValue(forKey: ObjectIdentifier(managedObjectContext)) }) {
+        change.add(days, for: .intake)
+      }
+    }
+
+    if change.isEmpty {
+      return
+    }
+
+    let today = DayIndex.current(covering: Date()).day(of: Date())
+
+    let handlers: [(Change) -> Void] = queue.sync {
+      var handlers = [(Change) -> Void]()
+
+      for case let subscription? in subscriptions.map({ $0.subscription }) {
+        if DataChangeBus.change(change, matches: subscription, today: today) {
+          handlers.append(subscription.handler)
+          _deliveriesCount += 1
+        } else {
+          _suppressedDeliveriesCount += 1
+        }
+      }
+
+      return handlers
+    }
+
+    for handler in handlers {
+      handler(change)
+    }
+  }
+
+  /// Should be called on the queue
+  fileprivate class func change(_ change: Change, matches subscription: Subscription, today: Int) -> Bool {
+    switch subscription._scope {
+    case .allDays:
+      return !subscription.entities.isDisjoint(with: change.entities)
+
+    case .today:
+      return change.affects(subscription.entities, beginDay: today, endDay: today + 1)
+
+    case let .dateRange(beginDate, endDate):
+      let dayIndex = DayIndex.current(covering: beginDate, endDate)
+      return change.affects(subscription.entities, beginDay: dayIndex.day(of: beginDate), endDay: dayIndex.day(of: endDate))
+    }
+  }
+
+  fileprivate class func change(from notification: Notification) -> Change {
+    var change = Change()
+
+    guard let userInfo = notification.userInfo else {
+      return change
+    }
+
+    let dayIndex = DayIndex.current(covering: Date())
+
+    for managedObject in userInfo[NSInsertedObjectsKey] as? Set<NSManagedObject> ?? [] {
+      change.add(managedObject, isDeleted: false, dayIndex: dayIndex)
+      change.insertedObjectIDs.insert(managedObject.objectID, for: entity(of: managedObject))
+    }
+
+    for managedObject in userInfo[NSUpdatedObjectsKey] as? Set<NSManagedObject> ?? [] {
+      change.add(managedObject, isDeleted: false, dayIndex: dayIndex)
+      change.updatedObjectIDs.insert(managedObject.objectID, for: entity(of: managedObject))
+    }
+
+    for managedObject in userInfo[NSDeletedObjectsKey] as? Set<NSManagedObject> ?? [] {
+      change.add(managedObject, isDeleted: true, dayIndex: dayIndex)
+      change.deletedObjectIDs.insert(managedObject.objectID, for: entity(of: managedObject))
+    }
+
+    return change
+  }
+
+  fileprivate class func entity(of managedObject: NSManagedObject) -> Entity? {
+    switch managedObject {
+    case is Intake, is DailySummary: return .intake
+    case is WaterGoal: return .waterGoal
+    case is Drink, is RecentAmount: return .drink
+    default: return nil
+    }
+  }
+
+  fileprivate class func days(of managedObject: NSManagedObject, dayIndex: DayIndex) -> IndexSet {
+    switch managedObject {
+    case let intake as Intake:
+      return IndexSet(integer: dayIndex.day(of: intake.date))
+
+    case let dailySummary as DailySummary:
+      return IndexSet(integer: dayIndex.day(of: dailySummary.date))
+
+    case let waterGoal as WaterGoal:
+      // Days following the water goal use its base amount until the next water goal
+      return IndexSet(integersIn: dayIndex.day(of: waterGoal.date)..<Constants.allDays.upperBound)
+
+    default:
+      // Drinks are displayed for all days
+      return IndexSet(integersIn: Constants.allDays)
+    }
+  }
+
+}
+
+private extension Dictionary where Key == DataChangeBus.Entity, Value == Set<NSManagedObjectID> {
+
+  mutating func insert(_ objectID: NSManagedObjectID, for entity: DataChangeBus.Entity?) {
+    if let entity = entity {
+      self[entity, default: []].insert(objectID)
+    }
+  }
+
+}
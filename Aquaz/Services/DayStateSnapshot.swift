@@ -0,0 +1,140 @@
+//
+//  DayStateSnapshot.swift
+//  Aquaz
+//
+
+import Foundation
+
+/// Last known state of the current day stored in the shared container beside the persistent store.
+/// It's rewritten after each commit touching today, so the application, the widget and the watch reply
+/// can render the day immediately on cold start and reconcile it once the persistent store is loaded.
+/// Volume units are not stored, because settings are available synchronously anyway.
+struct DayStateSnapshot: Codable {
+
+  // MARK: Types
+
+  fileprivate struct Goal: Codable {
+    let date: Date
+    let baseAmount: Double
+    let isHotDay: Bool
+    let isHighActivity: Bool
+  }
+
+  fileprivate struct Constants {
+    static let fileName = "DayState.plist"
+  }
+
+  // MARK: Properties
+
+  /// Start of the day
+  let date: Date
+
+  fileprivate let hydrationAmounts: [Int: Double]
+
+  fileprivate let dehydrationAmounts: [Int: Double]
+
+  fileprivate let waterGoal: Goal?
+
+  var summary: DaySummary {
+    return DaySummary(
+      date: date,
+      hydrationAmounts: DayStateSnapshot.amountsByDrinkTypes(hydrationAmounts),
+      dehydrationAmounts: DayStateSnapshot.amountsByDrinkTypes(dehydrationAmounts),
+      waterGoal: waterGoal.map { DaySummary.Goal(date: $0.date, baseAmount: $0.baseAmount, isHotDay: $0.isHotDay, isHighActivity: $0.isHighActivity) })
+  }
+
+  fileprivate static let queue = DispatchQueue(label: "\(GlobalConstants.bundleId).DayStateSnapshot", attributes: [])
+
+  fileprivate static var dataChangeSubscription: DataChangeBus.Subscription?
+
+  fileprivate static let fileURL = FileManager.default.containerURL(forSecurityApplicationGroupIdentifier: GlobalConstants.appGroupName)?.appendingPathComponent(Constants.fileName)
+
+  // MARK: Methods
+
+  init(summary: DaySummary) {
+    date = summary.date
+    hydrationAmounts = DayStateSnapshot.amountsByIndexes(summary.hydrationAmounts)
+    dehydrationAmounts = DayStateSnapshot.amountsByIndexes(summary.dehydrationAmounts)
+    waterGoal = summary.waterGoal.map { Goal(date: $0.date, baseAmount: $0.baseAmount, isHotDay: $0.isHotDay, isHighActivity: $0.isHighActivity) }
+  }
+
+  /// Starts rewriting the snapshot after commits touching today. The snapshot is also refreshed once the persistent store is loaded.
+  static func startUpdating() {
+    queue.sync {
+      if dataChangeSubscription != nil {
+        return
+      }
+
+      dataChangeSubscription = DataChangeBus.sharedInstance.subscribe(entities: [.intake, .waterGoal], scope: .today) { _ in
+        DayStateSnapshot.update()
+      }
+    }
+
+    update()
+  }
+
+  /// Returns the stored snapshot if it's taken for the day of the passed date
+  static func load(forDate date: Date) -> DayStateSnapshot? {
+    guard let fileURL = fileURL else {
+      return nil
+    }
+
+    return queue.sync {
+      guard let data = try? Data(contentsOf: fileURL),
+            let snapshot = try? PropertyListDecoder().decode(DayStateSnapshot.self, from: data),
+            DateHelper.areEqualDays(snapshot.date, date) else
+      {
+        return nil
+      }
+
+      return snapshot
+    }
+  }
+
+  fileprivate static func update() {
+    CoreDataStack.performRead { privateContext in
+      let summary = DaySummaryCache.sharedInstance.summary(forDate: Date(), managedObjectContext: privateContext)
+      DayStateSnapshot(summary: summary).write()
+    }
+  }
+
+  fileprivate func write() {
+    guard let fileURL = DayStateSnapshot.fileURL else {
+      return
+    }
+
+    let encoder = PropertyListEncoder()
+    encoder.outputFormat = .binary
+
+    DayStateSnapshot.queue.async {
+      do {
+        try encoder.encode(self).write(to: fileURL, options: .atomic)
+      } catch let error as NSError {
+        Logger.logError("Failed to write the snapshot of the day state", error: error)
+      }
+    }
+  }
+
+  fileprivate static func amountsByIndexes(_ amounts: [DrinkType: Double]) -> [Int: Double] {
+    var result = [Int: Double]()
+
+    for (drinkType, amount) in amounts {
+      result[drinkType.rawValue] = amount
+    }
+
+    return result
+  }
+
+  fileprivate static func amountsByDrinkTypes(_ amounts: [Int: Double]) -> [DrinkType: Double] {
+    var result = [DrinkType: Double]()
+
+    for (index, amount) in amounts {
+      if let drinkType = DrinkType(rawValue: index) {
+        result[drinkType] = amount
+      }
+    }
+
+    return result
+  }
+
+}
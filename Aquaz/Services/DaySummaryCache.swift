@@ -0,0 +1,334 @@
+//
+//  DaySummaryCache.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+
+/// Summary of a day: hydration amounts grouped by drinks, dehydration and resolved water goal.
+struct DaySummary {
+
+  /// Values of a water goal resolved for the day by rules of WaterGoal.fetchWaterGoalForDate
+  struct Goal {
+    let date: Date
+    let baseAmount: Double
+    let isHotDay: Bool
+    let isHighActivity: Bool
+
+    init(waterGoal: WaterGoal) {
+      date = waterGoal.date
+      baseAmount = waterGoal.baseAmount
+      isHotDay = waterGoal.isHotDay
+      isHighActivity = waterGoal.isHighActivity
+    }
+
+    init(entry: WaterGoalTimeline.Entry) {
+      date = entry.date
+      baseAmount = entry.baseAmount
+      isHotDay = entry.isHotDay
+      isHighActivity = entry.isHighActivity
+    }
+
+    init(date: Date, baseAmount: Double, isHotDay: Bool, isHighActivity: Bool) {
+      self.date = date
+      self.baseAmount = baseAmount
+      self.isHotDay = isHotDay
+      self.isHighActivity = isHighActivity
+    }
+
+    var hotDayFactor: Double {
+      return isHotDay ? Settings.sharedInstance.generalHotDayExtraFactor.value : 0
+    }
+
+    var highActivityFactor: Double {
+      return isHighActivity ? Settings.sharedInstance.generalHighActivityExtraFactor.value : 0
+    }
+
+    var amount: Double {
+      return baseAmount * (1 + hotDayFactor + highActivityFactor)
+    }
+  }
+
+  /// Start of the day
+  let date: Date
+
+  fileprivate(set) var hydrationAmounts = [DrinkType: Double]()
+
+  fileprivate(set) var dehydrationAmounts = [DrinkType: Double]()
+
+  fileprivate(set) var waterGoal: Goal?
+
+  var totalHydrationAmount: Double {
+    return hydrationAmounts.values.reduce(0, +)
+  }
+
+  var totalDehydrationAmount: Double {
+    return dehydrationAmounts.values.reduce(0, +)
+  }
+
+  /// Amount of the water goal or user's daily water intake from settings if there is no water goal at all
+  var waterGoalAmount: Double {
+    return waterGoal?.amount ?? Settings.sharedInstance.userDailyWaterIntake.value
+  }
+
+  fileprivate init(date: Date) {
+    self.date = date
+  }
+
+  /// Restores a summary stored outside of the persistent store, e.g. by DayStateSnapshot
+  init(date: Date, hydrationAmounts: [DrinkType: Double], dehydrationAmounts: [DrinkType: Double], waterGoal: Goal?) {
+    self.date = date
+    self.hydrationAmounts = hydrationAmounts
+    self.dehydrationAmounts = dehydrationAmounts
+    self.waterGoal = waterGoal
+  }
+
+}
+
+/// Shared cache of day summaries.
+/// Cached days are patched in place from changed daily summaries of saved managed object contexts,
+/// and water goals are resolved by WaterGoalTimeline, so repeated requests for a day never touch the persistent store.
+final class DaySummaryCache: NSObject {
+
+  // MARK: Types
+
+  fileprivate struct Constants {
+    static let maximumDaysCount = 62
+  }
+
+  // MARK: Properties
+
+  static let sharedInstance = DaySummaryCache()
+
+  fileprivate let queue = DispatchQueue(label: "\(GlobalConstants.bundleId).DaySummaryCache", attributes: [])
+
+  fileprivate var summaries = [Date: DaySummary]()
+
+  fileprivate var accessStamps = [Date: UInt64]()
+
+  fileprivate var accessCounter: UInt64 = 0
+
+  /// Days and drinks of cached daily summaries, used to patch days on deletion of the summaries
+  fileprivate var dailySummaryKeys = [NSManagedObjectID: (date: Date, drinkType: DrinkType)]()
+
+  /// Numbers of fetches in progress and epochs of their days. An epoch is advanced by every change of the day,
+  /// so a fetch which has raced with a save is not cached.
+  fileprivate var fetchingDays = [Date: (fetchesCount: Int, epoch: UInt64)]()
+
+  /// Advanced by changes which can't be attributed to a day
+  fileprivate var globalEpoch: UInt64 = 0
+
+  fileprivate var _hitsCount = 0
+
+  fileprivate var _missesCount = 0
+
+  /// Number of requests served from the cache
+  var hitsCount: Int {
+    return queue.sync { _hitsCount }
+  }
+
+  /// Number of requests which required fetching from the persistent store
+  var missesCount: Int {
+    return queue.sync { _missesCount }
+  }
+
+  // MARK: Methods
+
+  fileprivate override init() {
+    super.init()
+
+    NotificationCenter.default.addObserver(
+      self,
+      selector: #selector(self.managedObjectContextDidSave(_:)),
+      name: NSNotification.Name.NSManagedObjectContextDidSave,
+      object: nil)
+
+    NotificationCenter.default.addObserver(
+      self,
+      selector: #selector(self.managedObjectContextDidSave(_:)),
+      name: NSNotification.Name(rawValue: GlobalConstants.notificationManagedObjectContextWasMerged),
+      object: nil)
+
+    NotificationCenter.default.addObserver(
+      self,
+      selector: #selector(self.removeAll),
+      name: NSNotification.Name.NSSystemTimeZoneDidChange,
+      object: nil)
+  }
+
+  deinit {
+    NotificationCenter.default.removeObserver(self)
+  }
+
+  /// Returns summary for a day of the passed date. Should be called on the queue of the managed object context.
+  func summary(forDate date: Date, managedObjectContext: NSManagedObjectContext) -> DaySummary {
+    let day = DateHelper.startOfDay(date)
+
+    var fetchEpochs: (day: UInt64, global: UInt64) = (day: 0, global: 0)
+
+    let cachedSummary: DaySummary? = queue.sync {
+      guard let summary = summaries[day] else {
+        _missesCount += 1
+        let fetchingDay = fetchingDays[day] ?? (fetchesCount: 0, epoch: 0)
+        fetchingDays[day] = (fetchesCount: fetchingDay.fetchesCount + 1, epoch: fetchingDay.epoch)
+        fetchEpochs = (day: fetchingDay.epoch, global: globalEpoch)
+        return nil
+      }
+
+      _hitsCount += 1
+      touch(day)
+      return summary
+    }
+
+    if var cachedSummary = cachedSummary {
+      cachedSummary.waterGoal = resolveWaterGoal(forDay: day, managedObjectContext: managedObjectContext)
+      return cachedSummary
+    }
+
+    var summary = DaySummary(date: day)
+    var keys = [NSManagedObjectID: (date: Date, drinkType: DrinkType)]()
+
+    let dailySummaries = DailySummary.fetchDailySummaries(beginDate: day, endDate: DateHelper.nextDayFrom(day), managedObjectContext: managedObjectContext)
+
+    for dailySummary in dailySummaries {
+      if let drinkType = dailySummary.drinkType {
+        summary.hydrationAmounts[drinkType] = dailySummary.hydration
+        summary.dehydrationAmounts[drinkType] = dailySummary.dehydration
+        keys[dailySummary.objectID] = (date: day, drinkType: drinkType)
+      }
+    }
+
+    queue.sync {
+      guard let fetchingDay = fetchingDays[day] else {
+        return
+      }
+
+      if fetchingDay.fetchesCount > 1 {
+        fetchingDays[day] = (fetchesCount: fetchingDay.fetchesCount - 1, epoch: fetchingDay.epoch)
+      } else {
+        fetchingDays[day] = nil
+      }
+
+      // The day has been changed during the fetch, so the result may be outdated. The next request fetches it again.
+      if fetchingDay.epoch != fetchEpochs.day || globalEpoch != fetchEpochs.global {
+        return
+      }
+
+      summaries[day] = summary
+
+      for (objectID, key) in keys {
+        dailySummaryKeys[objectID] = key
+      }
+
+      touch(day)
+      evictIfNeeded()
+    }
+
+    summary.waterGoal = resolveWaterGoal(forDay: day, managedObjectContext: managedObjectContext)
+    return summary
+  }
+
+  fileprivate func resolveWaterGoal(forDay day: Date, managedObjectContext: NSManagedObjectContext) -> DaySummary.Goal? {
+    guard let entry = WaterGoalTimeline.timeline(for: managedObjectContext)?.entry(forDate: day, managedObjectContext: managedObjectContext) else {
+      return nil
+    }
+
+    return DaySummary.Goal(entry: entry)
+  }
+
+  /// Removes all cached summaries
+  @objc func removeAll() {
+    queue.sync {
+      summaries.removeAll()
+      accessStamps.removeAll()
+      dailySummaryKeys.removeAll()
+      globalEpoch += 1
+    }
+  }
+
+  // MARK: Patching
+
+  @objc func managedObjectContextDidSave(_ notification: Notification) {
+    guard let userInfo = notification.userInfo else {
+      return
+    }
+
+    let insertedObjects = userInfo[NSInsertedObjectsKey] as? Set<NSManagedObject> ?? []
+    let updatedObjects = userInfo[NSUpdatedObjectsKey] as? Set<NSManagedObject> ?? []
+    let deletedObjects = userInfo[NSDeletedObjectsKey] as? Set<NSManagedObject> ?? []
+
+    // Values are read on the posting thread, which is the queue of the managed object context owning the objects
+    var changedDailySummaries = [(objectID: NSManagedObjectID, date: Date, drinkType: DrinkType, hydration: Double, dehydration: Double)]()
+
+    for case let dailySummary as DailySummary in insertedObjects.union(updatedObjects) {
+      if let drinkType = dailySummary.drinkType {
+        changedDailySummaries.append((objectID: dailySummary.objectID, date: dailySummary.date, drinkType: drinkType, hydration: dailySummary.hydration, dehydration: dailySummary.dehydration))
+      }
+    }
+
+    let deletedDailySummaryIDs = deletedObjects.compactMap { ($0 as? DailySummary)?.objectID }
+
+    if changedDailySummaries.isEmpty && deletedDailySummaryIDs.isEmpty {
+      return
+    }
+
+    queue.sync {
+      for change in changedDailySummaries {
+        invalidateFetch(ofDay: change.date)
+
+        guard var summary = summaries[change.date] else {
+          continue
+        }
+
+        summary.hydrationAmounts[change.drinkType] = change.hydration
+        summary.dehydrationAmounts[change.drinkType] = change.dehydration
+        summaries[change.date] = summary
+        dailySummaryKeys[change.objectID] = (date: change.date, drinkType: change.drinkType)
+      }
+
+      for objectID in deletedDailySummaryIDs {
+        guard let key = dailySummaryKeys.removeValue(forKey: objectID), var summary = summaries[key.date] else {
+          // The day of a daily summary which is not cached is unknown, it may be being fetched
+          if !fetchingDays.isEmpty {
+            globalEpoch += 1
+          }
+          continue
+        }
+
+        summary.hydrationAmounts[key.drinkType] = nil
+        summary.dehydrationAmounts[key.drinkType] = nil
+        summaries[key.date] = summary
+      }
+    }
+  }
+
+  /// Should be called on the queue
+  fileprivate func invalidateFetch(ofDay day: Date) {
+    if let fetchingDay = fetchingDays[day] {
+      fetchingDays[day] = (fetchesCount: fetchingDay.fetchesCount, epoch: fetchingDay.epoch + 1)
+    }
+  }
+
+  fileprivate func touch(_ day: Date) {
+    accessCounter += 1
+    accessStamps[day] = accessCounter
+  }
+
+  /// Evicts the least recently used days if the cache is overfilled
+  fileprivate func evictIfNeeded() {
+    while summaries.count > Constants.maximumDaysCount {
+      guard let leastRecentlyUsedDay = accessStamps.min(by: { $0.value < $1.value })?.key else {
+        return
+      }
+
+      summaries[leastRecentlyUsedDay] = nil
+      accessStamps[leastRecentlyUsedDay] = nil
+
+      for (objectID, key) in dailySummaryKeys where key.date == leastRecentlyUsedDay {
+        dailySummaryKeys[objectID] = nil
+      }
+    }
+  }
+
+}
@@ -0,0 +1,104 @@
+//
+//  GroupCommitter.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+
+/// Groups saves of a writer context requested within the interval into a single commit, so a burst of writes costs one transaction.
+/// Its state is accessed on the queue of the context only, except statistics.
+final class GroupCommitter {
+
+  // MARK: Types
+
+  /// Counters of grouping saves into commits
+  struct Statistics {
+    fileprivate(set) var requestedSavesCount = 0
+    fileprivate(set) var commitsCount = 0
+
+    var savesPerCommit: Double {
+      return commitsCount > 0 ? Double(requestedSavesCount) / Double(commitsCount) : 0
+    }
+  }
+
+  // MARK: Properties
+
+  let managedObjectContext: NSManagedObjectContext
+
+  /// Zero interval turns off grouping, so every save is committed immediately
+  let interval: TimeInterval
+
+  fileprivate let statisticsQueue = DispatchQueue(label: "\(GlobalConstants.bundleId).GroupCommitter.Statistics", attributes: [])
+
+  fileprivate var isCommitScheduled = false
+
+  fileprivate var statistics = Statistics()
+
+  // MARK: Methods
+
+  init(managedObjectContext: NSManagedObjectContext, interval: TimeInterval) {
+    self.managedObjectContext = managedObjectContext
+    self.interval = interval
+  }
+
+  /// Requests saving of changes of the context, they are committed after the interval together with changes of later requests.
+  /// Should be called on the queue of the context.
+  func save() {
+    if !managedObjectContext.hasChanges {
+      return
+    }
+
+    statisticsQueue.async {
+      self.statistics.requestedSavesCount += 1
+    }
+
+    if interval <= 0 {
+      commit()
+      return
+    }
+
+    if isCommitScheduled {
+      return
+    }
+
+    isCommitScheduled = true
+
+    DispatchQueue.global(qos: .utility).asyncAfter(deadline: .now() + interval) { [weak self] in
+      guard let strongSelf = self else {
+        return
+      }
+
+      strongSelf.managedObjectContext.perform {
+        strongSelf.commit()
+      }
+    }
+  }
+
+  /// Durability barrier: commits changes of the context immediately including changes of deferred saves.
+  /// Should be called on the queue of the context.
+  func commit() {
+    isCommitScheduled = false
+
+    if !managedObjectContext.hasChanges {
+      return
+    }
+
+    do {
+      try managedObjectContext.save()
+    } catch {
+      let nserror = error as NSError
+      Logger.logError(Logger.Messages.failedToSaveManagedObjectContext, error: nserror)
+      abort()
+    }
+
+    statisticsQueue.async {
+      self.statistics.commitsCount += 1
+    }
+  }
+
+  func currentStatistics() -> Statistics {
+    return statisticsQueue.sync { statistics }
+  }
+
+}
@@ -0,0 +1,470 @@
+//
+//  HealthKitExporter.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+import HealthKit
+
+/// Subset of HKHealthStore used for exporting, so the exporter can be run against an in-memory stand-in
+@available(iOS 9.0, *)
+protocol HealthKitSampleStore: class {
+  func save(_ objects: [HKObject], withCompletion completion: @escaping (Bool, Error?) -> Void)
+  func deleteObjects(of objectType: HKObjectType, predicate: NSPredicate, withCompletion completion: @escaping (Bool, Int, Error?) -> Void)
+}
+
+@available(iOS 9.0, *)
+extension HKHealthStore: HealthKitSampleStore { }
+
+@available(iOS 9.0, *)
+extension HealthKitSampleStore {
+
+  /// Deletes samples having one of the passed values of the metadata key. Instead of a query per value,
+  /// values are matched by a single IN predicate per sample type split into chunks of bounded size.
+  /// Queries are run concurrently, completion is called once all of them are finished.
+  func deleteSamples(of sampleTypes: [HKSampleType], metadataKey: String, allowedValues: [String], maximumValuesPerQuery: Int = 200, completion: @escaping (_ success: Bool) -> Void) {
+    if allowedValues.isEmpty || sampleTypes.isEmpty {
+      completion(true)
+      return
+    }
+
+    let dispatchGroup = DispatchGroup()
+    let lock = NSLock()
+    var isSucceeded = true
+
+    for chunkStart in stride(from: 0, to: allowedValues.count, by: maximumValuesPerQuery) {
+      let chunk = Array(allowedValues[chunkStart..<min(chunkStart + maximumValuesPerQuery, allowedValues.count)])
+      let predicate = HKQuery.predicateForObjects(withMetadataKey: metadataKey, allowedValues: chunk)
+
+      for sampleType in sampleTypes {
+        dispatchGroup.enter()
+
+        deleteObjects(of: sampleType, predicate: predicate) { success, _, error in
+          if !success {
+            Logger.logError("Failed to delete samples from HealthKit", error: error as NSError?)
+            lock.lock()
+            isSucceeded = false
+            lock.unlock()
+          }
+
+          dispatchGroup.leave()
+        }
+      }
+    }
+
+    dispatchGroup.notify(queue: DispatchQueue.global(qos: .utility)) {
+      completion(isSucceeded)
+    }
+  }
+
+  /// Deletes all samples of the sample types, queries are run concurrently
+  func deleteAllSamples(of sampleTypes: [HKSampleType], completion: @escaping (_ success: Bool) -> Void) {
+    let predicate = HKQuery.predicateForSamples(withStart: nil, end: nil, options: HKQueryOptions())
+    let dispatchGroup = DispatchGroup()
+    let lock = NSLock()
+    var isSucceeded = true
+
+    for sampleType in sampleTypes {
+      dispatchGroup.enter()
+
+      deleteObjects(of: sampleType, predicate: predicate) { success, _, error in
+        if !success {
+          Logger.logError("Failed to delete samples from HealthKit", error: error as NSError?)
+          lock.lock()
+          isSucceeded = false
+          lock.unlock()
+        }
+
+        dispatchGroup.leave()
+      }
+    }
+
+    dispatchGroup.notify(queue: DispatchQueue.global(qos: .utility)) {
+      completion(isSucceeded)
+    }
+  }
+
+}
+
+/// Streams intakes into HealthKit. Intakes are read page by page in order of their dates,
+/// their samples are saved by batches and a bounded number of batches is kept in flight.
+/// Batch size follows observed latency of saving. Export can be cancelled and resumed from the last checkpoint.
+/// The exporter never blocks a thread: reading, saving and bookkeeping are chained by completions on an internal queue.
+@available(iOS 9.0, *)
+final class HealthKitExporter {
+
+  // MARK: Types
+
+  struct Configuration {
+    /// Number of intakes read from the store at once
+    var pageSize = 500
+    var initialBatchSize = 100
+    var minimumBatchSize = 25
+    var maximumBatchSize = 1000
+    var maximumBatchesInFlight = 3
+    /// Batch size is doubled while a batch is saved faster than the half of the latency and halved when it's slower
+    var targetBatchLatency: TimeInterval = 0.5
+    /// Priority of the internal queue
+    var qualityOfService = DispatchQoS.utility
+  }
+
+  /// Position right after the last intake which samples are saved along with all preceding ones
+  struct Checkpoint: Codable {
+    let date: Date
+    /// URIs of exported intakes having exactly the date of the checkpoint
+    let objectURIs: [URL]
+    let exportedIntakesCount: Int
+  }
+
+  enum Outcome {
+    case completed
+    case cancelled(Checkpoint?)
+    /// Batches following the checkpoint may be saved already, so resuming may duplicate a few samples
+    case failed(Checkpoint?, Error?)
+  }
+
+  struct Statistics {
+    var savedSamplesCount = 0
+    var savedBatchesCount = 0
+    var maximumBatchesInFlight = 0
+    var batchSize = 0
+    var averageBatchLatency: TimeInterval = 0
+    var duration: TimeInterval = 0
+  }
+
+  fileprivate struct Batch {
+    let index: Int
+    let samples: [HKObject]
+    let checkpoint: Checkpoint
+  }
+
+  fileprivate typealias PageEntry = (samples: [HKObject], date: Date, objectURI: URL)
+
+  // MARK: Properties
+
+  /// Called on an internal queue each time the checkpoint is advanced
+  var checkpointHandler: ((Checkpoint) -> Void)?
+
+  var statistics: Statistics {
+    return queue.sync { _statistics }
+  }
+
+  fileprivate let healthStore: HealthKitSampleStore
+
+  fileprivate let sampleTypes: [HKSampleType]
+
+  fileprivate let managedObjectContext: NSManagedObjectContext?
+
+  fileprivate let makeSamples: (Intake) -> [HKObject]
+
+  fileprivate let configuration: Configuration
+
+  fileprivate let queue: DispatchQueue
+
+  /// Counts exported intakes, cancelling it cancels the export
+  fileprivate let progress = Progress(totalUnitCount: -1)
+
+  fileprivate var completion: ((Outcome) -> Void)?
+
+  fileprivate var startTime: TimeInterval = 0
+
+  fileprivate var isCancelled = false
+
+  fileprivate var isFailed = false
+
+  fileprivate var failureError: Error?
+
+  fileprivate var batchSize: Int
+
+  fileprivate var lastCheckpoint: Checkpoint?
+
+  // Reading position
+
+  fileprivate var positionDate: Date?
+
+  fileprivate var positionObjectURIs = [URL]()
+
+  fileprivate var producedIntakesCount = 0
+
+  fileprivate var isReadingPage = false
+
+  fileprivate var isExhausted = false
+
+  // Batches
+
+  fileprivate var pendingSamples = [HKObject]()
+
+  fileprivate var hasPendingIntakes = false
+
+  fileprivate var nextBatchIndex = 0
+
+  fileprivate var readyBatches = [Batch]()
+
+  fileprivate var batchesInFlightCount = 0
+
+  /// Checkpoints of saved batches which cannot be acknowledged until all preceding batches are saved
+  fileprivate var savedBatchCheckpoints = [Int: Checkpoint]()
+
+  fileprivate var nextBatchIndexToAcknowledge = 0
+
+  fileprivate var _statistics = Statistics()
+
+  // MARK: Methods
+
+  /// Intakes are read from the passed context or from read contexts of CoreDataStack if the context is omitted
+  init(healthStore: HealthKitSampleStore, sampleTypes: [HKSampleType], managedObjectContext: NSManagedObjectContext? = nil, configuration: Configuration = Configuration(), makeSamples: @escaping (Intake) -> [HKObject]) {
+    self.healthStore = healthStore
+    self.sampleTypes = sampleTypes
+    self.managedObjectContext = managedObjectContext
+    self.configuration = configuration
+    self.makeSamples = makeSamples
+    batchSize = configuration.initialBatchSize
+    queue = DispatchQueue(label: "\(GlobalConstants.bundleId).HealthKitExporter", qos: configuration.qualityOfService)
+  }
+
+  /// Starts exporting and returns immediately. If there is no checkpoint, all existing samples of the sample types are deleted first.
+  /// The returned progress counts exported intakes, cancelling it is the same as calling cancel().
+  /// Completion is called on an internal queue.
+  @discardableResult
+  func start(from checkpoint: Checkpoint?, completion: @escaping (Outcome) -> Void) -> Progress {
+    progress.isCancellable = true
+    progress.cancellationHandler = { [weak self] in
+      self?.cancel()
+    }
+
+    queue.async {
+      self.startTime = ProcessInfo.processInfo.systemUptime
+      self.completion = completion
+      self.lastCheckpoint = checkpoint
+      self.positionDate = checkpoint?.date
+      self.positionObjectURIs = checkpoint?.objectURIs ?? []
+      self.producedIntakesCount = checkpoint?.exportedIntakesCount ?? 0
+
+      if checkpoint == nil {
+        self.healthStore.deleteAllSamples(of: self.sampleTypes) { success in
+          self.queue.async {
+            if success {
+              self.countIntakes()
+            } else {
+              // Exporting over remaining samples would duplicate them
+              self.isFailed = true
+              self.pump()
+            }
+          }
+        }
+      } else {
+        self.countIntakes()
+      }
+    }
+
+    return progress
+  }
+
+  /// Stops reading intakes, batches in flight are awaited and acknowledged before completion.
+  /// It's safe to call it from the checkpoint handler.
+  func cancel() {
+    queue.async {
+      self.isCancelled = true
+      self.pump()
+    }
+  }
+
+  /// Should be called on the internal queue
+  fileprivate func countIntakes() {
+    performRead { managedObjectContext in
+      let fetchRequest = Intake.createFetchRequest()
+      fetchRequest.includesSubentities = false
+      let count = (try? managedObjectContext.count(for: fetchRequest)) ?? 0
+
+      self.queue.async {
+        self.progress.totalUnitCount = Int64(count)
+        self.progress.completedUnitCount = Int64(self.lastCheckpoint?.exportedIntakesCount ?? 0)
+        self.pump()
+      }
+    }
+  }
+
+  /// Keeps the window of batches in flight full and reads the next page once ready batches run low.
+  /// Should be called on the internal queue after each state change.
+  fileprivate func pump() {
+    let isStopped = isCancelled || isFailed
+
+    if !isStopped {
+      while batchesInFlightCount < configuration.maximumBatchesInFlight && !readyBatches.isEmpty {
+        save(readyBatches.removeFirst())
+      }
+
+      if readyBatches.count < configuration.maximumBatchesInFlight && !isReadingPage && !isExhausted {
+        readNextPage()
+      }
+    }
+
+    let isFinished = (isStopped || (isExhausted && readyBatches.isEmpty)) && batchesInFlightCount == 0 && !isReadingPage
+
+    if isFinished, let completion = completion {
+      self.completion = nil
+      _statistics.duration = ProcessInfo.processInfo.systemUptime - startTime
+      _statistics.batchSize = batchSize
+
+      if isFailed {
+        completion(.failed(lastCheckpoint, failureError))
+      } else if isCancelled {
+        completion(.cancelled(lastCheckpoint))
+      } else {
+        completion(.completed)
+      }
+    }
+  }
+
+  /// Should be called on the internal queue
+  fileprivate func readNextPage() {
+    isReadingPage = true
+
+    let fromDate = positionDate
+    let excludedObjectURIs = positionObjectURIs
+
+    performRead { managedObjectContext in
+      let excludedObjectIDs = Set(excludedObjectURIs.compactMap {
+        managedObjectContext.persistentStoreCoordinator?.managedObjectID(forURIRepresentation: $0)
+      })
+
+      let intakes = Intake.fetchIntakesPage(fromDate: fromDate, excludingObjectIDs: excludedObjectIDs, limit: self.configuration.pageSize, managedObjectContext: managedObjectContext)
+
+      // Only values are taken from a page, so the read context is released before batches are saved
+      var page = [PageEntry]()
+      page.reserveCapacity(intakes.count)
+
+      for intake in intakes {
+        page.append((samples: self.makeSamples(intake), date: intake.date, objectURI: intake.objectID.uriRepresentation()))
+        managedObjectContext.refresh(intake, mergeChanges: false)
+      }
+
+      self.queue.async {
+        self.isReadingPage = false
+        self.makeBatches(page)
+        self.pump()
+      }
+    }
+  }
+
+  /// Should be called on the internal queue
+  fileprivate func makeBatches(_ page: [PageEntry]) {
+    if page.isEmpty {
+      isExhausted = true
+
+      if hasPendingIntakes {
+        makeBatchOfPendingSamples()
+      }
+
+      return
+    }
+
+    for entry in page {
+      if entry.date == positionDate {
+        positionObjectURIs.append(entry.objectURI)
+      } else {
+        positionDate = entry.date
+        positionObjectURIs = [entry.objectURI]
+      }
+
+      producedIntakesCount += 1
+      pendingSamples += entry.samples
+      hasPendingIntakes = true
+
+      if pendingSamples.count >= batchSize {
+        makeBatchOfPendingSamples()
+      }
+    }
+  }
+
+  fileprivate func makeBatchOfPendingSamples() {
+    let checkpoint = Checkpoint(date: positionDate ?? Date.distantPast, objectURIs: positionObjectURIs, exportedIntakesCount: producedIntakesCount)
+    readyBatches.append(Batch(index: nextBatchIndex, samples: pendingSamples, checkpoint: checkpoint))
+    nextBatchIndex += 1
+    pendingSamples.removeAll()
+    hasPendingIntakes = false
+  }
+
+  /// Should be called on the internal queue
+  fileprivate func save(_ batch: Batch) {
+    batchesInFlightCount += 1
+    _statistics.maximumBatchesInFlight = max(_statistics.maximumBatchesInFlight, batchesInFlightCount)
+
+    if batch.samples.isEmpty {
+      queue.async {
+        self.didSave(batch, latency: nil)
+      }
+      return
+    }
+
+    let startTime = ProcessInfo.processInfo.systemUptime
+
+    healthStore.save(batch.samples) { success, error in
+      let latency = ProcessInfo.processInfo.systemUptime - startTime
+
+      self.queue.async {
+        if success {
+          self.didSave(batch, latency: latency)
+        } else {
+          if let error = error {
+            Logger.logError("Failed to save samples to HealthKit", error: error as NSError)
+          }
+
+          self.batchesInFlightCount -= 1
+          self.isFailed = true
+          self.failureError = error
+          self.pump()
+        }
+      }
+    }
+  }
+
+  /// Should be called on the internal queue
+  fileprivate func didSave(_ batch: Batch, latency: TimeInterval?) {
+    batchesInFlightCount -= 1
+    savedBatchCheckpoints[batch.index] = batch.checkpoint
+
+    if let latency = latency {
+      let savedBatchesCount = Double(_statistics.savedBatchesCount)
+      _statistics.averageBatchLatency = (_statistics.averageBatchLatency * savedBatchesCount + latency) / (savedBatchesCount + 1)
+      _statistics.savedBatchesCount += 1
+      _statistics.savedSamplesCount += batch.samples.count
+      adjustBatchSize(latency: latency)
+    }
+
+    var acknowledgedCheckpoint: Checkpoint?
+
+    while let checkpoint = savedBatchCheckpoints.removeValue(forKey: nextBatchIndexToAcknowledge) {
+      acknowledgedCheckpoint = checkpoint
+      nextBatchIndexToAcknowledge += 1
+    }
+
+    if let checkpoint = acknowledgedCheckpoint {
+      lastCheckpoint = checkpoint
+      progress.completedUnitCount = Int64(checkpoint.exportedIntakesCount)
+      checkpointHandler?(checkpoint)
+    }
+
+    pump()
+  }
+
+  fileprivate func adjustBatchSize(latency: TimeInterval) {
+    if latency < configuration.targetBatchLatency / 2 {
+      batchSize = min(batchSize * 2, configuration.maximumBatchSize)
+    } else if latency > configuration.targetBatchLatency {
+      batchSize = max(batchSize / 2, configuration.minimumBatchSize)
+    }
+  }
+
+  fileprivate func performRead(_ callback: @escaping (NSManagedObjectContext) -> Void) {
+    if let managedObjectContext = managedObjectContext {
+      managedObjectContext.perform {
+        callback(managedObjectContext)
+      }
+    } else {
+      CoreDataStack.performRead(callback)
+    }
+  }
+
+}
@@ -0,0 +1,360 @@
+//
+//  HealthKitOutbox.swift
+//  Aquaz
+//
+
+import Foundation
+import HealthKit
+
+/// Durable journal of intake changes waiting to be reflected in HealthKit.
+/// Changes of an intake are coalesced, so adding and then editing an intake results in a single save,
+/// and adding and then removing it results in nothing. The journal is stored in the shared container,
+/// it's flushed in batches shortly after recording and retried with exponential backoff on failures.
+@available(iOS 9.0, *)
+final class HealthKitOutbox {
+
+  // MARK: Types
+
+  /// Values of an intake required for creating its samples
+  struct IntakeValues: Codable {
+    let date: Date
+    let hydrationAmount: Double
+    let caffeineAmount: Double
+    let drinkName: String
+  }
+
+  struct Change: Codable {
+    enum Operation: String, Codable {
+      case insert
+      case update
+      case delete
+    }
+
+    let intakeId: String
+    var operation: Operation
+    var values: IntakeValues?
+    /// Increased on each recording, it allows to detect changes recorded while the change is being flushed
+    var sequence: Int
+
+    init(intakeId: String, operation: Operation, values: IntakeValues?) {
+      self.intakeId = intakeId
+      self.operation = operation
+      self.values = values
+      sequence = 0
+    }
+  }
+
+  struct Configuration {
+    /// Delay between recording a change and flushing, changes recorded meanwhile are flushed together
+    var flushDelay: TimeInterval = 1
+    var initialRetryDelay: TimeInterval = 2
+    var maximumRetryDelay: TimeInterval = 300
+    var maximumSamplesPerSave = 500
+  }
+
+  /// Samples saved by a single call together with intakes they belong to
+  fileprivate struct SaveChunk {
+    var intakeIds: [String]
+    var samples: [HKObject]
+  }
+
+  fileprivate struct Constants {
+    static let fileName = "HealthKitOutbox.plist"
+  }
+
+  // MARK: Properties
+
+  var pendingChangesCount: Int {
+    return queue.sync { changes.count }
+  }
+
+  fileprivate let healthStore: HealthKitSampleStore
+
+  fileprivate let fileURL: URL?
+
+  fileprivate let configuration: Configuration
+
+  /// Quantity types allowed for sharing at the moment of flushing
+  fileprivate let sampleTypes: () -> [HKSampleType]
+
+  fileprivate let makeSamples: (_ intakeId: String, _ values: IntakeValues) -> [HKObject]
+
+  fileprivate let metadataIdentifierKey: String
+
+  fileprivate let queue = DispatchQueue(label: "\(GlobalConstants.bundleId).HealthKitOutbox", attributes: [])
+
+  fileprivate var changes = [String: Change]()
+
+  fileprivate var lastSequence = 0
+
+  fileprivate var isFlushScheduled = false
+
+  fileprivate var isFlushing = false
+
+  fileprivate var flushingIntakeIds = Set<String>()
+
+  fileprivate var retryAttempt = 0
+
+  fileprivate var flushCompletions = [() -> Void]()
+
+  // MARK: Methods
+
+  /// The journal is loaded from the file and flushing is scheduled if there are changes left from the previous run.
+  /// Pass nil as the file URL to keep the journal in memory only.
+  init(healthStore: HealthKitSampleStore, fileURL: URL?, configuration: Configuration = Configuration(), metadataIdentifierKey: String, sampleTypes: @escaping () -> [HKSampleType], makeSamples: @escaping (_ intakeId: String, _ values: IntakeValues) -> [HKObject]) {
+    self.healthStore = healthStore
+    self.fileURL = fileURL
+    self.configuration = configuration
+    self.metadataIdentifierKey = metadataIdentifierKey
+    self.sampleTypes = sampleTypes
+    self.makeSamples = makeSamples
+
+    queue.sync {
+      loadJournal()
+
+      if !changes.isEmpty {
+        scheduleFlush(after: configuration.flushDelay)
+      }
+    }
+  }
+
+  /// URL of the journal in the shared container
+  static var defaultFileURL: URL? {
+    return FileManager.default.containerURL(forSecurityApplicationGroupIdentifier: GlobalConstants.appGroupName)?.appendingPathComponent(Constants.fileName)
+  }
+
+  /// Coalesces the changes with already recorded ones, stores the journal and schedules flushing
+  func record(_ newChanges: [Change]) {
+    if newChanges.isEmpty {
+      return
+    }
+
+    queue.async {
+      for var change in newChanges {
+        self.lastSequence += 1
+        change.sequence = self.lastSequence
+
+        var existingChange = self.changes[change.intakeId]
+
+        // A sample being saved right now should be treated as an existing one
+        if existingChange?.operation == .insert && self.flushingIntakeIds.contains(change.intakeId) {
+          existingChange?.operation = .update
+        }
+
+        self.changes[change.intakeId] = HealthKitOutbox.coalesce(existingChange, with: change)
+      }
+
+      self.saveJournal()
+      self.scheduleFlush(after: self.configuration.flushDelay)
+    }
+  }
+
+  /// Drops all recorded changes, e.g. if all samples are going to be exported anew
+  func removeAll() {
+    queue.async {
+      self.changes.removeAll()
+      self.saveJournal()
+    }
+  }
+
+  /// Flushes recorded changes without waiting for the delay, completion is called once the journal is empty or flushing fails
+  func flush(completion: (() -> Void)? = nil) {
+    queue.async {
+      if let completion = completion {
+        self.flushCompletions.append(completion)
+      }
+
+      self.flushIfPossible()
+    }
+  }
+
+  /// Result of recording the new change after the existing one. Nil means the changes cancel each other.
+  class func coalesce(_ existingChange: Change?, with newChange: Change) -> Change? {
+    guard var change = existingChange else {
+      return newChange
+    }
+
+    change.sequence = newChange.sequence
+
+    switch (change.operation, newChange.operation) {
+    case (.insert, .delete):
+      // The sample has never been saved
+      return nil
+
+    case (.insert, _):
+      change.values = newChange.values
+      return change
+
+    case (_, .delete):
+      change.operation = .delete
+      change.values = nil
+      return change
+
+    default:
+      change.operation = .update
+      change.values = newChange.values
+      return change
+    }
+  }
+
+  /// Should be called on the internal queue
+  fileprivate func scheduleFlush(after delay: TimeInterval) {
+    if isFlushScheduled {
+      return
+    }
+
+    isFlushScheduled = true
+
+    queue.asyncAfter(deadline: .now() + delay) {
+      self.isFlushScheduled = false
+      self.flushIfPossible()
+    }
+  }
+
+  /// Should be called on the internal queue
+  fileprivate func flushIfPossible() {
+    if isFlushing {
+      return
+    }
+
+    if changes.isEmpty {
+      callFlushCompletions()
+      return
+    }
+
+    isFlushing = true
+
+    let flushedChanges = Array(changes.values)
+    flushingIntakeIds = Set(changes.keys)
+    let sampleTypes = self.sampleTypes()
+
+    // Old samples of updated intakes are removed before saving new ones
+    let removedIntakeIds = flushedChanges.filter { $0.operation != .insert }.map { $0.intakeId }
+
+    // Samples of an intake are never split between chunks, so each saved chunk completes its changes
+    var chunks = [SaveChunk]()
+
+    for change in flushedChanges where change.operation != .delete {
+      let changeSamples = change.values.map { makeSamples(change.intakeId, $0) } ?? []
+
+      if let lastChunk = chunks.last, lastChunk.samples.count + changeSamples.count <= configuration.maximumSamplesPerSave {
+        chunks[chunks.count - 1].intakeIds.append(change.intakeId)
+        chunks[chunks.count - 1].samples += changeSamples
+      } else {
+        chunks.append(SaveChunk(intakeIds: [change.intakeId], samples: changeSamples))
+      }
+    }
+
+    healthStore.deleteSamples(of: sampleTypes, metadataKey: metadataIdentifierKey, allowedValues: removedIntakeIds) { success in
+      if !success {
+        self.queue.async { self.didFlush(flushedChanges, completedIntakeIds: [], success: false) }
+        return
+      }
+
+      // Removal of deleted intakes is complete even if saving of new samples fails
+      let deletedIntakeIds = flushedChanges.filter { $0.operation == .delete }.map { $0.intakeId }
+
+      self.saveChunks(chunks[...], savedIntakeIds: Set(deletedIntakeIds)) { completedIntakeIds, success in
+        self.queue.async { self.didFlush(flushedChanges, completedIntakeIds: completedIntakeIds, success: success) }
+      }
+    }
+  }
+
+  /// Saves chunks one by one and stops on the first failure. Completion gets identifiers of intakes whose samples are saved.
+  fileprivate func saveChunks(_ chunks: ArraySlice<SaveChunk>, savedIntakeIds: Set<String>, completion: @escaping (Set<String>, Bool) -> Void) {
+    guard let chunk = chunks.first else {
+      completion(savedIntakeIds, true)
+      return
+    }
+
+    if chunk.samples.isEmpty {
+      saveChunks(chunks.dropFirst(), savedIntakeIds: savedIntakeIds.union(chunk.intakeIds), completion: completion)
+      return
+    }
+
+    healthStore.save(chunk.samples) { success, error in
+      if !success {
+        Logger.logError("Failed to save samples to HealthKit", error: error as NSError?)
+        completion(savedIntakeIds, false)
+        return
+      }
+
+      self.saveChunks(chunks.dropFirst(), savedIntakeIds: savedIntakeIds.union(chunk.intakeIds), completion: completion)
+    }
+  }
+
+  /// Should be called on the internal queue
+  fileprivate func didFlush(_ flushedChanges: [Change], completedIntakeIds: Set<String>, success: Bool) {
+    isFlushing = false
+    flushingIntakeIds.removeAll()
+
+    // Completed changes are removed even if flushing fails, otherwise samples of saved chunks would be saved again on retrying
+    for flushedChange in flushedChanges where success || completedIntakeIds.contains(flushedChange.intakeId) {
+      guard let change = changes[flushedChange.intakeId] else {
+        continue
+      }
+
+      // Changes recorded while flushing are left for the next flush
+      if change.sequence == flushedChange.sequence {
+        changes[flushedChange.intakeId] = nil
+      }
+    }
+
+    saveJournal()
+
+    if !success {
+      let delay = min(configuration.initialRetryDelay * pow(2, Double(retryAttempt)), configuration.maximumRetryDelay)
+      retryAttempt += 1
+      callFlushCompletions()
+      scheduleFlush(after: delay)
+      return
+    }
+
+    retryAttempt = 0
+
+    if changes.isEmpty {
+      callFlushCompletions()
+    } else {
+      flushIfPossible()
+    }
+  }
+
+  fileprivate func callFlushCompletions() {
+    let completions = flushCompletions
+    flushCompletions.removeAll()
+    completions.forEach { $0() }
+  }
+
+  fileprivate func loadJournal() {
+    guard let fileURL = fileURL, let data = try? Data(contentsOf: fileURL) else {
+      return
+    }
+
+    do {
+      let storedChanges = try PropertyListDecoder().decode([Change].self, from: data)
+
+      for change in storedChanges {
+        changes[change.intakeId] = change
+        lastSequence = max(lastSequence, change.sequence)
+      }
+    } catch let error as NSError {
+      Logger.logError("Failed to read the HealthKit outbox", error: error)
+    }
+  }
+
+  fileprivate func saveJournal() {
+    guard let fileURL = fileURL else {
+      return
+    }
+
+    let encoder = PropertyListEncoder()
+    encoder.outputFormat = .binary
+
+    do {
+      try encoder.encode(Array(changes.values)).write(to: fileURL, options: .atomic)
+    } catch let error as NSError {
+      Logger.logError("Failed to write the HealthKit outbox", error: error)
+    }
+  }
+
+}
@@ -20,6 +20,13 @@ final class HealthKitProvider: NSObject {
 
   fileprivate struct Constants {
     static let metadataIdentifierKey = "Intake Identifier"
+    static let exportCheckpointKey = "HealthKitProvider.ExportCheckpoint"
+  }
+
+  /// Checkpoint of an export together with sample types it writes, so it's not resumed after authorization is changed
+  fileprivate struct ExportCheckpoint: Codable {
+    let sampleTypeIdentifiers: [String]
+    let checkpoint: HealthKitExporter.Checkpoint
   }
 
   
@@ -30,6 +37,15 @@ final class HealthKitProvider: NSObject {
   
   fileprivate var localizedStrings = LocalizedStrings()
   
+  fileprivate let exportQueue = DispatchQueue(label: "\(GlobalConstants.bundleId).HealthKitProvider.Export", attributes: [])
+  
+  fileprivate var activeExporter: HealthKitExporter?
+  
+  fileprivate var outbox: HealthKitOutbox!
+  
+  /// Identifiers of intakes being deleted by the current save of the writer context, accessed on its queue only
+  fileprivate var deletedIntakeIds = [NSManagedObjectID: String]()
+  
   fileprivate let waterQuantityType = HKQuantityType.quantityType(forIdentifier: HKQuantityTypeIdentifier.dietaryWater)!
 
   fileprivate let caffeineQuantityType = HKQuantityType.quantityType(forIdentifier: HKQuantityTypeIdentifier.dietaryCaffeine)!
@@ -45,7 +61,22 @@ final class HealthKitProvider: NSObject {
   override init() {
     super.init()
     
-    CoreDataStack.performOnPrivateContext { managedObjectContext in
+    outbox = HealthKitOutbox(
+      healthStore: healthKitStore,
+      fileURL: HealthKitOutbox.defaultFileURL,
+      metadataIdentifierKey: Constants.metadataIdentifierKey,
+      sampleTypes: { [unowned self] in self.getAuthorizedSampleTypes() },
+      makeSamples: { [unowned self] intakeId, values in
+        self.createSamples(intakeId: intakeId, values: values, water: self.waterSharingIsAuthorized, caffeine: self.caffeineSharingIsAuthorized)
+      })
+    
+    CoreDataStack.performWrite { managedObjectContext in
+      NotificationCenter.default.addObserver(
+        self,
+        selector: #selector(self.contextWillSaveContext(_:)),
+        name: NSNotification.Name.NSManagedObjectContextWillSave,
+        object: managedObjectContext)
+      
       NotificationCenter.default.addObserver(
         self,
         selector: #selector(self.contextDidSaveContext(_:)),
@@ -84,93 +115,139 @@ final class HealthKitProvider: NSObject {
     }
   }
   
-  /// Exports all intakes into HealthKit, all old samples in HealthKit will be deleted.
-  func exportAllIntakesToHealthKit(progress: @escaping (_ current: Int, _ maximum: Int) -> Void, completion: @escaping () -> Void) {
-    let dispatchGroup = DispatchGroup()
+  /// Exports all intakes into HealthKit from scratch, all old samples in HealthKit will be deleted.
+  /// A checkpoint left by an interrupted export is discarded, so intakes changed meanwhile and newly authorized sample types are exported too.
+  /// The method returns immediately, the returned progress counts exported intakes and can be cancelled.
+  @discardableResult
+  func exportAllIntakesToHealthKit(qualityOfService: DispatchQoS = .userInitiated, completion: @escaping () -> Void) -> Progress {
+    HealthKitProvider.storeExportCheckpoint(nil)
+    return startExport(from: nil, sampleTypes: getAuthorizedSampleTypes(), qualityOfService: qualityOfService, completion: completion)
+  }
+  
+  /// Resumes an export interrupted e.g. by termination of the application from its last checkpoint.
+  /// Returns nil if there is no export to resume for the currently authorized sample types or an export is running already.
+  func resumeInterruptedExportToHealthKit(qualityOfService: DispatchQoS = .userInitiated, completion: @escaping () -> Void) -> Progress? {
+    let sampleTypes = getAuthorizedSampleTypes()
+    
+    guard let checkpoint = HealthKitProvider.loadExportCheckpoint(sampleTypes: sampleTypes),
+          exportQueue.sync(execute: { activeExporter == nil }) else
+    {
+      return nil
+    }
+    
+    return startExport(from: checkpoint, sampleTypes: sampleTypes, qualityOfService: qualityOfService, completion: completion)
+  }
+  
+  fileprivate func startExport(from checkpoint: HealthKitExporter.Checkpoint?, sampleTypes: [HKSampleType], qualityOfService: DispatchQoS, completion: @escaping () -> Void) -> Progress {
     // Just some minor optimizations
     let localWaterSharingIsAuthorized = waterSharingIsAuthorized
     let localCaffeineSharingIsAuthorized = caffeineSharingIsAuthorized
     
-    // Remove water samples from Apple Health
-    if localWaterSharingIsAuthorized {
-      dispatchGroup.enter()
-
-      let predicate = HKQuery.predicateForSamples(withStart: nil, end: nil, options: HKQueryOptions())
-
-      healthKitStore.deleteObjects(of: waterQuantityType, predicate: predicate) { success, deletedObjectCount, error in
-        dispatchGroup.leave()
-      }
-      
-      _ = dispatchGroup.wait(timeout: .distantFuture)
-    }
-
-    // Remove caffeine samples from Apple Health
-    if localCaffeineSharingIsAuthorized {
-      dispatchGroup.enter()
-      
-      let predicate = HKQuery.predicateForSamples(withStart: nil, end: nil, options: HKQueryOptions())
-      
-      healthKitStore.deleteObjects(of: caffeineQuantityType, predicate: predicate) { success, deletedObjectCount, error in
-        dispatchGroup.leave()
-      }
-      
-      _ = dispatchGroup.wait(timeout: .distantFuture)
+    var configuration = HealthKitExporter.Configuration()
+    configuration.qualityOfService = qualityOfService
+    
+    let exporter = HealthKitExporter(healthStore: healthKitStore, sampleTypes: sampleTypes, configuration: configuration) { intake in
+      return self.createSamples(intakeId: self.getIntakeId(intake), values: self.getIntakeValues(intake), water: localWaterSharingIsAuthorized, caffeine: localCaffeineSharingIsAuthorized)
     }
-
-    // Add samples to Apple Health
-    var samplesToSave = [HKQuantitySample]()
     
-    CoreDataStack.performOnPrivateContextAndWait { privateContext in
-      let intakes = Intake.fetchIntakes(beginDate: nil, endDate: nil, managedObjectContext: privateContext)
-      
-      for intake in intakes {
-        if localWaterSharingIsAuthorized, let waterSample = self.createWaterQuantitySampleFromIntake(intake) {
-          samplesToSave.append(waterSample)
-        }
-        
-        if localCaffeineSharingIsAuthorized, let caffeineSample = self.createCaffeineQuantitySampleFromIntake(intake) {
-          samplesToSave.append(caffeineSample)
+    // A replaced exporter may still acknowledge batches in flight, its checkpoints are not stored
+    exporter.checkpointHandler = { [unowned self] checkpoint in
+      self.exportQueue.sync {
+        if self.activeExporter === exporter {
+          HealthKitProvider.storeExportCheckpoint(checkpoint, sampleTypes: sampleTypes)
         }
       }
     }
     
-    progress(0, samplesToSave.count)
+    exportQueue.sync {
+      activeExporter?.cancel()
+      activeExporter = exporter
+    }
     
-    let maxSamplesInPacket = 100
-    var packetIndex = 0
+    if checkpoint == nil {
+      // All samples are going to be recreated from the current state of intakes
+      outbox.removeAll()
+    }
     
-    while true {
-      let skippedSamples = packetIndex * maxSamplesInPacket
-      let sliceToSave = samplesToSave.dropFirst(skippedSamples).prefix(maxSamplesInPacket) as ArraySlice<HKQuantitySample>
-      
-      if sliceToSave.isEmpty {
+    return exporter.start(from: checkpoint) { outcome in
+      switch outcome {
+      case .completed:
+        self.exportQueue.sync {
+          if self.activeExporter === exporter {
+            HealthKitProvider.storeExportCheckpoint(nil)
+          }
+        }
+        
+      case .cancelled:
         break
+        
+      case .failed(_, let error):
+        Logger.logError("Export to HealthKit is interrupted", error: error as NSError?)
       }
       
-      packetIndex += 1
+      Logger.logInfo("Export to HealthKit is finished", logDetails: [
+        "samples": String(exporter.statistics.savedSamplesCount),
+        "batch size": String(exporter.statistics.batchSize),
+        "duration": String(format: "%.3f", exporter.statistics.duration)])
       
-      dispatchGroup.enter()
-
-      let packetToSave = Array<HKQuantitySample>(sliceToSave)
+      self.exportQueue.sync {
+        if self.activeExporter === exporter {
+          self.activeExporter = nil
+        }
+      }
       
-      healthKitStore.save(packetToSave, withCompletion: { success, error in
-        progress(skippedSamples + sliceToSave.count, samplesToSave.count)
-        dispatchGroup.leave()
-      })
-
-      _ = dispatchGroup.wait(timeout: .distantFuture)
+      completion()
     }
+  }
   
-    completion()
+  /// Flushes changes of intakes waiting in the outbox without the usual delay
+  func flushPendingChanges(_ completion: (() -> Void)? = nil) {
+    outbox.flush(completion: completion)
   }
   
-  /// Reads user profile and executes completion closure as a result
-  func readUserProfile(_ completion: @escaping (_ age: Int?, _ biologicalSex: HKBiologicalSex?, _ bodyMass: HKQuantitySample?, _ height: HKQuantitySample?) -> Void) {
-    let age = readAge()
-    let biologicalSex = readBiologicalSex()
-
+  /// Returns the checkpoint of an interrupted export if it has been made for the same sample types
+  fileprivate class func loadExportCheckpoint(sampleTypes: [HKSampleType]) -> HealthKitExporter.Checkpoint? {
+    guard let data = Settings.userDefaults.data(forKey: Constants.exportCheckpointKey),
+          let exportCheckpoint = try? PropertyListDecoder().decode(ExportCheckpoint.self, from: data),
+          exportCheckpoint.sampleTypeIdentifiers == sampleTypeIdentifiers(sampleTypes) else
+    {
+      return nil
+    }
+    
+    return exportCheckpoint.checkpoint
+  }
+  
+  fileprivate class func storeExportCheckpoint(_ checkpoint: HealthKitExporter.Checkpoint?, sampleTypes: [HKSampleType] = []) {
+    let exportCheckpoint = checkpoint.map { ExportCheckpoint(sampleTypeIdentifiers: sampleTypeIdentifiers(sampleTypes), checkpoint: $0) }
+    
+    if let exportCheckpoint = exportCheckpoint, let data = try? PropertyListEncoder().encode(exportCheckpoint) {
+      Settings.userDefaults.set(data, forKey: Constants.exportCheckpointKey)
+    } else {
+      Settings.userDefaults.removeObject(forKey: Constants.exportCheckpointKey)
+    }
+  }
+  
+  fileprivate class func sampleTypeIdentifiers(_ sampleTypes: [HKSampleType]) -> [String] {
+    return sampleTypes.map { $0.identifier }.sorted()
+  }
+  
+  /// Reads user profile and executes completion closure on the main queue as a result.
+  /// All characteristics and samples are read concurrently.
+  func readUserProfile(qualityOfService: DispatchQoS = .userInitiated, _ completion: @escaping (_ age: Int?, _ biologicalSex: HKBiologicalSex?, _ bodyMass: HKQuantitySample?, _ height: HKQuantitySample?) -> Void) {
     let dispatchGroup = DispatchGroup()
     
+    // Read age
+    var age: Int?
+    DispatchQueue.global(qos: qualityOfService.qosClass).async(group: dispatchGroup) {
+      age = self.readAge()
+    }
+    
+    // Read biological sex
+    var biologicalSex: HKBiologicalSex?
+    DispatchQueue.global(qos: qualityOfService.qosClass).async(group: dispatchGroup) {
+      biologicalSex = self.readBiologicalSex()
+    }
+    
     // Read body mass
     dispatchGroup.enter()
     var bodyMass: HKQuantitySample?
@@ -258,139 +335,101 @@ final class HealthKitProvider: NSObject {
     healthKitStore.execute(sampleQuery)
   }
   
-  /// Saves water sample of intake to HealthKit
-  fileprivate func saveWaterSampleOfIntake(_ intake: Intake, completion: ((_ success: Bool) -> Void)? = nil) {
-    if let waterSample = createWaterQuantitySampleFromIntake(intake) {
-      healthKitStore.save(waterSample, withCompletion: { success, error in
-        completion?(success)
-      }) 
-    }
-  }
-
-  /// Saves caffeine sample of intake to HealthKit
-  fileprivate func saveCaffeineSampleOfIntake(_ intake: Intake, completion: ((_ success: Bool) -> Void)? = nil) {
-      if let caffeineSample = createCaffeineQuantitySampleFromIntake(intake) {
-        healthKitStore.save(caffeineSample, withCompletion: { success, error in
-          completion?(success)
-        }) 
-      }
-  }
-  
-  fileprivate func createWaterQuantitySampleFromIntake(_ intake: Intake) -> HKQuantitySample? {
-    guard let intakeId = getIntakeId(intake) else {
-      return nil
-    }
-    
-    let quantity = HKQuantity(unit: HKUnit.literUnit(with: .milli), doubleValue: intake.hydrationAmount)
+  /// Creates samples of the intake for quantity types allowed for sharing
+  fileprivate func createSamples(intakeId: String, values: HealthKitOutbox.IntakeValues, water: Bool, caffeine: Bool) -> [HKObject] {
+    var samples = [HKObject]()
     
     let metadata = [
-      localizedStrings.metadataDrinkKeyTitle: intake.drink.localizedName,
+      localizedStrings.metadataDrinkKeyTitle: values.drinkName,
       Constants.metadataIdentifierKey: intakeId]
     
-    return HKQuantitySample(type: waterQuantityType, quantity: quantity, start: intake.date as Date, end: intake.date as Date, metadata: metadata)
-  }
-
-  fileprivate func createCaffeineQuantitySampleFromIntake(_ intake: Intake) -> HKQuantitySample? {
-    if intake.caffeineAmount == 0 {
-      return nil
+    if water {
+      let quantity = HKQuantity(unit: HKUnit.literUnit(with: .milli), doubleValue: values.hydrationAmount)
+      samples.append(HKQuantitySample(type: waterQuantityType, quantity: quantity, start: values.date, end: values.date, metadata: metadata))
     }
     
-    guard let intakeId = getIntakeId(intake) else {
-      return nil
+    if caffeine && values.caffeineAmount != 0 {
+      let quantity = HKQuantity(unit: HKUnit.gramUnit(with: .milli), doubleValue: values.caffeineAmount)
+      samples.append(HKQuantitySample(type: caffeineQuantityType, quantity: quantity, start: values.date, end: values.date, metadata: metadata))
     }
     
-    let quantity = HKQuantity(unit: HKUnit.gramUnit(with: .milli), doubleValue: intake.caffeineAmount)
-    
-    let metadata = [
-      localizedStrings.metadataDrinkKeyTitle: intake.drink.localizedName,
-      Constants.metadataIdentifierKey: intakeId]
-    
-    return HKQuantitySample(type: caffeineQuantityType, quantity: quantity, start: intake.date as Date, end: intake.date as Date, metadata: metadata)
+    return samples
   }
   
-  /// Removes sample of intake from HealthKit
-  fileprivate func removeSampleOfIntake(_ intake: Intake, sample: String, completion: (() -> Void)?) {
-    guard let sampleType = HKSampleType.quantityType(forIdentifier: HKQuantityTypeIdentifier(rawValue: sample)) else {
-      return
-    }
+  fileprivate func getIntakeValues(_ intake: Intake) -> HealthKitOutbox.IntakeValues {
+    return HealthKitOutbox.IntakeValues(
+      date: intake.date,
+      hydrationAmount: intake.hydrationAmount,
+      caffeineAmount: intake.caffeineAmount,
+      drinkName: intake.drink.localizedName)
+  }
+  
+  /// Stored identifier is used if it's assigned. Intakes created by previous versions fall back to
+  /// the last path component of the object URI, which their existing samples in HealthKit are marked with.
+  fileprivate func getIntakeId(_ intake: Intake) -> String {
+    return intake.healthKitID ?? intake.objectID.uriRepresentation().lastPathComponent
+  }
+  
+  fileprivate func getAuthorizedSampleTypes() -> [HKSampleType] {
+    var sampleTypes = [HKSampleType]()
     
-    guard let intakeId = getIntakeId(intake) else {
-      return
+    if waterSharingIsAuthorized {
+      sampleTypes.append(waterQuantityType)
     }
     
-    let predicate = HKQuery.predicateForObjects(withMetadataKey: Constants.metadataIdentifierKey, allowedValues: [intakeId])
-    
-    healthKitStore.deleteObjects(of: sampleType, predicate: predicate) { success, deletedObjectCount, error in
-      completion?()
+    if caffeineSharingIsAuthorized {
+      sampleTypes.append(caffeineQuantityType)
     }
+    
+    return sampleTypes
   }
   
-  /// Updates water sample of intake in HealthKit, actually removes an old sample object related to the intake and saves a new one.
-  fileprivate func updateWaterSampleOfIntake(_ intake: Intake) {
-    removeSampleOfIntake(intake, sample: HKQuantityTypeIdentifier.dietaryWater.rawValue) {
-      self.saveWaterSampleOfIntake(intake)
-    }
-  }
+  // MARK: Synchronization with CoreData
   
-  /// Updates caffeine sample of intake in HealthKit, actually removes an old sample object related to the intake and saves a new one.
-  fileprivate func updateCaffeineSampleOfIntake(_ intake: Intake) {
-    removeSampleOfIntake(intake, sample: HKQuantityTypeIdentifier.dietaryCaffeine.rawValue) {
-      self.saveCaffeineSampleOfIntake(intake)
+  /// Identifiers of deleted intakes are taken before saving, because attributes of deleted objects are not reliable after it
+  @objc func contextWillSaveContext(_ notification: Notification) {
+    guard let managedObjectContext = notification.object as? NSManagedObjectContext else {
+      return
+    }
+    
+    deletedIntakeIds.removeAll()
+    
+    for case let intake as Intake in managedObjectContext.deletedObjects {
+      deletedIntakeIds[intake.objectID] = getIntakeId(intake)
     }
   }
   
-  fileprivate func getIntakeId(_ intake: Intake) -> String? {
-    return intake.objectID.uriRepresentation().lastPathComponent
-  }
-  
-  // MARK: Synchronization with CoreData
-  
+  /// Only values of changed intakes are taken on the save path, HealthKit is updated later by the outbox
   @objc func contextDidSaveContext(_ notification: Notification) {
-    let waterChangesAuthorized = healthKitStore.authorizationStatus(for: waterQuantityType) == .sharingAuthorized
-    let caffeineChangesAuthorized = healthKitStore.authorizationStatus(for: caffeineQuantityType) == .sharingAuthorized
+    let intakeIdsOfDeletedObjects = deletedIntakeIds
+    deletedIntakeIds.removeAll()
     
-    if !waterChangesAuthorized && !caffeineChangesAuthorized {
+    if !waterSharingIsAuthorized && !caffeineSharingIsAuthorized {
       return
     }
     
-    // Delete intakes from HealthKit
-    if let deletedObjects = (notification as NSNotification).userInfo?[NSDeletedObjectsKey] as? Set<NSManagedObject> {
-      for deletedObject in deletedObjects where deletedObject is Intake {
-        if waterChangesAuthorized {
-          self.removeSampleOfIntake(deletedObject as! Intake, sample: HKQuantityTypeIdentifier.dietaryWater.rawValue, completion: nil)
-        }
-        
-        if caffeineChangesAuthorized {
-          self.removeSampleOfIntake(deletedObject as! Intake, sample: HKQuantityTypeIdentifier.dietaryCaffeine.rawValue, completion: nil)
-        }
+    var changes = [HealthKitOutbox.Change]()
+    
+    if let deletedObjects = notification.userInfo?[NSDeletedObjectsKey] as? Set<NSManagedObject> {
+      for case let intake as Intake in deletedObjects {
+        let intakeId = intakeIdsOfDeletedObjects[intake.objectID] ?? intake.objectID.uriRepresentation().lastPathComponent
+        changes.append(HealthKitOutbox.Change(intakeId: intakeId, operation: .delete, values: nil))
       }
     }
     
-    // Insert intakes to HealthKit
-    if let insertedObjects = (notification as NSNotification).userInfo?[NSInsertedObjectsKey] as? Set<NSManagedObject> {
-      for insertedObject in insertedObjects where insertedObject is Intake {
-        if waterChangesAuthorized {
-          self.saveWaterSampleOfIntake(insertedObject as! Intake)
-        }
-        
-        if caffeineChangesAuthorized {
-          self.saveCaffeineSampleOfIntake(insertedObject as! Intake)
-        }
+    if let insertedObjects = notification.userInfo?[NSInsertedObjectsKey] as? Set<NSManagedObject> {
+      for case let intake as Intake in insertedObjects {
+        changes.append(HealthKitOutbox.Change(intakeId: getIntakeId(intake), operation: .insert, values: getIntakeValues(intake)))
       }
     }
     
-    // Update intakes in HealthKit
-    if let updatedObjects = (notification as NSNotification).userInfo?[NSUpdatedObjectsKey] as? Set<NSManagedObject> {
-      for updatedObject in updatedObjects where updatedObject is Intake {
-        if waterChangesAuthorized {
-          self.updateWaterSampleOfIntake(updatedObject as! Intake)
-        }
-        
-        if caffeineChangesAuthorized {
-          self.updateCaffeineSampleOfIntake(updatedObject as! Intake)
-        }
+    if let updatedObjects = notification.userInfo?[NSUpdatedObjectsKey] as? Set<NSManagedObject> {
+      for case let intake as Intake in updatedObjects {
+        changes.append(HealthKitOutbox.Change(intakeId: getIntakeId(intake), operation: .update, values: getIntakeValues(intake)))
       }
     }
+    
+    outbox.record(changes)
   }
   
 }
@@ -36,6 +36,7 @@ class Logger {
     static let name = "name"
     static let date = "date"
     static let count = "count"
+    static let callSite = "callSite"
   }
   
   static let sharedInstance = Logger()
@@ -0,0 +1,165 @@
+//
+//  PersistentHistoryTracker.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+
+/// Catches up with transactions committed to the shared store by other processes: the application, the widget and extensions.
+/// Every process keeps a token of the last transaction it has seen and fetches only newer transactions of other authors.
+/// History seen by all processes is pruned at most once per pruning interval, lagging processes don't hold it longer than maximumHistoryAge.
+@available(iOS 11.0, *)
+final class PersistentHistoryTracker {
+
+  // MARK: Types
+
+  /// Changed object identifiers of a transaction indexed by NSInsertedObjectsKey, NSUpdatedObjectsKey and NSDeletedObjectsKey
+  typealias TransactionChanges = [String: Set<NSManagedObjectID>]
+
+  struct CatchUp {
+    let transactions: [TransactionChanges]
+    /// True if history after the token has been pruned, so changes made meanwhile are unknown
+    let isIncomplete: Bool
+  }
+
+  struct Configuration {
+    var maximumHistoryAge: TimeInterval = 7 * 24 * 60 * 60
+    var pruningInterval: TimeInterval = 24 * 60 * 60
+  }
+
+  fileprivate struct Keys {
+    static let tokenPrefix = "PersistentHistoryTracker.Token."
+    static let catchUpDatePrefix = "PersistentHistoryTracker.CatchUpDate."
+    static let lastPruningDate = "PersistentHistoryTracker.LastPruningDate"
+  }
+
+  // MARK: Properties
+
+  /// Transaction author of the process, contexts saving to the store should use it
+  let author: String
+
+  /// Author of the current process, the application and each extension have their own one
+  static var defaultAuthor: String {
+    return Bundle.main.bundleIdentifier ?? GlobalConstants.bundleId
+  }
+
+  fileprivate let managedObjectContext: NSManagedObjectContext
+
+  fileprivate let userDefaults: UserDefaults
+
+  fileprivate let configuration: Configuration
+
+  // MARK: Methods
+
+  init(persistentStoreCoordinator: NSPersistentStoreCoordinator, author: String = PersistentHistoryTracker.defaultAuthor, userDefaults: UserDefaults, configuration: Configuration = Configuration()) {
+    self.author = author
+    self.userDefaults = userDefaults
+    self.configuration = configuration
+
+    managedObjectContext = NSManagedObjectContext(concurrencyType: .privateQueueConcurrencyType)
+    managedObjectContext.persistentStoreCoordinator = persistentStoreCoordinator
+  }
+
+  /// Fetches changes of other authors committed since the previous catch-up and advances the token of the process.
+  /// The first catch-up of the process just takes the current token. The completion is called on an internal queue.
+  func catchUp(completion: @escaping (CatchUp) -> Void) {
+    managedObjectContext.perform {
+      let catchUp = self.fetchTransactions()
+      self.pruneIfNeeded()
+      completion(catchUp)
+    }
+  }
+
+  /// Should be called on the queue of the managed object context
+  fileprivate func fetchTransactions() -> CatchUp {
+    let catchUpDate = Date()
+
+    guard let token = loadToken() else {
+      saveToken(currentToken, date: catchUpDate)
+      return CatchUp(transactions: [], isIncomplete: false)
+    }
+
+    let request = NSPersistentHistoryChangeRequest.fetchHistory(after: token)
+    request.resultType = .transactionsAndChanges
+
+    do {
+      let result = try managedObjectContext.execute(request) as? NSPersistentHistoryResult
+      let transactions = result?.result as? [NSPersistentHistoryTransaction] ?? []
+
+      // Own transactions are already in the contexts of the process
+      let changes = transactions.filter { $0.author != author }.map { PersistentHistoryTracker.changes(of: $0) }
+
+      saveToken(transactions.last?.token ?? token, date: catchUpDate)
+      return CatchUp(transactions: changes, isIncomplete: false)
+    } catch let error as NSError where error.domain == NSCocoaErrorDomain && error.code == NSPersistentHistoryTokenExpiredError {
+      Logger.logWarning("Persistent history after the token has been pruned, changes of other processes are lost")
+      saveToken(currentToken, date: catchUpDate)
+      return CatchUp(transactions: [], isIncomplete: true)
+    } catch let error as NSError {
+      Logger.logError("Failed to fetch persistent history", error: error)
+      return CatchUp(transactions: [], isIncomplete: false)
+    }
+  }
+
+  /// Should be called on the queue of the managed object context
+  fileprivate func pruneIfNeeded() {
+    let now = Date()
+
+    if let lastPruningDate = userDefaults.object(forKey: Keys.lastPruningDate) as? Date,
+       now.timeIntervalSince(lastPruningDate) < configuration.pruningInterval
+    {
+      return
+    }
+
+    let catchUpDates = userDefaults.dictionaryRepresentation().filter { $0.key.hasPrefix(Keys.catchUpDatePrefix) }.compactMap { $0.value as? Date }
+    let pruningDate = max(catchUpDates.min() ?? now, now.addingTimeInterval(-configuration.maximumHistoryAge))
+
+    do {
+      try managedObjectContext.execute(NSPersistentHistoryChangeRequest.deleteHistory(before: pruningDate))
+      userDefaults.set(now, forKey: Keys.lastPruningDate)
+    } catch let error as NSError {
+      Logger.logError("Failed to prune persistent history", error: error)
+    }
+  }
+
+  fileprivate var currentToken: NSPersistentHistoryToken? {
+    return managedObjectContext.persistentStoreCoordinator?.currentPersistentHistoryToken(fromStores: nil)
+  }
+
+  fileprivate func loadToken() -> NSPersistentHistoryToken? {
+    guard let data = userDefaults.data(forKey: Keys.tokenPrefix + author) else {
+      return nil
+    }
+
+    return NSKeyedUnarchiver.unarchiveObject(with: data) as? NSPersistentHistoryToken
+  }
+
+  fileprivate func saveToken(_ token: NSPersistentHistoryToken?, date: Date) {
+    guard let token = token else {
+      return
+    }
+
+    userDefaults.set(NSKeyedArchiver.archivedData(withRootObject: token), forKey: Keys.tokenPrefix + author)
+    userDefaults.set(date, forKey: Keys.catchUpDatePrefix + author)
+  }
+
+  fileprivate class func changes(of transaction: NSPersistentHistoryTransaction) -> TransactionChanges {
+    var changes = TransactionChanges()
+
+    for change in transaction.changes ?? [] {
+      let key: String
+
+      switch change.changeType {
+      case .insert: key = NSInsertedObjectsKey
+      case .delete: key = NSDeletedObjectsKey
+      default: key = NSUpdatedObjectsKey
+      }
+
+      changes[key, default: []].insert(change.changedObjectID)
+    }
+
+    return changes
+  }
+
+}
@@ -0,0 +1,148 @@
+//
+//  SaveNotificationCoalescer.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+
+/// Accumulates save notifications of other managed object contexts over a short window,
+/// so a burst of saves is merged into the writer context and announced to observers only once.
+final class SaveNotificationCoalescer {
+
+  // MARK: Types
+
+  /// Save notifications received during one window with the union of their changed object identifiers
+  struct Batch {
+    fileprivate(set) var notifications = [Notification]()
+    fileprivate(set) var insertedObjectIDs = Set<NSManagedObjectID>()
+    fileprivate(set) var updatedObjectIDs = Set<NSManagedObjectID>()
+    fileprivate(set) var deletedObjectIDs = Set<NSManagedObjectID>()
+    /// System uptime of receiving the first notification of the batch
+    fileprivate(set) var receiptTime: TimeInterval = 0
+
+    var isEmpty: Bool {
+      return notifications.isEmpty
+    }
+
+    /// True if the batch contains changes of another process, they are added with a nil object
+    var containsRemoteChanges: Bool {
+      return notifications.contains { $0.object == nil }
+    }
+
+    /// Changes in the form accepted by NSManagedObjectContext.mergeChanges(fromRemoteContextSave:into:)
+    var objectIDsByChangeKeys: [AnyHashable: Any] {
+      return [NSInsertedObjectsKey: Array(insertedObjectIDs),
+              NSUpdatedObjectsKey: Array(updatedObjectIDs),
+              NSDeletedObjectsKey: Array(deletedObjectIDs)]
+    }
+
+    fileprivate mutating func add(_ notification: Notification) {
+      notifications.append(notification)
+
+      let insertedIDs = Batch.objectIDs(notification, key: NSInsertedObjectsKey)
+      let updatedIDs = Batch.objectIDs(notification, key: NSUpdatedObjectsKey)
+      let deletedIDs = Batch.objectIDs(notification, key: NSDeletedObjectsKey)
+
+      // An object inserted and then deleted within the window is never seen by observers
+      let insertedAndDeletedIDs = insertedObjectIDs.intersection(deletedIDs)
+      insertedObjectIDs.subtract(insertedAndDeletedIDs)
+      updatedObjectIDs.subtract(deletedIDs)
+      deletedObjectIDs.formUnion(deletedIDs.subtracting(insertedAndDeletedIDs))
+
+      insertedObjectIDs.formUnion(insertedIDs)
+      updatedObjectIDs.formUnion(updatedIDs.subtracting(insertedObjectIDs))
+    }
+
+    /// Save notifications contain managed objects, but notifications passed from other processes may contain their identifiers only
+    fileprivate static func objectIDs(_ notification: Notification, key: String) -> Set<NSManagedObjectID> {
+      guard let value = notification.userInfo?[key] else {
+        return []
+      }
+
+      if let managedObjects = value as? Set<NSManagedObject> {
+        return Set(managedObjects.map { $0.objectID })
+      }
+
+      return value as? Set<NSManagedObjectID> ?? []
+    }
+  }
+
+  struct Statistics {
+    fileprivate(set) var receivedNotificationsCount = 0
+    fileprivate(set) var mergesCount = 0
+    /// Time between receiving the first notification of a batch and finishing its merge
+    fileprivate(set) var totalMergeLatency: TimeInterval = 0
+    fileprivate(set) var maximumMergeLatency: TimeInterval = 0
+
+    /// Number of received notifications per merge
+    var coalescingRatio: Double {
+      return mergesCount > 0 ? Double(receivedNotificationsCount) / Double(mergesCount) : 0
+    }
+
+    var averageMergeLatency: TimeInterval {
+      return mergesCount > 0 ? totalMergeLatency / Double(mergesCount) : 0
+    }
+  }
+
+  // MARK: Properties
+
+  let interval: TimeInterval
+
+  fileprivate let queue = DispatchQueue(label: "\(GlobalConstants.bundleId).SaveNotificationCoalescer", attributes: [])
+
+  fileprivate let flush: (Batch) -> Void
+
+  fileprivate var pendingBatch = Batch()
+
+  fileprivate var statistics = Statistics()
+
+  // MARK: Methods
+
+  /// The flush callback is called on an internal queue with a non-empty batch.
+  /// didMerge(_:) should be called when changes of the batch are merged and announced.
+  init(interval: TimeInterval, flush: @escaping (Batch) -> Void) {
+    self.interval = interval
+    self.flush = flush
+  }
+
+  func add(_ notification: Notification) {
+    queue.async {
+      self.statistics.receivedNotificationsCount += 1
+
+      if self.pendingBatch.isEmpty {
+        self.pendingBatch.receiptTime = ProcessInfo.processInfo.systemUptime
+        self.queue.asyncAfter(deadline: .now() + self.interval) {
+          self.flushPendingBatch()
+        }
+      }
+
+      self.pendingBatch.add(notification)
+    }
+  }
+
+  func didMerge(_ batch: Batch) {
+    let latency = ProcessInfo.processInfo.systemUptime - batch.receiptTime
+
+    queue.async {
+      self.statistics.mergesCount += 1
+      self.statistics.totalMergeLatency += latency
+      self.statistics.maximumMergeLatency = max(self.statistics.maximumMergeLatency, latency)
+    }
+  }
+
+  func currentStatistics() -> Statistics {
+    return queue.sync { statistics }
+  }
+
+  /// Should be called on the queue
+  fileprivate func flushPendingBatch() {
+    let batch = pendingBatch
+    pendingBatch = Batch()
+
+    if !batch.isEmpty {
+      flush(batch)
+    }
+  }
+
+}
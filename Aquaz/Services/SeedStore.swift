@@ -0,0 +1,145 @@
+//
+//  SeedStore.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+
+/// Prebuilt SQLite store containing the catalog of drinks, shipped in the bundle as Seed.sqlite.
+/// On the first launch it's cloned into the place of the persistent store instead of inserting the catalog object by object.
+/// The catalog version is stamped into metadata of the store, so later catalog changes are applied to existing stores as deltas.
+/// The seed is generated by generate(at:managedObjectModel:), see Distribution/GenerateSeedStore.sh.
+final class SeedStore {
+
+  // MARK: Types
+
+  fileprivate struct Constants {
+    static let resourceName = "Seed"
+    static let resourceExtension = "sqlite"
+  }
+
+  // MARK: Properties
+
+  /// Version of the catalog created by CoreDataPrePopulation.prePopulateCatalog.
+  /// It should be increased together with adding a delta to catalogDeltas.
+  static let catalogVersion = 1
+
+  /// Key of the catalog version in metadata of the store
+  static let catalogVersionMetadataKey = "AquazCatalogVersion"
+
+  /// Changes of the catalog indexed by the catalog version they lead to. Deltas should be idempotent.
+  fileprivate static let catalogDeltas: [Int: (NSManagedObjectContext) -> Void] = [
+    1: { CoreDataPrePopulation.prePopulateCatalog(managedObjectContext: $0) }
+  ]
+
+  /// URL of the seed store in the bundle
+  static var bundledStoreURL: URL? {
+    return Bundle.main.url(forResource: Constants.resourceName, withExtension: Constants.resourceExtension)
+  }
+
+  // MARK: Methods
+
+  /// Clones the seed store to the URL if there is no store there yet and the seed is compatible with the model.
+  /// Returns true if the seed store is installed. Should be called before the store is added to a coordinator.
+  class func installIfNeeded(at storeURL: URL, persistentStoreCoordinator: NSPersistentStoreCoordinator) -> Bool {
+    if FileManager.default.fileExists(atPath: storeURL.path) {
+      return false
+    }
+
+    guard let seedURL = bundledStoreURL else {
+      return false
+    }
+
+    do {
+      let metadata = try NSPersistentStoreCoordinator.metadataForPersistentStore(ofType: NSSQLiteStoreType, at: seedURL, options: nil)
+
+      if !persistentStoreCoordinator.managedObjectModel.isConfiguration(withName: nil, compatibleWithStoreMetadata: metadata) {
+        Logger.logWarning("The seed store is not compatible with the model, the catalog is inserted instead")
+        return false
+      }
+
+      // The store is copied by SQLite, so the destination appears with all its journal files at once
+      try persistentStoreCoordinator.replacePersistentStore(
+        at: storeURL,
+        destinationOptions: nil,
+        withPersistentStoreFrom: seedURL,
+        sourceOptions: [NSReadOnlyPersistentStoreOption: true],
+        ofType: NSSQLiteStoreType)
+
+      return true
+    } catch let error as NSError {
+      Logger.logError("Failed to install the seed store", error: error)
+      return false
+    }
+  }
+
+  /// Applies catalog deltas newer than the catalog version of the store and stamps the current version.
+  /// Should be called on the queue of the managed object context right after the store is added.
+  /// Metadata is written with the next commit, so if deltas change nothing they are reapplied until then, which is harmless.
+  class func applyCatalogDeltas(managedObjectContext: NSManagedObjectContext) {
+    guard let coordinator = managedObjectContext.persistentStoreCoordinator,
+          let store = coordinator.persistentStores.first else
+    {
+      return
+    }
+
+    let storeVersion = coordinator.metadata(for: store)[catalogVersionMetadataKey] as? Int ?? 0
+
+    if storeVersion >= catalogVersion {
+      return
+    }
+
+    for version in (storeVersion + 1)...catalogVersion {
+      catalogDeltas[version]?(managedObjectContext)
+    }
+
+    stampCatalogVersion(store: store, coordinator: coordinator)
+    CoreDataStack.commitContext(managedObjectContext)
+  }
+
+  /// Builds the seed store at the URL. The store uses rollback journal, so it's a single file suitable for bundling.
+  class func generate(at storeURL: URL, managedObjectModel: NSManagedObjectModel) throws {
+    let fileManager = FileManager.default
+
+    for suffix in ["", "-wal", "-shm"] where fileManager.fileExists(atPath: storeURL.path + suffix) {
+      try fileManager.removeItem(atPath: storeURL.path + suffix)
+    }
+
+    let coordinator = NSPersistentStoreCoordinator(managedObjectModel: managedObjectModel)
+    let store = try coordinator.addPersistentStore(
+      ofType: NSSQLiteStoreType,
+      configurationName: nil,
+      at: storeURL,
+      options: [NSSQLitePragmasOption: ["journal_mode": "DELETE"]])
+
+    let managedObjectContext = NSManagedObjectContext(concurrencyType: .privateQueueConcurrencyType)
+    managedObjectContext.persistentStoreCoordinator = coordinator
+
+    var saveError: Error?
+
+    managedObjectContext.performAndWait {
+      CoreDataPrePopulation.prePopulateCatalog(managedObjectContext: managedObjectContext)
+      stampCatalogVersion(store: store, coordinator: coordinator)
+
+      do {
+        try managedObjectContext.save()
+      } catch {
+        saveError = error
+      }
+    }
+
+    if let saveError = saveError {
+      throw saveError
+    }
+
+    try coordinator.remove(store)
+  }
+
+  fileprivate class func stampCatalogVersion(store: NSPersistentStore, coordinator: NSPersistentStoreCoordinator) {
+    var metadata = coordinator.metadata(for: store)
+    metadata[catalogVersionMetadataKey] = catalogVersion
+    coordinator.setMetadata(metadata, for: store)
+  }
+
+}
@@ -71,7 +71,7 @@ final class SnapshotsInitializer {
   }
   
   fileprivate class func generateUserContent() {
-    CoreDataStack.performOnPrivateContext { privateContext in
+    CoreDataStack.performWrite { privateContext in
       removeAllExistingUserData(privateContext: privateContext)
       
       coreDataPrepopulation(privateContext: privateContext)
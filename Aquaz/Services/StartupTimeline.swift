@@ -0,0 +1,94 @@
+//
+//  StartupTimeline.swift
+//  Aquaz
+//
+
+import Foundation
+
+/// Milestones of a cold start measured from the launch of the process (or the extension)
+final class StartupTimeline {
+
+  // MARK: Types
+
+  enum RenderSource: String {
+    /// The last known state of the day stored by DayStateSnapshot
+    case snapshot
+    /// Data fetched from the persistent store
+    case store
+  }
+
+  // MARK: Properties
+
+  static let sharedInstance = StartupTimeline()
+
+  fileprivate let queue = DispatchQueue(label: "\(GlobalConstants.bundleId).StartupTimeline", attributes: [])
+
+  fileprivate var launchTime: TimeInterval?
+
+  fileprivate var _timeToStoreLoading: TimeInterval?
+
+  fileprivate var _timeToFirstMeaningfulRender: TimeInterval?
+
+  fileprivate var _firstMeaningfulRenderSource: RenderSource?
+
+  /// Time between the launch and adding the persistent store
+  var timeToStoreLoading: TimeInterval? {
+    return queue.sync { _timeToStoreLoading }
+  }
+
+  /// Time between the launch and the first rendering of the current day with real amounts
+  var timeToFirstMeaningfulRender: TimeInterval? {
+    return queue.sync { _timeToFirstMeaningfulRender }
+  }
+
+  var firstMeaningfulRenderSource: RenderSource? {
+    return queue.sync { _firstMeaningfulRenderSource }
+  }
+
+  // MARK: Methods
+
+  fileprivate init() {
+    // Hide initializer, sharedInstance should be used instead.
+  }
+
+  /// Should be called as early as possible, following calls are ignored
+  func markLaunch() {
+    let time = ProcessInfo.processInfo.systemUptime
+
+    queue.sync {
+      if launchTime == nil {
+        launchTime = time
+      }
+    }
+  }
+
+  func markStoreLoaded() {
+    let time = ProcessInfo.processInfo.systemUptime
+
+    queue.sync {
+      if let launchTime = launchTime, _timeToStoreLoading == nil {
+        _timeToStoreLoading = time - launchTime
+      }
+    }
+  }
+
+  /// Only the first render after the launch is taken into account
+  func markFirstMeaningfulRender(source: RenderSource) {
+    let time = ProcessInfo.processInfo.systemUptime
+
+    let interval: TimeInterval? = queue.sync {
+      guard let launchTime = launchTime, _timeToFirstMeaningfulRender == nil else {
+        return nil
+      }
+
+      _timeToFirstMeaningfulRender = time - launchTime
+      _firstMeaningfulRenderSource = source
+      return _timeToFirstMeaningfulRender
+    }
+
+    if let interval = interval {
+      Logger.logInfo("First meaningful render", logDetails: ["source": source.rawValue, "time": String(format: "%.3f", interval)])
+    }
+  }
+
+}
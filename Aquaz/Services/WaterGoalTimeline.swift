@@ -0,0 +1,345 @@
+//
+//  WaterGoalTimeline.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+
+/// In-memory index of all water goals of a persistent store sorted by date.
+/// Water goals are loaded once without materializing managed objects,
+/// point and range queries are answered by binary search,
+/// and the index is updated incrementally from saved and merged managed object contexts.
+final class WaterGoalTimeline: NSObject {
+
+  // MARK: Types
+
+  /// Values of a water goal record
+  struct Entry {
+    let objectID: NSManagedObjectID
+    let date: Date
+    let baseAmount: Double
+    let isHotDay: Bool
+    let isHighActivity: Bool
+
+    fileprivate init(objectID: NSManagedObjectID, date: Date, baseAmount: Double, isHotDay: Bool, isHighActivity: Bool) {
+      self.objectID = objectID
+      self.date = date
+      self.baseAmount = baseAmount
+      self.isHotDay = isHotDay
+      self.isHighActivity = isHighActivity
+    }
+
+    fileprivate init(waterGoal: WaterGoal) {
+      self.init(objectID: waterGoal.objectID, date: waterGoal.date, baseAmount: waterGoal.baseAmount, isHotDay: waterGoal.isHotDay, isHighActivity: waterGoal.isHighActivity)
+    }
+
+    /// Amount taking into account hot day and high activity factors (see WaterGoal.amount)
+    var amount: Double {
+      let hotDayFactor = isHotDay ? Settings.sharedInstance.generalHotDayExtraFactor.value : 0
+      let highActivityFactor = isHighActivity ? Settings.sharedInstance.generalHighActivityExtraFactor.value : 0
+      return baseAmount * (1 + hotDayFactor + highActivityFactor)
+    }
+  }
+
+  /// Run of consecutive days having the same water goal amount
+  struct Span {
+    let beginDate: Date
+    let daysCount: Int
+    let amount: Double
+  }
+
+  fileprivate struct Changes {
+    var upsertedEntries = [Entry]()
+    var deletedObjectIDs = Set<NSManagedObjectID>()
+
+    var isEmpty: Bool {
+      return upsertedEntries.isEmpty && deletedObjectIDs.isEmpty
+    }
+  }
+
+  // MARK: Properties
+
+  fileprivate static let registryQueue = DispatchQueue(label: "\(GlobalConstants.bundleId).WaterGoalTimeline.Registry", attributes: [])
+
+  fileprivate static var timelines = [WaterGoalTimeline]()
+
+  fileprivate weak var persistentStoreCoordinator: NSPersistentStoreCoordinator?
+
+  fileprivate let queue = DispatchQueue(label: "\(GlobalConstants.bundleId).WaterGoalTimeline", attributes: [])
+
+  /// Sorted by date, nil until the first request
+  fileprivate var entries: ContiguousArray<Entry>?
+
+  /// Incremented on every applied change, used to detect changes made during loading
+  fileprivate var generation = 0
+
+  // MARK: Methods
+
+  /// Returns the timeline of the persistent store coordinator of the managed object context
+  class func timeline(for managedObjectContext: NSManagedObjectContext) -> WaterGoalTimeline? {
+    guard let coordinator = managedObjectContext.persistentStoreCoordinator else {
+      return nil
+    }
+
+    return registryQueue.sync {
+      timelines = timelines.filter { $0.persistentStoreCoordinator != nil }
+
+      if let timeline = timelines.first(where: { $0.persistentStoreCoordinator === coordinator }) {
+        return timeline
+      }
+
+      let timeline = WaterGoalTimeline(persistentStoreCoordinator: coordinator)
+      timelines.append(timeline)
+      return timeline
+    }
+  }
+
+  fileprivate init(persistentStoreCoordinator: NSPersistentStoreCoordinator) {
+    self.persistentStoreCoordinator = persistentStoreCoordinator
+
+    super.init()
+
+    NotificationCenter.default.addObserver(
+      self,
+      selector: #selector(self.managedObjectContextDidChange(_:)),
+      name: NSNotification.Name.NSManagedObjectContextDidSave,
+      object: nil)
+
+    NotificationCenter.default.addObserver(
+      self,
+      selector: #selector(self.managedObjectContextDidChange(_:)),
+      name: NSNotification.Name(rawValue: GlobalConstants.notificationManagedObjectContextWasMerged),
+      object: nil)
+  }
+
+  deinit {
+    NotificationCenter.default.removeObserver(self)
+  }
+
+  /// Returns a water goal record suiting for the date by rules of WaterGoal.fetchWaterGoalForDate.
+  /// Unsaved changes of the managed object context are taken into account.
+  /// Should be called on the queue of the managed object context.
+  func entry(forDate date: Date, managedObjectContext: NSManagedObjectContext) -> Entry? {
+    let entries = currentEntries(managedObjectContext: managedObjectContext)
+    let day = DateHelper.startOfDay(date)
+    let index = lowerBound(day, in: entries)
+
+    if index < entries.count && entries[index].date == day {
+      return entries[index]
+    }
+
+    if index > 0 {
+      return entries[index - 1]
+    }
+
+    return index < entries.count ? entries[index] : nil
+  }
+
+  /// Returns water goal amounts of the date period (beginDate..<endDate) as runs of days with the same amount.
+  /// Full amount is used for days having their own water goal, base amount of a suiting water goal is used for other days.
+  /// Should be called on the queue of the managed object context.
+  func spans(beginDate: Date, endDate: Date, managedObjectContext: NSManagedObjectContext) -> [Span] {
+    let dayIndex = DayIndex.current(covering: beginDate, endDate)
+    let beginDay = dayIndex.day(of: beginDate)
+    let endDay = dayIndex.day(of: endDate)
+
+    if beginDay >= endDay {
+      return []
+    }
+
+    let entries = currentEntries(managedObjectContext: managedObjectContext)
+
+    if entries.isEmpty {
+      Logger.logError(Logger.Messages.logicalError, logDetails: "There are no water goals at all")
+      return [Span(beginDate: dayIndex.startOfDay(beginDay), daysCount: endDay - beginDay, amount: Settings.sharedInstance.userDailyWaterIntake.value)]
+    }
+
+    var spans = [Span]()
+
+    func appendSpan(from spanBeginDay: Int, to spanEndDay: Int, amount: Double) {
+      let daysCount = spanEndDay - spanBeginDay
+      if daysCount <= 0 {
+        return
+      }
+
+      if let lastSpan = spans.last, lastSpan.amount == amount {
+        spans[spans.count - 1] = Span(beginDate: lastSpan.beginDate, daysCount: lastSpan.daysCount + daysCount, amount: amount)
+      } else {
+        spans.append(Span(beginDate: dayIndex.startOfDay(spanBeginDay), daysCount: daysCount, amount: amount))
+      }
+    }
+
+    var index = lowerBound(dayIndex.startOfDay(beginDay), in: entries)
+
+    // Days without own water goals use base amount of the nearest earlier water goal, or of the nearest later one
+    var baseAmount = index > 0 ? entries[index - 1].baseAmount : entries[index].baseAmount
+    var currentDay = beginDay
+
+    while index < entries.count {
+      let entry = entries[index]
+      let entryDay = dayIndex.day(of: entry.date)
+
+      if entryDay >= endDay {
+        break
+      }
+
+      appendSpan(from: currentDay, to: entryDay, amount: baseAmount)
+      appendSpan(from: entryDay, to: entryDay + 1, amount: entry.amount)
+
+      baseAmount = entry.baseAmount
+      currentDay = entryDay + 1
+      index += 1
+    }
+
+    appendSpan(from: currentDay, to: endDay, amount: baseAmount)
+
+    return spans
+  }
+
+  // MARK: Loading
+
+  /// Entries of saved water goals with applied unsaved changes of the managed object context
+  fileprivate func currentEntries(managedObjectContext: NSManagedObjectContext) -> ContiguousArray<Entry> {
+    var entries = loadedEntries(managedObjectContext: managedObjectContext)
+
+    let pendingChanges = WaterGoalTimeline.changes(
+      insertedObjects: managedObjectContext.insertedObjects,
+      updatedObjects: managedObjectContext.updatedObjects,
+      deletedObjects: managedObjectContext.deletedObjects)
+
+    if !pendingChanges.isEmpty {
+      apply(pendingChanges, to: &entries)
+    }
+
+    return entries
+  }
+
+  fileprivate func loadedEntries(managedObjectContext: NSManagedObjectContext) -> ContiguousArray<Entry> {
+    let (entries, loadingGeneration): (ContiguousArray<Entry>?, Int) = queue.sync { (self.entries, generation) }
+
+    if let entries = entries {
+      return entries
+    }
+
+    let fetchedEntries = WaterGoalTimeline.fetchEntries(managedObjectContext: managedObjectContext)
+
+    queue.sync {
+      // The store has been changed during loading, so the fetched entries may be outdated and they are used only once
+      if generation == loadingGeneration {
+        self.entries = fetchedEntries
+      }
+    }
+
+    return fetchedEntries
+  }
+
+  /// Fetches all water goals sorted by date. Dictionary result type is used to avoid materializing them.
+  fileprivate class func fetchEntries(managedObjectContext: NSManagedObjectContext) -> ContiguousArray<Entry> {
+    let objectID = NSExpressionDescription()
+    objectID.expression = NSExpression.expressionForEvaluatedObject()
+    objectID.expressionResultType = .objectIDAttributeType
+    objectID.name = "objectID"
+
+    let fetchRequest = NSFetchRequest<NSDictionary>()
+    fetchRequest.entity = WaterGoal.entityDescription(inManagedObjectContext: managedObjectContext)
+    fetchRequest.propertiesToFetch = [objectID, "date", "baseAmount", "isHotDay", "isHighActivity"]
+    fetchRequest.sortDescriptors = [NSSortDescriptor(key: "date", ascending: true)]
+    fetchRequest.resultType = .dictionaryResultType
+
+    var entries = ContiguousArray<Entry>()
+
+    do {
+      for record in try managedObjectContext.fetch(fetchRequest) {
+        guard let objectID = record[objectID.name] as? NSManagedObjectID,
+              let date = record["date"] as? Date,
+              let baseAmount = record["baseAmount"] as? Double else
+        {
+          continue
+        }
+
+        entries.append(Entry(
+          objectID: objectID,
+          date: date,
+          baseAmount: baseAmount,
+          isHotDay: (record["isHotDay"] as? Bool) ?? false,
+          isHighActivity: (record["isHighActivity"] as? Bool) ?? false))
+      }
+    } catch let error as NSError {
+      Logger.logError(Logger.Messages.failedToExecuteFetchRequest, error: error)
+    }
+
+    return entries
+  }
+
+  // MARK: Updating
+
+  @objc func managedObjectContextDidChange(_ notification: Notification) {
+    guard let managedObjectContext = notification.object as? NSManagedObjectContext,
+          managedObjectContext.persistentStoreCoordinator === persistentStoreCoordinator,
+          let userInfo = notification.userInfo else
+    {
+      return
+    }
+
+    // Values are read on the posting thread, which is the queue of the managed object context owning the objects
+    let changes = WaterGoalTimeline.changes(
+      insertedObjects: userInfo[NSInsertedObjectsKey] as? Set<NSManagedObject> ?? [],
+      updatedObjects: userInfo[NSUpdatedObjectsKey] as? Set<NSManagedObject> ?? [],
+      deletedObjects: userInfo[NSDeletedObjectsKey] as? Set<NSManagedObject> ?? [])
+
+    if changes.isEmpty {
+      return
+    }
+
+    queue.sync {
+      generation += 1
+
+      if entries != nil {
+        apply(changes, to: &entries!)
+      }
+    }
+  }
+
+  fileprivate class func changes(insertedObjects: Set<NSManagedObject>, updatedObjects: Set<NSManagedObject>, deletedObjects: Set<NSManagedObject>) -> Changes {
+    var changes = Changes()
+
+    for case let waterGoal as WaterGoal in insertedObjects.union(updatedObjects) where !waterGoal.isDeleted {
+      changes.upsertedEntries.append(Entry(waterGoal: waterGoal))
+    }
+
+    for case let waterGoal as WaterGoal in deletedObjects {
+      changes.deletedObjectIDs.insert(waterGoal.objectID)
+    }
+
+    return changes
+  }
+
+  fileprivate func apply(_ changes: Changes, to entries: inout ContiguousArray<Entry>) {
+    let replacedObjectIDs = changes.deletedObjectIDs.union(changes.upsertedEntries.map { $0.objectID })
+    entries = entries.filter { !replacedObjectIDs.contains($0.objectID) }
+
+    for entry in changes.upsertedEntries {
+      entries.insert(entry, at: lowerBound(entry.date, in: entries))
+    }
+  }
+
+  /// Index of the first entry with date not earlier than the passed one
+  fileprivate func lowerBound(_ date: Date, in entries: ContiguousArray<Entry>) -> Int {
+    var low = 0
+    var high = entries.count
+
+    while low < high {
+      let middle = (low + high) / 2
+
+      if entries[middle].date.isEarlierThan(date) {
+        low = middle + 1
+      } else {
+        high = middle
+      }
+    }
+
+    return low
+  }
+
+}
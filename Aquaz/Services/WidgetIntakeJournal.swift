@@ -0,0 +1,200 @@
+//
+//  WidgetIntakeJournal.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+
+/// Intakes added by the widget. They are appended to a file in the shared container as fixed-size records
+/// instead of being saved to the persistent store, and the application ingests them later.
+/// Ingesting is idempotent, because every record has an origin identifier. Records are kept in the journal
+/// until their origin identifiers are found in the store, so a failed commit or a changed clock never loses them.
+/// Record: origin identifier (16 bytes), date (Float64), amount (Float64), drink index (UInt64).
+final class WidgetIntakeJournal {
+
+  // MARK: Types
+
+  struct Record {
+    let originID: UUID
+    let drinkType: DrinkType
+    let amount: Double
+    let date: Date
+  }
+
+  fileprivate struct Layout {
+    static let originIDOffset = 0
+    static let dateOffset = 16
+    static let amountOffset = 24
+    static let drinkIndexOffset = 32
+    static let recordSize = 40
+  }
+
+  fileprivate struct Constants {
+    static let fileName = "WidgetIntakes.journal"
+  }
+
+  // MARK: Properties
+
+  fileprivate static let fileURL = FileManager.default.containerURL(forSecurityApplicationGroupIdentifier: GlobalConstants.appGroupName)?.appendingPathComponent(Constants.fileName)
+
+  // MARK: Methods
+
+  /// Appends the record by a single write, returns false if the journal is not available
+  @discardableResult
+  class func append(_ record: Record) -> Bool {
+    return withJournal(flags: O_WRONLY | O_APPEND | O_CREAT, lock: LOCK_EX) { (fileDescriptor: Int32) -> Bool in
+      var data = Data(count: Layout.recordSize)
+      data.withUnsafeMutableBytes { (bytes: UnsafeMutableRawBufferPointer) in encode(record, into: bytes.baseAddress!) }
+
+      return data.withUnsafeBytes { (bytes: UnsafeRawBufferPointer) in write(fileDescriptor, bytes.baseAddress, bytes.count) == bytes.count }
+    } ?? false
+  }
+
+  /// All records of the journal including ingested ones which are not removed yet
+  class func pendingRecords() -> [Record] {
+    return withJournal(flags: O_RDONLY, lock: LOCK_SH) { readRecords($0) } ?? []
+  }
+
+  /// Date of the latest record of the journal found in the store. Records up to the date are included into the published widget state.
+  /// It's computed by the context the state is composed by, so the date always matches amounts of the state.
+  /// Should be called on the queue of the managed object context.
+  class func lastIngestedDate(managedObjectContext: NSManagedObjectContext) -> Date {
+    let records = pendingRecords()
+
+    if records.isEmpty {
+      return .distantPast
+    }
+
+    let storedOriginIDs = Intake.fetchOriginIDs(records.map { $0.originID.uuidString }, managedObjectContext: managedObjectContext)
+    return records.filter { storedOriginIDs.contains($0.originID.uuidString) }.map { $0.date }.max() ?? .distantPast
+  }
+
+  /// Adds records of the journal to the store. Records found in the store are removed from the journal,
+  /// others are added again, because the previous commit might fail. Origin identifiers keep repeated adding idempotent.
+  class func ingest() {
+    CoreDataStack.performWrite { privateContext in
+      let records = withJournal(flags: O_RDWR, lock: LOCK_EX) { (fileDescriptor: Int32) -> [Record] in
+        let records = readRecords(fileDescriptor)
+
+        if records.isEmpty {
+          return []
+        }
+
+        let storedOriginIDs = Intake.fetchOriginIDs(records.map { $0.originID.uuidString }, managedObjectContext: privateContext)
+        let pendingRecords = records.filter { !storedOriginIDs.contains($0.originID.uuidString) }
+
+        if pendingRecords.count < records.count {
+          rewrite(fileDescriptor, records: pendingRecords)
+        }
+
+        return pendingRecords
+      } ?? []
+
+      if records.isEmpty {
+        return
+      }
+
+      let drafts = records.map { Intake.Draft(drinkType: $0.drinkType, amount: $0.amount, date: $0.date, originID: $0.originID.uuidString) }
+      _ = Intake.addEntities(drafts, managedObjectContext: privateContext, saveImmediately: false)
+
+      CoreDataStack.commitContext(privateContext)
+    }
+  }
+
+  fileprivate class func withJournal<T>(flags: Int32, lock: Int32, _ body: (Int32) -> T) -> T? {
+    guard let fileURL = fileURL else {
+      return nil
+    }
+
+    let fileDescriptor = open(fileURL.path, flags, 0o644)
+
+    if fileDescriptor < 0 {
+      if errno != ENOENT {
+        Logger.logError("Failed to open the widget intake journal", error: NSError(domain: NSPOSIXErrorDomain, code: Int(errno), userInfo: nil))
+      }
+
+      return nil
+    }
+
+    defer {
+      close(fileDescriptor)
+    }
+
+    flock(fileDescriptor, lock)
+
+    defer {
+      flock(fileDescriptor, LOCK_UN)
+    }
+
+    return body(fileDescriptor)
+  }
+
+  fileprivate class func readRecords(_ fileDescriptor: Int32) -> [Record] {
+    var fileInfo = stat()
+    fstat(fileDescriptor, &fileInfo)
+
+    let recordsCount = Int(fileInfo.st_size) / Layout.recordSize
+
+    if recordsCount == 0 {
+      return []
+    }
+
+    var data = Data(count: recordsCount * Layout.recordSize)
+
+    let readCount = data.withUnsafeMutableBytes { (bytes: UnsafeMutableRawBufferPointer) in pread(fileDescriptor, bytes.baseAddress, bytes.count, 0) }
+
+    if readCount != data.count {
+      return []
+    }
+
+    return data.withUnsafeBytes { (bytes: UnsafeRawBufferPointer) -> [Record] in
+      (0..<recordsCount).compactMap { decodeRecord(bytes.baseAddress! + $0 * Layout.recordSize) }
+    }
+  }
+
+  fileprivate class func rewrite(_ fileDescriptor: Int32, records: [Record]) {
+    var data = Data(count: records.count * Layout.recordSize)
+
+    data.withUnsafeMutableBytes { (bytes: UnsafeMutableRawBufferPointer) in
+      for (index, record) in records.enumerated() {
+        encode(record, into: bytes.baseAddress! + index * Layout.recordSize)
+      }
+    }
+
+    let writtenCount = data.withUnsafeBytes { (bytes: UnsafeRawBufferPointer) in pwrite(fileDescriptor, bytes.baseAddress, bytes.count, 0) }
+
+    if writtenCount != data.count || ftruncate(fileDescriptor, off_t(data.count)) != 0 {
+      Logger.logError("Failed to compact the widget intake journal", error: NSError(domain: NSPOSIXErrorDomain, code: Int(errno), userInfo: nil))
+    }
+  }
+
+  fileprivate class func encode(_ record: Record, into pointer: UnsafeMutableRawPointer) {
+    withUnsafeBytes(of: record.originID.uuid) { originID in
+      (pointer + Layout.originIDOffset).copyMemory(from: originID.baseAddress!, byteCount: originID.count)
+    }
+
+    pointer.storeBytes(of: record.date.timeIntervalSinceReferenceDate.bitPattern.littleEndian, toByteOffset: Layout.dateOffset, as: UInt64.self)
+    pointer.storeBytes(of: record.amount.bitPattern.littleEndian, toByteOffset: Layout.amountOffset, as: UInt64.self)
+    pointer.storeBytes(of: UInt64(record.drinkType.rawValue).littleEndian, toByteOffset: Layout.drinkIndexOffset, as: UInt64.self)
+  }
+
+  fileprivate class func decodeRecord(_ pointer: UnsafeRawPointer) -> Record? {
+    var uuid = UUID().uuid
+
+    withUnsafeMutableBytes(of: &uuid) { originID in
+      originID.copyMemory(from: UnsafeRawBufferPointer(start: pointer + Layout.originIDOffset, count: originID.count))
+    }
+
+    let date = Double(bitPattern: UInt64(littleEndian: pointer.load(fromByteOffset: Layout.dateOffset, as: UInt64.self)))
+    let amount = Double(bitPattern: UInt64(littleEndian: pointer.load(fromByteOffset: Layout.amountOffset, as: UInt64.self)))
+    let drinkIndex = UInt64(littleEndian: pointer.load(fromByteOffset: Layout.drinkIndexOffset, as: UInt64.self))
+
+    guard let drinkType = DrinkType(rawValue: Int(truncatingIfNeeded: drinkIndex)) else {
+      return nil
+    }
+
+    return Record(originID: UUID(uuid: uuid), drinkType: drinkType, amount: amount, date: Date(timeIntervalSinceReferenceDate: date))
+  }
+
+}
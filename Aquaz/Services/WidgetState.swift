@@ -0,0 +1,326 @@
+//
+//  WidgetState.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+
+/// Everything the Today widget displays, so the widget never loads the persistent store.
+/// The application publishes it to the shared container after commits changing intakes, water goals or drinks.
+/// The file has a fixed little-endian layout and is read by a single mmap.
+/// Amounts are metric. Volume units are not stored, because settings are available synchronously anyway.
+struct WidgetState {
+
+  // MARK: Types
+
+  struct DisplayedDrink {
+    let drinkType: DrinkType
+    let recentAmount: Double
+  }
+
+  /// Header: magic (UInt32), version (UInt32), date, water goal amount, dehydration amount, last ingested widget intake date (Float64).
+  /// Then displayed drinks as pairs of drink index (UInt64) and recent amount (Float64), and hydration amounts indexed by drinks (Float64).
+  fileprivate struct Layout {
+    static let magic: UInt32 = 0x41515753 // "AQWS"
+    static let version: UInt32 = 1
+    static let displayedDrinksCount = 3
+    static let drinksCapacity = 32
+
+    static let magicOffset = 0
+    static let versionOffset = 4
+    static let dateOffset = 8
+    static let waterGoalAmountOffset = 16
+    static let dehydrationAmountOffset = 24
+    static let lastIngestedIntakeDateOffset = 32
+    static let displayedDrinksOffset = 40
+    static let displayedDrinkSize = 16
+    static let hydrationAmountsOffset = displayedDrinksOffset + displayedDrinksCount * displayedDrinkSize
+    static let size = hydrationAmountsOffset + drinksCapacity * 8
+  }
+
+  fileprivate struct Constants {
+    static let fileName = "WidgetState.bin"
+  }
+
+  // MARK: Properties
+
+  /// Start of the day
+  fileprivate(set) var date: Date
+
+  /// Water goal of the day not including dehydration
+  fileprivate(set) var waterGoalAmount: Double
+
+  fileprivate(set) var dehydrationAmount: Double
+
+  fileprivate(set) var hydrationAmounts: [DrinkType: Double]
+
+  /// Water and two most recently used drinks ordered by drink indexes
+  let displayedDrinks: [DisplayedDrink]
+
+  /// Intakes added by the widget up to the date are included into the amounts
+  let lastIngestedIntakeDate: Date
+
+  var totalHydrationAmount: Double {
+    return hydrationAmounts.values.reduce(0, +)
+  }
+
+  /// Water goal increased by dehydration, as it's displayed
+  var totalWaterGoalAmount: Double {
+    return waterGoalAmount + dehydrationAmount
+  }
+
+  fileprivate static let queue = DispatchQueue(label: "\(GlobalConstants.bundleId).WidgetState", attributes: [])
+
+  fileprivate static var dataChangeSubscription: DataChangeBus.Subscription?
+
+  /// Publications are composed concurrently by read contexts, so a state composed earlier may be written later.
+  /// Numbers of publications let such states be dropped. Both are accessed on the queue.
+  fileprivate static var lastPublicationNumber = 0
+
+  fileprivate static var lastWrittenPublicationNumber = 0
+
+  fileprivate static let fileURL = FileManager.default.containerURL(forSecurityApplicationGroupIdentifier: GlobalConstants.appGroupName)?.appendingPathComponent(Constants.fileName)
+
+  // MARK: Methods
+
+  /// State of an empty day used until the application publishes the first one
+  init(date: Date) {
+    self.date = DateHelper.startOfDay(date)
+    waterGoalAmount = Settings.sharedInstance.userDailyWaterIntake.value
+    dehydrationAmount = 0
+    hydrationAmounts = [:]
+    displayedDrinks = [DrinkType.water, .coffee, .tea].map { DisplayedDrink(drinkType: $0, recentAmount: CoreDataPrePopulation.catalogRecentAmount) }
+    lastIngestedIntakeDate = .distantPast
+  }
+
+  /// Computes the state of today. Should be called on the queue of the managed object context.
+  init(managedObjectContext: NSManagedObjectContext, lastIngestedIntakeDate: Date) {
+    let summary = DaySummaryCache.sharedInstance.summary(forDate: Date(), managedObjectContext: managedObjectContext)
+    let drinks = Drink.fetchAllDrinksIndexed(managedObjectContext: managedObjectContext)
+
+    date = summary.date
+    waterGoalAmount = summary.waterGoalAmount
+    dehydrationAmount = summary.totalDehydrationAmount
+    hydrationAmounts = summary.hydrationAmounts
+    displayedDrinks = WidgetState.fetchDisplayedDrinkTypes(managedObjectContext: managedObjectContext).map {
+      DisplayedDrink(drinkType: $0, recentAmount: drinks[$0.rawValue]?.recentAmount.amount ?? CoreDataPrePopulation.catalogRecentAmount)
+    }
+    self.lastIngestedIntakeDate = lastIngestedIntakeDate
+  }
+
+  /// Starts publishing the state after commits. The state is also published once the persistent store is loaded.
+  static func startPublishing() {
+    queue.sync {
+      if dataChangeSubscription != nil {
+        return
+      }
+
+      // Recent amounts and the most recently used drinks may be changed by intakes of any day
+      dataChangeSubscription = DataChangeBus.sharedInstance.subscribe(entities: [.intake, .waterGoal, .drink], scope: .allDays) { _ in
+        WidgetState.publish()
+      }
+    }
+
+    publish()
+  }
+
+  static func publish() {
+    let publicationNumber: Int = queue.sync {
+      lastPublicationNumber += 1
+      return lastPublicationNumber
+    }
+
+    CoreDataStack.performRead { privateContext in
+      let state = WidgetState(managedObjectContext: privateContext, lastIngestedIntakeDate: WidgetIntakeJournal.lastIngestedDate(managedObjectContext: privateContext))
+      state.write(publicationNumber: publicationNumber)
+    }
+  }
+
+  /// Reads the published state, nil if it's absent or has an unknown layout
+  static func load() -> WidgetState? {
+    guard let fileURL = fileURL else {
+      return nil
+    }
+
+    let fileDescriptor = open(fileURL.path, O_RDONLY)
+
+    if fileDescriptor < 0 {
+      return nil
+    }
+
+    defer {
+      close(fileDescriptor)
+    }
+
+    var fileInfo = stat()
+
+    if fstat(fileDescriptor, &fileInfo) != 0 || fileInfo.st_size < off_t(Layout.size) {
+      return nil
+    }
+
+    guard let pointer = mmap(nil, Layout.size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0), pointer != MAP_FAILED else {
+      return nil
+    }
+
+    defer {
+      munmap(pointer, Layout.size)
+    }
+
+    return WidgetState(pointer: UnsafeRawPointer(pointer))
+  }
+
+  /// The state of another day is rolled over to the empty state of the date, it keeps the water goal and displayed drinks.
+  /// Intakes added by the widget which are not ingested yet are added to the amounts.
+  func applying(_ pendingRecords: [WidgetIntakeJournal.Record], forDate date: Date) -> WidgetState {
+    var state = self
+
+    if !DateHelper.areEqualDays(state.date, date) {
+      state.date = DateHelper.startOfDay(date)
+      state.dehydrationAmount = 0
+      state.hydrationAmounts = [:]
+    }
+
+    for record in pendingRecords where record.date > lastIngestedIntakeDate && DateHelper.areEqualDays(record.date, state.date) {
+      state.add(drinkType: record.drinkType, amount: record.amount)
+    }
+
+    return state
+  }
+
+  mutating func add(drinkType: DrinkType, amount: Double) {
+    hydrationAmounts[drinkType, default: 0] += amount * drinkType.hydrationFactor
+    dehydrationAmount += amount * drinkType.dehydrationFactor
+  }
+
+  fileprivate init?(pointer: UnsafeRawPointer) {
+    func load<T: FixedWidthInteger>(_ offset: Int) -> T {
+      return T(littleEndian: pointer.load(fromByteOffset: offset, as: T.self))
+    }
+
+    func loadDouble(_ offset: Int) -> Double {
+      return Double(bitPattern: load(offset))
+    }
+
+    guard load(Layout.magicOffset) == Layout.magic && load(Layout.versionOffset) == Layout.version else {
+      return nil
+    }
+
+    date = Date(timeIntervalSinceReferenceDate: loadDouble(Layout.dateOffset))
+    waterGoalAmount = loadDouble(Layout.waterGoalAmountOffset)
+    dehydrationAmount = loadDouble(Layout.dehydrationAmountOffset)
+    lastIngestedIntakeDate = Date(timeIntervalSinceReferenceDate: loadDouble(Layout.lastIngestedIntakeDateOffset))
+
+    var displayedDrinks = [DisplayedDrink]()
+
+    for index in 0..<Layout.displayedDrinksCount {
+      let offset = Layout.displayedDrinksOffset + index * Layout.displayedDrinkSize
+
+      guard let drinkType = DrinkType(rawValue: Int(truncatingIfNeeded: load(offset) as UInt64)) else {
+        return nil
+      }
+
+      displayedDrinks.append(DisplayedDrink(drinkType: drinkType, recentAmount: loadDouble(offset + 8)))
+    }
+
+    self.displayedDrinks = displayedDrinks
+
+    var hydrationAmounts = [DrinkType: Double]()
+
+    for index in 0..<min(DrinkType.count, Layout.drinksCapacity) {
+      let amount = loadDouble(Layout.hydrationAmountsOffset + index * 8)
+
+      if amount > 0, let drinkType = DrinkType(rawValue: index) {
+        hydrationAmounts[drinkType] = amount
+      }
+    }
+
+    self.hydrationAmounts = hydrationAmounts
+  }
+
+  fileprivate func encoded() -> Data {
+    var data = Data(count: Layout.size)
+
+    data.withUnsafeMutableBytes { (bytes: UnsafeMutableRawBufferPointer) in
+      let pointer = bytes.baseAddress!
+
+      func store<T: FixedWidthInteger>(_ value: T, _ offset: Int) {
+        pointer.storeBytes(of: value.littleEndian, toByteOffset: offset, as: T.self)
+      }
+
+      store(Layout.magic, Layout.magicOffset)
+      store(Layout.version, Layout.versionOffset)
+      store(date.timeIntervalSinceReferenceDate.bitPattern, Layout.dateOffset)
+      store(waterGoalAmount.bitPattern, Layout.waterGoalAmountOffset)
+      store(dehydrationAmount.bitPattern, Layout.dehydrationAmountOffset)
+      store(lastIngestedIntakeDate.timeIntervalSinceReferenceDate.bitPattern, Layout.lastIngestedIntakeDateOffset)
+
+      for (index, displayedDrink) in displayedDrinks.prefix(Layout.displayedDrinksCount).enumerated() {
+        let offset = Layout.displayedDrinksOffset + index * Layout.displayedDrinkSize
+        store(UInt64(displayedDrink.drinkType.rawValue), offset)
+        store(displayedDrink.recentAmount.bitPattern, offset + 8)
+      }
+
+      for (drinkType, amount) in hydrationAmounts where drinkType.rawValue < Layout.drinksCapacity {
+        store(amount.bitPattern, Layout.hydrationAmountsOffset + drinkType.rawValue * 8)
+      }
+    }
+
+    return data
+  }
+
+  /// The file is replaced atomically, so a reader maps either the previous or the new state.
+  /// The state is dropped if a later publication is already written.
+  fileprivate func write(publicationNumber: Int) {
+    guard let fileURL = WidgetState.fileURL else {
+      return
+    }
+
+    let data = encoded()
+
+    WidgetState.queue.async {
+      if publicationNumber < WidgetState.lastWrittenPublicationNumber {
+        return
+      }
+
+      WidgetState.lastWrittenPublicationNumber = publicationNumber
+
+      do {
+        try data.write(to: fileURL, options: .atomic)
+      } catch let error as NSError {
+        Logger.logError("Failed to write the widget state", error: error)
+        return
+      }
+
+      DispatchQueue.main.async {
+        NotificationCenter.default.post(name: Notification.Name(rawValue: GlobalConstants.notificationWidgetStateWasPublished), object: nil)
+      }
+    }
+  }
+
+  /// Water is always displayed together with two other most recently used drinks
+  fileprivate static func fetchDisplayedDrinkTypes(managedObjectContext: NSManagedObjectContext) -> [DrinkType] {
+    let request = NSFetchRequest<NSDictionary>()
+    request.entity = Intake.entityDescription(inManagedObjectContext: managedObjectContext)
+    request.resultType = .dictionaryResultType
+    request.propertiesToFetch = ["drink.index"]
+    request.propertiesToGroupBy = ["drink.index"]
+    request.fetchLimit = 2
+    request.sortDescriptors = [NSSortDescriptor(key: "date", ascending: false)]
+    request.predicate = NSPredicate(format: "%K != %d", "drink.index", DrinkType.water.rawValue)
+
+    var drinkIndexes = [DrinkType.water.rawValue]
+
+    if let fetch = try? managedObjectContext.fetch(request) {
+      drinkIndexes += fetch.compactMap { ($0["drink.index"] as? NSNumber)?.intValue }.prefix(2)
+    }
+
+    // Drinks which have never been used are taken in order of their indexes
+    for drinkIndex in 0..<DrinkType.count where drinkIndexes.count < Layout.displayedDrinksCount && !drinkIndexes.contains(drinkIndex) {
+      drinkIndexes.append(drinkIndex)
+    }
+
+    return drinkIndexes.sorted().compactMap { DrinkType(rawValue: $0) }
+  }
+
+}
@@ -7,7 +7,6 @@
 //
 
 import Foundation
-import CoreData
 import MMWormhole
 
 final class WormholeDataProvider: NSObject {
@@ -18,7 +17,7 @@ final class WormholeDataProvider: NSObject {
     super.init()
     
     initWormhole()
-    setupCoreDataSynchronization()
+    setupWidgetStateSignalling()
   }
   
   deinit {
@@ -28,30 +27,36 @@ final class WormholeDataProvider: NSObject {
   fileprivate func initWormhole() {
     wormhole = MMWormhole(applicationGroupIdentifier: GlobalConstants.appGroupName, optionalDirectory: GlobalConstants.wormholeOptionalDirectory)
 
-    wormhole.listenForMessage(withIdentifier: GlobalConstants.wormholeMessageFromWidget) { [weak self] messageObject in
-      if let notification = messageObject as? Notification {
-        CoreDataStack.mergeAllContextsWithNotification(notification)
-        self?.wormhole.clearMessageContents(forIdentifier: GlobalConstants.wormholeMessageFromWidget)
+    wormhole.wormholeMessenger = WormholeRingBufferTransiting(
+      applicationGroupIdentifier: GlobalConstants.appGroupName,
+      optionalDirectory: GlobalConstants.wormholeOptionalDirectory,
+      readIdentifiers: [GlobalConstants.wormholeMessageFromWidget])
+
+    // Reading consumes changes, so there is no need to clear message contents
+    wormhole.listenForMessage(withIdentifier: GlobalConstants.wormholeMessageFromWidget) { messageObject in
+      if let changes = messageObject as? WormholeChanges {
+        CoreDataStack.mergeAllContextsWithRemoteChanges(changes.objectURIsByChangeKeys, isIncomplete: changes.isIncomplete)
       }
     }
-  }
-  
-  fileprivate func setupCoreDataSynchronization() {
-    CoreDataStack.performOnPrivateContext { privateContext in
-      NotificationCenter.default.addObserver(
-        self,
-        selector: #selector(self.managedObjectContextDidSave(_:)),
-        name: NSNotification.Name.NSManagedObjectContextDidSave,
-        object: privateContext)
+
+    // The widget appends intakes to the journal and just signals about them
+    wormhole.listenForMessage(withIdentifier: GlobalConstants.wormholeMessageWidgetIntakes) { _ in
+      WidgetIntakeJournal.ingest()
     }
   }
   
-  @objc func managedObjectContextDidSave(_ notification: Notification) {
-    // By unknown reason existance of "managedObjectContext" key produces an exception during passing massage object through wormhole
-    var clearedNotification = notification
-    _ = clearedNotification.userInfo?.removeValue(forKey: "managedObjectContext")
-    
-    wormhole.passMessageObject(clearedNotification as NSCoding?, identifier: GlobalConstants.wormholeMessageFromAquaz)
+  /// The widget never loads the persistent store, so saves are not passed to it. It's signalled about published states only.
+  fileprivate func setupWidgetStateSignalling() {
+    NotificationCenter.default.addObserver(
+      self,
+      selector: #selector(self.widgetStateWasPublished(_:)),
+      name: NSNotification.Name(rawValue: GlobalConstants.notificationWidgetStateWasPublished),
+      object: nil)
+  }
+
+  /// The widget reads the state file by itself, so only a signal is passed
+  @objc func widgetStateWasPublished(_ notification: Notification) {
+    wormhole.passMessageObject(nil, identifier: GlobalConstants.wormholeMessageWidgetState)
   }
   
 }
@@ -0,0 +1,463 @@
+//
+//  WormholeRingBufferTransiting.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+import MMWormhole
+
+/// Changes of managed objects passed between the application and the widget through the wormhole
+final class WormholeChanges: NSObject, NSCoding {
+
+  // MARK: Types
+
+  enum Kind: UInt8 {
+    case inserted = 1
+    case updated = 2
+    case deleted = 3
+
+    var changeKey: String {
+      switch self {
+      case .inserted: return NSInsertedObjectsKey
+      case .updated: return NSUpdatedObjectsKey
+      case .deleted: return NSDeletedObjectsKey
+      }
+    }
+  }
+
+  struct Record: Equatable {
+    let kind: Kind
+    let entityName: String
+    let objectURI: URL
+  }
+
+  // MARK: Properties
+
+  let records: [Record]
+
+  /// True if the reader fell behind the writer and some changes were overwritten before being read
+  let isIncomplete: Bool
+
+  var isEmpty: Bool {
+    return records.isEmpty && !isIncomplete
+  }
+
+  /// URI representations of changed objects indexed by NSInsertedObjectsKey, NSUpdatedObjectsKey and NSDeletedObjectsKey
+  var objectURIsByChangeKeys: [String: [URL]] {
+    var objectURIs = [String: [URL]]()
+
+    for record in records {
+      objectURIs[record.kind.changeKey, default: []].append(record.objectURI)
+    }
+
+    return objectURIs
+  }
+
+  // MARK: Methods
+
+  init(records: [Record], isIncomplete: Bool = false) {
+    self.records = records
+    self.isIncomplete = isIncomplete
+  }
+
+  /// Takes changed objects of a NSManagedObjectContextDidSave notification.
+  /// Should be called on the queue of the saved managed object context.
+  convenience init(saveNotification: Notification) {
+    var records = [Record]()
+
+    for kind in [Kind.inserted, .updated, .deleted] {
+      for managedObject in saveNotification.userInfo?[kind.changeKey] as? Set<NSManagedObject> ?? [] where !managedObject.objectID.isTemporaryID {
+        records.append(Record(kind: kind, entityName: managedObject.entity.name ?? "", objectURI: managedObject.objectID.uriRepresentation()))
+      }
+    }
+
+    self.init(records: records)
+  }
+
+  required convenience init?(coder aDecoder: NSCoder) {
+    guard let kinds = aDecoder.decodeObject(forKey: Keys.kinds) as? [UInt8],
+          let entityNames = aDecoder.decodeObject(forKey: Keys.entityNames) as? [String],
+          let objectURIs = aDecoder.decodeObject(forKey: Keys.objectURIs) as? [URL],
+          kinds.count == entityNames.count && kinds.count == objectURIs.count else
+    {
+      return nil
+    }
+
+    var records = [Record]()
+
+    for index in kinds.indices {
+      if let kind = Kind(rawValue: kinds[index]) {
+        records.append(Record(kind: kind, entityName: entityNames[index], objectURI: objectURIs[index]))
+      }
+    }
+
+    self.init(records: records, isIncomplete: aDecoder.decodeBool(forKey: Keys.isIncomplete))
+  }
+
+  func encode(with aCoder: NSCoder) {
+    aCoder.encode(records.map { $0.kind.rawValue }, forKey: Keys.kinds)
+    aCoder.encode(records.map { $0.entityName }, forKey: Keys.entityNames)
+    aCoder.encode(records.map { $0.objectURI }, forKey: Keys.objectURIs)
+    aCoder.encode(isIncomplete, forKey: Keys.isIncomplete)
+  }
+
+  fileprivate struct Keys {
+    static let kinds = "kinds"
+    static let entityNames = "entityNames"
+    static let objectURIs = "objectURIs"
+    static let isIncomplete = "isIncomplete"
+  }
+
+}
+
+/// Wormhole transiting keeping messages of each identifier in a memory-mapped ring buffer file in the shared container.
+/// Messages are WormholeChanges. Each change is appended as a sequence-numbered fixed-size binary record,
+/// so saves following each other are not lost before the other side reads them, and nothing is archived or synced to disk.
+/// Every instance keeps its own cursor per identifier and reads records appended after it.
+/// Identifiers to be listened should be passed on creating, otherwise records written before the first read are skipped.
+final class WormholeRingBufferTransiting: NSObject, MMWormholeTransiting {
+
+  // MARK: Types
+
+  struct Constants {
+    static let defaultSlotsCount = 1024
+    static let fileExtension = "ring"
+  }
+
+  // MARK: Properties
+
+  fileprivate let directoryURL: URL?
+
+  fileprivate let slotsCount: Int
+
+  fileprivate var ringBuffers = [String: RingBuffer]()
+
+  fileprivate let lock = NSLock()
+
+  // MARK: Methods
+
+  init(directoryURL: URL?, readIdentifiers: [String], slotsCount: Int = Constants.defaultSlotsCount) {
+    self.directoryURL = directoryURL
+    self.slotsCount = slotsCount
+
+    super.init()
+
+    if let directoryURL = directoryURL {
+      do {
+        try FileManager.default.createDirectory(at: directoryURL, withIntermediateDirectories: true, attributes: nil)
+      } catch let error as NSError {
+        Logger.logError("Failed to create the wormhole directory", error: error)
+      }
+    }
+
+    lock.lock()
+    readIdentifiers.forEach { _ = ringBuffer(for: $0) }
+    lock.unlock()
+  }
+
+  convenience init(applicationGroupIdentifier: String, optionalDirectory: String?, readIdentifiers: [String]) {
+    var directoryURL = FileManager.default.containerURL(forSecurityApplicationGroupIdentifier: applicationGroupIdentifier)
+
+    if let optionalDirectory = optionalDirectory {
+      directoryURL = directoryURL?.appendingPathComponent(optionalDirectory, isDirectory: true)
+    }
+
+    self.init(directoryURL: directoryURL, readIdentifiers: readIdentifiers)
+  }
+
+  func writeMessageObject(_ messageObject: NSCoding?, forIdentifier identifier: String) -> Bool {
+    guard let messageObject = messageObject else {
+      return true
+    }
+
+    guard let changes = messageObject as? WormholeChanges else {
+      Logger.logError("Only WormholeChanges can be passed through the ring buffer wormhole")
+      return false
+    }
+
+    if changes.records.isEmpty {
+      return false
+    }
+
+    lock.lock()
+    defer { lock.unlock() }
+
+    guard let ringBuffer = ringBuffer(for: identifier) else {
+      return false
+    }
+
+    ringBuffer.append(changes.records)
+    return true
+  }
+
+  /// Returns changes written after the previous call for the identifier or nil if there are no new changes
+  func messageObject(forIdentifier identifier: String?) -> NSCoding? {
+    guard let identifier = identifier else {
+      return nil
+    }
+
+    lock.lock()
+    defer { lock.unlock() }
+
+    // Only buffers opened for reading on initialization have their cursors, other messages are just signals
+    guard let changes = ringBuffers[identifier]?.readNewRecords(), !changes.isEmpty else {
+      return nil
+    }
+
+    return changes
+  }
+
+  /// Records are overwritten by the writer only, so clearing just skips unread records
+  func deleteContent(forIdentifier identifier: String?) {
+    guard let identifier = identifier else {
+      return
+    }
+
+    lock.lock()
+    ringBuffer(for: identifier)?.skipUnreadRecords()
+    lock.unlock()
+  }
+
+  func deleteContentForAllMessages() {
+    lock.lock()
+    ringBuffers.values.forEach { $0.skipUnreadRecords() }
+    lock.unlock()
+  }
+
+  /// Should be called under the lock
+  fileprivate func ringBuffer(for identifier: String) -> RingBuffer? {
+    if let ringBuffer = ringBuffers[identifier] {
+      return ringBuffer
+    }
+
+    guard let fileURL = directoryURL?.appendingPathComponent(identifier).appendingPathExtension(Constants.fileExtension),
+          let ringBuffer = RingBuffer(fileURL: fileURL, slotsCount: slotsCount) else
+    {
+      return nil
+    }
+
+    ringBuffers[identifier] = ringBuffer
+    return ringBuffer
+  }
+
+}
+
+/// Memory-mapped file with a header followed by fixed-size slots. Record with sequence N is stored in the slot (N - 1) % slotsCount.
+/// Header: magic (UInt32), version (UInt32), slot size (UInt32), slots count (UInt32), sequence of the last record (UInt64).
+/// Slot: sequence (UInt64), kind (UInt8), entity name length (UInt8), object URI length (UInt16), UTF-8 entity name and object URI.
+/// Processes synchronize by flock, a shared lock for reading and an exclusive one for appending.
+private final class RingBuffer {
+
+  fileprivate struct Layout {
+    static let magic: UInt32 = 0x41515242 // "AQRB"
+    static let version: UInt32 = 1
+    static let headerSize = 64
+    static let slotSize = 256
+
+    static let magicOffset = 0
+    static let versionOffset = 4
+    static let slotSizeOffset = 8
+    static let slotsCountOffset = 12
+    static let lastSequenceOffset = 16
+
+    static let slotSequenceOffset = 0
+    static let slotKindOffset = 8
+    static let slotEntityNameLengthOffset = 9
+    static let slotObjectURILengthOffset = 10
+    static let slotPayloadOffset = 12
+  }
+
+  let slotsCount: Int
+
+  fileprivate let fileSize: Int
+
+  fileprivate var fileDescriptor: Int32 = -1
+
+  fileprivate var pointer: UnsafeMutableRawPointer?
+
+  /// Sequence of the last record read through this instance
+  fileprivate var cursor: UInt64 = 0
+
+  init?(fileURL: URL, slotsCount: Int) {
+    self.slotsCount = slotsCount
+    fileSize = Layout.headerSize + slotsCount * Layout.slotSize
+
+    fileDescriptor = open(fileURL.path, O_RDWR | O_CREAT, 0o644)
+
+    if fileDescriptor < 0 {
+      RingBuffer.logPOSIXError("Failed to open the wormhole ring buffer")
+      return nil
+    }
+
+    flock(fileDescriptor, LOCK_EX)
+    defer { flock(fileDescriptor, LOCK_UN) }
+
+    var fileInfo = stat()
+    fstat(fileDescriptor, &fileInfo)
+
+    let isResized = fileInfo.st_size != off_t(fileSize)
+
+    if isResized && ftruncate(fileDescriptor, off_t(fileSize)) != 0 {
+      RingBuffer.logPOSIXError("Failed to resize the wormhole ring buffer")
+      return nil
+    }
+
+    guard let mapping = mmap(nil, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0), mapping != MAP_FAILED else {
+      RingBuffer.logPOSIXError("Failed to map the wormhole ring buffer")
+      return nil
+    }
+
+    pointer = mapping
+
+    if isResized || !hasValidHeader {
+      memset(mapping, 0, fileSize)
+      store(Layout.magic, at: Layout.magicOffset)
+      store(Layout.version, at: Layout.versionOffset)
+      store(UInt32(Layout.slotSize), at: Layout.slotSizeOffset)
+      store(UInt32(slotsCount), at: Layout.slotsCountOffset)
+    }
+
+    // Records written before opening are not interesting, the other side reads the store anyway
+    cursor = lastSequence
+  }
+
+  deinit {
+    if let pointer = pointer {
+      munmap(pointer, fileSize)
+    }
+
+    if fileDescriptor >= 0 {
+      close(fileDescriptor)
+    }
+  }
+
+  func append(_ records: [WormholeChanges.Record]) {
+    flock(fileDescriptor, LOCK_EX)
+    defer { flock(fileDescriptor, LOCK_UN) }
+
+    var sequence = lastSequence
+
+    for record in records {
+      sequence += 1
+      write(record, sequence: sequence)
+    }
+
+    store(sequence, at: Layout.lastSequenceOffset)
+  }
+
+  func readNewRecords() -> WormholeChanges {
+    flock(fileDescriptor, LOCK_SH)
+    defer { flock(fileDescriptor, LOCK_UN) }
+
+    let lastSequence = self.lastSequence
+    var isIncomplete = false
+
+    if lastSequence < cursor {
+      // The file has been recreated by the other side
+      cursor = 0
+      isIncomplete = true
+    }
+
+    if lastSequence - cursor > UInt64(slotsCount) {
+      cursor = lastSequence - UInt64(slotsCount)
+      isIncomplete = true
+    }
+
+    var records = [WormholeChanges.Record]()
+
+    while cursor < lastSequence {
+      cursor += 1
+
+      if let record = readRecord(sequence: cursor) {
+        records.append(record)
+      } else {
+        isIncomplete = true
+      }
+    }
+
+    return WormholeChanges(records: records, isIncomplete: isIncomplete)
+  }
+
+  func skipUnreadRecords() {
+    flock(fileDescriptor, LOCK_SH)
+    cursor = lastSequence
+    flock(fileDescriptor, LOCK_UN)
+  }
+
+  fileprivate var lastSequence: UInt64 {
+    return load(at: Layout.lastSequenceOffset)
+  }
+
+  fileprivate var hasValidHeader: Bool {
+    return load(at: Layout.magicOffset) == Layout.magic
+      && load(at: Layout.versionOffset) == Layout.version
+      && load(at: Layout.slotSizeOffset) == UInt32(Layout.slotSize)
+      && load(at: Layout.slotsCountOffset) == UInt32(slotsCount)
+  }
+
+  fileprivate func slotOffset(sequence: UInt64) -> Int {
+    return Layout.headerSize + Int((sequence - 1) % UInt64(slotsCount)) * Layout.slotSize
+  }
+
+  /// A record which doesn't fit a slot is written with zero kind, so readers know that a change is lost
+  fileprivate func write(_ record: WormholeChanges.Record, sequence: UInt64) {
+    let offset = slotOffset(sequence: sequence)
+    let entityName = Array(record.entityName.utf8)
+    let objectURI = Array(record.objectURI.absoluteString.utf8)
+    let fits = entityName.count <= Int(UInt8.max) && Layout.slotPayloadOffset + entityName.count + objectURI.count <= Layout.slotSize
+
+    store(sequence, at: offset + Layout.slotSequenceOffset)
+    store(fits ? record.kind.rawValue : 0, at: offset + Layout.slotKindOffset)
+    store(fits ? UInt8(entityName.count) : 0, at: offset + Layout.slotEntityNameLengthOffset)
+    store(fits ? UInt16(objectURI.count) : 0, at: offset + Layout.slotObjectURILengthOffset)
+
+    if fits, let pointer = pointer {
+      let payload = pointer + offset + Layout.slotPayloadOffset
+      payload.copyMemory(from: entityName, byteCount: entityName.count)
+      (payload + entityName.count).copyMemory(from: objectURI, byteCount: objectURI.count)
+    }
+  }
+
+  fileprivate func readRecord(sequence: UInt64) -> WormholeChanges.Record? {
+    let offset = slotOffset(sequence: sequence)
+
+    guard let pointer = pointer,
+          load(at: offset + Layout.slotSequenceOffset) == sequence,
+          let kind = WormholeChanges.Kind(rawValue: load(at: offset + Layout.slotKindOffset)) else
+    {
+      return nil
+    }
+
+    let entityNameLength = Int(load(at: offset + Layout.slotEntityNameLengthOffset) as UInt8)
+    let objectURILength = Int(load(at: offset + Layout.slotObjectURILengthOffset) as UInt16)
+
+    if Layout.slotPayloadOffset + entityNameLength + objectURILength > Layout.slotSize {
+      return nil
+    }
+
+    let payload = UnsafeRawBufferPointer(start: pointer + offset + Layout.slotPayloadOffset, count: entityNameLength + objectURILength)
+
+    guard let entityName = String(bytes: payload.prefix(entityNameLength), encoding: .utf8),
+          let objectURIString = String(bytes: payload.dropFirst(entityNameLength), encoding: .utf8),
+          let objectURI = URL(string: objectURIString) else
+    {
+      return nil
+    }
+
+    return WormholeChanges.Record(kind: kind, entityName: entityName, objectURI: objectURI)
+  }
+
+  fileprivate func load<T: FixedWidthInteger>(at offset: Int) -> T {
+    return T(littleEndian: pointer!.load(fromByteOffset: offset, as: T.self))
+  }
+
+  fileprivate func store<T: FixedWidthInteger>(_ value: T, at offset: Int) {
+    pointer!.storeBytes(of: value.littleEndian, toByteOffset: offset, as: T.self)
+  }
+
+  fileprivate class func logPOSIXError(_ message: String) {
+    Logger.logError(message, error: NSError(domain: NSPOSIXErrorDomain, code: Int(errno), userInfo: nil))
+  }
+
+}
@@ -0,0 +1,95 @@
+//
+//  CodingManagedObjectBenchmarkTests.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+import XCTest
+@testable import AquazPro
+
+/// Compares decoding time of archived intakes resolved one by one and resolved in batch before decoding.
+/// Every payload is decoded by a fresh context, as it is on the receiving side.
+class CodingManagedObjectBenchmarkTests: XCTestCase {
+
+  fileprivate struct Constants {
+    static let payloadSize = 100
+  }
+
+  override func setUp() {
+    super.setUp()
+
+    let drink = Drink.fetchDrinkByType(.water, managedObjectContext: managedObjectContext)!
+
+    for intake in Intake.fetchManagedObjects(managedObjectContext: managedObjectContext) {
+      managedObjectContext.delete(intake)
+    }
+
+    for index in 0..<Constants.payloadSize {
+      _ = Intake.addEntity(drink: drink, amount: 100, date: Date(timeIntervalSinceReferenceDate: TimeInterval(index * 60)), managedObjectContext: managedObjectContext, saveImmediately: false)
+    }
+
+    try! managedObjectContext.save()
+  }
+
+  func testDecodingOneByOne() {
+    let data = archivedIntakes(count: Constants.payloadSize)
+
+    measure {
+      _ = self.decode(data, resolvesObjectsInBatch: false)
+    }
+  }
+
+  func testDecodingInBatch() {
+    let data = archivedIntakes(count: Constants.payloadSize)
+
+    measure {
+      _ = self.decode(data, resolvesObjectsInBatch: true)
+    }
+  }
+
+  func testBatchDecodingMatchesOneByOne() {
+    let intakes = Array(Intake.fetchManagedObjects(managedObjectContext: managedObjectContext).prefix(10))
+    let data = NSKeyedArchiver.archivedData(withRootObject: intakes)
+
+    XCTAssertEqual(CodingManagedObject.objectURIs(inArchive: data), Set(intakes.map { $0.objectID.uriRepresentation() }))
+
+    let oneByOne = decode(data, resolvesObjectsInBatch: false)
+    let inBatch = decode(data, resolvesObjectsInBatch: true)
+
+    XCTAssertEqual(inBatch.map { $0.objectID }, intakes.map { $0.objectID })
+    XCTAssertEqual(inBatch.map { $0.objectID }, oneByOne.map { $0.objectID })
+    XCTAssertEqual(inBatch.map { $0.amount }, intakes.map { $0.amount })
+  }
+
+  func testRegisteredObjectsAreReturned() {
+    let intakes = Array(Intake.fetchManagedObjects(managedObjectContext: managedObjectContext).prefix(3))
+    let decodedIntakes = CodingManagedObject.unarchiveObject(with: NSKeyedArchiver.archivedData(withRootObject: intakes), managedObjectContext: managedObjectContext) as? [Intake] ?? []
+
+    XCTAssertEqual(decodedIntakes.count, intakes.count)
+
+    for (decodedIntake, intake) in zip(decodedIntakes, intakes) {
+      XCTAssertTrue(decodedIntake === intake, "Registered objects should be taken from the context")
+    }
+  }
+
+  fileprivate func archivedIntakes(count: Int) -> Data {
+    let intakes = Array(Intake.fetchManagedObjects(managedObjectContext: managedObjectContext).prefix(count))
+    XCTAssertEqual(intakes.count, count)
+    return NSKeyedArchiver.archivedData(withRootObject: intakes)
+  }
+
+  fileprivate func decode(_ data: Data, resolvesObjectsInBatch: Bool) -> [Intake] {
+    let receivingContext = NSManagedObjectContext(concurrencyType: .mainQueueConcurrencyType)
+    receivingContext.persistentStoreCoordinator = managedObjectContext.persistentStoreCoordinator
+
+    let intakes = CodingManagedObject.unarchiveObject(with: data, managedObjectContext: receivingContext, resolvesObjectsInBatch: resolvesObjectsInBatch) as? [Intake] ?? []
+
+    // Attributes are read to include fetching of faults into the time
+    _ = intakes.reduce(0) { $0 + $1.amount }
+    return intakes
+  }
+
+  fileprivate var managedObjectContext: NSManagedObjectContext { return CoreDataSupport.sharedInstance.managedObjectContext }
+
+}
@@ -0,0 +1,154 @@
+//
+//  ConnectivityStatePublisherTests.swift
+//  Aquaz
+//
+
+import Foundation
+import XCTest
+@testable import AquazPro
+
+class ConnectivityStatePublisherTests: XCTestCase {
+
+  fileprivate var hydrationAmount: Double = 0
+
+  fileprivate var publishedStates = [ConnectivityMessageCurrentState]()
+
+  override func setUp() {
+    super.setUp()
+    hydrationAmount = 0
+    publishedStates = []
+  }
+
+  func testBurstIsComposedOnce() {
+    let publisher = makePublisher(interval: 0.2)
+
+    for _ in 0..<10 {
+      publisher.setNeedsPublish()
+    }
+
+    waitUntil { self.publishedStates.count == 1 }
+
+    XCTAssertEqual(publisher.compositionsCount, 1, "Requests within the interval should be composed together")
+  }
+
+  func testUnchangedStateIsNotPublished() {
+    let publisher = makePublisher(interval: 0.05)
+
+    publisher.setNeedsPublish()
+    waitUntil { self.publishedStates.count == 1 }
+
+    publisher.setNeedsPublish()
+    waitUntil { publisher.skippedPublicationsCount == 1 }
+
+    XCTAssertEqual(publishedStates.count, 1, "The watch already displays the state")
+
+    hydrationAmount = 250
+    publisher.setNeedsPublish()
+    waitUntil { self.publishedStates.count == 2 }
+
+    XCTAssertEqual(publishedStates.map { $0.hydrationAmount }, [0, 250])
+  }
+
+  func testPublishNowRepliesWithoutWaiting() {
+    let publisher = makePublisher(interval: 60)
+    let replied = expectation(description: "Replied")
+
+    hydrationAmount = 300
+
+    publisher.publishNow { state in
+      XCTAssertEqual(state.hydrationAmount, 300)
+      replied.fulfill()
+    }
+
+    waitForExpectations(timeout: 1, handler: nil)
+    waitUntil { self.publishedStates.count == 1 }
+
+    XCTAssertEqual(publisher.lastState?.hydrationAmount, 300)
+  }
+
+  func testOlderCompositionIsIgnored() {
+    var compositionCompletions = [(ConnectivityMessageCurrentState) -> Void]()
+
+    let publisher = ConnectivityStatePublisher(
+      interval: 60,
+      composeState: { completion in
+        DispatchQueue.main.async {
+          compositionCompletions.append(completion)
+        }
+      },
+      publish: { state in
+        DispatchQueue.main.async {
+          self.publishedStates.append(state)
+        }
+        return true
+      })
+
+    // Awaited one by one, so they are not registered in the test case
+    let olderReplied = XCTestExpectation(description: "The older composition replied")
+    let newerReplied = XCTestExpectation(description: "The newer composition replied")
+
+    // Replies are passed to the main queue after publications, so they are fulfilled after states are collected
+    publisher.publishNow { state in
+      XCTAssertEqual(state.hydrationAmount, 200, "The older composition should reply with the applied state")
+      DispatchQueue.main.async { olderReplied.fulfill() }
+    }
+
+    publisher.publishNow { _ in
+      DispatchQueue.main.async { newerReplied.fulfill() }
+    }
+
+    waitUntil { compositionCompletions.count == 2 }
+
+    compositionCompletions[1](makeState(hydrationAmount: 200))
+    wait(for: [newerReplied], timeout: 1)
+
+    compositionCompletions[0](makeState(hydrationAmount: 100))
+    wait(for: [olderReplied], timeout: 1)
+
+    XCTAssertEqual(publisher.lastState?.hydrationAmount, 200)
+    XCTAssertEqual(publishedStates.map { $0.hydrationAmount }, [200])
+  }
+
+  func testRestoredStateIsNotPublished() {
+    let publisher = makePublisher(interval: 0.05)
+    publisher.restore(makeState(hydrationAmount: 100))
+
+    XCTAssertEqual(publisher.lastState?.hydrationAmount, 100)
+    XCTAssertTrue(publishedStates.isEmpty)
+  }
+
+  fileprivate func makePublisher(interval: TimeInterval) -> ConnectivityStatePublisher {
+    // The handlers are called on the internal queue of the publisher, so amounts are read and states are collected on the main queue
+    return ConnectivityStatePublisher(
+      interval: interval,
+      composeState: { completion in
+        DispatchQueue.main.async {
+          completion(self.makeState(hydrationAmount: self.hydrationAmount))
+        }
+      },
+      publish: { state in
+        DispatchQueue.main.async {
+          self.publishedStates.append(state)
+        }
+        return true
+      })
+  }
+
+  fileprivate func makeState(hydrationAmount: Double) -> ConnectivityMessageCurrentState {
+    return ConnectivityMessageCurrentState(
+      messageDate: Date(),
+      hydrationAmount: hydrationAmount,
+      dehydrationAmount: 0,
+      dailyWaterGoal: 2000,
+      highPhysicalActivityModeEnabled: false,
+      hotWeatherModeEnabled: false,
+      volumeUnits: .millilitres)
+  }
+
+  /// Waits for the condition checked on the main queue, so states collected on it are taken into account
+  fileprivate func waitUntil(_ condition: @escaping () -> Bool) {
+    _ = expectation(for: NSPredicate { _, _ in condition() }, evaluatedWith: nil, handler: nil)
+    waitForExpectations(timeout: 2, handler: nil)
+  }
+
+}
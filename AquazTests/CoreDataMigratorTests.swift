@@ -0,0 +1,115 @@
+//
+//  CoreDataMigratorTests.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+import XCTest
+@testable import AquazPro
+
+class CoreDataMigratorTests: XCTestCase {
+
+  fileprivate let intakesCount = 500
+
+  func testMigrationFromFirstModelVersion() {
+    let storeURL = URL(fileURLWithPath: NSTemporaryDirectory()).appendingPathComponent("MigratorTests.sqlite")
+    let currentModel = NSManagedObjectModel(contentsOf: modelURL)!
+    let firstModel = NSManagedObjectModel(contentsOf: modelURL.appendingPathComponent("Aquaz.mom"))!
+
+    destroyStore(storeURL, model: currentModel)
+    populateStore(storeURL, model: firstModel)
+
+    let migrator = CoreDataMigrator(storeURL: storeURL, modelURL: modelURL, destinationModel: currentModel)
+    XCTAssertTrue(migrator.isMigrationNeeded, "Store of the first model version should require migration")
+
+    var progressValues = [Float]()
+    XCTAssertTrue(migrator.migrateIfNeeded { progressValues.append($0) }, "Migration should succeed")
+    XCTAssertFalse(migrator.isMigrationNeeded, "Migrated store should be compatible with the current model")
+    XCTAssertEqual(progressValues.first, 0)
+    XCTAssertEqual(progressValues.last, 1)
+    XCTAssertEqual(progressValues, progressValues.sorted(), "Progress should not decrease")
+
+    // Check that data survived the migration
+    let coordinator = NSPersistentStoreCoordinator(managedObjectModel: currentModel)
+    XCTAssertNotNil(try? coordinator.addPersistentStore(ofType: NSSQLiteStoreType, configurationName: nil, at: storeURL, options: nil))
+
+    let managedObjectContext = NSManagedObjectContext(concurrencyType: .mainQueueConcurrencyType)
+    managedObjectContext.persistentStoreCoordinator = coordinator
+
+    let fetchRequest = NSFetchRequest<NSFetchRequestResult>(entityName: Intake.entityName)
+    XCTAssertEqual(try? managedObjectContext.count(for: fetchRequest), intakesCount)
+
+    destroyStore(storeURL, model: currentModel)
+  }
+
+  func testCurrentModelHasDateIndexes() {
+    let currentModel = NSManagedObjectModel(contentsOf: modelURL)!
+
+    for entityName in [Intake.entityName, WaterGoal.entityName, DailySummary.entityName] {
+      let dateProperty = currentModel.entitiesByName[entityName]?.propertiesByName["date"]
+      XCTAssertEqual(dateProperty?.isIndexed, true, "Date of \(entityName) should be indexed")
+    }
+  }
+
+  func testCompatibleStoreIsNotMigrated() {
+    let storeURL = URL(fileURLWithPath: NSTemporaryDirectory()).appendingPathComponent("MigratorTestsCurrent.sqlite")
+    let currentModel = NSManagedObjectModel(contentsOf: modelURL)!
+
+    destroyStore(storeURL, model: currentModel)
+    populateStore(storeURL, model: currentModel)
+
+    let migrator = CoreDataMigrator(storeURL: storeURL, modelURL: modelURL, destinationModel: currentModel)
+    XCTAssertFalse(migrator.isMigrationNeeded)
+
+    var progressValues = [Float]()
+    XCTAssertTrue(migrator.migrateIfNeeded { progressValues.append($0) })
+    XCTAssertTrue(progressValues.isEmpty, "Progress should not be reported if migration is not needed")
+
+    destroyStore(storeURL, model: currentModel)
+  }
+
+  fileprivate var modelURL: URL {
+    return Bundle.main.url(forResource: "Aquaz", withExtension: "momd")!
+  }
+
+  /// Fills the store with a drink and intakes using KVC, because classes of the entities may not match to the model version
+  fileprivate func populateStore(_ storeURL: URL, model: NSManagedObjectModel) {
+    let coordinator = NSPersistentStoreCoordinator(managedObjectModel: model)
+    let store = try? coordinator.addPersistentStore(ofType: NSSQLiteStoreType, configurationName: nil, at: storeURL, options: nil)
+    XCTAssertNotNil(store, "Failed to create persistent store")
+
+    let managedObjectContext = NSManagedObjectContext(concurrencyType: .mainQueueConcurrencyType)
+    managedObjectContext.persistentStoreCoordinator = coordinator
+
+    let drink = NSEntityDescription.insertNewObject(forEntityName: Drink.entityName, into: managedObjectContext)
+    drink.setValue(DrinkType.water.rawValue, forKey: "index")
+    drink.setValue("Water", forKey: "name")
+    drink.setValue(DrinkType.water.hydrationFactor, forKey: "hydrationFactor")
+
+    let startDate = Date()
+
+    for i in 0..<intakesCount {
+      let intake = NSEntityDescription.insertNewObject(forEntityName: Intake.entityName, into: managedObjectContext)
+      intake.setValue(Double(100 + i), forKey: "amount")
+      intake.setValue(startDate.addingTimeInterval(TimeInterval(i) * 3600), forKey: "date")
+      intake.setValue(drink, forKey: "drink")
+    }
+
+    do {
+      try managedObjectContext.save()
+    } catch {
+      XCTFail("Failed to save managed object context")
+    }
+
+    if let store = store {
+      try? coordinator.remove(store)
+    }
+  }
+
+  fileprivate func destroyStore(_ storeURL: URL, model: NSManagedObjectModel) {
+    let coordinator = NSPersistentStoreCoordinator(managedObjectModel: model)
+    try? coordinator.destroyPersistentStore(at: storeURL, ofType: NSSQLiteStoreType, options: nil)
+  }
+
+}
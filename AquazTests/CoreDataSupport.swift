@@ -19,12 +19,17 @@ class CoreDataSupport {
   fileprivate init() {
     Logger.setup(logLevel: .none, assertLevel: .none, consoleLevel: .warning, showLogLevel: true, showFileNames: true, showLineNumbers: true, showFunctionNames: true)
     
+    DailySummary.startMaintenance()
+    
     // Create managed object context
     let model = NSManagedObjectModel.mergedModel(from: [Bundle.main])
     XCTAssert(model != nil, "Failed to create managed object model")
     
     let coordinator = NSPersistentStoreCoordinator(managedObjectModel: model!)
-    let store = try? coordinator.addPersistentStore(ofType: NSInMemoryStoreType, configurationName: nil, at: nil, options: nil)
+    
+    // The catalog is copied from the seed store like on the first launch, it's inserted object by object only if there is no seed
+    let store = CoreDataSupport.addSeededInMemoryStore(coordinator: coordinator) ??
+      (try? coordinator.addPersistentStore(ofType: NSInMemoryStoreType, configurationName: nil, at: nil, options: nil))
     XCTAssert(store != nil, "Failed to create persistent store")
     
     managedObjectContext = NSManagedObjectContext(concurrencyType: .mainQueueConcurrencyType)
@@ -32,8 +37,27 @@ class CoreDataSupport {
 
     // Pre-populate core data
     managedObjectContext.performAndWait {
+      SeedStore.applyCatalogDeltas(managedObjectContext: self.managedObjectContext)
       CoreDataPrePopulation.prePopulateCoreData(managedObjectContext: self.managedObjectContext, saveContext: true)
     }
   }
   
+  /// Copies the bundled seed store into an in-memory store. Returns nil if there is no seed compatible with the model.
+  fileprivate class func addSeededInMemoryStore(coordinator: NSPersistentStoreCoordinator) -> NSPersistentStore? {
+    guard let seedURL = SeedStore.bundledStoreURL,
+          let metadata = try? NSPersistentStoreCoordinator.metadataForPersistentStore(ofType: NSSQLiteStoreType, at: seedURL, options: nil),
+          coordinator.managedObjectModel.isConfiguration(withName: nil, compatibleWithStoreMetadata: metadata),
+          let seedStore = try? coordinator.addPersistentStore(ofType: NSSQLiteStoreType, configurationName: nil, at: seedURL, options: [NSReadOnlyPersistentStoreOption: true]) else
+    {
+      return nil
+    }
+    
+    do {
+      return try coordinator.migratePersistentStore(seedStore, to: URL(fileURLWithPath: "/dev/null"), options: [NSReadOnlyPersistentStoreOption: false], withType: NSInMemoryStoreType)
+    } catch {
+      try? coordinator.remove(seedStore)
+      return nil
+    }
+  }
+  
 }
@@ -0,0 +1,57 @@
+//
+//  CoreDataTestCase.swift
+//  Aquaz
+//
+
+import XCTest
+import CoreData
+@testable import AquazPro
+
+/// Helpers of tests working with the shared in-memory context of CoreDataSupport
+protocol CoreDataTestCase {
+}
+
+extension CoreDataTestCase {
+
+  var managedObjectContext: NSManagedObjectContext {
+    return CoreDataSupport.sharedInstance.managedObjectContext
+  }
+
+  /// Accepts "dd.MM.yyyy" and "dd.MM.yyyy HH:mm:ss" formats
+  func dateFromString(_ textDate: String) -> Date {
+    let dateFormatter = DateFormatter()
+    let range = textDate.range(of: ":", options: .caseInsensitive, range: nil, locale: nil)
+    dateFormatter.dateFormat = range == nil ? "dd.MM.yyyy" : "dd.MM.yyyy HH:mm:ss"
+    return dateFormatter.date(from: textDate)!
+  }
+
+  func addIntake(_ textDate: String, _ drinkType: DrinkType, _ amount: Double) -> Intake {
+    let drink = Drink.fetchDrinkByType(drinkType, managedObjectContext: managedObjectContext)!
+    return Intake.addEntity(drink: drink, amount: amount, date: dateFromString(textDate), managedObjectContext: managedObjectContext, saveImmediately: true)!
+  }
+
+  func saveContext(file: StaticString = #file, line: UInt = #line) {
+    do {
+      try managedObjectContext.save()
+    } catch {
+      XCTFail("Failed to save managed object context", file: file, line: line)
+    }
+  }
+
+  func deleteAllIntakes() {
+    for intake in Intake.fetchManagedObjects(managedObjectContext: managedObjectContext) {
+      managedObjectContext.delete(intake)
+    }
+
+    saveContext()
+  }
+
+  func deleteAllWaterGoals() {
+    for waterGoal in WaterGoal.fetchManagedObjects(managedObjectContext: managedObjectContext) {
+      managedObjectContext.delete(waterGoal)
+    }
+
+    saveContext()
+  }
+
+}
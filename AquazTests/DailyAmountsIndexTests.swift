@@ -0,0 +1,100 @@
+//
+//  DailyAmountsIndexTests.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+import XCTest
+@testable import AquazPro
+
+class DailyAmountsIndexTests: XCTestCase, CoreDataTestCase {
+
+  func testTotalsMatchDailySummaries() {
+    deleteAllIntakes()
+
+    _ = addIntake("01.03.2015 10:00:00", .water,  1000)
+    _ = addIntake("01.03.2015 21:00:00", .wine,   200)
+    _ = addIntake("15.03.2015 10:00:00", .coffee, 300)
+    _ = addIntake("02.04.2015 10:00:00", .tea,    250)
+
+    assertTotalsMatchDailySummaries("01.03.2015", "01.04.2015")
+    assertTotalsMatchDailySummaries("02.03.2015", "15.03.2015")
+    assertTotalsMatchDailySummaries("01.01.2015", "01.01.2016")
+
+    XCTAssertEqual(totals("01.03.2015", "01.05.2015").activeDaysCount, 3)
+    XCTAssertEqual(totals("02.03.2015", "15.03.2015").hydration, 0, "Days without intakes should have exactly zero amounts")
+  }
+
+  func testTotalsFollowSavedChanges() {
+    deleteAllIntakes()
+
+    _ = totals("01.03.2015", "01.04.2015") // load the index
+
+    let intake = addIntake("10.03.2015 10:00:00", .water, 1000)
+    XCTAssertEqual(totals("01.03.2015", "01.04.2015").hydration, 1000 * DrinkType.water.hydrationFactor, accuracy: 0.001)
+
+    intake.date = dateFromString("10.05.2015 10:00:00")
+    saveContext()
+    XCTAssertEqual(totals("01.03.2015", "01.04.2015").activeDaysCount, 0, "Moved intake should be removed from the previous day")
+    assertTotalsMatchDailySummaries("01.05.2015", "01.06.2015")
+
+    // A day far from loaded days requires resizing of the index
+    _ = addIntake("10.05.2005 10:00:00", .juice, 300)
+    assertTotalsMatchDailySummaries("01.01.2005", "01.01.2006")
+
+    intake.deleteEntity(saveImmediately: true)
+    XCTAssertEqual(totals("01.05.2015", "01.06.2015").activeDaysCount, 0)
+  }
+
+  func testRemoteChangesDropIndex() {
+    deleteAllIntakes()
+
+    // Amounts of another process are not known to the index, they are simulated by a delta nothing has saved
+    let index = DailyAmountsIndex.index(for: managedObjectContext)!
+    _ = totals("01.03.2015", "01.04.2015")
+    index.stage([DailyAmountsIndex.DayDelta(day: DayIndex.current(covering: dateFromString("12.03.2015")).day(of: dateFromString("12.03.2015")), hydration: 500, dehydration: 0, intakesCount: 1)], for: managedObjectContext)
+    _ = addIntake("10.03.2015 10:00:00", .water, 1000)
+    XCTAssertEqual(totals("01.03.2015", "01.04.2015").activeDaysCount, 2)
+
+    NotificationCenter.default.post(
+      name: Notification.Name(rawValue: GlobalConstants.notificationManagedObjectContextWasMerged),
+      object: managedObjectContext,
+      userInfo: [GlobalConstants.notificationContainsRemoteChangesKey: true])
+
+    XCTAssertEqual(totals("01.03.2015", "01.04.2015").activeDaysCount, 1, "The index should be loaded from the store again")
+    assertTotalsMatchDailySummaries("01.03.2015", "01.04.2015")
+  }
+
+  func testMonthGroupingUsesIndex() {
+    deleteAllIntakes()
+
+    _ = addIntake("05.01.2015 10:00:00", .water, 3100)
+    _ = addIntake("10.02.2015 10:00:00", .water, 2800)
+
+    let amountParts = Intake.fetchIntakeAmountPartsGroupedBy(.month,
+      beginDate: dateFromString("01.01.2015"),
+      endDate: dateFromString("01.03.2015"),
+      dayOffsetInHours: 0,
+      aggregateFunction: .average,
+      managedObjectContext: managedObjectContext)
+
+    XCTAssertEqual(amountParts.count, 2)
+    XCTAssertEqual(amountParts[0].hydration, 3100 * DrinkType.water.hydrationFactor / 31, accuracy: 0.001)
+    XCTAssertEqual(amountParts[1].hydration, 2800 * DrinkType.water.hydrationFactor / 28, accuracy: 0.001)
+  }
+
+  fileprivate func assertTotalsMatchDailySummaries(_ textBeginDate: String, _ textEndDate: String, file: StaticString = #file, line: UInt = #line) {
+    let columns = DailySummary.fetchAmountPartColumns(beginDate: dateFromString(textBeginDate), endDate: dateFromString(textEndDate), managedObjectContext: managedObjectContext)
+    let rangeTotals = totals(textBeginDate, textEndDate)
+
+    XCTAssertEqual(rangeTotals.hydration, columns.hydrations.reduce(0, +), accuracy: 0.001, file: file, line: line)
+    XCTAssertEqual(rangeTotals.dehydration, columns.dehydrations.reduce(0, +), accuracy: 0.001, file: file, line: line)
+  }
+
+  fileprivate func totals(_ textBeginDate: String, _ textEndDate: String) -> DailyAmountsIndex.Totals {
+    let index = DailyAmountsIndex.index(for: managedObjectContext)!
+    return index.totals(beginDate: dateFromString(textBeginDate), endDate: dateFromString(textEndDate), managedObjectContext: managedObjectContext)
+  }
+
+}
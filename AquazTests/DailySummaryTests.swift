@@ -0,0 +1,89 @@
+//
+//  DailySummaryTests.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+import XCTest
+@testable import AquazPro
+
+class DailySummaryTests: XCTestCase, CoreDataTestCase {
+
+  func testSummariesFollowInsertedIntakes() {
+    deleteAllIntakes()
+
+    _ = addIntake("01.03.2015 10:00:00", .water, 1000)
+    _ = addIntake("01.03.2015 20:00:00", .water, 500)
+    _ = addIntake("01.03.2015 21:00:00", .wine,  200)
+    _ = addIntake("02.03.2015 00:00:00", .coffee, 300)
+
+    let summaries = fetchSummaries("01.03.2015", "03.03.2015")
+    XCTAssertEqual(summaries.count, 3, "Summaries should be grouped by days and drinks")
+
+    let water = summaries.first { $0.drinkType == .water }!
+    XCTAssertEqual(water.intakesCount, 2)
+    XCTAssertEqual(water.amount, 1500)
+    XCTAssertEqual(water.hydration, 1500 * DrinkType.water.hydrationFactor)
+
+    let wine = summaries.first { $0.drinkType == .wine }!
+    XCTAssertEqual(wine.dehydration, 200 * DrinkType.wine.dehydrationFactor)
+
+    let coffee = summaries.first { $0.drinkType == .coffee }!
+    XCTAssertEqual(coffee.caffeine, 300 * DrinkType.coffee.caffeineGramPerLiter)
+    XCTAssert(DateHelper.areEqualDays(coffee.date, dateFromString("02.03.2015")))
+
+    XCTAssert(DailySummary.verify(managedObjectContext: managedObjectContext), "Summaries should match to intakes")
+  }
+
+  func testSummariesFollowUpdatedAndDeletedIntakes() {
+    deleteAllIntakes()
+
+    let intake1 = addIntake("01.03.2015 10:00:00", .water, 1000)
+    let intake2 = addIntake("01.03.2015 11:00:00", .tea,   250)
+
+    // Move the intake to another day and change its amount
+    intake1.date = dateFromString("05.03.2015 10:00:00")
+    intake1.amount = 700
+    saveContext()
+
+    XCTAssertTrue(fetchSummaries("01.03.2015", "02.03.2015").filter { $0.drinkType == .water }.isEmpty)
+    XCTAssertEqual(fetchSummaries("05.03.2015", "06.03.2015").first?.amount, 700)
+
+    // Change the drink
+    intake2.drink = Drink.fetchDrinkByType(.juice, managedObjectContext: managedObjectContext)!
+    saveContext()
+
+    let summaries = fetchSummaries("01.03.2015", "02.03.2015")
+    XCTAssertEqual(summaries.count, 1)
+    XCTAssertEqual(summaries.first?.drinkType, .juice)
+
+    // Delete the intake
+    intake2.deleteEntity(saveImmediately: true)
+    XCTAssertTrue(fetchSummaries("01.03.2015", "02.03.2015").isEmpty, "Summary should be removed with the last intake of a day")
+
+    XCTAssert(DailySummary.verify(managedObjectContext: managedObjectContext), "Summaries should match to intakes")
+  }
+
+  func testVerifyAndRepair() {
+    deleteAllIntakes()
+
+    _ = addIntake("01.03.2015 10:00:00", .water, 1000)
+    _ = addIntake("02.03.2015 10:00:00", .beer,  500)
+
+    // Make a drift
+    let summary = fetchSummaries("01.03.2015", "02.03.2015").first!
+    summary.amount += 100
+    saveContext()
+
+    XCTAssertFalse(DailySummary.verify(managedObjectContext: managedObjectContext), "Drift should be detected")
+    XCTAssertTrue(DailySummary.verifyAndRepair(managedObjectContext: managedObjectContext), "Drift should be repaired")
+    XCTAssertTrue(DailySummary.verify(managedObjectContext: managedObjectContext), "Summaries should match to intakes after repairing")
+    XCTAssertEqual(fetchSummaries("01.03.2015", "02.03.2015").first?.amount, 1000)
+  }
+
+  fileprivate func fetchSummaries(_ textBeginDate: String, _ textEndDate: String) -> [DailySummary] {
+    return DailySummary.fetchDailySummaries(beginDate: dateFromString(textBeginDate), endDate: dateFromString(textEndDate), managedObjectContext: managedObjectContext)
+  }
+
+}
@@ -0,0 +1,81 @@
+//
+//  DataChangeBusTests.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+import XCTest
+@testable import AquazPro
+
+class DataChangeBusTests: XCTestCase, CoreDataTestCase {
+
+  func testSubscribersAreNotifiedForTheirDaysOnly() {
+    let bus = DataChangeBus(managedObjectContext: managedObjectContext)
+
+    var marchChanges = [DataChangeBus.Change]()
+    let marchSubscription = bus.subscribe(entities: [.intake], scope: .dateRange(beginDate: dateFromString("01.03.2015"), endDate: dateFromString("01.04.2015"))) {
+      marchChanges.append($0)
+    }
+
+    var waterGoalChangesCount = 0
+    let waterGoalSubscription = bus.subscribe(entities: [.waterGoal], scope: .dateRange(beginDate: dateFromString("01.03.2015"), endDate: dateFromString("01.04.2015"))) { _ in
+      waterGoalChangesCount += 1
+    }
+
+    let mayIntake = addIntake("10.05.2015 10:00:00", .water, 300)
+    XCTAssertTrue(marchChanges.isEmpty, "Changes of other days should not be delivered")
+
+    let marchIntake = addIntake("10.03.2015 10:00:00", .tea, 250)
+    XCTAssertEqual(marchChanges.count, 1)
+    XCTAssertEqual(marchChanges.last?.insertedObjectIDs[.intake]?.contains(marchIntake.objectID), true)
+
+    // Moving an intake from March touches both days
+    marchIntake.date = dateFromString("20.05.2015 10:00:00")
+    saveContext()
+    XCTAssertEqual(marchChanges.count, 2)
+
+    _ = WaterGoal.addEntity(date: dateFromString("01.01.2015"), baseAmount: 2000, isHotDay: false, isHighActivity: false, managedObjectContext: managedObjectContext, saveImmediately: true)
+    XCTAssertEqual(waterGoalChangesCount, 1, "A water goal affects all days following its date")
+    XCTAssertEqual(marchChanges.count, 2)
+
+    marchSubscription.cancel()
+    mayIntake.deleteEntity(saveImmediately: true)
+    marchIntake.deleteEntity(saveImmediately: true)
+    XCTAssertEqual(marchChanges.count, 2, "Cancelled subscription should not be notified")
+
+    XCTAssertGreaterThan(bus.suppressedDeliveriesCount, 0)
+    _ = waterGoalSubscription
+  }
+
+  func testMovedIntakeTouchesPreviousDay() {
+    // Without daily summaries the previous day of a moved intake is known only from its committed date
+    let model = managedObjectContext.persistentStoreCoordinator!.managedObjectModel.copy() as! NSManagedObjectModel
+    model.entities = model.entities.filter { $0.name != DailySummary.entityName }
+
+    let coordinator = NSPersistentStoreCoordinator(managedObjectModel: model)
+    _ = try! coordinator.addPersistentStore(ofType: NSInMemoryStoreType, configurationName: nil, at: nil, options: nil)
+
+    let context = NSManagedObjectContext(concurrencyType: .mainQueueConcurrencyType)
+    context.persistentStoreCoordinator = coordinator
+    CoreDataPrePopulation.prePopulateCatalog(managedObjectContext: context)
+    try! context.save()
+
+    let bus = DataChangeBus(managedObjectContext: context)
+    let drink = Drink.fetchDrinkByType(.water, managedObjectContext: context)!
+    let intake = Intake.addEntity(drink: drink, amount: 300, date: dateFromString("10.03.2015 10:00:00"), managedObjectContext: context, saveImmediately: false)!
+    try! context.save()
+
+    var marchChangesCount = 0
+    let marchSubscription = bus.subscribe(entities: [.intake], scope: .dateRange(beginDate: dateFromString("01.03.2015"), endDate: dateFromString("01.04.2015"))) { _ in
+      marchChangesCount += 1
+    }
+
+    intake.date = dateFromString("20.05.2015 10:00:00")
+    try! context.save()
+
+    XCTAssertEqual(marchChangesCount, 1, "The day the intake is moved from should be touched")
+    marchSubscription.cancel()
+  }
+
+}
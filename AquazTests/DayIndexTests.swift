@@ -0,0 +1,109 @@
+//
+//  DayIndexTests.swift
+//  Aquaz
+//
+
+import Foundation
+import XCTest
+@testable import AquazPro
+
+class DayIndexTests: XCTestCase {
+
+  fileprivate var originalTimeZone: TimeZone!
+
+  override func setUp() {
+    super.setUp()
+
+    // A time zone with DST transitions
+    originalTimeZone = NSTimeZone.default
+    NSTimeZone.default = TimeZone(identifier: "America/New_York")!
+    DayIndex.invalidate()
+  }
+
+  override func tearDown() {
+    NSTimeZone.default = originalTimeZone
+    DayIndex.invalidate()
+
+    super.tearDown()
+  }
+
+  func testDaysMatchCalendar() {
+    let calendar = Calendar.current
+    let beginDate = calendar.date(from: DateComponents(year: 2015, month: 1, day: 1))!
+    let dayIndex = DayIndex.current(covering: beginDate)
+    let beginDay = dayIndex.day(of: beginDate)
+
+    var dayStart = beginDate
+
+    for dayOffset in 0..<(3 * 365) {
+      let dayEnd = calendar.date(byAdding: .day, value: 1, to: dayStart)!
+
+      XCTAssertEqual(dayIndex.startOfDay(beginDay + dayOffset), dayStart)
+      XCTAssertEqual(dayIndex.day(of: dayStart), beginDay + dayOffset)
+      XCTAssertEqual(dayIndex.day(of: dayEnd.addingTimeInterval(-1)), beginDay + dayOffset, "Last second of a day should belong to the day")
+
+      dayStart = dayEnd
+    }
+  }
+
+  func testMonths() {
+    let calendar = Calendar.current
+    let date = calendar.date(from: DateComponents(year: 2016, month: 2, day: 10, hour: 15))!
+    let dayIndex = DayIndex.current(covering: date)
+    let month = dayIndex.month(ofDay: dayIndex.day(of: date))
+
+    XCTAssertEqual(dayIndex.daysInMonth(month), 29, "February of a leap year")
+    XCTAssertEqual(dayIndex.startOfDay(dayIndex.firstDay(ofMonth: month)), calendar.date(from: DateComponents(year: 2016, month: 2, day: 1))!)
+
+    // Days of month overflow like date components do
+    let january31 = calendar.date(from: DateComponents(year: 2016, month: 1, day: 31))!
+    let january31Day = dayIndex.day(of: january31)
+
+    for months in 1...3 {
+      let expectedDate = calendar.date(from: DateComponents(year: 2016, month: 1 + months, day: 31))!
+      XCTAssertEqual(dayIndex.startOfDay(dayIndex.day(january31Day, addingMonths: months)), expectedDate)
+    }
+  }
+
+  func testThreadSnapshotFollowsInvalidation() {
+    let date = Date()
+    let index = DayIndex.current(covering: date)
+
+    XCTAssertTrue(DayIndex.current(covering: date) === index, "The snapshot of the thread should be reused")
+
+    DayIndex.invalidate()
+
+    XCTAssertFalse(DayIndex.current(covering: date) === index, "The index should be rebuilt after invalidation")
+  }
+
+  func testDatesOutOfTable() {
+    let calendar = Calendar.current
+    let dayIndex = DayIndex.current(covering: Date())
+    let farDate = calendar.date(from: DateComponents(year: 1990, month: 6, day: 15, hour: 12))!
+
+    XCTAssertEqual(dayIndex.startOfDay(dayIndex.day(of: farDate)), calendar.startOfDay(for: farDate))
+    XCTAssert(DayIndex.current(covering: farDate).covers(farDate), "The shared index should be extended to cover requested dates")
+  }
+
+  func testDistantDatesDoNotExtendTable() {
+    let calendar = Calendar.current
+    let index = DayIndex.current(covering: Date())
+    let distantDate = calendar.date(from: DateComponents(year: 1600, month: 6, day: 15, hour: 12))!
+
+    XCTAssertTrue(DayIndex.current(covering: distantDate, Date.distantFuture) === index, "The table should not be rebuilt for distant dates")
+    XCTAssertFalse(index.covers(distantDate))
+    XCTAssertEqual(index.startOfDay(index.day(of: distantDate)), calendar.startOfDay(for: distantDate), "Distant dates should be resolved by the calendar")
+  }
+
+  func testInvalidationOnTimeZoneChange() {
+    let date = Calendar.current.date(from: DateComponents(year: 2016, month: 7, day: 1, hour: 12))!
+    let newYorkStartOfDay = DateHelper.startOfDay(date)
+
+    NSTimeZone.default = TimeZone(identifier: "Asia/Tokyo")!
+    NotificationCenter.default.post(name: NSNotification.Name.NSSystemTimeZoneDidChange, object: nil)
+
+    XCTAssertNotEqual(DateHelper.startOfDay(date), newYorkStartOfDay)
+    XCTAssertEqual(DateHelper.startOfDay(date), Calendar.current.startOfDay(for: date))
+  }
+
+}
@@ -0,0 +1,105 @@
+//
+//  DaySummaryCacheTests.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+import XCTest
+@testable import AquazPro
+
+class DaySummaryCacheTests: XCTestCase, CoreDataTestCase {
+
+  override func setUp() {
+    super.setUp()
+    deleteAllEntities()
+    cache.removeAll()
+  }
+
+  func testRepeatedRequestsAreServedFromCache() {
+    _ = addIntake("01.03.2015 10:00:00", .water, 1000)
+
+    let missesCount = cache.missesCount
+    let hitsCount = cache.hitsCount
+
+    let summary1 = cache.summary(forDate: dateFromString("01.03.2015 12:00:00"), managedObjectContext: managedObjectContext)
+    let summary2 = cache.summary(forDate: dateFromString("01.03.2015 18:00:00"), managedObjectContext: managedObjectContext)
+
+    XCTAssertEqual(cache.missesCount, missesCount + 1, "Only the first request should fetch from the store")
+    XCTAssertEqual(cache.hitsCount, hitsCount + 1)
+    XCTAssertEqual(summary1.totalHydrationAmount, 1000 * DrinkType.water.hydrationFactor)
+    XCTAssertEqual(summary2.totalHydrationAmount, summary1.totalHydrationAmount)
+  }
+
+  func testCachedDaysArePatchedOnSave() {
+    let intake = addIntake("01.03.2015 10:00:00", .water, 1000)
+    _ = cache.summary(forDate: dateFromString("01.03.2015"), managedObjectContext: managedObjectContext)
+
+    _ = addIntake("01.03.2015 11:00:00", .wine, 200)
+    intake.amount = 500
+    saveContext()
+
+    let missesCount = cache.missesCount
+    let summary = cache.summary(forDate: dateFromString("01.03.2015"), managedObjectContext: managedObjectContext)
+
+    XCTAssertEqual(cache.missesCount, missesCount, "Patched day should not be fetched again")
+    XCTAssertEqual(summary.hydrationAmounts[.water], 500 * DrinkType.water.hydrationFactor)
+    XCTAssertEqual(summary.dehydrationAmounts[.wine], 200 * DrinkType.wine.dehydrationFactor)
+
+    intake.deleteEntity(saveImmediately: true)
+    XCTAssertNil(cache.summary(forDate: dateFromString("01.03.2015"), managedObjectContext: managedObjectContext).hydrationAmounts[.water])
+  }
+
+  func testWaterGoalsAreResolvedOnSave() {
+    _ = cache.summary(forDate: dateFromString("05.03.2015"), managedObjectContext: managedObjectContext)
+
+    _ = WaterGoal.addEntity(date: dateFromString("10.03.2015"), baseAmount: 2000, isHotDay: false, isHighActivity: false, managedObjectContext: managedObjectContext)
+    XCTAssertEqual(cachedGoalBaseAmount("05.03.2015"), 2000, "The nearest later water goal should be used if there are no earlier ones")
+
+    _ = WaterGoal.addEntity(date: dateFromString("01.03.2015"), baseAmount: 1500, isHotDay: false, isHighActivity: false, managedObjectContext: managedObjectContext)
+    XCTAssertEqual(cachedGoalBaseAmount("05.03.2015"), 1500, "The nearest earlier water goal should have priority")
+
+    _ = WaterGoal.addEntity(date: dateFromString("05.03.2015"), baseAmount: 3000, isHotDay: true, isHighActivity: false, managedObjectContext: managedObjectContext)
+    XCTAssertEqual(cachedGoalBaseAmount("05.03.2015"), 3000, "Water goal of the day should have priority")
+    XCTAssertEqual(cache.summary(forDate: dateFromString("05.03.2015"), managedObjectContext: managedObjectContext).waterGoal?.isHotDay, true)
+
+    _ = WaterGoal.addEntity(date: dateFromString("03.03.2015"), baseAmount: 1800, isHotDay: false, isHighActivity: false, managedObjectContext: managedObjectContext)
+    XCTAssertEqual(cachedGoalBaseAmount("05.03.2015"), 3000)
+  }
+
+  func testSnapshotRestoresSummary() {
+    _ = addIntake("01.03.2015 10:00:00", .water, 1000)
+    _ = addIntake("01.03.2015 11:00:00", .wine, 200)
+    _ = WaterGoal.addEntity(date: dateFromString("01.03.2015"), baseAmount: 2500, isHotDay: true, isHighActivity: false, managedObjectContext: managedObjectContext)
+
+    let summary = cache.summary(forDate: dateFromString("01.03.2015"), managedObjectContext: managedObjectContext)
+
+    let data = try! PropertyListEncoder().encode(DayStateSnapshot(summary: summary))
+    let restoredSummary = try! PropertyListDecoder().decode(DayStateSnapshot.self, from: data).summary
+
+    XCTAssertEqual(restoredSummary.date, summary.date)
+    XCTAssertEqual(restoredSummary.hydrationAmounts, summary.hydrationAmounts)
+    XCTAssertEqual(restoredSummary.dehydrationAmounts, summary.dehydrationAmounts)
+    XCTAssertEqual(restoredSummary.waterGoalAmount, summary.waterGoalAmount, accuracy: 0.001)
+    XCTAssertEqual(restoredSummary.waterGoal?.isHotDay, true)
+  }
+
+  fileprivate func cachedGoalBaseAmount(_ textDate: String) -> Double? {
+    return cache.summary(forDate: dateFromString(textDate), managedObjectContext: managedObjectContext).waterGoal?.baseAmount
+  }
+
+  fileprivate func deleteAllEntities() {
+    for intake in Intake.fetchManagedObjects(managedObjectContext: managedObjectContext) {
+      managedObjectContext.delete(intake)
+    }
+
+    for waterGoal in WaterGoal.fetchManagedObjects(managedObjectContext: managedObjectContext) {
+      managedObjectContext.delete(waterGoal)
+    }
+
+    saveContext()
+  }
+
+  fileprivate var cache: DaySummaryCache { return DaySummaryCache.sharedInstance }
+
+}
@@ -0,0 +1,88 @@
+//
+//  GroupCommitterTests.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+import XCTest
+@testable import AquazPro
+
+class GroupCommitterTests: XCTestCase {
+
+  fileprivate var writerContext: NSManagedObjectContext!
+
+  override func setUp() {
+    super.setUp()
+    writerContext = NSManagedObjectContext(concurrencyType: .privateQueueConcurrencyType)
+    writerContext.persistentStoreCoordinator = CoreDataSupport.sharedInstance.managedObjectContext.persistentStoreCoordinator
+  }
+
+  func testSavesWithinIntervalAreCommittedOnce() {
+    let groupCommitter = GroupCommitter(managedObjectContext: writerContext, interval: 0.2)
+    _ = expectation(forNotification: NSNotification.Name.NSManagedObjectContextDidSave, object: writerContext, handler: nil)
+
+    writerContext.performAndWait {
+      for _ in 0..<3 {
+        self.addIntake()
+        groupCommitter.save()
+      }
+
+      XCTAssertTrue(self.writerContext.hasChanges, "Saves should be deferred until the end of the interval")
+    }
+
+    waitForExpectations(timeout: 2, handler: nil)
+
+    writerContext.performAndWait {
+      XCTAssertFalse(self.writerContext.hasChanges)
+    }
+
+    let statistics = groupCommitter.currentStatistics()
+    XCTAssertEqual(statistics.requestedSavesCount, 3)
+    XCTAssertEqual(statistics.commitsCount, 1)
+    XCTAssertEqual(statistics.savesPerCommit, 3)
+  }
+
+  func testCommitIsBarrier() {
+    let groupCommitter = GroupCommitter(managedObjectContext: writerContext, interval: 60)
+
+    writerContext.performAndWait {
+      self.addIntake()
+      groupCommitter.save()
+      XCTAssertTrue(self.writerContext.hasChanges)
+
+      groupCommitter.commit()
+      XCTAssertFalse(self.writerContext.hasChanges, "Deferred changes should be committed by the barrier")
+
+      // Nothing is left for the scheduled commit
+      groupCommitter.commit()
+    }
+
+    XCTAssertEqual(groupCommitter.currentStatistics().commitsCount, 1)
+  }
+
+  func testZeroIntervalCommitsEverySave() {
+    let groupCommitter = GroupCommitter(managedObjectContext: writerContext, interval: 0)
+
+    writerContext.performAndWait {
+      for _ in 0..<2 {
+        self.addIntake()
+        groupCommitter.save()
+        XCTAssertFalse(self.writerContext.hasChanges)
+      }
+
+      groupCommitter.save()
+    }
+
+    let statistics = groupCommitter.currentStatistics()
+    XCTAssertEqual(statistics.requestedSavesCount, 2, "Saves without changes should not be counted")
+    XCTAssertEqual(statistics.commitsCount, 2)
+  }
+
+  /// Should be called on the queue of the writer context
+  fileprivate func addIntake() {
+    let drink = Drink.fetchDrinkByType(.water, managedObjectContext: writerContext)!
+    _ = Intake.addEntity(drink: drink, amount: 250, date: Date(), managedObjectContext: writerContext, saveImmediately: false)
+  }
+
+}
@@ -0,0 +1,207 @@
+//
+//  HealthKitExporterTests.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+import HealthKit
+import XCTest
+@testable import AquazPro
+
+/// Health store stand-in keeping samples in memory and answering after a fixed latency
+class InMemoryHealthKitSampleStore: HealthKitSampleStore {
+
+  let latency: TimeInterval
+
+  fileprivate let queue = DispatchQueue(label: "InMemoryHealthKitSampleStore", attributes: [])
+
+  fileprivate var _samples = [HKObject]()
+
+  fileprivate var _saveCallsCount = 0
+
+  fileprivate var _deletePredicates = [NSPredicate]()
+
+  fileprivate var _failingSaveCalls = Set<Int>()
+
+  fileprivate var _isDeletingFailed = false
+
+  var samples: [HKObject] {
+    return queue.sync { _samples }
+  }
+
+  var saveCallsCount: Int {
+    return queue.sync { _saveCallsCount }
+  }
+
+  /// Predicates of delete calls, only sample types are taken into account on deleting
+  var deletePredicates: [NSPredicate] {
+    return queue.sync { _deletePredicates }
+  }
+
+  /// One-based numbers of save calls which fail without saving anything
+  var failingSaveCalls: Set<Int> {
+    get { return queue.sync { _failingSaveCalls } }
+    set { queue.sync { _failingSaveCalls = newValue } }
+  }
+
+  /// Delete calls fail without deleting anything
+  var isDeletingFailed: Bool {
+    get { return queue.sync { _isDeletingFailed } }
+    set { queue.sync { _isDeletingFailed = newValue } }
+  }
+
+  init(latency: TimeInterval) {
+    self.latency = latency
+  }
+
+  func save(_ objects: [HKObject], withCompletion completion: @escaping (Bool, Error?) -> Void) {
+    DispatchQueue.global().asyncAfter(deadline: .now() + latency) {
+      let success: Bool = self.queue.sync {
+        self._saveCallsCount += 1
+
+        if self._failingSaveCalls.contains(self._saveCallsCount) {
+          return false
+        }
+
+        self._samples += objects
+        return true
+      }
+      completion(success, nil)
+    }
+  }
+
+  func deleteObjects(of objectType: HKObjectType, predicate: NSPredicate, withCompletion completion: @escaping (Bool, Int, Error?) -> Void) {
+    let deletedCount: Int? = queue.sync {
+      _deletePredicates.append(predicate)
+
+      if _isDeletingFailed {
+        return nil
+      }
+
+      let count = _samples.count
+      _samples = _samples.filter { ($0 as? HKSample)?.sampleType != objectType }
+      return count - _samples.count
+    }
+
+    completion(deletedCount != nil, deletedCount ?? 0, nil)
+  }
+
+}
+
+class HealthKitExporterTests: XCTestCase {
+
+  override func setUp() {
+    super.setUp()
+
+    for intake in Intake.fetchManagedObjects(managedObjectContext: managedObjectContext) {
+      managedObjectContext.delete(intake)
+    }
+
+    // Several intakes share a date to check resuming inside a group of equal dates
+    let drink = Drink.fetchDrinkByType(.water, managedObjectContext: managedObjectContext)!
+    let beginDate = Date(timeIntervalSinceReferenceDate: 0)
+
+    for index in 0..<Constants.intakesCount {
+      _ = Intake.addEntity(drink: drink, amount: 100, date: beginDate.addingTimeInterval(TimeInterval(index / 3 * 60)), managedObjectContext: managedObjectContext, saveImmediately: false)
+    }
+
+    try! managedObjectContext.save()
+  }
+
+  func testAllIntakesAreExportedWithBoundedWindow() {
+    let healthStore = InMemoryHealthKitSampleStore(latency: 0.01)
+    let exporter = makeExporter(healthStore: healthStore)
+
+    let outcome = export(exporter, from: nil)
+
+    guard case .completed = outcome else {
+      return XCTFail("Export should be completed")
+    }
+
+    XCTAssertEqual(exportedIntakeIdentifiers(healthStore).count, Constants.intakesCount)
+    XCTAssertEqual(healthStore.samples.count, Constants.intakesCount, "Samples should not be duplicated")
+    XCTAssertLessThanOrEqual(exporter.statistics.maximumBatchesInFlight, Constants.configuration.maximumBatchesInFlight)
+    XCTAssertGreaterThan(exporter.statistics.batchSize, Constants.configuration.initialBatchSize, "Batch size should grow while saving is fast")
+  }
+
+  func testCancelledExportIsResumedFromCheckpoint() {
+    let healthStore = InMemoryHealthKitSampleStore(latency: 0.01)
+    let exporter = makeExporter(healthStore: healthStore)
+
+    exporter.checkpointHandler = { _ in
+      exporter.cancel()
+    }
+
+    guard case .cancelled(let checkpoint?) = export(exporter, from: nil) else {
+      return XCTFail("Export should be cancelled with a checkpoint")
+    }
+
+    XCTAssertLessThan(checkpoint.exportedIntakesCount, Constants.intakesCount)
+    XCTAssertEqual(exportedIntakeIdentifiers(healthStore).count, checkpoint.exportedIntakesCount)
+
+    guard case .completed = export(makeExporter(healthStore: healthStore), from: checkpoint) else {
+      return XCTFail("Resumed export should be completed")
+    }
+
+    XCTAssertEqual(exportedIntakeIdentifiers(healthStore).count, Constants.intakesCount)
+    XCTAssertEqual(healthStore.samples.count, Constants.intakesCount, "Resumed export should not duplicate samples")
+  }
+
+  func testExportFailsIfExistingSamplesAreNotDeleted() {
+    let healthStore = InMemoryHealthKitSampleStore(latency: 0.01)
+    healthStore.isDeletingFailed = true
+
+    guard case .failed(nil, _) = export(makeExporter(healthStore: healthStore), from: nil) else {
+      return XCTFail("Export should fail without a checkpoint")
+    }
+
+    XCTAssertTrue(healthStore.samples.isEmpty, "Nothing should be saved over remaining samples")
+  }
+
+  fileprivate func makeExporter(healthStore: HealthKitSampleStore) -> HealthKitExporter {
+    let waterQuantityType = HKQuantityType.quantityType(forIdentifier: .dietaryWater)!
+
+    return HealthKitExporter(healthStore: healthStore, sampleTypes: [waterQuantityType], managedObjectContext: managedObjectContext, configuration: Constants.configuration) { intake in
+      let quantity = HKQuantity(unit: HKUnit.literUnit(with: .milli), doubleValue: intake.amount)
+      let metadata = [Constants.identifierKey: intake.objectID.uriRepresentation().absoluteString]
+      return [HKQuantitySample(type: waterQuantityType, quantity: quantity, start: intake.date, end: intake.date, metadata: metadata)]
+    }
+  }
+
+  fileprivate func export(_ exporter: HealthKitExporter, from checkpoint: HealthKitExporter.Checkpoint?) -> HealthKitExporter.Outcome? {
+    let finished = expectation(description: "Export is finished")
+    var result: HealthKitExporter.Outcome?
+
+    exporter.start(from: checkpoint) { outcome in
+      result = outcome
+      finished.fulfill()
+    }
+
+    waitForExpectations(timeout: 10, handler: nil)
+    return result
+  }
+
+  fileprivate func exportedIntakeIdentifiers(_ healthStore: InMemoryHealthKitSampleStore) -> Set<String> {
+    return Set(healthStore.samples.compactMap { $0.metadata?[Constants.identifierKey] as? String })
+  }
+
+  fileprivate struct Constants {
+    static let intakesCount = 300
+    static let identifierKey = "Intake Identifier"
+
+    static let configuration: HealthKitExporter.Configuration = {
+      var configuration = HealthKitExporter.Configuration()
+      configuration.pageSize = 40
+      configuration.initialBatchSize = 10
+      configuration.minimumBatchSize = 5
+      configuration.maximumBatchSize = 80
+      configuration.maximumBatchesInFlight = 3
+      configuration.targetBatchLatency = 1
+      return configuration
+    }()
+  }
+
+  fileprivate var managedObjectContext: NSManagedObjectContext { return CoreDataSupport.sharedInstance.managedObjectContext }
+
+}
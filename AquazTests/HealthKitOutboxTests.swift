@@ -0,0 +1,120 @@
+//
+//  HealthKitOutboxTests.swift
+//  Aquaz
+//
+
+import Foundation
+import HealthKit
+import XCTest
+@testable import AquazPro
+
+class HealthKitOutboxTests: XCTestCase {
+
+  func testChangesOfIntakeAreCoalesced() {
+    let healthStore = InMemoryHealthKitSampleStore(latency: 0)
+    let outbox = makeOutbox(healthStore: healthStore, fileURL: nil)
+
+    // Added and edited
+    outbox.record([change("1", .insert, 100)])
+    outbox.record([change("1", .update, 200)])
+
+    // Added and removed
+    outbox.record([change("2", .insert, 100), change("2", .delete)])
+
+    // Edited twice
+    outbox.record([change("3", .update, 100), change("3", .update, 300)])
+
+    XCTAssertEqual(outbox.pendingChangesCount, 2)
+
+    flush(outbox)
+
+    XCTAssertEqual(outbox.pendingChangesCount, 0)
+    XCTAssertEqual(healthStore.saveCallsCount, 1, "All samples should be saved at once")
+    XCTAssertEqual(healthStore.deletePredicates.count, 1, "Old samples of all updated intakes should be removed at once")
+
+    let amounts = healthStore.samples.compactMap { ($0 as? HKQuantitySample)?.quantity.doubleValue(for: HKUnit.literUnit(with: .milli)) }
+    XCTAssertEqual(amounts.sorted(), [200, 300])
+  }
+
+  func testJournalSurvivesRestart() {
+    let fileURL = URL(fileURLWithPath: NSTemporaryDirectory()).appendingPathComponent("HealthKitOutboxTests.plist")
+    try? FileManager.default.removeItem(at: fileURL)
+
+    let healthStore = InMemoryHealthKitSampleStore(latency: 0)
+    let outbox = makeOutbox(healthStore: healthStore, fileURL: fileURL)
+    outbox.record([change("1", .insert, 100), change("2", .update, 200)])
+    XCTAssertEqual(outbox.pendingChangesCount, 2)
+
+    let restoredOutbox = makeOutbox(healthStore: healthStore, fileURL: fileURL)
+    XCTAssertEqual(restoredOutbox.pendingChangesCount, 2)
+
+    flush(restoredOutbox)
+    XCTAssertEqual(healthStore.samples.count, 2)
+
+    try? FileManager.default.removeItem(at: fileURL)
+  }
+
+  func testRemovalIsSplitIntoChunks() {
+    let healthStore = InMemoryHealthKitSampleStore(latency: 0)
+    let sampleTypes: [HKSampleType] = [HKQuantityType.quantityType(forIdentifier: .dietaryWater)!, HKQuantityType.quantityType(forIdentifier: .dietaryCaffeine)!]
+    let intakeIds = (0..<450).map { _ in UUID().uuidString }
+    let removed = expectation(description: "Samples are removed")
+
+    healthStore.deleteSamples(of: sampleTypes, metadataKey: Constants.identifierKey, allowedValues: intakeIds, maximumValuesPerQuery: 200) { success in
+      XCTAssertTrue(success)
+      removed.fulfill()
+    }
+
+    waitForExpectations(timeout: 5, handler: nil)
+    XCTAssertEqual(healthStore.deletePredicates.count, 6, "Three chunks of identifiers should be removed for each sample type")
+  }
+
+  func testSavedChunksAreNotSavedAgainOnRetrying() {
+    let healthStore = InMemoryHealthKitSampleStore(latency: 0)
+    healthStore.failingSaveCalls = [2]
+
+    let outbox = makeOutbox(healthStore: healthStore, fileURL: nil, maximumSamplesPerSave: 2)
+    outbox.record((0..<4).map { change("\($0)", .insert, 100) })
+
+    flush(outbox)
+    XCTAssertEqual(outbox.pendingChangesCount, 2, "Changes of the saved chunk should be removed from the journal")
+    XCTAssertEqual(healthStore.samples.count, 2)
+
+    flush(outbox)
+    XCTAssertEqual(outbox.pendingChangesCount, 0)
+    XCTAssertEqual(healthStore.samples.count, 4, "Samples should not be duplicated")
+  }
+
+  fileprivate func makeOutbox(healthStore: HealthKitSampleStore, fileURL: URL?, flushDelay: TimeInterval = 60, maximumSamplesPerSave: Int = 500) -> HealthKitOutbox {
+    let waterQuantityType = HKQuantityType.quantityType(forIdentifier: .dietaryWater)!
+
+    var configuration = HealthKitOutbox.Configuration()
+    configuration.flushDelay = flushDelay
+    configuration.maximumSamplesPerSave = maximumSamplesPerSave
+
+    return HealthKitOutbox(healthStore: healthStore, fileURL: fileURL, configuration: configuration, metadataIdentifierKey: Constants.identifierKey, sampleTypes: { [waterQuantityType] }) { intakeId, values in
+      let quantity = HKQuantity(unit: HKUnit.literUnit(with: .milli), doubleValue: values.hydrationAmount)
+      return [HKQuantitySample(type: waterQuantityType, quantity: quantity, start: values.date, end: values.date, metadata: [Constants.identifierKey: intakeId])]
+    }
+  }
+
+  fileprivate func change(_ intakeId: String, _ operation: HealthKitOutbox.Change.Operation, _ amount: Double = 0) -> HealthKitOutbox.Change {
+    let values = operation == .delete ? nil : HealthKitOutbox.IntakeValues(date: Date(), hydrationAmount: amount, caffeineAmount: 0, drinkName: "Water")
+    return HealthKitOutbox.Change(intakeId: intakeId, operation: operation, values: values)
+  }
+
+  fileprivate func flush(_ outbox: HealthKitOutbox) {
+    let flushed = expectation(description: "Outbox is flushed")
+
+    outbox.flush {
+      flushed.fulfill()
+    }
+
+    waitForExpectations(timeout: 5, handler: nil)
+  }
+
+  fileprivate struct Constants {
+    static let identifierKey = "Intake Identifier"
+  }
+
+}
@@ -28,6 +28,80 @@ class IntakeTests: XCTestCase {
     XCTAssert(areEqual, "Fetched intakes are not equal to generated intakes")
   }
   
+  func testAddEntities() {
+    deleteAllIntakes()
+
+    let date = dateFromString("01.03.2015 10:00:00")
+    _ = addIntake("01.03.2015 10:00:00", .water, 250)
+
+    let drafts = [
+      Intake.Draft(drinkType: .water,  amount: 250, date: date), // already stored
+      Intake.Draft(drinkType: .coffee, amount: 250, date: date),
+      Intake.Draft(drinkType: .coffee, amount: 250, date: date), // repeated in the batch
+      Intake.Draft(drinkType: .tea,    amount: 0,   date: date), // invalid amount
+      Intake.Draft(drinkType: .juice,  amount: 300, date: dateFromString("02.03.2015 10:00:00"))]
+
+    var savesCount = 0
+    let observer = NotificationCenter.default.addObserver(forName: NSNotification.Name.NSManagedObjectContextDidSave, object: managedObjectContext, queue: nil) { _ in
+      savesCount += 1
+    }
+
+    let results = Intake.addEntities(drafts, managedObjectContext: managedObjectContext)
+    NotificationCenter.default.removeObserver(observer)
+
+    let outcomes: [String] = results.map {
+      switch $0 {
+      case .added:     return "added"
+      case .duplicate: return "duplicate"
+      case .invalid:   return "invalid"
+      }
+    }
+
+    XCTAssertEqual(outcomes, ["duplicate", "added", "duplicate", "invalid", "added"])
+    XCTAssertEqual(savesCount, 1, "The whole batch should be committed by a single save")
+    XCTAssertEqual(Intake.fetchIntakes(beginDate: nil, endDate: nil, managedObjectContext: managedObjectContext).count, 3)
+  }
+
+  func testAddEntitiesWithOriginIDs() {
+    deleteAllIntakes()
+
+    let date = dateFromString("01.03.2015 10:00:00")
+    let firstOriginID = UUID().uuidString
+    let secondOriginID = UUID().uuidString
+
+    let drafts = [
+      Intake.Draft(drinkType: .water, amount: 250, date: date, originID: firstOriginID),
+      Intake.Draft(drinkType: .water, amount: 250, date: date, originID: secondOriginID), // the same values, but another intake
+      Intake.Draft(drinkType: .water, amount: 250, date: date, originID: firstOriginID)] // repeated in the batch
+
+    let results = Intake.addEntities(drafts, managedObjectContext: managedObjectContext)
+    XCTAssertEqual(results.filter { if case .added = $0 { return true } else { return false } }.count, 2)
+
+    // Redelivery of already added intakes
+    let retryResults = Intake.addEntities(Array(drafts.prefix(2)), managedObjectContext: managedObjectContext)
+    XCTAssertEqual(retryResults.filter { if case .duplicate = $0 { return true } else { return false } }.count, 2)
+
+    let intakes = Intake.fetchIntakes(beginDate: nil, endDate: nil, managedObjectContext: managedObjectContext)
+    XCTAssertEqual(Set(intakes.compactMap { $0.originID }), [firstOriginID, secondOriginID])
+  }
+
+  func testRolledBackOriginIDsAreAcceptedOnRedelivery() {
+    deleteAllIntakes()
+
+    let draft = Intake.Draft(drinkType: .water, amount: 250, date: dateFromString("01.03.2015 10:00:00"), originID: UUID().uuidString)
+
+    _ = Intake.addEntities([draft], managedObjectContext: managedObjectContext, saveImmediately: false)
+
+    let pendingResults = Intake.addEntities([draft], managedObjectContext: managedObjectContext, saveImmediately: false)
+    XCTAssertEqual(pendingResults.filter { if case .duplicate = $0 { return true } else { return false } }.count, 1, "Unsaved intakes should be taken into account")
+
+    managedObjectContext.rollback()
+
+    let retryResults = Intake.addEntities([draft], managedObjectContext: managedObjectContext)
+    XCTAssertEqual(retryResults.filter { if case .added = $0 { return true } else { return false } }.count, 1, "Rolled back intakes should be added again")
+    XCTAssertEqual(Intake.fetchIntakes(beginDate: nil, endDate: nil, managedObjectContext: managedObjectContext).count, 1)
+  }
+
   func testFetchIntake() {
     deleteAllIntakes()
     
@@ -71,6 +145,50 @@ class IntakeTests: XCTestCase {
     XCTAssert(areEqual, "Fetched intakes are not equal to generated intakes")
   }
   
+  func testFetchColumns() {
+    deleteAllIntakes()
+
+    let startDate = Date()
+    let generatedIntakes = generateIntakes(intakeCount: 200, startDate: startDate, endTimeInterval: 60 * 60 * 24 * 7)
+    let sortedIntakes = generatedIntakes.sorted { $0.date.isEarlierThan($1.date) }
+
+    let columns = Intake.fetchColumns(beginDate: nil, endDate: nil, managedObjectContext: managedObjectContext)
+    XCTAssertEqual(columns.count, sortedIntakes.count)
+    XCTAssertEqual(columns.timeIntervals, sortedIntakes.map { $0.date.timeIntervalSinceReferenceDate }, "Columns should be sorted by date")
+    XCTAssertEqual(columns.drinkIndexes, sortedIntakes.map { $0.drink.drinkType.rawValue })
+
+    let amountPartColumns = columns.amountPartColumns
+    XCTAssert(areArraysOfDoublesAreEqual(amountPartColumns.hydrations, sortedIntakes.map { $0.hydrationAmount }), "Hydration amounts computed via factor tables are wrong")
+    XCTAssert(areArraysOfDoublesAreEqual(amountPartColumns.dehydrations, sortedIntakes.map { $0.dehydrationAmount }), "Dehydration amounts computed via factor tables are wrong")
+  }
+
+  func testFetchRequestTemplatesAreReused() {
+    deleteAllIntakes()
+
+    _ = addIntake("01.03.2015 10:00:00", .water, 250)
+    _ = addIntake("02.03.2015 10:00:00", .water, 250)
+
+    let templates = FetchRequestTemplates.sharedInstance
+    _ = Intake.fetchIntakes(beginDate: nil, endDate: nil, managedObjectContext: managedObjectContext)
+    templates.resetStatistics()
+
+    let intakes = Intake.fetchIntakes(beginDate: dateFromString("01.03.2015 00:00:00"), endDate: dateFromString("02.03.2015 00:00:00"), managedObjectContext: managedObjectContext)
+    XCTAssertEqual(intakes.count, 1, "Substitution variables should be bound")
+    XCTAssertEqual(Intake.fetchIntakes(beginDate: nil, endDate: nil, managedObjectContext: managedObjectContext).count, 2, "Open bounds should not filter intakes")
+
+    XCTAssertGreaterThanOrEqual(templates.reusedCount, 2, "Already built fetch requests should be reused")
+  }
+
+  func testEntityDescriptionsAreSharedByThreads() {
+    let entity = Intake.entityDescription(inManagedObjectContext: managedObjectContext)
+    XCTAssertTrue(entity === managedObjectContext.persistentStoreCoordinator!.managedObjectModel.entitiesByName[Intake.entityName])
+
+    let context = managedObjectContext
+    DispatchQueue.concurrentPerform(iterations: 8) { _ in
+      XCTAssertTrue(Intake.entityDescription(inManagedObjectContext: context) === entity, "Entity description should be taken from the coordinator")
+    }
+  }
+
   func testFetchWaterIntakeGroupedByDaysRandom() {
     deleteAllIntakes()
     
@@ -0,0 +1,112 @@
+//
+//  PersistentHistoryTrackerTests.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+import XCTest
+@testable import AquazPro
+
+/// Two coordinators on the same store file play the roles of the application and the widget
+class PersistentHistoryTrackerTests: XCTestCase {
+
+  fileprivate var storeURL: URL!
+
+  fileprivate var userDefaults: UserDefaults!
+
+  override func setUp() {
+    super.setUp()
+    storeURL = URL(fileURLWithPath: NSTemporaryDirectory()).appendingPathComponent("\(UUID().uuidString).sqlite")
+    userDefaults = UserDefaults(suiteName: Constants.userDefaultsSuiteName)
+    userDefaults.removePersistentDomain(forName: Constants.userDefaultsSuiteName)
+  }
+
+  override func tearDown() {
+    userDefaults.removePersistentDomain(forName: Constants.userDefaultsSuiteName)
+
+    for suffix in ["", "-wal", "-shm"] {
+      try? FileManager.default.removeItem(atPath: storeURL.path + suffix)
+    }
+
+    super.tearDown()
+  }
+
+  func testTransactionsOfOtherProcessesAreFetchedOnce() {
+    guard #available(iOS 11.0, *) else {
+      return
+    }
+
+    let applicationContext = makeContext(author: Constants.applicationAuthor)
+    let widgetContext = makeContext(author: Constants.widgetAuthor)
+    let tracker = PersistentHistoryTracker(persistentStoreCoordinator: widgetContext.persistentStoreCoordinator!, author: Constants.widgetAuthor, userDefaults: userDefaults)
+
+    XCTAssertTrue(catchUp(tracker).transactions.isEmpty, "The first catch-up should start from the current state")
+
+    let waterGoal = WaterGoal.addEntity(date: Date(), baseAmount: 2000, isHotDay: false, isHighActivity: false, managedObjectContext: applicationContext, saveImmediately: false)
+    try! applicationContext.save()
+
+    let catchUp1 = catchUp(tracker)
+    XCTAssertEqual(catchUp1.transactions.count, 1)
+    XCTAssertEqual(catchUp1.transactions.first?[NSInsertedObjectsKey]?.map { $0.uriRepresentation() } ?? [], [waterGoal.objectID.uriRepresentation()])
+    XCTAssertFalse(catchUp1.isIncomplete)
+
+    XCTAssertTrue(catchUp(tracker).transactions.isEmpty, "Transactions should not be fetched again")
+
+    _ = WaterGoal.addEntity(date: Date(), baseAmount: 2500, isHotDay: true, isHighActivity: false, managedObjectContext: widgetContext, saveImmediately: false)
+    try! widgetContext.save()
+
+    XCTAssertTrue(catchUp(tracker).transactions.isEmpty, "Own transactions should be skipped")
+  }
+
+  func testTokenIsKeptPerProcess() {
+    guard #available(iOS 11.0, *) else {
+      return
+    }
+
+    let applicationContext = makeContext(author: Constants.applicationAuthor)
+    let widgetCoordinator = makeContext(author: Constants.widgetAuthor).persistentStoreCoordinator!
+
+    _ = catchUp(PersistentHistoryTracker(persistentStoreCoordinator: widgetCoordinator, author: Constants.widgetAuthor, userDefaults: userDefaults))
+
+    _ = WaterGoal.addEntity(date: Date(), baseAmount: 2000, isHotDay: false, isHighActivity: false, managedObjectContext: applicationContext, saveImmediately: false)
+    try! applicationContext.save()
+
+    // A relaunched process continues from its stored token
+    let relaunchedTracker = PersistentHistoryTracker(persistentStoreCoordinator: widgetCoordinator, author: Constants.widgetAuthor, userDefaults: userDefaults)
+    XCTAssertEqual(catchUp(relaunchedTracker).transactions.count, 1)
+  }
+
+  @available(iOS 11.0, *)
+  fileprivate func catchUp(_ tracker: PersistentHistoryTracker) -> PersistentHistoryTracker.CatchUp {
+    let caughtUp = expectation(description: "Caught up")
+    var result: PersistentHistoryTracker.CatchUp!
+
+    tracker.catchUp { catchUp in
+      result = catchUp
+      caughtUp.fulfill()
+    }
+
+    waitForExpectations(timeout: 5, handler: nil)
+    return result
+  }
+
+  @available(iOS 11.0, *)
+  fileprivate func makeContext(author: String) -> NSManagedObjectContext {
+    let coordinator = NSPersistentStoreCoordinator(managedObjectModel: Constants.model)
+    _ = try! coordinator.addPersistentStore(ofType: NSSQLiteStoreType, configurationName: nil, at: storeURL, options: [NSPersistentHistoryTrackingKey: true])
+
+    let managedObjectContext = NSManagedObjectContext(concurrencyType: .mainQueueConcurrencyType)
+    managedObjectContext.persistentStoreCoordinator = coordinator
+    managedObjectContext.transactionAuthor = author
+    return managedObjectContext
+  }
+
+  fileprivate struct Constants {
+    static let applicationAuthor = "Application"
+    static let widgetAuthor = "Widget"
+    static let userDefaultsSuiteName = "PersistentHistoryTrackerTests"
+    static let model = NSManagedObjectModel.mergedModel(from: [Bundle.main])!
+  }
+
+}
@@ -0,0 +1,62 @@
+//
+//  SaveNotificationCoalescerTests.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+import XCTest
+@testable import AquazPro
+
+class SaveNotificationCoalescerTests: XCTestCase {
+
+  func testBurstIsFlushedOnce() {
+    let water = drinkObjectID(.water)
+    let tea = drinkObjectID(.tea)
+    let coffee = drinkObjectID(.coffee)
+
+    var batches = [SaveNotificationCoalescer.Batch]()
+    let flushExpectation = expectation(description: "flush")
+
+    let coalescer = SaveNotificationCoalescer(interval: 0.2) { batch in
+      batches.append(batch)
+      flushExpectation.fulfill()
+    }
+
+    coalescer.add(saveNotification(inserted: [water]))
+    coalescer.add(saveNotification(inserted: [tea], updated: [water]))
+    coalescer.add(saveNotification(updated: [coffee], deleted: [tea]))
+
+    waitForExpectations(timeout: 2, handler: nil)
+
+    XCTAssertEqual(batches.count, 1)
+
+    let batch = batches[0]
+    XCTAssertEqual(batch.notifications.count, 3)
+    XCTAssertEqual(batch.insertedObjectIDs, [water], "Updates of inserted objects should be folded into inserts")
+    XCTAssertEqual(batch.updatedObjectIDs, [coffee])
+    XCTAssertTrue(batch.deletedObjectIDs.isEmpty, "Objects inserted and deleted within a window should be dropped")
+
+    coalescer.didMerge(batch)
+
+    let statistics = coalescer.currentStatistics()
+    XCTAssertEqual(statistics.receivedNotificationsCount, 3)
+    XCTAssertEqual(statistics.mergesCount, 1)
+    XCTAssertEqual(statistics.coalescingRatio, 3, accuracy: 0.001)
+    XCTAssertGreaterThan(statistics.maximumMergeLatency, 0)
+  }
+
+  fileprivate func saveNotification(inserted: Set<NSManagedObjectID> = [], updated: Set<NSManagedObjectID> = [], deleted: Set<NSManagedObjectID> = []) -> Notification {
+    return Notification(
+      name: NSNotification.Name.NSManagedObjectContextDidSave,
+      object: nil,
+      userInfo: [NSInsertedObjectsKey: inserted, NSUpdatedObjectsKey: updated, NSDeletedObjectsKey: deleted])
+  }
+
+  fileprivate func drinkObjectID(_ drinkType: DrinkType) -> NSManagedObjectID {
+    return Drink.fetchDrinkByType(drinkType, managedObjectContext: managedObjectContext)!.objectID
+  }
+
+  fileprivate var managedObjectContext: NSManagedObjectContext { return CoreDataSupport.sharedInstance.managedObjectContext }
+
+}
@@ -0,0 +1,54 @@
+//
+//  SeedStoreTests.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+import XCTest
+@testable import AquazPro
+
+class SeedStoreTests: XCTestCase {
+
+  /// Also used by Distribution/GenerateSeedStore.sh, which passes the destination of Seed.sqlite in the environment
+  func testGeneratedStoreContainsCatalog() {
+    let environment = ProcessInfo.processInfo.environment
+    let storeURL = environment[Constants.outputPathVariable].map { URL(fileURLWithPath: $0) } ??
+      URL(fileURLWithPath: NSTemporaryDirectory()).appendingPathComponent("Seed.sqlite")
+
+    let model = NSManagedObjectModel.mergedModel(from: [Bundle.main])!
+
+    XCTAssertNoThrow(try SeedStore.generate(at: storeURL, managedObjectModel: model))
+    XCTAssertFalse(FileManager.default.fileExists(atPath: storeURL.path + "-wal"), "The seed store should be a single file")
+
+    let metadata = try? NSPersistentStoreCoordinator.metadataForPersistentStore(ofType: NSSQLiteStoreType, at: storeURL, options: nil)
+    XCTAssertEqual(metadata?[SeedStore.catalogVersionMetadataKey] as? Int, SeedStore.catalogVersion)
+
+    let coordinator = NSPersistentStoreCoordinator(managedObjectModel: model)
+    _ = try? coordinator.addPersistentStore(ofType: NSSQLiteStoreType, configurationName: nil, at: storeURL, options: [NSReadOnlyPersistentStoreOption: true])
+
+    let managedObjectContext = NSManagedObjectContext(concurrencyType: .mainQueueConcurrencyType)
+    managedObjectContext.persistentStoreCoordinator = coordinator
+
+    let drinks = Drink.fetchAllDrinksTyped(managedObjectContext: managedObjectContext)
+    XCTAssertEqual(drinks.count, Drink.getDrinksCount())
+    XCTAssertEqual(drinks[.coffee]?.recentAmount.amount, 250)
+    XCTAssertNil(WaterGoal.fetchManagedObject(managedObjectContext: managedObjectContext), "User data should not be seeded")
+  }
+
+  func testCatalogIsNotDuplicated() {
+    let managedObjectContext = CoreDataSupport.sharedInstance.managedObjectContext
+    let drinksCount = Drink.fetchManagedObjects(managedObjectContext: managedObjectContext).count
+
+    CoreDataPrePopulation.prePopulateCatalog(managedObjectContext: managedObjectContext)
+    XCTAssertFalse(managedObjectContext.hasChanges)
+
+    SeedStore.applyCatalogDeltas(managedObjectContext: managedObjectContext)
+    XCTAssertEqual(Drink.fetchManagedObjects(managedObjectContext: managedObjectContext).count, drinksCount)
+  }
+
+  fileprivate struct Constants {
+    static let outputPathVariable = "AQUAZ_SEED_STORE_OUTPUT"
+  }
+
+}
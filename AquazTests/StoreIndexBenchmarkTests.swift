@@ -0,0 +1,193 @@
+//
+//  StoreIndexBenchmarkTests.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+import XCTest
+@testable import AquazPro
+
+/// Compares query times of synthetic stores created by the model version without date indexes (Aquaz 2)
+/// and by the current model version with date indexes.
+class StoreIndexBenchmarkTests: XCTestCase {
+
+  fileprivate struct Constants {
+    static let intakesCount = 100_000
+    static let waterGoalsCount = 1_000
+    static let intakesPerDay = 8
+    static let queriesCount = 200
+    static let saveBatchSize = 5_000
+  }
+
+  fileprivate enum ModelVersion: String {
+    case withoutIndexes = "Aquaz 2"
+    case current = ""
+  }
+
+  /// Stores are expensive to build, so they are shared between tests of the run
+  fileprivate static var contexts = [String: NSManagedObjectContext]()
+
+  func testDayRangeQueriesWithoutIndexes() {
+    let managedObjectContext = context(modelVersion: .withoutIndexes, intakesCount: Constants.intakesCount)
+
+    measure {
+      self.performDayRangeQueries(managedObjectContext: managedObjectContext, intakesCount: Constants.intakesCount)
+    }
+  }
+
+  func testDayRangeQueriesWithIndexes() {
+    let managedObjectContext = context(modelVersion: .current, intakesCount: Constants.intakesCount)
+
+    measure {
+      self.performDayRangeQueries(managedObjectContext: managedObjectContext, intakesCount: Constants.intakesCount)
+    }
+  }
+
+  func testNearestGoalQueriesWithoutIndexes() {
+    let managedObjectContext = context(modelVersion: .withoutIndexes, intakesCount: Constants.intakesCount)
+
+    measure {
+      self.performNearestGoalQueries(managedObjectContext: managedObjectContext)
+    }
+  }
+
+  func testNearestGoalQueriesWithIndexes() {
+    let managedObjectContext = context(modelVersion: .current, intakesCount: Constants.intakesCount)
+
+    measure {
+      self.performNearestGoalQueries(managedObjectContext: managedObjectContext)
+    }
+  }
+
+  // MARK: Workload
+
+  fileprivate var beginDate: Date {
+    return Calendar.current.date(from: DateComponents(year: 2010, month: 1, day: 1))!
+  }
+
+  fileprivate func performDayRangeQueries(managedObjectContext: NSManagedObjectContext, intakesCount: Int) {
+    let daysCount = intakesCount / Constants.intakesPerDay
+
+    for i in 0..<Constants.queriesCount {
+      let dayBeginDate = DateHelper.addToDate(beginDate, years: 0, months: 0, days: (i * 7919) % daysCount)
+      let dayEndDate = DateHelper.nextDayFrom(dayBeginDate)
+
+      let fetchRequest = NSFetchRequest<NSDictionary>(entityName: Intake.entityName)
+      fetchRequest.predicate = NSPredicate(format: "(date >= %@) AND (date < %@)", argumentArray: [dayBeginDate, dayEndDate])
+      fetchRequest.propertiesToFetch = ["amount", "drink.index"]
+      fetchRequest.resultType = .dictionaryResultType
+
+      let records = try? managedObjectContext.fetch(fetchRequest)
+      XCTAssertEqual(records?.count, Constants.intakesPerDay)
+    }
+  }
+
+  fileprivate func performNearestGoalQueries(managedObjectContext: NSManagedObjectContext) {
+    for i in 0..<Constants.queriesCount {
+      let date = DateHelper.addToDate(beginDate, years: 0, months: 0, days: (i * 7919) % (Constants.waterGoalsCount * 10))
+
+      let fetchRequest = NSFetchRequest<NSDictionary>(entityName: WaterGoal.entityName)
+      fetchRequest.predicate = NSPredicate(format: "date <= %@", argumentArray: [date])
+      fetchRequest.sortDescriptors = [NSSortDescriptor(key: "date", ascending: false)]
+      fetchRequest.propertiesToFetch = ["baseAmount"]
+      fetchRequest.resultType = .dictionaryResultType
+      fetchRequest.fetchLimit = 1
+
+      XCTAssertNotNil(try? managedObjectContext.fetch(fetchRequest))
+    }
+  }
+
+  // MARK: Synthetic stores
+
+  fileprivate func context(modelVersion: ModelVersion, intakesCount: Int) -> NSManagedObjectContext {
+    let key = "\(modelVersion.rawValue)-\(intakesCount)"
+
+    if let managedObjectContext = StoreIndexBenchmarkTests.contexts[key] {
+      return managedObjectContext
+    }
+
+    let managedObjectContext = makeStore(modelVersion: modelVersion, intakesCount: intakesCount)
+    StoreIndexBenchmarkTests.contexts[key] = managedObjectContext
+    return managedObjectContext
+  }
+
+  /// Creates a SQLite store filled with intakes distributed by days and water goals set every 10 days.
+  /// Objects are inserted using KVC, so the same code fills stores of both model versions.
+  /// Entities are mapped to NSManagedObject, so maintenance of daily summaries, which observes saves of all contexts, skips them.
+  fileprivate func makeStore(modelVersion: ModelVersion, intakesCount: Int) -> NSManagedObjectContext {
+    let modelURL = Bundle.main.url(forResource: "Aquaz", withExtension: "momd")!
+    let versionURL = modelVersion == .current ? modelURL : modelURL.appendingPathComponent("\(modelVersion.rawValue).mom")
+    let model = NSManagedObjectModel(contentsOf: versionURL)!
+
+    for entity in model.entities {
+      entity.managedObjectClassName = NSStringFromClass(NSManagedObject.self)
+    }
+
+    let fileName = "Benchmark-\(modelVersion == .current ? "Current" : "Previous")-\(intakesCount).sqlite"
+    let storeURL = URL(fileURLWithPath: NSTemporaryDirectory()).appendingPathComponent(fileName)
+
+    let coordinator = NSPersistentStoreCoordinator(managedObjectModel: model)
+    try? coordinator.destroyPersistentStore(at: storeURL, ofType: NSSQLiteStoreType, options: nil)
+    XCTAssertNotNil(try? coordinator.addPersistentStore(ofType: NSSQLiteStoreType, configurationName: nil, at: storeURL, options: nil))
+
+    // A separate context is used for filling, so the long-living one stays empty
+    let fillingContext = NSManagedObjectContext(concurrencyType: .privateQueueConcurrencyType)
+    fillingContext.persistentStoreCoordinator = coordinator
+    fillingContext.undoManager = nil
+
+    fillingContext.performAndWait {
+      var drinks = [NSManagedObject]()
+
+      for drinkType in (0..<DrinkType.count).compactMap({ DrinkType(rawValue: $0) }) {
+        let drink = NSEntityDescription.insertNewObject(forEntityName: Drink.entityName, into: fillingContext)
+        drink.setValue(drinkType.rawValue, forKey: "index")
+        drink.setValue("\(drinkType)", forKey: "name")
+        drinks.append(drink)
+      }
+
+      for i in 0..<Constants.waterGoalsCount {
+        let waterGoal = NSEntityDescription.insertNewObject(forEntityName: WaterGoal.entityName, into: fillingContext)
+        waterGoal.setValue(DateHelper.addToDate(self.beginDate, years: 0, months: 0, days: i * 10), forKey: "date")
+        waterGoal.setValue(2000, forKey: "baseAmount")
+      }
+
+      // Intakes are placed every two hours starting from 1:00, so every day has exactly the same number of them
+      var dayDate = self.beginDate
+
+      for i in 0..<intakesCount {
+        if i > 0 && i % Constants.intakesPerDay == 0 {
+          dayDate = DateHelper.nextDayFrom(dayDate)
+        }
+
+        let intake = NSEntityDescription.insertNewObject(forEntityName: Intake.entityName, into: fillingContext)
+        intake.setValue(Double(100 + i % 400), forKey: "amount")
+        intake.setValue(dayDate.addingTimeInterval(TimeInterval(1 + (i % Constants.intakesPerDay) * 2) * 60 * 60), forKey: "date")
+        intake.setValue(drinks[i % drinks.count], forKey: "drink")
+
+        if (i + 1) % Constants.saveBatchSize == 0 {
+          self.saveAndReset(fillingContext, drinks: &drinks)
+        }
+      }
+
+      self.saveAndReset(fillingContext, drinks: &drinks)
+    }
+
+    let managedObjectContext = NSManagedObjectContext(concurrencyType: .mainQueueConcurrencyType)
+    managedObjectContext.persistentStoreCoordinator = coordinator
+    return managedObjectContext
+  }
+
+  fileprivate func saveAndReset(_ managedObjectContext: NSManagedObjectContext, drinks: inout [NSManagedObject]) {
+    do {
+      try managedObjectContext.save()
+    } catch {
+      XCTFail("Failed to save managed object context")
+    }
+
+    let drinkIDs = drinks.map { $0.objectID }
+    managedObjectContext.reset()
+    drinks = drinkIDs.map { managedObjectContext.object(with: $0) }
+  }
+
+}
@@ -0,0 +1,68 @@
+//
+//  WaterGoalTimelineTests.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+import XCTest
+@testable import AquazPro
+
+class WaterGoalTimelineTests: XCTestCase, CoreDataTestCase {
+
+  func testSpansAreRunLengthEncoded() {
+    deleteAllWaterGoals()
+
+    let goal05 = addWaterGoal("05.01.2015", 1000, true, false)
+    let goal10 = addWaterGoal("10.01.2015", 2000)
+
+    let spans = timeline.spans(beginDate: dateFromString("01.01.2015"), endDate: dateFromString("01.02.2015"), managedObjectContext: managedObjectContext)
+
+    XCTAssertEqual(spans.map { $0.daysCount }, [4, 1, 4, 22], "01-04 and 06-09 use the base amount of 05.01, 10-31 use the amount of 10.01")
+    XCTAssertEqual(spans.map { $0.amount }, [goal05.baseAmount, goal05.amount, goal05.baseAmount, goal10.baseAmount])
+    XCTAssertEqual(spans.reduce(0) { $0 + $1.daysCount }, 31)
+  }
+
+  func testTimelineFollowsSavedChanges() {
+    deleteAllWaterGoals()
+
+    let goal01 = addWaterGoal("01.01.2015", 1000)
+    XCTAssertEqual(entryBaseAmount("20.01.2015"), 1000)
+
+    let goal15 = addWaterGoal("15.01.2015", 1500)
+    XCTAssertEqual(entryBaseAmount("20.01.2015"), 1500, "Inserted water goal should be taken into account")
+
+    goal15.baseAmount = 1700
+    saveContext()
+    XCTAssertEqual(entryBaseAmount("20.01.2015"), 1700, "Updated water goal should be taken into account")
+
+    managedObjectContext.delete(goal15)
+    saveContext()
+    XCTAssertEqual(entryBaseAmount("20.01.2015"), goal01.baseAmount, "Deleted water goal should be removed")
+  }
+
+  func testTimelineTakesPendingChangesIntoAccount() {
+    deleteAllWaterGoals()
+
+    _ = addWaterGoal("01.01.2015", 1000)
+    _ = WaterGoal.addEntity(date: dateFromString("10.01.2015"), baseAmount: 3000, isHotDay: false, isHighActivity: false, managedObjectContext: managedObjectContext, saveImmediately: false)
+
+    XCTAssertEqual(entryBaseAmount("10.01.2015"), 3000, "Unsaved water goal should be taken into account")
+
+    managedObjectContext.rollback()
+    XCTAssertEqual(entryBaseAmount("10.01.2015"), 1000)
+  }
+
+  fileprivate var timeline: WaterGoalTimeline {
+    return WaterGoalTimeline.timeline(for: managedObjectContext)!
+  }
+
+  fileprivate func entryBaseAmount(_ textDate: String) -> Double? {
+    return timeline.entry(forDate: dateFromString(textDate), managedObjectContext: managedObjectContext)?.baseAmount
+  }
+
+  fileprivate func addWaterGoal(_ textDate: String, _ baseAmount: Double, _ isHotDay: Bool = false, _ isHighActivity: Bool = false) -> WaterGoal {
+    return WaterGoal.addEntity(date: dateFromString(textDate), baseAmount: baseAmount, isHotDay: isHotDay, isHighActivity: isHighActivity, managedObjectContext: managedObjectContext, saveImmediately: true)
+  }
+
+}
@@ -0,0 +1,74 @@
+//
+//  WidgetStateTests.swift
+//  Aquaz
+//
+
+import Foundation
+import CoreData
+import XCTest
+@testable import AquazPro
+
+class WidgetStateTests: XCTestCase {
+
+  func testPendingRecordsAreApplied() {
+    let date = Date()
+    var state = WidgetState(date: date)
+    state.add(drinkType: .water, amount: 300)
+
+    let records = [
+      record(.water, 200, date),
+      record(.coffee, 100, date),
+      record(.water, 500, date.addingTimeInterval(-2 * 24 * 60 * 60))]
+
+    let appliedState = state.applying(records, forDate: date)
+
+    XCTAssertEqual(appliedState.hydrationAmounts[.water], 500, "Records of other days should be skipped")
+    XCTAssertEqual(appliedState.hydrationAmounts[.coffee], 100 * DrinkType.coffee.hydrationFactor)
+    XCTAssertEqual(appliedState.dehydrationAmount, 100 * DrinkType.coffee.dehydrationFactor)
+    XCTAssertEqual(appliedState.totalWaterGoalAmount, state.waterGoalAmount + appliedState.dehydrationAmount)
+  }
+
+  func testStateOfAnotherDayIsRolledOver() {
+    let date = Date()
+    var state = WidgetState(date: date.addingTimeInterval(-24 * 60 * 60))
+    state.add(drinkType: .coffee, amount: 200)
+
+    let rolledOverState = state.applying([], forDate: date)
+
+    XCTAssertTrue(DateHelper.areEqualDays(rolledOverState.date, date))
+    XCTAssertEqual(rolledOverState.totalHydrationAmount, 0)
+    XCTAssertEqual(rolledOverState.dehydrationAmount, 0)
+    XCTAssertEqual(rolledOverState.waterGoalAmount, state.waterGoalAmount)
+  }
+
+  func testStateIsComputedFromStore() {
+    let drinks = Drink.fetchAllDrinksIndexed(managedObjectContext: managedObjectContext)
+
+    for intake in Intake.fetchManagedObjects(managedObjectContext: managedObjectContext) {
+      managedObjectContext.delete(intake)
+    }
+
+    _ = Intake.addEntity(drink: drinks[DrinkType.juice.rawValue]!, amount: 200, date: Date().addingTimeInterval(-60), managedObjectContext: managedObjectContext, saveImmediately: false)
+    _ = Intake.addEntity(drink: drinks[DrinkType.water.rawValue]!, amount: 300, date: Date(), managedObjectContext: managedObjectContext, saveImmediately: false)
+    try! managedObjectContext.save()
+
+    let state = WidgetState(managedObjectContext: managedObjectContext, lastIngestedIntakeDate: .distantPast)
+
+    XCTAssertEqual(state.displayedDrinks.count, 3)
+    XCTAssertEqual(state.displayedDrinks.first?.drinkType, .water, "Water should be always displayed")
+    XCTAssertTrue(state.displayedDrinks.contains { $0.drinkType == .juice }, "Recently used drinks should be displayed")
+    XCTAssertEqual(state.hydrationAmounts[.water], 300)
+
+    let lastIngestedDate = Date()
+    let ingestedState = WidgetState(managedObjectContext: managedObjectContext, lastIngestedIntakeDate: lastIngestedDate)
+    let appliedState = ingestedState.applying([record(.water, 100, lastIngestedDate), record(.water, 100, lastIngestedDate.addingTimeInterval(1))], forDate: lastIngestedDate)
+    XCTAssertEqual(appliedState.hydrationAmounts[.water], 400, "Ingested records should be skipped")
+  }
+
+  fileprivate func record(_ drinkType: DrinkType, _ amount: Double, _ date: Date) -> WidgetIntakeJournal.Record {
+    return WidgetIntakeJournal.Record(originID: UUID(), drinkType: drinkType, amount: amount, date: date)
+  }
+
+  fileprivate var managedObjectContext: NSManagedObjectContext { return CoreDataSupport.sharedInstance.managedObjectContext }
+
+}
@@ -0,0 +1,82 @@
+//
+//  WormholeRingBufferTransitingTests.swift
+//  Aquaz
+//
+
+import Foundation
+import XCTest
+@testable import AquazPro
+
+class WormholeRingBufferTransitingTests: XCTestCase {
+
+  fileprivate var directoryURL: URL!
+
+  override func setUp() {
+    super.setUp()
+    directoryURL = URL(fileURLWithPath: NSTemporaryDirectory()).appendingPathComponent(UUID().uuidString, isDirectory: true)
+  }
+
+  override func tearDown() {
+    try? FileManager.default.removeItem(at: directoryURL)
+    super.tearDown()
+  }
+
+  func testConsecutiveMessagesAreNotLost() {
+    // Writer and reader are separate instances as they are in the application and the widget
+    let reader = WormholeRingBufferTransiting(directoryURL: directoryURL, readIdentifiers: [Constants.identifier])
+    let writer = WormholeRingBufferTransiting(directoryURL: directoryURL, readIdentifiers: [])
+
+    let records1 = [record(.inserted, 1), record(.updated, 2)]
+    let records2 = [record(.deleted, 3)]
+
+    XCTAssertTrue(writer.writeMessageObject(WormholeChanges(records: records1), forIdentifier: Constants.identifier))
+    XCTAssertTrue(writer.writeMessageObject(WormholeChanges(records: records2), forIdentifier: Constants.identifier))
+
+    let changes = reader.messageObject(forIdentifier: Constants.identifier) as? WormholeChanges
+    XCTAssertEqual(changes?.records ?? [], records1 + records2, "The second message should not overwrite the first one")
+    XCTAssertEqual(changes?.isIncomplete, false)
+    XCTAssertEqual(changes?.objectURIsByChangeKeys[NSDeletedObjectsKey] ?? [], [records2[0].objectURI])
+
+    XCTAssertNil(reader.messageObject(forIdentifier: Constants.identifier), "Read records should not be returned again")
+  }
+
+  func testOverwrittenRecordsMakeChangesIncomplete() {
+    let reader = WormholeRingBufferTransiting(directoryURL: directoryURL, readIdentifiers: [Constants.identifier], slotsCount: 4)
+    let writer = WormholeRingBufferTransiting(directoryURL: directoryURL, readIdentifiers: [], slotsCount: 4)
+
+    let records = (1...6).map { record(.updated, $0) }
+    _ = writer.writeMessageObject(WormholeChanges(records: records), forIdentifier: Constants.identifier)
+
+    let changes = reader.messageObject(forIdentifier: Constants.identifier) as? WormholeChanges
+    XCTAssertEqual(changes?.records ?? [], Array(records.suffix(4)), "The latest records should survive wrapping around")
+    XCTAssertEqual(changes?.isIncomplete, true)
+  }
+
+  func testRecordsWrittenBeforeOpeningAreSkipped() {
+    let writer = WormholeRingBufferTransiting(directoryURL: directoryURL, readIdentifiers: [])
+    _ = writer.writeMessageObject(WormholeChanges(records: [record(.inserted, 1)]), forIdentifier: Constants.identifier)
+
+    let reader = WormholeRingBufferTransiting(directoryURL: directoryURL, readIdentifiers: [Constants.identifier])
+    XCTAssertNil(reader.messageObject(forIdentifier: Constants.identifier))
+
+    _ = writer.writeMessageObject(WormholeChanges(records: [record(.inserted, 2)]), forIdentifier: Constants.identifier)
+    XCTAssertEqual((reader.messageObject(forIdentifier: Constants.identifier) as? WormholeChanges)?.records ?? [], [record(.inserted, 2)])
+  }
+
+  func testChangesSurviveArchiving() {
+    let changes = WormholeChanges(records: [record(.inserted, 1), record(.deleted, 2)], isIncomplete: true)
+    let restoredChanges = NSKeyedUnarchiver.unarchiveObject(with: NSKeyedArchiver.archivedData(withRootObject: changes)) as? WormholeChanges
+
+    XCTAssertEqual(restoredChanges?.records ?? [], changes.records)
+    XCTAssertEqual(restoredChanges?.isIncomplete, true)
+  }
+
+  fileprivate func record(_ kind: WormholeChanges.Kind, _ index: Int) -> WormholeChanges.Record {
+    return WormholeChanges.Record(kind: kind, entityName: "Intake", objectURI: URL(string: "x-coredata://7A3A1B4C-0000-4000-8000-000000000000/Intake/p\(index)")!)
+  }
+
+  fileprivate struct Constants {
+    static let identifier = "Test-From App"
+  }
+
+}
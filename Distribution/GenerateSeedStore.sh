@@ -0,0 +1,19 @@
+#!/bin/sh
+
+#  GenerateSeedStore.sh
+#  Aquaz
+
+###########################################################################################
+# IMPORTANT: read readme.txt file before usage
+
+# Regenerate the seed store shipped in the bundle. It should be done after each change of the data model or the catalog of drinks.
+SEED_STORE_FILE="$(cd .. && pwd)/Aquaz/Seed.sqlite"
+
+# Variables prefixed with TEST_RUNNER_ are passed to the test process without the prefix
+TEST_RUNNER_AQUAZ_SEED_STORE_OUTPUT="${SEED_STORE_FILE}" xcodebuild test \
+  -project ../Aquaz.xcodeproj \
+  -scheme AquazPro \
+  -destination "platform=iOS Simulator,name=iPhone 8" \
+  -only-testing:AquazTests/SeedStoreTests/testGeneratedStoreContainsCatalog || exit 1
+
+echo "Seed store is generated: ${SEED_STORE_FILE}"
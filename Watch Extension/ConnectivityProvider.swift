@@ -19,9 +19,12 @@ class ConnectivityProvider: NSObject {
   // MARK: Public methods
 
   func addIntake(drinkType: DrinkType, amount: Double, date: Date) {
+    // The identifier is kept on resending, so the iOS app can drop the intake if it has been already delivered
+    let originID = UUID().uuidString
+    
     if let session = reachableSession {
       // If the session is available (active and reachable) try to send message to iOS app immediately
-      let addIntakeMessage = ConnectivityMessageAddIntake(drinkType: drinkType, amount: amount, date: date)
+      let addIntakeMessage = ConnectivityMessageAddIntake(drinkType: drinkType, amount: amount, date: date, originID: originID)
       
       session.sendMessage(
         addIntakeMessage.composeMetadata(),
@@ -30,12 +33,12 @@ class ConnectivityProvider: NSObject {
         },
         errorHandler: { _ in
           // If an error happens during sending the message, add intake to pending intakes
-          WatchSettings.sharedInstance.pendingIntakes.addIntake(drinkType: drinkType, amount: amount, date: date)
+          WatchSettings.sharedInstance.pendingIntakes.addIntake(drinkType: drinkType, amount: amount, date: date, originID: originID)
         }
       )
     } else {
       // If the session is not available, add intake to pending intakes
-      WatchSettings.sharedInstance.pendingIntakes.addIntake(drinkType: drinkType, amount: amount, date: date)
+      WatchSettings.sharedInstance.pendingIntakes.addIntake(drinkType: drinkType, amount: amount, date: date, originID: originID)
     }
   }
   
@@ -81,8 +81,8 @@ final class WatchSettings {
       saveMessage()
     }
     
-    public func addIntake(drinkType: DrinkType, amount: Double, date: Date) {
-      message.addIntake(drinkType: drinkType, amount: amount, date: date)
+    public func addIntake(drinkType: DrinkType, amount: Double, date: Date, originID: String) {
+      message.addIntake(drinkType: drinkType, amount: amount, date: date, originID: originID)
       saveMessage()
     }
         
@@ -7,7 +7,6 @@
 //
 
 import UIKit
-import CoreData
 import NotificationCenter
 import Fabric
 import Crashlytics
@@ -31,9 +30,9 @@ class TodayViewController: UIViewController {
   @IBOutlet weak var drink3TitleLabel: UILabel!
   @IBOutlet weak var openApplicationButton: UIButton!
   
-  fileprivate var drink1: Drink!
-  fileprivate var drink2: Drink!
-  fileprivate var drink3: Drink!
+  fileprivate var drink1: WidgetState.DisplayedDrink!
+  fileprivate var drink2: WidgetState.DisplayedDrink!
+  fileprivate var drink3: WidgetState.DisplayedDrink!
   
   fileprivate var multiProgressSections: [Int: MultiProgressView.Section] = [:]
   fileprivate var wormhole: MMWormhole!
@@ -50,39 +49,35 @@ class TodayViewController: UIViewController {
   override func viewDidLoad() {
     super.viewDidLoad()
     
+    StartupTimeline.sharedInstance.markLaunch()
+    
     if #available(iOSApplicationExtension 10.0, *) {
       extensionContext?.widgetLargestAvailableDisplayMode = .expanded
     }
     
     setupDrinksUI()
     setupProgressView()
-    setupCoreDataSynchronization()
-    setupNotificationsObservation()
+    setupWormhole()
+    
+    // The state file is tiny, so it's read synchronously and the persistent store is never loaded by the widget
+    loadState()
+    updateUI(animated: false)
   }
   
-  deinit {
-    NotificationCenter.default.removeObserver(self)
-    // It's necessary to reset the managed object context in order to finalize background tasks correctly.
-    CoreDataStack.performOnPrivateContext { privateContext in
-      privateContext.reset()
-    }
-  }
-
-  fileprivate func setupCoreDataSynchronization() {
+  fileprivate func setupWormhole() {
     wormhole = MMWormhole(applicationGroupIdentifier: GlobalConstants.appGroupName, optionalDirectory: GlobalConstants.wormholeOptionalDirectory)
     
-    wormhole.listenForMessage(withIdentifier: GlobalConstants.wormholeMessageFromAquaz) { [weak self] messageObject in
-      if let notification = messageObject as? Notification {
-        CoreDataStack.mergeAllContextsWithNotification(notification)
-        self?.wormhole.clearMessageContents(forIdentifier: GlobalConstants.wormholeMessageFromWidget)
-      }
+    // Messages are just signals, the state and intakes are passed through their own files
+    wormhole.listenForMessage(withIdentifier: GlobalConstants.wormholeMessageWidgetState) { [weak self] _ in
+      self?.loadState()
+      self?.updateUI(animated: true)
     }
   }
 
   fileprivate func setupProgressView() {
     progressView.animationDuration = 0.7
     
-    for drinkIndex in 0..<Drink.getDrinksCount() {
+    for drinkIndex in 0..<DrinkType.count {
       if let drinkType = DrinkType(rawValue: drinkIndex) {
         let section = progressView.addSection(color: drinkType.mainColor)
         multiProgressSections[drinkIndex] = section
@@ -116,139 +111,43 @@ class TodayViewController: UIViewController {
     drink3AmountLabel.text = " "
   }
 
-  fileprivate func setupNotificationsObservation() {
-    CoreDataStack.performOnPrivateContext { privateContext in
-      NotificationCenter.default.addObserver(
-        self,
-        selector: #selector(self.managedObjectContextDidSave(_:)),
-        name: NSNotification.Name.NSManagedObjectContextDidSave,
-        object: privateContext)
-    }
-  }
-  
-  @objc func managedObjectContextDidSave(_ notification: Notification) {
-    // By unknown reason existance of "managedObjectContext" key produces an exception during passing massage object through wormhole
-    var clearedNotification = notification
-    _ = clearedNotification.userInfo?.removeValue(forKey: "managedObjectContext")
-
-    wormhole.passMessageObject(clearedNotification as NSCoding?, identifier: GlobalConstants.wormholeMessageFromWidget)
-  }
-  
-  fileprivate func fetchData(_ completion: @escaping () -> ()) {
-    CoreDataStack.performOnPrivateContext { privateContext in
-      if !Settings.sharedInstance.generalHasLaunchedOnce.value {
-        CoreDataPrePopulation.prePopulateCoreData(managedObjectContext: privateContext, saveContext: true)
-      }
-    
-      self.fetchDrinks(managedObjectContext: privateContext)
-      self.fetchWaterIntakes(managedObjectContext: privateContext)
-      completion()
-    }
-  }
-  
-  fileprivate func fetchDrinks(managedObjectContext: NSManagedObjectContext) {
-    let entity = Intake.entityDescription(inManagedObjectContext: managedObjectContext)
-    let request = NSFetchRequest<NSDictionary>()
-    request.entity = entity
-    request.resultType = .dictionaryResultType
-    request.propertiesToFetch = ["drink.index"]
-    request.propertiesToGroupBy = ["drink.index"]
-    request.fetchLimit = 2
-    request.sortDescriptors = [NSSortDescriptor(key: "date", ascending: false)]
-    request.predicate = NSPredicate(format: "%K != %d", "drink.index", DrinkType.water.rawValue)
-
-    // The first drink should be always water
-    var drinkIndexesToDisplay = [DrinkType.water.rawValue]
-    var drinkIndexes = Array((DrinkType.water.rawValue + 1)..<Drink.getDrinksCount())
-    
-    if let fetch = try? managedObjectContext.fetch(request) {
-      for drinkIndex in 0..<2 {
-        if drinkIndex >= fetch.count {
-          break
-        }
-        
-        let entry = fetch[drinkIndex]
-        
-        guard let index = entry["drink.index"] as? NSNumber else {
-          break
-        }
-        
-        drinkIndexesToDisplay += [index.intValue]
-        
-        if let indexToRemove = drinkIndexes.firstIndex(of: index.intValue) {
-          drinkIndexes.remove(at: indexToRemove)
-        }
-      }
-    }
-    
-    if drinkIndexesToDisplay.count < 1 {
-      drinkIndexesToDisplay += [drinkIndexes.remove(at: 0)]
-    }
-    
-    if drinkIndexesToDisplay.count < 2 {
-      drinkIndexesToDisplay += [drinkIndexes.remove(at: 0)]
-    }
-    
-    if drinkIndexesToDisplay.count < 3 {
-      drinkIndexesToDisplay += [drinkIndexes.remove(at: 0)]
-    }
-    
-    drinkIndexesToDisplay.sort(by: <)
-    
-    let drinks = Drink.fetchAllDrinksIndexed(managedObjectContext: managedObjectContext)
-    
-    drink1 = drinks[drinkIndexesToDisplay[0]]
-    drink2 = drinks[drinkIndexesToDisplay[1]]
-    drink3 = drinks[drinkIndexesToDisplay[2]]
+  /// Applies intakes added by the widget which are not published by the application yet
+  fileprivate func loadState() {
+    let date = Date()
+    let state = (WidgetState.load() ?? WidgetState(date: date)).applying(WidgetIntakeJournal.pendingRecords(), forDate: date)
+    applyState(state)
   }
   
-  fileprivate func fetchWaterIntakes(managedObjectContext: NSManagedObjectContext) {
-    let date = Date()
-    
-    waterGoalAmount = WaterGoal.fetchWaterGoalForDate(date, managedObjectContext: managedObjectContext)?.amount ?? 0
+  fileprivate func applyState(_ state: WidgetState) {
+    drink1 = state.displayedDrinks[0]
+    drink2 = state.displayedDrinks[1]
+    drink3 = state.displayedDrinks[2]
     
-    let totalDehydrationAmount = Intake.fetchTotalDehydrationAmountForDay(date, dayOffsetInHours: 0, managedObjectContext: managedObjectContext)
-    waterGoalAmount += totalDehydrationAmount
+    waterGoalAmount = state.totalWaterGoalAmount
     
-    hydrationAmounts = Intake.fetchHydrationAmountsGroupedByDrinksForDay(date, dayOffsetInHours: 0, managedObjectContext: managedObjectContext)
+    hydrationAmounts = state.hydrationAmounts
     
-    totalHydrationAmount = hydrationAmounts.reduce(0, { (totalHydration, amount) -> Double in
-      return totalHydration + amount.value
-    })
+    totalHydrationAmount = state.totalHydrationAmount
   }
   
   fileprivate func updateUI(animated: Bool) {
     updateDrinks()
     updateWaterIntakes(animated: animated)
+    StartupTimeline.sharedInstance.markFirstMeaningfulRender(source: .snapshot)
   }
   
   fileprivate func updateDrinks() {
-    let drinksInfo = getDrinksInfo()
+    drink1AmountLabel.text = formatWaterVolume(drink1.recentAmount)
+    drink1TitleLabel.text = drink1.drinkType.localizedName
+    drink1View.drinkType = drink1.drinkType
     
-    drink1AmountLabel.text = formatWaterVolume(drinksInfo[0].amount)
-    drink1TitleLabel.text = drinksInfo[0].name
-    drink1View.drinkType = drinksInfo[0].drinkType
+    drink2AmountLabel.text = formatWaterVolume(drink2.recentAmount)
+    drink2TitleLabel.text = drink2.drinkType.localizedName
+    drink2View.drinkType = drink2.drinkType
     
-    drink2AmountLabel.text = formatWaterVolume(drinksInfo[1].amount)
-    drink2TitleLabel.text = drinksInfo[1].name
-    drink2View.drinkType = drinksInfo[1].drinkType
-    
-    drink3AmountLabel.text = formatWaterVolume(drinksInfo[2].amount)
-    drink3TitleLabel.text = drinksInfo[2].name
-    drink3View.drinkType = drinksInfo[2].drinkType
-  }
-  
-  fileprivate func getDrinksInfo() -> [(amount: Double, name: String, drinkType: DrinkType)] {
-    var drinksInfo: [(amount: Double, name: String, drinkType: DrinkType)]!
-    
-    CoreDataStack.performOnPrivateContextAndWait { _ in
-      drinksInfo = [
-        (amount: self.drink1.recentAmount.amount, name: self.drink1.localizedName, drinkType: self.drink1.drinkType),
-        (amount: self.drink2.recentAmount.amount, name: self.drink2.localizedName, drinkType: self.drink2.drinkType),
-        (amount: self.drink3.recentAmount.amount, name: self.drink3.localizedName, drinkType: self.drink3.drinkType)]
-    }
-    
-    return drinksInfo
+    drink3AmountLabel.text = formatWaterVolume(drink3.recentAmount)
+    drink3TitleLabel.text = drink3.drinkType.localizedName
+    drink3View.drinkType = drink3.drinkType
   }
 
   fileprivate func updateIntakeHydrationAmounts(_ intakeHydrationAmounts: [DrinkType: Double]) {
@@ -335,25 +234,23 @@ class TodayViewController: UIViewController {
     addIntakeForDrink(drink3)
   }
   
-  fileprivate func addIntakeForDrink(_ drink: Drink!) {
+  fileprivate func addIntakeForDrink(_ drink: WidgetState.DisplayedDrink!) {
     if drink == nil {
       return
     }
     
-    CoreDataStack.performOnPrivateContext { privateContext in
-      _ = Intake.addEntity(
-        drink: drink,
-        amount: drink.recentAmount.amount,
-        date: Date(),
-        managedObjectContext: privateContext,
-        saveImmediately: true)
-    }
-
-    fetchData {
-      DispatchQueue.main.async {
-        self.updateUI(animated: true)
-      }
+    let record = WidgetIntakeJournal.Record(originID: UUID(), drinkType: drink.drinkType, amount: drink.recentAmount, date: Date())
+    
+    // The extension may be terminated at any moment, so the intake is appended to the journal by a single write.
+    // The application adds it to the store and publishes the state including it.
+    if !WidgetIntakeJournal.append(record) {
+      return
     }
+    
+    loadState()
+    updateWaterIntakes(animated: true)
+    
+    wormhole.passMessageObject(nil, identifier: GlobalConstants.wormholeMessageWidgetIntakes)
   }
   
   @IBAction func openApplicationWasTapped() {
@@ -365,12 +262,9 @@ class TodayViewController: UIViewController {
 extension TodayViewController : NCWidgetProviding {
   
   func widgetPerformUpdate(completionHandler: (@escaping (NCUpdateResult) -> Void)) {
-    fetchData {
-      DispatchQueue.main.async {
-        self.updateUI(animated: false)
-        completionHandler(.newData)
-      }
-    }
+    loadState()
+    updateUI(animated: false)
+    completionHandler(.newData)
   }
   
   func widgetMarginInsets(forProposedMarginInsets defaultMarginInsets: UIEdgeInsets) -> UIEdgeInsets {